@@ -27,6 +27,7 @@
 
 #define FP_COMPONENT "egismoc"
 
+#include <errno.h>
 #include <stdio.h>
 #include <glib.h>
 #include <sys/param.h>
@@ -44,8 +45,10 @@ struct _FpiDeviceEgisMoc
   FpiSsm         *cmd_ssm;
   FpiUsbTransfer *cmd_transfer;
   GPtrArray      *enrolled_ids;
+  guint           enrolled_ids_generation;
+  guint           enrolled_ids_valid_generation;
+  gboolean        enrolled_ids_cache_check;
   guchar         *enrollment_nonce;
-  gint            max_enroll_stages;
   FpiSsm         *wait_finger_ssm;
   gint64          wait_finger_start;
   GCancellable   *interrupt_cancellable;
@@ -69,11 +72,24 @@ typedef void (*SynCmdMsgCallback) (FpDevice *device,
                                    gsize     length_in,
                                    GError   *error);
 
+#define EGISMOC_MAX_BATCH_LENGTH 4
+
 typedef struct egismoc_command_data
 {
   SynCmdMsgCallback callback;
+  EgisMocFrame      batch[EGISMOC_MAX_BATCH_LENGTH];
+  guint             batch_len;
+  guint             batch_pos;
 } CommandData;
 
+typedef struct egismoc_frame_data
+{
+  guchar *data;
+  gsize   length;
+} FrameData;
+
+static FrameData egismoc_frames[EGISMOC_FRAMES];
+
 typedef struct egismoc_enroll_print
 {
   FpPrint *print;
@@ -110,6 +126,45 @@ egismoc_validate_response_suffix (const guchar *buffer_in,
   return result;
 }
 
+/*
+ * The list of enrolled IDs only changes when a print is committed, deleted or
+ * the storage is cleared, so it is kept across tasks and re-used by identify
+ * and verify for as long as its generation is still current. Any operation
+ * which may change the storage on the device bumps the generation.
+ */
+static void
+egismoc_invalidate_enrolled_ids (FpiDeviceEgisMoc *self)
+{
+  fp_dbg ("Invalidate cached enrolled IDs");
+
+  self->enrolled_ids_generation++;
+  g_clear_pointer (&self->enrolled_ids, g_ptr_array_unref);
+}
+
+static gboolean
+egismoc_enrolled_ids_are_cached (FpiDeviceEgisMoc *self)
+{
+  return self->enrolled_ids != NULL &&
+         self->enrolled_ids_valid_generation == self->enrolled_ids_generation;
+}
+
+static gboolean
+egismoc_enrolled_ids_equal (GPtrArray *a,
+                            GPtrArray *b)
+{
+  guint i;
+
+  if (a->len != b->len)
+    return FALSE;
+
+  for (i = 0; i < a->len; i++)
+    if (memcmp (g_ptr_array_index (a, i), g_ptr_array_index (b, i),
+                SDCP_ENROLLMENT_ID_SIZE) != 0)
+      return FALSE;
+
+  return TRUE;
+}
+
 static void
 egismoc_task_ssm_done (FpiSsm   *ssm,
                        FpDevice *device,
@@ -122,7 +177,9 @@ egismoc_task_ssm_done (FpiSsm   *ssm,
   g_assert (!self->task_ssm || self->task_ssm == ssm);
   self->task_ssm = NULL;
 
-  g_clear_pointer (&self->enrolled_ids, g_ptr_array_unref);
+  /* only a list which was fully read from the device may outlive its task */
+  if (!egismoc_enrolled_ids_are_cached (self))
+    g_clear_pointer (&self->enrolled_ids, g_ptr_array_unref);
 
   if (error)
     fpi_device_action_error (device, error);
@@ -143,6 +200,28 @@ egismoc_task_ssm_next_state_cb (FpDevice *device,
     fpi_ssm_next_state (self->task_ssm);
 }
 
+static FpiUsbTransfer *
+egismoc_frame_transfer_new (FpDevice    *device,
+                            EgisMocFrame frame,
+                            FpiSsm      *ssm)
+{
+  FpiUsbTransfer *transfer = fpi_usb_transfer_new (device);
+
+  g_assert (egismoc_frames[frame].data != NULL);
+
+  transfer->short_is_error = TRUE;
+  transfer->ssm = ssm;
+
+  /* frames are shared and read-only, so the transfer must not free them */
+  fpi_usb_transfer_fill_bulk_full (transfer,
+                                   EGISMOC_EP_CMD_OUT,
+                                   egismoc_frames[frame].data,
+                                   egismoc_frames[frame].length,
+                                   NULL);
+
+  return transfer;
+}
+
 static void
 egismoc_cmd_receive_cb (FpiUsbTransfer *transfer,
                         FpDevice       *device,
@@ -168,6 +247,24 @@ egismoc_cmd_receive_cb (FpiUsbTransfer *transfer,
       return;
     }
 
+  /* Responses to all but the last command of a batch are not inspected, just
+   * go on and send the next frame re-using the same command SSM */
+  if (data->batch_pos + 1 < data->batch_len)
+    {
+      FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
+
+      data->batch_pos++;
+      fp_dbg ("Command batch continuing (%u/%u)", data->batch_pos + 1,
+              data->batch_len);
+
+      g_assert (self->cmd_transfer == NULL);
+      self->cmd_transfer = egismoc_frame_transfer_new (device,
+                                                       data->batch[data->batch_pos],
+                                                       transfer->ssm);
+      fpi_ssm_jump_to_state (transfer->ssm, CMD_SEND);
+      return;
+    }
+
   /* Let's complete the previous ssm and then handle the callback, so that
    * we are sure that we won't start a transfer or a new command while there is
    * another one still ongoing
@@ -260,31 +357,24 @@ egismoc_get_check_bytes (FpiByteReader *reader)
   return G_MAXUINT16 - (sum_values % G_MAXUINT16);
 }
 
-static void
-egismoc_exec_cmd (FpDevice         *device,
-                  guchar           *cmd,
-                  const gsize       cmd_length,
-                  GDestroyNotify    cmd_destroy,
-                  SynCmdMsgCallback callback)
+/*
+ * Builds a fully composed command frame (with prefix, check bytes, etc) which
+ * looks like this:
+ *   E G I S 00 00 00 01 {cb1} {cb2} {payload}
+ * where cb1 and cb2 are some check bytes generated by the
+ * egismoc_get_check_bytes() method and payload is what is passed via the cmd
+ * parameter
+ */
+static guchar *
+egismoc_build_frame (const guchar *cmd,
+                     const gsize   cmd_length,
+                     gsize        *length_out)
 {
   g_auto(FpiByteWriter) writer = {0};
-  g_autoptr(FpiUsbTransfer) transfer = NULL;
-  FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
-  g_autofree CommandData *data = NULL;
   gsize buffer_out_length = 0;
   gboolean written = TRUE;
   guint16 check_value;
 
-  fp_dbg ("Execute command and get response");
-
-  /*
-   * buffer_out should be a fully composed command (with prefix, check bytes, etc)
-   * which looks like this:
-   *   E G I S 00 00 00 01 {cb1} {cb2} {payload}
-   * where cb1 and cb2 are some check bytes generated by the
-   * egismoc_get_check_bytes() method and payload is what is passed via the cmd
-   * parameter
-   */
   buffer_out_length = egismoc_write_prefix_len
                       + EGISMOC_CHECK_BYTES_LENGTH
                       + cmd_length;
@@ -309,6 +399,36 @@ egismoc_exec_cmd (FpDevice         *device,
   fpi_byte_writer_set_pos (&writer, egismoc_write_prefix_len);
   written &= fpi_byte_writer_put_uint16_be (&writer, check_value);
 
+  if (!written)
+    return NULL;
+
+  if (length_out)
+    *length_out = buffer_out_length;
+
+  return fpi_byte_writer_reset_and_get_data (&writer);
+}
+
+/*
+ * Only used for commands carrying a dynamic payload (SDCP, enrollment, check
+ * and delete); all fixed commands are sent via egismoc_exec_frame().
+ */
+static void
+egismoc_exec_cmd (FpDevice         *device,
+                  guchar           *cmd,
+                  const gsize       cmd_length,
+                  GDestroyNotify    cmd_destroy,
+                  SynCmdMsgCallback callback)
+{
+  g_autoptr(FpiUsbTransfer) transfer = NULL;
+  FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
+  g_autofree CommandData *data = NULL;
+  g_autofree guchar *buffer_out = NULL;
+  gsize buffer_out_length = 0;
+
+  fp_dbg ("Execute command and get response");
+
+  buffer_out = egismoc_build_frame (cmd, cmd_length, &buffer_out_length);
+
   /* destroy cmd if requested */
   if (cmd_destroy)
     g_clear_pointer (&cmd, cmd_destroy);
@@ -322,7 +442,7 @@ egismoc_exec_cmd (FpDevice         *device,
   data->callback = callback;
   fpi_ssm_set_data (self->cmd_ssm, g_steal_pointer (&data), g_free);
 
-  if (!written)
+  if (!buffer_out)
     {
       fpi_ssm_start (self->cmd_ssm, egismoc_cmd_ssm_done);
       fpi_ssm_mark_failed (self->cmd_ssm,
@@ -336,7 +456,7 @@ egismoc_exec_cmd (FpDevice         *device,
 
   fpi_usb_transfer_fill_bulk_full (transfer,
                                    EGISMOC_EP_CMD_OUT,
-                                   fpi_byte_writer_reset_and_get_data (&writer),
+                                   g_steal_pointer (&buffer_out),
                                    buffer_out_length,
                                    g_free);
 
@@ -345,6 +465,85 @@ egismoc_exec_cmd (FpDevice         *device,
   fpi_ssm_start (self->cmd_ssm, egismoc_cmd_ssm_done);
 }
 
+/*
+ * Sends a batch of pre-built fixed command frames one after the other within
+ * a single command SSM. Only the response to the last command is handed to the
+ * callback; an error at any point aborts the batch.
+ */
+static void
+egismoc_exec_frames (FpDevice           *device,
+                     const EgisMocFrame *frames,
+                     guint               n_frames,
+                     SynCmdMsgCallback   callback)
+{
+  FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
+  g_autofree CommandData *data = NULL;
+
+  fp_dbg ("Execute batch of %u commands and get response", n_frames);
+
+  g_assert (n_frames > 0 && n_frames <= EGISMOC_MAX_BATCH_LENGTH);
+
+  g_assert (self->cmd_ssm == NULL);
+  self->cmd_ssm = fpi_ssm_new (device,
+                               egismoc_cmd_run_state,
+                               CMD_STATES);
+
+  data = g_new0 (CommandData, 1);
+  data->callback = callback;
+  memcpy (data->batch, frames, n_frames * sizeof (EgisMocFrame));
+  data->batch_len = n_frames;
+  data->batch_pos = 0;
+  fpi_ssm_set_data (self->cmd_ssm, g_steal_pointer (&data), g_free);
+
+  g_assert (self->cmd_transfer == NULL);
+  self->cmd_transfer = egismoc_frame_transfer_new (device, frames[0],
+                                                   self->cmd_ssm);
+  fpi_ssm_start (self->cmd_ssm, egismoc_cmd_ssm_done);
+}
+
+static void
+egismoc_exec_frame (FpDevice         *device,
+                    EgisMocFrame      frame,
+                    SynCmdMsgCallback callback)
+{
+  egismoc_exec_frames (device, &frame, 1, callback);
+}
+
+static void
+egismoc_build_frames (void)
+{
+  const struct
+  {
+    EgisMocFrame  frame;
+    const guchar *cmd;
+    gsize         cmd_length;
+  } fixed_cmds[] = {
+    { EGISMOC_FRAME_SENSOR_RESET, cmd_sensor_reset, cmd_sensor_reset_len },
+    { EGISMOC_FRAME_SENSOR_IDENTIFY, cmd_sensor_identify, cmd_sensor_identify_len },
+    { EGISMOC_FRAME_SENSOR_ENROLL, cmd_sensor_enroll, cmd_sensor_enroll_len },
+    { EGISMOC_FRAME_SENSOR_START_CAPTURE, cmd_sensor_start_capture, cmd_sensor_start_capture_len },
+    { EGISMOC_FRAME_SENSOR_CHECK, cmd_sensor_check, cmd_sensor_check_len },
+    { EGISMOC_FRAME_FW_VERSION, cmd_fw_version, cmd_fw_version_len },
+    { EGISMOC_FRAME_LIST, cmd_list, cmd_list_len },
+    { EGISMOC_FRAME_ENROLL_STARTING, cmd_enroll_starting, cmd_enroll_starting_len },
+    { EGISMOC_FRAME_CAPTURE_POST_WAIT_FINGER, cmd_capture_post_wait_finger, cmd_capture_post_wait_finger_len },
+    { EGISMOC_FRAME_READ_CAPTURE, cmd_read_capture, cmd_read_capture_len },
+    { EGISMOC_FRAME_COMMIT_STARTING, cmd_commit_starting, cmd_commit_starting_len },
+  };
+
+  G_STATIC_ASSERT (G_N_ELEMENTS (fixed_cmds) == EGISMOC_FRAMES);
+
+  for (guint i = 0; i < G_N_ELEMENTS (fixed_cmds); i++)
+    {
+      FrameData *frame = &egismoc_frames[fixed_cmds[i].frame];
+
+      frame->data = egismoc_build_frame (fixed_cmds[i].cmd,
+                                         fixed_cmds[i].cmd_length,
+                                         &frame->length);
+      g_assert (frame->data != NULL);
+    }
+}
+
 static void
 egismoc_wait_finger_ssm_done (FpiSsm   *ssm,
                               FpDevice *device,
@@ -443,6 +642,7 @@ egismoc_wait_finger_on_sensor (FpDevice *device)
 
   self->wait_finger_start = g_get_monotonic_time ();
 
+  /* Also records FP_DEVICE_TRACE_READY for the first stage of the action */
   fpi_device_report_finger_status (device, FP_FINGER_STATUS_NEEDED);
 
   g_assert (self->wait_finger_ssm == NULL);
@@ -488,6 +688,25 @@ egismoc_get_enrolled_prints (FpDevice *device)
   return g_steal_pointer (&result);
 }
 
+static void
+egismoc_sdcp_verify_connect_cb (GObject      *source_object,
+                                GAsyncResult *res,
+                                gpointer      user_data)
+{
+  fp_dbg ("SDCP ConnectResponse verification callback");
+  FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (source_object);
+  GError *error = NULL;
+
+  if (!fpi_sdcp_derive_keys_and_verify_connect_finish (FPI_SDCP_DEVICE (source_object),
+                                                       res, &error))
+    {
+      fpi_ssm_mark_failed (self->task_ssm, error);
+      return;
+    }
+
+  fpi_ssm_next_state (self->task_ssm);
+}
+
 /*
  * Validates and uses the SDCP "ConnectResponse" payload to establish a secure
  * device connection which can then be used to generate enrollment IDs and
@@ -585,14 +804,12 @@ egismoc_sdcp_connect_cb (FpDevice *device,
   memcpy (response->mac, buffer_in + pos, SDCP_DIGEST_SIZE);
   pos += SDCP_DIGEST_SIZE;
 
-  /* Derive SDCP keys and establish secured connection */
-  if (!fpi_sdcp_derive_keys_and_verify_connect (sdcp, response))
-    fpi_ssm_mark_failed (self->task_ssm,
-                         fpi_device_error_new_msg (FP_DEVICE_ERROR_PROTO,
-                                                   "Secure connection could "
-                                                   "not be established"));
-  else
-    fpi_ssm_next_state (self->task_ssm);
+  /* Derive SDCP keys and establish secured connection off the main loop */
+  fpi_sdcp_derive_keys_and_verify_connect_async (sdcp,
+                                                 g_steal_pointer (&response),
+                                                 fpi_device_get_cancellable (device),
+                                                 egismoc_sdcp_verify_connect_cb,
+                                                 NULL);
 }
 
 /*
@@ -649,6 +866,7 @@ egismoc_list_fill_enrolled_ids_cb (FpDevice *device,
 {
   fp_dbg ("List callback");
   FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
+  g_autoptr(GPtrArray) cached_ids = NULL;
   const guint8 *data;
   guchar *enrollment_id = NULL;
   gchar *enrollment_id_hex = NULL;
@@ -662,6 +880,9 @@ egismoc_list_fill_enrolled_ids_cb (FpDevice *device,
       return;
     }
 
+  if (self->enrolled_ids_cache_check && egismoc_enrolled_ids_are_cached (self))
+    cached_ids = g_steal_pointer (&self->enrolled_ids);
+
   g_clear_pointer (&self->enrolled_ids, g_ptr_array_unref);
   self->enrolled_ids = g_ptr_array_new_with_free_func (g_free);
 
@@ -694,6 +915,18 @@ egismoc_list_fill_enrolled_ids_cb (FpDevice *device,
   fp_info ("Number of currently enrolled fingerprints on the device is %d",
            self->enrolled_ids->len);
 
+  /* A cache that is still current must match what the device returns */
+  if (cached_ids && !egismoc_enrolled_ids_equal (cached_ids, self->enrolled_ids))
+    {
+      g_clear_pointer (&self->enrolled_ids, g_ptr_array_unref);
+      fpi_ssm_mark_failed (self->task_ssm,
+                           fpi_device_error_new_msg (FP_DEVICE_ERROR_GENERAL,
+                                                     "Cached enrolled IDs are out of date"));
+      return;
+    }
+
+  self->enrolled_ids_valid_generation = self->enrolled_ids_generation;
+
   if (self->task_ssm)
     fpi_ssm_next_state (self->task_ssm);
 }
@@ -707,8 +940,8 @@ egismoc_list_run_state (FpiSsm   *ssm,
   switch (fpi_ssm_get_cur_state (ssm))
     {
     case LIST_GET_ENROLLED_IDS:
-      egismoc_exec_cmd (device, cmd_list, cmd_list_len, NULL,
-                        egismoc_list_fill_enrolled_ids_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_LIST,
+                          egismoc_list_fill_enrolled_ids_cb);
       break;
 
     case LIST_RETURN_ENROLLED_PRINTS:
@@ -863,6 +1096,9 @@ egismoc_delete_cb (FpDevice *device,
   fp_dbg ("Delete callback");
   FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
 
+  /* the storage may have changed even if the response could not be read */
+  self->enrolled_ids_generation++;
+
   if (error)
     {
       fpi_ssm_mark_failed (self->task_ssm, error);
@@ -913,8 +1149,8 @@ egismoc_delete_run_state (FpiSsm   *ssm,
     {
     case DELETE_GET_ENROLLED_IDS:
       /* get enrolled_ids from device for use building delete payload below */
-      egismoc_exec_cmd (device, cmd_list, cmd_list_len, NULL,
-                        egismoc_list_fill_enrolled_ids_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_LIST,
+                          egismoc_list_fill_enrolled_ids_cb);
       break;
 
     case DELETE_DELETE:
@@ -986,6 +1222,9 @@ egismoc_commit_cb (FpDevice *device,
 
   g_clear_pointer (&self->enrollment_nonce, g_free);
 
+  /* the storage may have changed even if the response could not be read */
+  egismoc_invalidate_enrolled_ids (self);
+
   if (error)
     {
       fpi_ssm_mark_failed (self->task_ssm, error);
@@ -1030,7 +1269,7 @@ egismoc_enroll_status_report (FpDevice    *device,
       enroll_print->stage++;
       fp_info ("Partial capture successful. Please touch the sensor again (%d/%d)",
                enroll_print->stage,
-               self->max_enroll_stages);
+               fp_device_get_nr_enroll_stages (device));
       fpi_device_enroll_progress (device, enroll_print->stage, enroll_print->print, NULL);
       break;
 
@@ -1102,10 +1341,10 @@ egismoc_read_capture_cb (FpDevice *device,
       egismoc_enroll_status_report (device, enroll_print, ENROLL_STATUS_RETRY, error);
     }
 
-  if (enroll_print->stage == self->max_enroll_stages)
+  if (enroll_print->stage == fp_device_get_nr_enroll_stages (device))
     fpi_ssm_next_state (self->task_ssm);
   else
-    fpi_ssm_jump_to_state (self->task_ssm, ENROLL_CAPTURE_SENSOR_RESET);
+    fpi_ssm_jump_to_state (self->task_ssm, ENROLL_CAPTURE_SENSOR_PREPARE);
 }
 
 static void
@@ -1295,6 +1534,16 @@ egismoc_get_check_cmd (FpDevice *device,
   return fpi_byte_writer_reset_and_get_data (&writer);
 }
 
+static const EgisMocFrame enroll_prepare_frames[] = {
+  EGISMOC_FRAME_SENSOR_RESET,
+  EGISMOC_FRAME_SENSOR_ENROLL,
+};
+
+static const EgisMocFrame enroll_capture_prepare_frames[] = {
+  EGISMOC_FRAME_SENSOR_RESET,
+  EGISMOC_FRAME_SENSOR_START_CAPTURE,
+};
+
 static void
 egismoc_enroll_run_state (FpiSsm   *ssm,
                           FpDevice *device)
@@ -1324,8 +1573,8 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
 
     case ENROLL_GET_ENROLLED_IDS:
       /* get enrolled_ids from device for use in check stages below */
-      egismoc_exec_cmd (device, cmd_list, cmd_list_len,
-                        NULL, egismoc_list_fill_enrolled_ids_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_LIST,
+                          egismoc_list_fill_enrolled_ids_cb);
       break;
 
     case ENROLL_CHECK_ENROLLED_NUM:
@@ -1338,14 +1587,10 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
       fpi_ssm_next_state (ssm);
       break;
 
-    case ENROLL_SENSOR_RESET:
-      egismoc_exec_cmd (device, cmd_sensor_reset, cmd_sensor_reset_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
-      break;
-
-    case ENROLL_SENSOR_ENROLL:
-      egismoc_exec_cmd (device, cmd_sensor_enroll, cmd_sensor_enroll_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+    case ENROLL_SENSOR_PREPARE:
+      egismoc_exec_frames (device, enroll_prepare_frames,
+                           G_N_ELEMENTS (enroll_prepare_frames),
+                           egismoc_task_ssm_next_state_cb);
       break;
 
     case ENROLL_WAIT_FINGER:
@@ -1353,8 +1598,8 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
       break;
 
     case ENROLL_SENSOR_CHECK:
-      egismoc_exec_cmd (device, cmd_sensor_check, cmd_sensor_check_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_SENSOR_CHECK,
+                          egismoc_task_ssm_next_state_cb);
       break;
 
     case ENROLL_CHECK:
@@ -1364,19 +1609,14 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
       break;
 
     case ENROLL_START:
-      egismoc_exec_cmd (device, cmd_enroll_starting, cmd_enroll_starting_len,
-                        NULL, egismoc_enroll_starting_cb);
-      break;
-
-    case ENROLL_CAPTURE_SENSOR_RESET:
-      egismoc_exec_cmd (device, cmd_sensor_reset, cmd_sensor_reset_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_ENROLL_STARTING,
+                          egismoc_enroll_starting_cb);
       break;
 
-    case ENROLL_CAPTURE_SENSOR_START_CAPTURE:
-      egismoc_exec_cmd (device, cmd_sensor_start_capture, cmd_sensor_start_capture_len,
-                        NULL,
-                        egismoc_task_ssm_next_state_cb);
+    case ENROLL_CAPTURE_SENSOR_PREPARE:
+      egismoc_exec_frames (device, enroll_capture_prepare_frames,
+                           G_N_ELEMENTS (enroll_capture_prepare_frames),
+                           egismoc_task_ssm_next_state_cb);
       break;
 
     case ENROLL_CAPTURE_WAIT_FINGER:
@@ -1384,18 +1624,18 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
       break;
 
     case ENROLL_CAPTURE_POST_WAIT_FINGER:
-      egismoc_exec_cmd (device, cmd_capture_post_wait_finger, cmd_capture_post_wait_finger_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_CAPTURE_POST_WAIT_FINGER,
+                          egismoc_task_ssm_next_state_cb);
       break;
 
     case ENROLL_CAPTURE_READ_RESPONSE:
-      egismoc_exec_cmd (device, cmd_read_capture, cmd_read_capture_len,
-                        NULL, egismoc_read_capture_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_READ_CAPTURE,
+                          egismoc_read_capture_cb);
       break;
 
     case ENROLL_COMMIT_START:
-      egismoc_exec_cmd (device, cmd_commit_starting, cmd_commit_starting_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_COMMIT_STARTING,
+                          egismoc_task_ssm_next_state_cb);
       break;
 
     case ENROLL_COMMIT:
@@ -1404,7 +1644,9 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
       egismoc_set_print_data (enroll_print->print, enrollment_id);
 
       fpi_byte_writer_init (&writer);
-      if (!fpi_byte_writer_put_data (&writer, cmd_new_print_prefix,
+      if (!fpi_byte_writer_reserve (&writer, cmd_new_print_prefix_len +
+                                    SDCP_ENROLLMENT_ID_SIZE) ||
+          !fpi_byte_writer_put_data (&writer, cmd_new_print_prefix,
                                      cmd_new_print_prefix_len))
         {
           fpi_ssm_mark_failed (ssm, fpi_device_error_new (FP_DEVICE_ERROR_PROTO));
@@ -1423,8 +1665,8 @@ egismoc_enroll_run_state (FpiSsm   *ssm,
 
     case ENROLL_COMMIT_SENSOR_RESET:
       g_clear_pointer (&self->enrollment_nonce, g_free);
-      egismoc_exec_cmd (device, cmd_sensor_reset, cmd_sensor_reset_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_SENSOR_RESET,
+                          egismoc_task_ssm_next_state_cb);
       break;
 
     case ENROLL_COMPLETE:
@@ -1581,6 +1823,11 @@ egismoc_identify_check_cb (FpDevice *device,
   fpi_ssm_next_state (self->task_ssm);
 }
 
+static const EgisMocFrame identify_prepare_frames[] = {
+  EGISMOC_FRAME_SENSOR_RESET,
+  EGISMOC_FRAME_SENSOR_IDENTIFY,
+};
+
 static void
 egismoc_identify_run_state (FpiSsm   *ssm,
                             FpDevice *device)
@@ -1606,9 +1853,16 @@ egismoc_identify_run_state (FpiSsm   *ssm,
       break;
 
     case IDENTIFY_GET_ENROLLED_IDS:
+      if (egismoc_enrolled_ids_are_cached (self) && !self->enrolled_ids_cache_check)
+        {
+          fp_dbg ("Using %u cached enrolled IDs", self->enrolled_ids->len);
+          fpi_ssm_next_state (ssm);
+          break;
+        }
+
       /* get enrolled_ids from device for use in check stages below */
-      egismoc_exec_cmd (device, cmd_list, cmd_list_len,
-                        NULL, egismoc_list_fill_enrolled_ids_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_LIST,
+                          egismoc_list_fill_enrolled_ids_cb);
       break;
 
     case IDENTIFY_CHECK_ENROLLED_NUM:
@@ -1621,14 +1875,10 @@ egismoc_identify_run_state (FpiSsm   *ssm,
       fpi_ssm_next_state (ssm);
       break;
 
-    case IDENTIFY_SENSOR_RESET:
-      egismoc_exec_cmd (device, cmd_sensor_reset, cmd_sensor_reset_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
-      break;
-
-    case IDENTIFY_SENSOR_IDENTIFY:
-      egismoc_exec_cmd (device, cmd_sensor_identify, cmd_sensor_identify_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+    case IDENTIFY_SENSOR_PREPARE:
+      egismoc_exec_frames (device, identify_prepare_frames,
+                           G_N_ELEMENTS (identify_prepare_frames),
+                           egismoc_task_ssm_next_state_cb);
       break;
 
     case IDENTIFY_WAIT_FINGER:
@@ -1636,8 +1886,8 @@ egismoc_identify_run_state (FpiSsm   *ssm,
       break;
 
     case IDENTIFY_SENSOR_CHECK:
-      egismoc_exec_cmd (device, cmd_sensor_check, cmd_sensor_check_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_SENSOR_CHECK,
+                          egismoc_task_ssm_next_state_cb);
       break;
 
     case IDENTIFY_CHECK:
@@ -1647,8 +1897,8 @@ egismoc_identify_run_state (FpiSsm   *ssm,
       break;
 
     case IDENTIFY_COMPLETE_SENSOR_RESET:
-      egismoc_exec_cmd (device, cmd_sensor_reset, cmd_sensor_reset_len,
-                        NULL, egismoc_task_ssm_next_state_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_SENSOR_RESET,
+                          egismoc_task_ssm_next_state_cb);
       break;
 
     /*
@@ -1730,6 +1980,204 @@ egismoc_fw_version_cb (FpDevice *device,
   fpi_ssm_next_state (self->task_ssm);
 }
 
+/*
+ * Probing requires a reset of the device and a round-trip to read its serial
+ * number. The result is therefore stored in a file, so that probing the same
+ * device again during the same boot can skip both. This covers a daemon
+ * restart as well as unplugging and re-plugging the device. An entry is keyed
+ * by the port the device is plugged into and its descriptor, and records the
+ * boot it was read in. Entries of an earlier boot are never used.
+ *
+ * A different unit of the same model plugged into the same port during the
+ * same boot picks up the serial of the previous one. The entry is dropped
+ * whenever opening the device fails, which forces the next probe to do the
+ * full sequence again.
+ */
+#define EGISMOC_PROBE_CACHE_BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+G_LOCK_DEFINE_STATIC (egismoc_probe_cache);
+
+static gchar *
+egismoc_probe_cache_get_path (void)
+{
+  const gchar *state_dir = g_getenv ("STATE_DIRECTORY");
+  g_autofree gchar *base_path = NULL;
+
+  /* The recordings replay the reset of every probe, so under emulation the
+   * cache is only used by tests that give it a state directory of their own */
+  if (g_strcmp0 (g_getenv ("FP_DEVICE_EMULATION"), "1") == 0 &&
+      (!state_dir || !*state_dir))
+    return NULL;
+
+  /* Same location as the SDCP claims, see fpi-sdcp-device.c */
+  if (state_dir && *state_dir)
+    {
+      g_auto(GStrv) elems = g_strsplit (state_dir, ":", 2);
+
+      base_path = g_strdup (elems[0]);
+    }
+  else
+    {
+      base_path = g_build_filename (g_get_tmp_dir (), ".libfprint", NULL);
+    }
+
+  return g_build_filename (base_path, "egismoc", "probe-cache", NULL);
+}
+
+static gchar *
+egismoc_probe_cache_get_boot_id (void)
+{
+  g_autofree gchar *boot_id = NULL;
+
+  /* Without a boot ID, entries of earlier boots cannot be told apart */
+  if (!g_file_get_contents (EGISMOC_PROBE_CACHE_BOOT_ID_PATH, &boot_id, NULL, NULL))
+    return NULL;
+
+  return g_strdup (g_strstrip (boot_id));
+}
+
+static gchar *
+egismoc_probe_cache_key (GUsbDevice *usb_dev)
+{
+  g_autoptr(GString) ports = g_string_new (NULL);
+  g_autoptr(GUsbDevice) dev = g_object_ref (usb_dev);
+
+  /* Walk up, skipping the root hub. */
+  while (TRUE)
+    {
+      g_autoptr(GUsbDevice) parent = g_usb_device_get_parent (dev);
+      g_autofree gchar *port_str = NULL;
+
+      if (!parent)
+        break;
+
+      port_str = g_strdup_printf ("%d.", g_usb_device_get_port_number (dev));
+      g_string_prepend (ports, port_str);
+      g_set_object (&dev, parent);
+    }
+  if (ports->len > 0)
+    g_string_set_size (ports, ports->len - 1);
+
+  return g_strdup_printf ("%d-%s %04x:%04x %04x %d",
+                          g_usb_device_get_bus (usb_dev),
+                          ports->str,
+                          g_usb_device_get_vid (usb_dev),
+                          g_usb_device_get_pid (usb_dev),
+                          g_usb_device_get_release (usb_dev),
+                          g_usb_device_get_serial_number_index (usb_dev));
+}
+
+static GKeyFile *
+egismoc_probe_cache_load (const gchar *path)
+{
+  GKeyFile *cache = g_key_file_new ();
+
+  /* A missing or broken file is an empty cache */
+  g_key_file_load_from_file (cache, path, G_KEY_FILE_NONE, NULL);
+
+  return cache;
+}
+
+static void
+egismoc_probe_cache_save (GKeyFile    *cache,
+                          const gchar *path)
+{
+  g_autofree gchar *dir = g_path_get_dirname (path);
+  g_autoptr(GError) error = NULL;
+
+  if (g_mkdir_with_parents (dir, 0700) < 0 ||
+      !g_key_file_save_to_file (cache, path, &error))
+    fp_dbg ("Could not write probe cache \"%s\": %s", path,
+            error ? error->message : g_strerror (errno));
+}
+
+static gchar *
+egismoc_probe_cache_lookup (GUsbDevice *usb_dev)
+{
+  g_autofree gchar *path = egismoc_probe_cache_get_path ();
+  g_autofree gchar *boot_id = NULL;
+  g_autofree gchar *cached_boot_id = NULL;
+  g_autofree gchar *key = NULL;
+  g_autoptr(GKeyFile) cache = NULL;
+  gchar *serial = NULL;
+
+  if (!path || !(boot_id = egismoc_probe_cache_get_boot_id ()))
+    return NULL;
+
+  key = egismoc_probe_cache_key (usb_dev);
+
+  G_LOCK (egismoc_probe_cache);
+  cache = egismoc_probe_cache_load (path);
+  G_UNLOCK (egismoc_probe_cache);
+
+  cached_boot_id = g_key_file_get_string (cache, key, "boot-id", NULL);
+  if (g_strcmp0 (cached_boot_id, boot_id) == 0)
+    serial = g_key_file_get_string (cache, key, "serial", NULL);
+
+  if (serial)
+    fp_dbg ("Using cached probe result for %s", key);
+
+  return serial;
+}
+
+static void
+egismoc_probe_cache_store (GUsbDevice  *usb_dev,
+                           const gchar *serial)
+{
+  g_autofree gchar *path = egismoc_probe_cache_get_path ();
+  g_autofree gchar *boot_id = NULL;
+  g_autofree gchar *key = NULL;
+  g_auto(GStrv) groups = NULL;
+  g_autoptr(GKeyFile) cache = NULL;
+  guint i;
+
+  if (!path || !serial || !(boot_id = egismoc_probe_cache_get_boot_id ()))
+    return;
+
+  key = egismoc_probe_cache_key (usb_dev);
+
+  G_LOCK (egismoc_probe_cache);
+  cache = egismoc_probe_cache_load (path);
+
+  /* Drop whatever was left over from earlier boots */
+  groups = g_key_file_get_groups (cache, NULL);
+  for (i = 0; groups[i]; i++)
+    {
+      g_autofree gchar *cached_boot_id = NULL;
+
+      cached_boot_id = g_key_file_get_string (cache, groups[i], "boot-id", NULL);
+      if (g_strcmp0 (cached_boot_id, boot_id) != 0)
+        g_key_file_remove_group (cache, groups[i], NULL);
+    }
+
+  g_key_file_set_string (cache, key, "boot-id", boot_id);
+  g_key_file_set_string (cache, key, "serial", serial);
+  egismoc_probe_cache_save (cache, path);
+  G_UNLOCK (egismoc_probe_cache);
+}
+
+static void
+egismoc_probe_cache_invalidate (FpDevice *device)
+{
+  g_autofree gchar *path = egismoc_probe_cache_get_path ();
+  g_autofree gchar *key = NULL;
+  g_autoptr(GKeyFile) cache = NULL;
+
+  if (!path)
+    return;
+
+  key = egismoc_probe_cache_key (fpi_device_get_usb_device (device));
+
+  G_LOCK (egismoc_probe_cache);
+  cache = egismoc_probe_cache_load (path);
+  if (g_key_file_remove_group (cache, key, NULL))
+    {
+      fp_dbg ("Dropped cached probe result for %s", key);
+      egismoc_probe_cache_save (cache, path);
+    }
+  G_UNLOCK (egismoc_probe_cache);
+}
+
 static void
 egismoc_dev_init_done (FpiSsm   *ssm,
                        FpDevice *device,
@@ -1739,6 +2187,7 @@ egismoc_dev_init_done (FpiSsm   *ssm,
     {
       g_usb_device_release_interface (
         fpi_device_get_usb_device (device), 0, 0, NULL);
+      egismoc_probe_cache_invalidate (device);
       egismoc_task_ssm_done (ssm, device, error);
       return;
     }
@@ -1796,8 +2245,8 @@ egismoc_dev_init_handler (FpiSsm   *ssm,
       break;
 
     case DEV_GET_FW_VERSION:
-      egismoc_exec_cmd (device, cmd_fw_version, cmd_fw_version_len,
-                        NULL, egismoc_fw_version_cb);
+      egismoc_exec_frame (device, EGISMOC_FRAME_FW_VERSION,
+                          egismoc_fw_version_cb);
       return;
 
     default:
@@ -1813,40 +2262,64 @@ egismoc_dev_init_handler (FpiSsm   *ssm,
                            NULL);
 }
 
-static void
-egismoc_probe (FpDevice *device)
+static gint
+egismoc_probe_get_enroll_stages (FpDevice *device)
+{
+  guint64 driver_data;
+
+  driver_data = fpi_device_get_driver_data (device);
+  if (driver_data & EGISMOC_DRIVER_MAX_ENROLL_STAGES_20)
+    return 20;
+  else if (driver_data & EGISMOC_DRIVER_MAX_ENROLL_STAGES_15)
+    return 15;
+  else
+    return EGISMOC_MAX_ENROLL_STAGES_DEFAULT;
+}
+
+/*
+ * Probing only does blocking USB requests, so it is run on a worker thread to
+ * not hold up the probing of other devices.
+ */
+static gboolean
+egismoc_probe (FpDevice *device,
+               gchar   **device_id,
+               gint     *nr_enroll_stages,
+               GError  **error)
 {
   GUsbDevice *usb_dev;
-  GError *error = NULL;
   g_autofree gchar *serial = NULL;
-  FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
-  guint64 driver_data;
 
   fp_dbg ("%s enter --> ", G_STRFUNC);
 
-  /* Claim usb interface */
   usb_dev = fpi_device_get_usb_device (device);
-  if (!g_usb_device_open (usb_dev, &error))
+
+  serial = egismoc_probe_cache_lookup (usb_dev);
+  if (serial)
     {
-      fp_dbg ("%s g_usb_device_open failed %s", G_STRFUNC, error->message);
-      fpi_device_probe_complete (device, NULL, NULL, error);
-      return;
+      *nr_enroll_stages = egismoc_probe_get_enroll_stages (device);
+      *device_id = g_steal_pointer (&serial);
+      return TRUE;
     }
 
-  if (!g_usb_device_reset (usb_dev, &error))
+  /* Claim usb interface */
+  if (!g_usb_device_open (usb_dev, error))
     {
-      fp_dbg ("%s g_usb_device_reset failed %s", G_STRFUNC, error->message);
+      fp_dbg ("%s g_usb_device_open failed %s", G_STRFUNC, (*error)->message);
+      return FALSE;
+    }
+
+  if (!g_usb_device_reset (usb_dev, error))
+    {
+      fp_dbg ("%s g_usb_device_reset failed %s", G_STRFUNC, (*error)->message);
       g_usb_device_close (usb_dev, NULL);
-      fpi_device_probe_complete (device, NULL, NULL, error);
-      return;
+      return FALSE;
     }
 
-  if (!g_usb_device_claim_interface (usb_dev, 0, 0, &error))
+  if (!g_usb_device_claim_interface (usb_dev, 0, 0, error))
     {
-      fp_dbg ("%s g_usb_device_claim_interface failed %s", G_STRFUNC, error->message);
+      fp_dbg ("%s g_usb_device_claim_interface failed %s", G_STRFUNC, (*error)->message);
       g_usb_device_close (usb_dev, NULL);
-      fpi_device_probe_complete (device, NULL, NULL, error);
-      return;
+      return FALSE;
     }
 
   if (g_strcmp0 (g_getenv ("FP_DEVICE_EMULATION"), "1") == 0)
@@ -1854,32 +2327,25 @@ egismoc_probe (FpDevice *device)
   else
     serial = g_usb_device_get_string_descriptor (usb_dev,
                                                  g_usb_device_get_serial_number_index (usb_dev),
-                                                 &error);
+                                                 error);
 
-  if (error)
+  if (!serial)
     {
-      fp_dbg ("%s g_usb_device_get_string_descriptor failed %s", G_STRFUNC, error->message);
-      g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (device)),
-                                      0, 0, NULL);
+      fp_dbg ("%s g_usb_device_get_string_descriptor failed %s", G_STRFUNC, (*error)->message);
+      g_usb_device_release_interface (usb_dev, 0, 0, NULL);
       g_usb_device_close (usb_dev, NULL);
-      fpi_device_probe_complete (device, NULL, NULL, error);
-      return;
+      return FALSE;
     }
 
-  driver_data = fpi_device_get_driver_data (device);
-  if (driver_data & EGISMOC_DRIVER_MAX_ENROLL_STAGES_20)
-     self->max_enroll_stages = 20;
-  else if (driver_data & EGISMOC_DRIVER_MAX_ENROLL_STAGES_15)
-    self->max_enroll_stages = 15;
-  else
-    self->max_enroll_stages = EGISMOC_MAX_ENROLL_STAGES_DEFAULT;
-
-  fpi_device_set_nr_enroll_stages (device, self->max_enroll_stages);
+  *nr_enroll_stages = egismoc_probe_get_enroll_stages (device);
 
-  g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (device)), 0, 0, NULL);
+  g_usb_device_release_interface (usb_dev, 0, 0, NULL);
   g_usb_device_close (usb_dev, NULL);
 
-  fpi_device_probe_complete (device, serial, NULL, error);
+  egismoc_probe_cache_store (usb_dev, serial);
+
+  *device_id = g_steal_pointer (&serial);
+  return TRUE;
 }
 
 static void
@@ -1891,8 +2357,12 @@ egismoc_open (FpDevice *device)
 
   self->interrupt_cancellable = g_cancellable_new ();
 
+  /* prints may have been changed while we did not have the device open */
+  egismoc_invalidate_enrolled_ids (self);
+
   if (!g_usb_device_reset (fpi_device_get_usb_device (device), &error))
     {
+      egismoc_probe_cache_invalidate (device);
       fpi_device_open_complete (device, error);
       return;
     }
@@ -1900,6 +2370,7 @@ egismoc_open (FpDevice *device)
   if (!g_usb_device_claim_interface (fpi_device_get_usb_device (device),
                                      0, 0, &error))
     {
+      egismoc_probe_cache_invalidate (device);
       fpi_device_open_complete (device, error);
       return;
     }
@@ -1924,6 +2395,11 @@ static void
 egismoc_suspend (FpDevice *device)
 {
   fp_dbg ("Suspend");
+  FpiDeviceEgisMoc *self = FPI_DEVICE_EGISMOC (device);
+
+  /* another OS may modify the storage while the system is suspended; an
+   * interrupted task may still hold the list, so just mark it outdated */
+  self->enrolled_ids_generation++;
 
   egismoc_cancel (device);
   g_cancellable_cancel (fpi_device_get_cancellable (device));
@@ -1939,6 +2415,7 @@ egismoc_close (FpDevice *device)
 
   egismoc_cancel (device);
   g_clear_object (&self->interrupt_cancellable);
+  egismoc_invalidate_enrolled_ids (self);
 
   g_usb_device_release_interface (fpi_device_get_usb_device (device),
                                   0, 0, &error);
@@ -1949,6 +2426,15 @@ static void
 fpi_device_egismoc_init (FpiDeviceEgisMoc *self)
 {
   G_DEBUG_HERE ();
+
+  /* The recordings replay every list command, so rather than skipping the
+   * command it is still sent and has to return the cached list. This checks
+   * that the cache is invalidated whenever the storage changes. Recordings
+   * made without these list commands set FP_EGISMOC_TRUST_CACHED_IDS to
+   * test skipping them as on real hardware. */
+  self->enrolled_ids_cache_check =
+    g_strcmp0 (g_getenv ("FP_DEVICE_EMULATION"), "1") == 0 &&
+    g_strcmp0 (g_getenv ("FP_EGISMOC_TRUST_CACHED_IDS"), "1") != 0;
 }
 
 static void
@@ -1960,6 +2446,8 @@ fpi_device_egismoc_class_init (FpiDeviceEgisMocClass *klass)
   dev_class->id = FP_COMPONENT;
   dev_class->full_name = EGISMOC_DRIVER_FULLNAME;
 
+  egismoc_build_frames ();
+
   dev_class->type = FP_DEVICE_TYPE_USB;
   dev_class->scan_type = FP_SCAN_TYPE_PRESS;
   dev_class->id_table = egismoc_id_table;
@@ -1967,7 +2455,7 @@ fpi_device_egismoc_class_init (FpiDeviceEgisMocClass *klass)
   /* device should be "always off" unless being used */
   dev_class->temp_hot_seconds = 0;
 
-  dev_class->probe = egismoc_probe;
+  dev_class->probe_in_thread = egismoc_probe;
   dev_class->open = egismoc_open;
   dev_class->cancel = egismoc_cancel;
   dev_class->suspend = egismoc_suspend;
@@ -1985,4 +2473,5 @@ fpi_device_egismoc_class_init (FpiDeviceEgisMocClass *klass)
   /* some but not all egismoc devices support reconnect; easiest to just disable for all */
   sdcp_dev_class->supports_reconnect = FALSE;
   sdcp_dev_class->claim_expiration_seconds = 86400;
+  sdcp_dev_class->precompute_host_keys = TRUE;
 }
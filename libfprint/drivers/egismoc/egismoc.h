@@ -138,6 +138,24 @@ static gsize rsp_commit_success_suffix_len = sizeof (rsp_commit_success_suffix)
  */
 
 
+/* fixed commands which are sent from frames built once at class init */
+
+typedef enum {
+  EGISMOC_FRAME_SENSOR_RESET,
+  EGISMOC_FRAME_SENSOR_IDENTIFY,
+  EGISMOC_FRAME_SENSOR_ENROLL,
+  EGISMOC_FRAME_SENSOR_START_CAPTURE,
+  EGISMOC_FRAME_SENSOR_CHECK,
+  EGISMOC_FRAME_FW_VERSION,
+  EGISMOC_FRAME_LIST,
+  EGISMOC_FRAME_ENROLL_STARTING,
+  EGISMOC_FRAME_CAPTURE_POST_WAIT_FINGER,
+  EGISMOC_FRAME_READ_CAPTURE,
+  EGISMOC_FRAME_COMMIT_STARTING,
+  EGISMOC_FRAMES,
+} EgisMocFrame;
+
+
 /* prefixes/suffixes and other things for dynamically created command payloads */
 
 #define EGISMOC_CHECK_BYTES_LENGTH 2
@@ -195,8 +213,7 @@ typedef enum {
   IDENTIFY_SDCP_CONNECT,
   IDENTIFY_GET_ENROLLED_IDS,
   IDENTIFY_CHECK_ENROLLED_NUM,
-  IDENTIFY_SENSOR_RESET,
-  IDENTIFY_SENSOR_IDENTIFY,
+  IDENTIFY_SENSOR_PREPARE,
   IDENTIFY_WAIT_FINGER,
   IDENTIFY_SENSOR_CHECK,
   IDENTIFY_CHECK,
@@ -209,14 +226,12 @@ typedef enum {
   ENROLL_SDCP_CONNECT,
   ENROLL_GET_ENROLLED_IDS,
   ENROLL_CHECK_ENROLLED_NUM,
-  ENROLL_SENSOR_RESET,
-  ENROLL_SENSOR_ENROLL,
+  ENROLL_SENSOR_PREPARE,
   ENROLL_WAIT_FINGER,
   ENROLL_SENSOR_CHECK,
   ENROLL_CHECK,
   ENROLL_START,
-  ENROLL_CAPTURE_SENSOR_RESET,
-  ENROLL_CAPTURE_SENSOR_START_CAPTURE,
+  ENROLL_CAPTURE_SENSOR_PREPARE,
   ENROLL_CAPTURE_WAIT_FINGER,
   ENROLL_CAPTURE_POST_WAIT_FINGER,
   ENROLL_CAPTURE_READ_RESPONSE,
@@ -216,7 +216,6 @@ enum elanspi_capture_hv_state {
 
 enum elanspi_write_regtable_state {
   ELANSPI_WRTABLE_WRITE,
-  ELANSPI_WRTABLE_ITERATE,
   ELANSPI_WRTABLE_NSTATES
 };
 
@@ -516,20 +515,18 @@ elanspi_send_regtable_handler (FpiSsm *ssm, FpDevice *dev)
   switch (fpi_ssm_get_cur_state (ssm))
     {
     case ELANSPI_WRTABLE_WRITE:
-      xfer = elanspi_write_register (self, entry->addr, entry->value);
-      xfer->ssm = ssm;
-      fpi_spi_transfer_submit (xfer, fpi_device_get_cancellable (dev), fpi_ssm_spi_transfer_cb, NULL);
-      return;
-
-    case ELANSPI_WRTABLE_ITERATE:
-      entry += 1;
-      if (entry->addr != 0xff)
+      /* write the whole table as one batch */
+      xfer = fpi_spi_transfer_new (dev, self->spi_fd);
+      do
         {
-          fpi_ssm_set_data (ssm, (gpointer) entry, NULL);
-          fpi_ssm_jump_to_state (ssm, ELANSPI_WRTABLE_WRITE);
-          return;
+          guint8 cmd[2] = { entry->addr | 0x80, entry->value };
+
+          fpi_spi_transfer_batch_write (xfer, cmd, sizeof (cmd));
+          entry += 1;
         }
-      fpi_ssm_mark_completed (ssm);
+      while (entry->addr != 0xff);
+      xfer->ssm = ssm;
+      fpi_spi_transfer_submit (xfer, fpi_device_get_cancellable (dev), fpi_ssm_spi_transfer_cb, NULL);
       return;
     }
 }
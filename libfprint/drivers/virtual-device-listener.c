@@ -24,7 +24,13 @@
 #include "fpi-log.h"
 
 #include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gunixconnection.h>
 #include <gio/gunixsocketaddress.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "virtual-device-private.h"
 
@@ -41,11 +47,21 @@ struct _FpiDeviceVirtualListener
 
   gint                                 socket_fd;
   gint                                 client_fd;
+
+  /* The client can write to all of the mapping at any time, so the layout
+   * is copied on attach and slot headers are copied before they are checked. */
+  FpiDeviceVirtualRingHeader          *ring;
+  gsize                                ring_size;
+  guint32                              ring_n_slots;
+  guint32                              ring_slot_size;
+  guint32                              ring_tail;
+  FpiDeviceVirtualRingSlot             ring_slot;
 };
 
 G_DEFINE_TYPE (FpiDeviceVirtualListener, fpi_device_virtual_listener, G_TYPE_SOCKET_LISTENER)
 
 static void start_listen (FpiDeviceVirtualListener *self);
+static void ring_detach (FpiDeviceVirtualListener *self);
 
 FpiDeviceVirtualListener *
 fpi_device_virtual_listener_new (void)
@@ -67,6 +83,7 @@ fpi_device_virtual_listener_dispose (GObject *object)
   g_cancellable_cancel (self->cancellable);
   g_clear_object (&self->cancellable);
   g_clear_object (&self->connection);
+  ring_detach (self);
 
   self->ready_cb = NULL;
 
@@ -115,6 +132,7 @@ new_connection_cb (GObject *source_object, GAsyncResult *res, gpointer user_data
       g_io_stream_close (G_IO_STREAM (self->connection), NULL, NULL);
       g_clear_object (&self->connection);
     }
+  ring_detach (self);
 
   self->connection = connection;
   fp_dbg ("Got a new connection!");
@@ -200,6 +218,7 @@ fpi_device_virtual_listener_connection_close (FpiDeviceVirtualListener *self)
 
   g_io_stream_close (G_IO_STREAM (self->connection), NULL, NULL);
   g_clear_object (&self->connection);
+  ring_detach (self);
 
   return TRUE;
 }
@@ -354,3 +373,172 @@ fpi_device_virtual_listener_write_sync (FpiDeviceVirtualListener *self,
                                     self->cancellable,
                                     error);
 }
+
+static void
+ring_detach (FpiDeviceVirtualListener *self)
+{
+  if (!self->ring)
+    return;
+
+  munmap (self->ring, self->ring_size);
+  self->ring = NULL;
+  self->ring_size = 0;
+}
+
+/* Receives a memfd from the client (sent with SCM_RIGHTS after the command
+ * that announced it) and maps it as the frame ring of this connection.
+ * The memfd must be sealed against shrinking, as truncating it would make
+ * accessing the mapping fail with SIGBUS. */
+gboolean
+fpi_device_virtual_listener_attach_ring (FpiDeviceVirtualListener *self,
+                                         GError                  **error)
+{
+  FpiDeviceVirtualRingHeader *ring;
+  struct stat st;
+  guint32 n_slots, slot_size;
+  guint64 needed;
+  int seals;
+  int fd;
+
+  g_return_val_if_fail (FPI_IS_DEVICE_VIRTUAL_LISTENER (self), FALSE);
+
+  if (!self->connection || !G_IS_UNIX_CONNECTION (self->connection))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                   "Listener not connected to any stream");
+      return FALSE;
+    }
+
+  fd = g_unix_connection_receive_fd (G_UNIX_CONNECTION (self->connection),
+                                     self->cancellable, error);
+  if (fd < 0)
+    return FALSE;
+
+  seals = fcntl (fd, F_GET_SEALS);
+  if (seals < 0 || !(seals & F_SEAL_SHRINK))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                   "Ring buffer must be a memfd sealed with F_SEAL_SHRINK");
+      close (fd);
+      return FALSE;
+    }
+
+  if (fstat (fd, &st) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Could not stat ring buffer: %s", g_strerror (errno));
+      close (fd);
+      return FALSE;
+    }
+
+  if (st.st_size < (off_t) sizeof (FpiDeviceVirtualRingHeader))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Ring buffer is too small");
+      close (fd);
+      return FALSE;
+    }
+
+  ring = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (ring == MAP_FAILED)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Could not map ring buffer: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  n_slots = ring->n_slots;
+  slot_size = ring->slot_size;
+  needed = sizeof (FpiDeviceVirtualRingHeader) +
+           (guint64) n_slots * (sizeof (FpiDeviceVirtualRingSlot) + slot_size);
+
+  if (ring->magic != FPI_DEVICE_VIRTUAL_RING_MAGIC ||
+      ring->version != FPI_DEVICE_VIRTUAL_RING_VERSION ||
+      n_slots == 0 || slot_size % 8 != 0 ||
+      needed > (guint64) st.st_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid ring buffer header");
+      munmap (ring, st.st_size);
+      return FALSE;
+    }
+
+  ring_detach (self);
+  self->ring = ring;
+  self->ring_size = st.st_size;
+  self->ring_n_slots = n_slots;
+  self->ring_slot_size = slot_size;
+  self->ring_tail = ring->tail;
+
+  fp_dbg ("Attached ring with %u slots of %u bytes", n_slots, slot_size);
+
+  return TRUE;
+}
+
+gboolean
+fpi_device_virtual_listener_has_ring (FpiDeviceVirtualListener *self)
+{
+  g_return_val_if_fail (FPI_IS_DEVICE_VIRTUAL_LISTENER (self), FALSE);
+
+  return self->ring != NULL;
+}
+
+/* Returns a copy of the oldest queued slot without consuming it, or %NULL if
+ * the ring is empty. The slot and its data stay valid until it is released. */
+const FpiDeviceVirtualRingSlot *
+fpi_device_virtual_listener_ring_peek (FpiDeviceVirtualListener *self,
+                                       const guint8            **data)
+{
+  const FpiDeviceVirtualRingSlot *slot;
+  guint32 head;
+  gsize stride;
+
+  g_return_val_if_fail (FPI_IS_DEVICE_VIRTUAL_LISTENER (self), NULL);
+
+  if (!self->ring)
+    return NULL;
+
+  head = (guint32) g_atomic_int_get ((gint *) &self->ring->head);
+
+  if (head == self->ring_tail)
+    return NULL;
+
+  if (head - self->ring_tail > self->ring_n_slots)
+    {
+      g_warning ("Ring buffer overrun by client, detaching it");
+      ring_detach (self);
+      return NULL;
+    }
+
+  stride = sizeof (FpiDeviceVirtualRingSlot) + self->ring_slot_size;
+  slot = (const FpiDeviceVirtualRingSlot *) ((guint8 *) (self->ring + 1) +
+                                             (self->ring_tail % self->ring_n_slots) * stride);
+  memcpy (&self->ring_slot, slot, sizeof (FpiDeviceVirtualRingSlot));
+
+  if (self->ring_slot.width > 0 && self->ring_slot.height > 0 &&
+      (guint64) self->ring_slot.width * self->ring_slot.height > self->ring_slot_size)
+    {
+      g_warning ("Ring buffer slot is larger than the slot size, detaching it");
+      ring_detach (self);
+      return NULL;
+    }
+
+  if (data)
+    *data = (const guint8 *) (slot + 1);
+
+  return &self->ring_slot;
+}
+
+void
+fpi_device_virtual_listener_ring_release (FpiDeviceVirtualListener *self)
+{
+  g_return_if_fail (FPI_IS_DEVICE_VIRTUAL_LISTENER (self));
+
+  if (!self->ring)
+    return;
+
+  self->ring_tail++;
+  g_atomic_int_set ((gint *) &self->ring->tail, self->ring_tail);
+}
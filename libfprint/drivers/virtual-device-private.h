@@ -63,6 +63,41 @@ gboolean fpi_device_virtual_listener_write_sync (FpiDeviceVirtualListener *self,
                                                  gsize                     count,
                                                  GError                  **error);
 
+/* Shared memory ring that a client can hand over (as a memfd) to queue many
+ * frames at once. The memory starts with a FpiDeviceVirtualRingHeader which is
+ * followed by n_slots slots, each a FpiDeviceVirtualRingSlot followed by
+ * slot_size bytes of pixel data. head and tail are free running counters,
+ * the client only ever writes head and the driver only ever writes tail. */
+#define FPI_DEVICE_VIRTUAL_RING_MAGIC 0x47525046 /* "FPRG" */
+#define FPI_DEVICE_VIRTUAL_RING_VERSION 1
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 n_slots;
+  guint32 slot_size;
+  guint32 head;
+  guint32 tail;
+  guint32 reserved[2];
+} FpiDeviceVirtualRingHeader;
+
+typedef struct
+{
+  /* Image size, or a command and its argument as in the socket protocol */
+  gint32  width;
+  gint32  height;
+  /* Replay time in microseconds, 0 to not wait */
+  guint64 timestamp;
+} FpiDeviceVirtualRingSlot;
+
+gboolean fpi_device_virtual_listener_attach_ring (FpiDeviceVirtualListener *self,
+                                                  GError                  **error);
+gboolean fpi_device_virtual_listener_has_ring (FpiDeviceVirtualListener *self);
+const FpiDeviceVirtualRingSlot *fpi_device_virtual_listener_ring_peek (FpiDeviceVirtualListener *self,
+                                                                       const guint8            **data);
+void fpi_device_virtual_listener_ring_release (FpiDeviceVirtualListener *self);
+
 
 struct _FpDeviceVirtualDevice
 {
@@ -72,8 +107,9 @@ struct _FpDeviceVirtualDevice
   GCancellable             *cancellable;
 
   char                      recv_buf[MAX_LINE_LEN];
+  char                     *batch_buf;
 
-  GPtrArray                *pending_commands;
+  GQueue                   *pending_commands;
 
   GHashTable               *prints_storage;
 
@@ -35,6 +35,39 @@ G_DEFINE_TYPE (FpDeviceVirtualDeviceStorage, fpi_device_virtual_device_storage,
 
 static GPtrArray * get_stored_prints (FpDeviceVirtualDevice * self);
 
+/* Returns the first print of the gallery with the given ID. Same criteria as
+ * fp_print_equal() for our raw prints, but without creating a print first. */
+static FpPrint *
+find_gallery_print (FpDevice   *dev,
+                    GPtrArray  *prints,
+                    const char *id)
+{
+  guint i;
+
+  for (i = 0; i < prints->len; i++)
+    {
+      g_autoptr(GVariant) data = NULL;
+      FpPrint *print = g_ptr_array_index (prints, i);
+      FpiPrintType type;
+
+      g_object_get (print,
+                    "fpi-type", &type,
+                    "fpi-data", &data,
+                    NULL);
+
+      if (type != FPI_PRINT_RAW || !data ||
+          !g_variant_is_of_type (data, G_VARIANT_TYPE_STRING) ||
+          g_strcmp0 (fp_print_get_driver (print), fp_device_get_driver (dev)) != 0 ||
+          g_strcmp0 (fp_print_get_device_id (print), fp_device_get_device_id (dev)) != 0)
+        continue;
+
+      if (g_str_equal (g_variant_get_string (data, NULL), id))
+        return print;
+    }
+
+  return NULL;
+}
+
 static void
 dev_identify (FpDevice *dev)
 {
@@ -47,12 +80,10 @@ dev_identify (FpDevice *dev)
 
   if (scan_id)
     {
-      g_autoptr(GPtrArray) stored = get_stored_prints (self);
       GPtrArray *prints;
       GVariant *data = NULL;
       FpPrint *new_scan;
       FpPrint *match = NULL;
-      guint idx;
 
       new_scan = fp_print_new (dev);
       fpi_print_set_type (new_scan, FPI_PRINT_RAW);
@@ -63,21 +94,10 @@ dev_identify (FpDevice *dev)
       fpi_device_get_identify_data (dev, &prints);
       g_debug ("Trying to identify print '%s' against a gallery of %u prints", scan_id, prints->len);
 
-      if (!g_ptr_array_find_with_equal_func (stored,
-                                             new_scan,
-                                             (GEqualFunc) fp_print_equal,
-                                             NULL))
-        {
-          match = FALSE;
-          g_clear_object (&new_scan);
-        }
-      else if (g_ptr_array_find_with_equal_func (prints,
-                                                 new_scan,
-                                                 (GEqualFunc) fp_print_equal,
-                                                 &idx))
-        {
-          match = g_ptr_array_index (prints, idx);
-        }
+      if (!g_hash_table_contains (self->prints_storage, scan_id))
+        g_clear_object (&new_scan);
+      else
+        match = find_gallery_print (dev, prints, scan_id);
 
       if (!self->match_reported)
         {
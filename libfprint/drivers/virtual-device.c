@@ -47,9 +47,14 @@ G_DEFINE_TYPE (FpDeviceVirtualDevice, fpi_device_virtual_device, FP_TYPE_DEVICE)
 #define SET_CANCELLATION_PREFIX "SET_CANCELLATION_ENABLED "
 #define SET_KEEP_ALIVE_PREFIX "SET_KEEP_ALIVE "
 
+#define BATCH_CMD_PREFIX "BATCH "
+#define SCENARIO_CMD_PREFIX "SCENARIO "
+
 #define LIST_CMD "LIST"
 #define UNPLUG_CMD "UNPLUG"
 
+#define MAX_BATCH_SIZE (64 * 1024 * 1024)
+
 static void
 maybe_continue_current_action (FpDeviceVirtualDevice *self)
 {
@@ -144,6 +149,67 @@ wait_for_command_timeout (gpointer data)
   return FALSE;
 }
 
+static gboolean
+is_setting_command (const char *cmd)
+{
+  return g_str_has_prefix (cmd, UNPLUG_CMD) ||
+         g_str_has_prefix (cmd, SET_ENROLL_STAGES_PREFIX) ||
+         g_str_has_prefix (cmd, SET_SCAN_TYPE_PREFIX) ||
+         g_str_has_prefix (cmd, SET_CANCELLATION_PREFIX) ||
+         g_str_has_prefix (cmd, SET_KEEP_ALIVE_PREFIX);
+}
+
+/* Applies the commands that change the device state rather than being
+ * consumed by an action, returns whether @cmd was one of them. */
+static gboolean
+apply_setting_command (FpDeviceVirtualDevice *self,
+                       const char            *cmd)
+{
+  if (g_str_has_prefix (cmd, UNPLUG_CMD))
+    {
+      fpi_device_remove (FP_DEVICE (self));
+    }
+  else if (g_str_has_prefix (cmd, SET_ENROLL_STAGES_PREFIX))
+    {
+      guint stages;
+
+      stages = g_ascii_strtoull (cmd + strlen (SET_ENROLL_STAGES_PREFIX), NULL, 10);
+      fpi_device_set_nr_enroll_stages (FP_DEVICE (self), stages);
+    }
+  else if (g_str_has_prefix (cmd, SET_SCAN_TYPE_PREFIX))
+    {
+      const char *scan_type = cmd + strlen (SET_SCAN_TYPE_PREFIX);
+      g_autoptr(GEnumClass) scan_types = g_type_class_ref (fp_scan_type_get_type ());
+      GEnumValue *value = g_enum_get_value_by_nick (scan_types, scan_type);
+
+      if (value)
+        fpi_device_set_scan_type (FP_DEVICE (self), value->value);
+      else
+        g_warning ("Scan type '%s' not found", scan_type);
+    }
+  else if (g_str_has_prefix (cmd, SET_CANCELLATION_PREFIX))
+    {
+      self->supports_cancellation = g_ascii_strtoull (
+        cmd + strlen (SET_CANCELLATION_PREFIX), NULL, 10) != 0;
+
+      g_debug ("Cancellation support toggled: %d",
+               self->supports_cancellation);
+    }
+  else if (g_str_has_prefix (cmd, SET_KEEP_ALIVE_PREFIX))
+    {
+      self->keep_alive = g_ascii_strtoull (
+        cmd + strlen (SET_KEEP_ALIVE_PREFIX), NULL, 10) != 0;
+
+      g_debug ("Keep alive toggled: %d", self->keep_alive);
+    }
+  else
+    {
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 gboolean
 process_cmds (FpDeviceVirtualDevice * self,
               gboolean                scan,
@@ -161,14 +227,11 @@ process_cmds (FpDeviceVirtualDevice * self,
       return TRUE;
     }
 
-  while (self->pending_commands->len > 0)
+  while (!g_queue_is_empty (self->pending_commands))
     {
       g_autofree gchar *cmd = NULL;
 
-      /* TODO: g_ptr_array_steal_index requires GLib 2.58, we depend on 2.56 */
-      cmd = g_ptr_array_index (self->pending_commands, 0);
-      g_ptr_array_index (self->pending_commands, 0) = NULL;
-      g_ptr_array_remove_index (self->pending_commands, 0);
+      cmd = g_queue_pop_head (self->pending_commands);
 
       g_debug ("Processing command %s", cmd);
 
@@ -190,6 +253,11 @@ process_cmds (FpDeviceVirtualDevice * self,
 
           continue;
         }
+      else if (apply_setting_command (self, cmd))
+        {
+          /* Queued behind other commands by a batch or scenario */
+          continue;
+        }
       else if (g_str_has_prefix (cmd, SLEEP_CMD_PREFIX))
         {
           guint64 sleep_ms = g_ascii_strtoull (cmd + strlen (SLEEP_CMD_PREFIX), NULL, 10);
@@ -270,6 +338,194 @@ write_key_to_listener (void *key, void *val, void *user_data)
     g_warning ("Error writing reply to LIST command");
 }
 
+/* Handles a single instruction, returns whether it was queued */
+static gboolean
+handle_instruction (FpDeviceVirtualDevice    *self,
+                    FpiDeviceVirtualListener *listener,
+                    char                     *cmd)
+{
+  if (g_str_has_prefix (cmd, LIST_CMD))
+    {
+      if (self->prints_storage)
+        g_hash_table_foreach (self->prints_storage, write_key_to_listener, listener);
+    }
+  else if (apply_setting_command (self, cmd))
+    {
+      if (g_str_has_prefix (cmd, UNPLUG_CMD))
+        maybe_continue_current_action (self);
+    }
+  else
+    {
+      g_queue_push_tail (self->pending_commands, cmd);
+      return TRUE;
+    }
+
+  g_free (cmd);
+  return FALSE;
+}
+
+/* Handles newline separated instructions, as sent in a batch or read from
+ * a scenario file. Empty lines and lines starting with '#' are skipped.
+ *
+ * The instructions run in order: UNPLUG and the SET_* commands are applied
+ * right away only if no earlier command is still pending, otherwise they are
+ * queued and applied once the commands in front of them were consumed by an
+ * action. LIST is rejected, as the reply could not be ordered with the rest
+ * of the batch and the connection is closed once the batch was handled. */
+static void
+handle_instructions (FpDeviceVirtualDevice    *self,
+                     FpiDeviceVirtualListener *listener,
+                     char                     *instructions)
+{
+  gboolean queued = FALSE;
+  char *line = instructions;
+  guint count = 0;
+
+  while (line && *line != '\0')
+    {
+      char *next = strchr (line, '\n');
+      gsize len;
+
+      if (next)
+        *next++ = '\0';
+
+      len = strlen (line);
+      if (len > 0 && line[len - 1] == '\r')
+        line[--len] = '\0';
+
+      if (len > 0 && line[0] != '#')
+        {
+          if (g_str_has_prefix (line, BATCH_CMD_PREFIX) ||
+              g_str_has_prefix (line, SCENARIO_CMD_PREFIX))
+            {
+              g_warning ("Ignoring nested command: %s", line);
+            }
+          else if (g_str_has_prefix (line, LIST_CMD))
+            {
+              g_warning ("Ignoring LIST in batch or scenario");
+            }
+          else if (is_setting_command (line) &&
+                   !g_queue_is_empty (self->pending_commands))
+            {
+              g_queue_push_tail (self->pending_commands, g_strndup (line, len));
+              queued = TRUE;
+            }
+          else
+            {
+              queued |= handle_instruction (self, listener, g_strndup (line, len));
+            }
+          count++;
+        }
+
+      line = next;
+    }
+
+  g_debug ("Handled %u instructions", count);
+
+  if (queued)
+    {
+      g_clear_handle_id (&self->wait_command_id, g_source_remove);
+      maybe_continue_current_action (self);
+    }
+}
+
+static void
+load_scenario (FpDeviceVirtualDevice    *self,
+               FpiDeviceVirtualListener *listener,
+               const char               *path)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *contents = NULL;
+
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    {
+      g_warning ("Could not load scenario: %s", error->message);
+      return;
+    }
+
+  fp_dbg ("Loading scenario %s", path);
+  handle_instructions (self, listener, contents);
+}
+
+static void
+recv_batch_cb (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *batch = NULL;
+  FpiDeviceVirtualListener *listener = FPI_DEVICE_VIRTUAL_LISTENER (source_object);
+  FpDeviceVirtualDevice *self;
+
+  fpi_device_virtual_listener_read_finish (listener, res, &error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  self = FP_DEVICE_VIRTUAL_DEVICE (user_data);
+  batch = g_steal_pointer (&self->batch_buf);
+
+  if (error)
+    g_warning ("Error receiving batch data: %s", error->message);
+  else
+    handle_instructions (self, listener, batch);
+
+  fpi_device_virtual_listener_connection_close (listener);
+}
+
+/* A batch starts with "BATCH <size>\n" and is followed by size bytes of
+ * newline separated instructions. Part of them already arrived together
+ * with the header. */
+static gboolean
+start_batch (FpDeviceVirtualDevice    *self,
+             FpiDeviceVirtualListener *listener,
+             const char               *data,
+             gsize                     bytes)
+{
+  const char *payload;
+  char *end = NULL;
+  guint64 size;
+  gsize received;
+
+  size = g_ascii_strtoull (data + strlen (BATCH_CMD_PREFIX), &end, 10);
+  if (!end || end >= data + bytes || *end != '\n' || size > MAX_BATCH_SIZE)
+    {
+      g_warning ("Invalid batch header");
+      return FALSE;
+    }
+
+  payload = end + 1;
+  received = bytes - (payload - data);
+  if (received > size)
+    {
+      g_warning ("Batch is larger than announced");
+      return FALSE;
+    }
+
+  g_clear_pointer (&self->batch_buf, g_free);
+  self->batch_buf = g_malloc (size + 1);
+  memcpy (self->batch_buf, payload, received);
+  self->batch_buf[size] = '\0';
+
+  fp_dbg ("Receiving batch of %" G_GUINT64_FORMAT " bytes", size);
+
+  if (received == size)
+    {
+      g_autofree char *batch = g_steal_pointer (&self->batch_buf);
+
+      handle_instructions (self, listener, batch);
+      return FALSE;
+    }
+
+  fpi_device_virtual_listener_read (listener,
+                                    TRUE,
+                                    self->batch_buf + received,
+                                    size - received,
+                                    recv_batch_cb,
+                                    self);
+  return TRUE;
+}
+
 static void
 recv_instruction_cb (GObject      *source_object,
                      GAsyncResult *res,
@@ -301,52 +557,18 @@ recv_instruction_cb (GObject      *source_object,
       cmd = g_strndup (self->recv_buf, bytes);
       fp_dbg ("Received command %s", cmd);
 
-      if (g_str_has_prefix (cmd, LIST_CMD))
+      if (g_str_has_prefix (cmd, BATCH_CMD_PREFIX))
         {
-          if (self->prints_storage)
-            g_hash_table_foreach (self->prints_storage, write_key_to_listener, listener);
-        }
-      else if (g_str_has_prefix (cmd, UNPLUG_CMD))
-        {
-          fpi_device_remove (FP_DEVICE (self));
-          maybe_continue_current_action (self);
-        }
-      else if (g_str_has_prefix (cmd, SET_ENROLL_STAGES_PREFIX))
-        {
-          guint stages;
-
-          stages = g_ascii_strtoull (cmd + strlen (SET_ENROLL_STAGES_PREFIX), NULL, 10);
-          fpi_device_set_nr_enroll_stages (FP_DEVICE (self), stages);
-        }
-      else if (g_str_has_prefix (cmd, SET_SCAN_TYPE_PREFIX))
-        {
-          const char *scan_type = cmd + strlen (SET_SCAN_TYPE_PREFIX);
-          g_autoptr(GEnumClass) scan_types = g_type_class_ref (fp_scan_type_get_type ());
-          GEnumValue *value = g_enum_get_value_by_nick (scan_types, scan_type);
-
-          if (value)
-            fpi_device_set_scan_type (FP_DEVICE (self), value->value);
-          else
-            g_warning ("Scan type '%s' not found", scan_type);
-        }
-      else if (g_str_has_prefix (cmd, SET_CANCELLATION_PREFIX))
-        {
-          self->supports_cancellation = g_ascii_strtoull (
-            cmd + strlen (SET_CANCELLATION_PREFIX), NULL, 10) != 0;
-
-          g_debug ("Cancellation support toggled: %d",
-                   self->supports_cancellation);
+          /* The connection is closed once the whole batch arrived */
+          if (start_batch (self, listener, cmd, bytes))
+            return;
         }
-      else if (g_str_has_prefix (cmd, SET_KEEP_ALIVE_PREFIX))
+      else if (g_str_has_prefix (cmd, SCENARIO_CMD_PREFIX))
         {
-          self->keep_alive = g_ascii_strtoull (
-            cmd + strlen (SET_KEEP_ALIVE_PREFIX), NULL, 10) != 0;
-
-          g_debug ("Keep alive toggled: %d", self->keep_alive);
+          load_scenario (self, listener, cmd + strlen (SCENARIO_CMD_PREFIX));
         }
-      else
+      else if (handle_instruction (self, listener, g_steal_pointer (&cmd)))
         {
-          g_ptr_array_add (self->pending_commands, g_steal_pointer (&cmd));
           g_clear_handle_id (&self->wait_command_id, g_source_remove);
 
           maybe_continue_current_action (self);
@@ -475,10 +697,10 @@ should_wait_to_sleep (FpDeviceVirtualDevice *self,
   if (self->sleep_timeout_id)
     return TRUE;
 
-  if (!self->pending_commands->len)
+  if (g_queue_is_empty (self->pending_commands))
     return FALSE;
 
-  cmd = g_ptr_array_index (self->pending_commands, 0);
+  cmd = g_queue_peek_head (self->pending_commands);
 
   if (g_str_has_prefix (cmd, SLEEP_CMD_PREFIX))
     {
@@ -491,7 +713,7 @@ should_wait_to_sleep (FpDeviceVirtualDevice *self,
       g_assert (!self->injected_synthetic_cmd);
       g_assert (self->sleep_timeout_id != 0);
 
-      if (!self->pending_commands->len)
+      if (g_queue_is_empty (self->pending_commands))
         {
           g_autofree char *injected_cmd = NULL;
 
@@ -506,7 +728,7 @@ should_wait_to_sleep (FpDeviceVirtualDevice *self,
 
           g_debug ("Sleeping now, command queued for later: %s", injected_cmd);
 
-          g_ptr_array_insert (self->pending_commands, 0, g_steal_pointer (&injected_cmd));
+          g_queue_push_head (self->pending_commands, g_steal_pointer (&injected_cmd));
           self->injected_synthetic_cmd = TRUE;
         }
     }
@@ -691,7 +913,7 @@ dev_cancel (FpDevice *dev)
   if (self->injected_synthetic_cmd)
     {
       self->injected_synthetic_cmd = FALSE;
-      g_ptr_array_remove_index (self->pending_commands, 0);
+      g_free (g_queue_pop_head (self->pending_commands));
     }
 
   if (!self->supports_cancellation)
@@ -751,7 +973,9 @@ fpi_device_virtual_device_finalize (GObject *object)
 
   G_DEBUG_HERE ();
   stop_listener (self);
-  g_clear_pointer (&self->pending_commands, g_ptr_array_unref);
+  g_clear_pointer (&self->batch_buf, g_free);
+  if (self->pending_commands)
+    g_queue_free_full (g_steal_pointer (&self->pending_commands), g_free);
   G_OBJECT_CLASS (fpi_device_virtual_device_parent_class)->finalize (object);
 }
 
@@ -759,7 +983,7 @@ static void
 fpi_device_virtual_device_init (FpDeviceVirtualDevice *self)
 {
   self->supports_cancellation = TRUE;
-  self->pending_commands = g_ptr_array_new_with_free_func (g_free);
+  self->pending_commands = g_queue_new ();
 }
 
 static const FpIdEntry driver_ids[] = {
@@ -23,6 +23,11 @@
  * python script is provided to connect to it via a socket, allowing
  * prints to be sent to this device programmatically.
  * Using this it is possible to test libfprint and fprintd.
+ *
+ * For load testing, a client can also hand over a shared memory ring (see
+ * FpiDeviceVirtualRingHeader) and queue many frames in it at once. Queued
+ * frames are handed to the image device whenever it waits for a finger, and
+ * frames with a timestamp are replayed with the same relative timing.
  */
 
 #define FP_COMPONENT "virtual_image"
@@ -44,12 +49,208 @@ struct _FpDeviceVirtualImage
   gboolean                  automatic_finger;
   FpImage                  *recv_img;
   gint                      recv_img_hdr[2];
+
+  GSource                  *ring_source;
+  gint64                    replay_start;
+  guint64                   replay_base;
 };
 
 G_DECLARE_FINAL_TYPE (FpDeviceVirtualImage, fpi_device_virtual_image, FPI, DEVICE_VIRTUAL_IMAGE, FpImageDevice)
 G_DEFINE_TYPE (FpDeviceVirtualImage, fpi_device_virtual_image, FP_TYPE_IMAGE_DEVICE)
 
 static void recv_image (FpDeviceVirtualImage *self);
+static void ring_schedule_dispatch (FpDeviceVirtualImage *self,
+                                    guint                 timeout_ms);
+
+static void
+submit_image (FpDeviceVirtualImage *self, FpImage *image)
+{
+  FpImageDevice *device = FP_IMAGE_DEVICE (self);
+
+  if (self->automatic_finger)
+    fpi_image_device_report_finger_status (device, TRUE);
+  fpi_image_device_image_captured (device, image);
+  if (self->automatic_finger)
+    fpi_image_device_report_finger_status (device, FALSE);
+}
+
+static void
+handle_command (FpDeviceVirtualImage *self, gint cmd, gint arg)
+{
+  g_autoptr(GError) error = NULL;
+
+  switch (cmd)
+    {
+    case -1:
+      /* -1 is a retry error, just pass it through */
+      fpi_image_device_retry_scan (FP_IMAGE_DEVICE (self), arg);
+      break;
+
+    case -2:
+      /* -2 is a fatal error, just pass it through*/
+      fpi_image_device_session_error (FP_IMAGE_DEVICE (self),
+                                      fpi_device_error_new (arg));
+      break;
+
+    case -3:
+      /* -3 sets/clears automatic finger detection for images */
+      self->automatic_finger = !!arg;
+      break;
+
+    case -4:
+      /* -4 submits a finger detection report */
+      fpi_image_device_report_finger_status (FP_IMAGE_DEVICE (self), !!arg);
+      break;
+
+    case -5:
+      /* -5 causes the device to disappear (no further data) */
+      fpi_device_remove (FP_DEVICE (self));
+      break;
+
+    case -6:
+      /* -6 is followed by a memfd with a frame ring */
+      self->replay_start = 0;
+      if (!fpi_device_virtual_listener_attach_ring (self->listener, &error))
+        {
+          g_warning ("Could not attach ring buffer, disconnecting client: %s",
+                     error->message);
+          fpi_device_virtual_listener_connection_close (self->listener);
+          break;
+        }
+      ring_schedule_dispatch (self, 0);
+      break;
+
+    case -7:
+      /* -7 notifies us that frames were queued in the ring */
+      ring_schedule_dispatch (self, 0);
+      break;
+
+    default:
+      /* disconnect client, it didn't play fair */
+      fpi_device_virtual_listener_connection_close (self->listener);
+    }
+}
+
+/* Images, retries and errors are held back until the device waits for a
+ * finger, other commands are handled right away. */
+static gboolean
+ring_can_dispatch (FpDeviceVirtualImage *self, const FpiDeviceVirtualRingSlot *slot)
+{
+  FpiImageDeviceState state;
+
+  if (slot->width < 0 && slot->width != -1 && slot->width != -2)
+    return TRUE;
+
+  g_object_get (self,
+                "fpi-image-device-state", &state,
+                NULL);
+
+  if (state == FPI_IMAGE_DEVICE_STATE_CAPTURE)
+    return TRUE;
+
+  if (state != FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_ON)
+    return FALSE;
+
+  return slot->width < 0 || self->automatic_finger;
+}
+
+/* Returns the time to wait for the frame in milliseconds, 0 if it is due */
+static guint
+ring_replay_delay (FpDeviceVirtualImage *self, guint64 timestamp)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 due;
+
+  if (timestamp == 0)
+    {
+      self->replay_start = 0;
+      return 0;
+    }
+
+  /* A timestamp going backwards starts a new replay */
+  if (self->replay_start == 0 || timestamp < self->replay_base)
+    {
+      self->replay_start = now;
+      self->replay_base = timestamp;
+    }
+
+  due = self->replay_start + (gint64) (timestamp - self->replay_base);
+  if (due <= now)
+    return 0;
+
+  return MAX ((due - now + 999) / 1000, 1);
+}
+
+static void
+ring_dispatch (FpDeviceVirtualImage *self)
+{
+  const FpiDeviceVirtualRingSlot *slot;
+  const guint8 *data;
+  FpImage *image;
+  guint delay;
+
+  while ((slot = fpi_device_virtual_listener_ring_peek (self->listener, &data)))
+    {
+      if (!ring_can_dispatch (self, slot))
+        return;
+
+      delay = ring_replay_delay (self, slot->timestamp);
+      if (delay > 0)
+        {
+          ring_schedule_dispatch (self, delay);
+          return;
+        }
+
+      if (slot->width < 0)
+        {
+          gint cmd = slot->width;
+          gint arg = slot->height;
+
+          fpi_device_virtual_listener_ring_release (self->listener);
+          if (cmd == -6)
+            fpi_device_virtual_listener_connection_close (self->listener);
+          else
+            handle_command (self, cmd, arg);
+          continue;
+        }
+
+      if (slot->width == 0 || slot->width > 5000 ||
+          slot->height <= 0 || slot->height > 5000)
+        {
+          g_warning ("Ring frame has an invalid image size, disconnecting client.");
+          fpi_device_virtual_listener_connection_close (self->listener);
+          return;
+        }
+
+      image = fp_image_new (slot->width, slot->height);
+      memcpy (image->data, data, slot->width * slot->height);
+      fpi_device_virtual_listener_ring_release (self->listener);
+
+      submit_image (self, image);
+    }
+}
+
+static void
+ring_dispatch_cb (FpDevice *device, gpointer user_data)
+{
+  FpDeviceVirtualImage *self = FPI_DEVICE_VIRTUAL_IMAGE (device);
+
+  self->ring_source = NULL;
+  ring_dispatch (self);
+}
+
+static void
+ring_schedule_dispatch (FpDeviceVirtualImage *self, guint timeout_ms)
+{
+  if (!self->listener || !fpi_device_virtual_listener_has_ring (self->listener))
+    return;
+
+  if (self->ring_source)
+    g_source_destroy (self->ring_source);
+
+  self->ring_source = fpi_device_add_timeout (FP_DEVICE (self), timeout_ms,
+                                              ring_dispatch_cb, NULL, NULL);
+}
 
 static void
 recv_image_img_recv_cb (GObject      *source_object,
@@ -59,7 +260,6 @@ recv_image_img_recv_cb (GObject      *source_object,
   g_autoptr(GError) error = NULL;
   FpiDeviceVirtualListener *listener = FPI_DEVICE_VIRTUAL_LISTENER (source_object);
   FpDeviceVirtualImage *self;
-  FpImageDevice *device;
   gsize bytes;
 
   bytes = fpi_device_virtual_listener_read_finish (listener, res, &error);
@@ -69,13 +269,7 @@ recv_image_img_recv_cb (GObject      *source_object,
     return;
 
   self = FPI_DEVICE_VIRTUAL_IMAGE (user_data);
-  device = FP_IMAGE_DEVICE (self);
-
-  if (self->automatic_finger)
-    fpi_image_device_report_finger_status (device, TRUE);
-  fpi_image_device_image_captured (device, g_steal_pointer (&self->recv_img));
-  if (self->automatic_finger)
-    fpi_image_device_report_finger_status (device, FALSE);
+  submit_image (self, g_steal_pointer (&self->recv_img));
 
   /* And, listen for more images from the same client. */
   recv_image (self);
@@ -116,39 +310,7 @@ recv_image_hdr_recv_cb (GObject      *source_object,
 
   if (self->recv_img_hdr[0] < 0 || self->recv_img_hdr[1] < 0)
     {
-      switch (self->recv_img_hdr[0])
-        {
-        case -1:
-          /* -1 is a retry error, just pass it through */
-          fpi_image_device_retry_scan (FP_IMAGE_DEVICE (self), self->recv_img_hdr[1]);
-          break;
-
-        case -2:
-          /* -2 is a fatal error, just pass it through*/
-          fpi_image_device_session_error (FP_IMAGE_DEVICE (self),
-                                          fpi_device_error_new (self->recv_img_hdr[1]));
-          break;
-
-        case -3:
-          /* -3 sets/clears automatic finger detection for images */
-          self->automatic_finger = !!self->recv_img_hdr[1];
-          break;
-
-        case -4:
-          /* -4 submits a finger detection report */
-          fpi_image_device_report_finger_status (FP_IMAGE_DEVICE (self),
-                                                 !!self->recv_img_hdr[1]);
-          break;
-
-        case -5:
-          /* -5 causes the device to disappear (no further data) */
-          fpi_device_remove (FP_DEVICE (self));
-          break;
-
-        default:
-          /* disconnect client, it didn't play fair */
-          fpi_device_virtual_listener_connection_close (listener);
-        }
+      handle_command (self, self->recv_img_hdr[0], self->recv_img_hdr[1]);
 
       /* And, listen for more images from the same client. */
       recv_image (self);
@@ -243,6 +405,9 @@ dev_deinit (FpImageDevice *dev)
 
   G_DEBUG_HERE ();
 
+  if (self->ring_source)
+    g_source_destroy (g_steal_pointer (&self->ring_source));
+
   g_cancellable_cancel (self->cancellable);
   g_clear_object (&self->cancellable);
   g_clear_object (&self->listener);
@@ -268,6 +433,17 @@ dev_deactivate (FpImageDevice *dev)
   fpi_image_device_deactivate_complete (dev, NULL);
 }
 
+static void
+dev_change_state (FpImageDevice *dev, FpiImageDeviceState state)
+{
+  FpDeviceVirtualImage *self = FPI_DEVICE_VIRTUAL_IMAGE (dev);
+
+  /* Queued frames are only handed out while we wait for a finger */
+  if (state == FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_ON ||
+      state == FPI_IMAGE_DEVICE_STATE_CAPTURE)
+    ring_schedule_dispatch (self, 0);
+}
+
 static void
 dev_notify_removed_cb (FpDevice *dev)
 {
@@ -322,6 +498,7 @@ fpi_device_virtual_image_class_init (FpDeviceVirtualImageClass *klass)
 
   img_class->activate = dev_activate;
   img_class->deactivate = dev_deactivate;
+  img_class->change_state = dev_change_state;
 
   if ((hot_seconds = g_getenv ("FP_VIRTUAL_IMAGE_HOT_SECONDS")) &&
       *hot_seconds != '\0')
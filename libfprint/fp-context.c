@@ -52,11 +52,24 @@ typedef struct
 
   gint          pending_devices;
   gboolean      enumerated;
+  gboolean      device_threads;
 
   GArray       *drivers;
   GPtrArray    *devices;
+
+  GPtrArray    *usb_driver_classes;
+  GHashTable   *usb_driver_index;
 } FpContextPrivate;
 
+typedef struct
+{
+  GType            driver;
+  FpDeviceClass   *cls;
+  const FpIdEntry *entry;
+} UsbDriverCandidate;
+
+#define USB_DRIVER_INDEX_KEY(vid, pid) GUINT_TO_POINTER (((guint) (vid) << 16) | (pid))
+
 G_DEFINE_TYPE_WITH_PRIVATE (FpContext, fp_context, G_TYPE_OBJECT)
 
 enum {
@@ -66,6 +79,14 @@ enum {
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+enum {
+  PROP_0,
+  PROP_DEVICE_THREADS,
+  N_PROPS
+};
+
+static GParamSpec *properties[N_PROPS];
+
 static const char *
 get_drivers_allowlist_env (void)
 {
@@ -200,48 +221,124 @@ async_device_init_done_cb (GObject *source_object, GAsyncResult *res, gpointer u
 }
 
 static void
-usb_device_added_cb (FpContext *self, GUsbDevice *device, GUsbContext *usb_ctx)
+build_usb_driver_index (FpContext *self)
 {
   FpContextPrivate *priv = fp_context_get_instance_private (self);
-  GType found_driver = G_TYPE_NONE;
-  const FpIdEntry *found_entry = NULL;
-  gint found_score = 0;
   gint i;
-  guint16 pid, vid;
 
-  pid = g_usb_device_get_pid (device);
-  vid = g_usb_device_get_vid (device);
+  priv->usb_driver_classes = g_ptr_array_new_with_free_func (g_type_class_unref);
+  priv->usb_driver_index = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) g_array_unref);
 
-  /* Find the best driver to handle this USB device. */
+  /* Candidates are added in driver and id_table order, so that a lookup
+   * resolves ties exactly like a linear scan of all drivers would. */
   for (i = 0; i < priv->drivers->len; i++)
     {
       GType driver = g_array_index (priv->drivers, GType, i);
-      g_autoptr(FpDeviceClass) cls = g_type_class_ref (driver);
+      FpDeviceClass *cls = g_type_class_ref (driver);
       const FpIdEntry *entry;
 
       if (cls->type != FP_DEVICE_TYPE_USB)
-        continue;
+        {
+          g_type_class_unref (cls);
+          continue;
+        }
+
+      g_ptr_array_add (priv->usb_driver_classes, cls);
 
       for (entry = cls->id_table; entry->pid; entry++)
         {
-          gint driver_score = 50;
+          gpointer key = USB_DRIVER_INDEX_KEY (entry->vid, entry->pid);
+          UsbDriverCandidate candidate = { driver, cls, entry };
+          GArray *candidates;
+
+          candidates = g_hash_table_lookup (priv->usb_driver_index, key);
+          if (!candidates)
+            {
+              candidates = g_array_sized_new (FALSE, FALSE,
+                                              sizeof (UsbDriverCandidate), 1);
+              g_hash_table_insert (priv->usb_driver_index, key, candidates);
+            }
+
+          g_array_append_val (candidates, candidate);
+        }
+    }
 
-          if (entry->pid != pid || entry->vid != vid)
-            continue;
+  g_debug ("Indexed %u USB IDs from %u USB drivers",
+           g_hash_table_size (priv->usb_driver_index),
+           priv->usb_driver_classes->len);
+}
 
-          if (cls->usb_discover)
-            driver_score = cls->usb_discover (device);
+/**
+ * fpi_context_find_usb_driver:
+ * @context: a #FpContext
+ * @vid: the USB vendor ID
+ * @pid: the USB product ID
+ * @usb_device: (nullable): the #GUsbDevice to pass to usb_discover hooks
+ * @entry: (out) (optional) (transfer none): the matching #FpIdEntry
+ *
+ * Find the best driver of @context for a USB device. If @usb_device is
+ * %NULL, the usb_discover hooks of the candidate drivers are not called.
+ *
+ * Returns: The #GType of the driver, or %G_TYPE_NONE if there is none
+ */
+GType
+fpi_context_find_usb_driver (FpContext        *context,
+                             guint16           vid,
+                             guint16           pid,
+                             GUsbDevice       *usb_device,
+                             const FpIdEntry **entry)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (context);
+  GType found_driver = G_TYPE_NONE;
+  const FpIdEntry *found_entry = NULL;
+  gint found_score = 0;
+  GArray *candidates;
+  guint i;
 
-          /* Is this driver better than the one we had? */
-          if (driver_score <= found_score)
-            continue;
+  g_return_val_if_fail (FP_IS_CONTEXT (context), G_TYPE_NONE);
 
-          found_score = driver_score;
-          found_driver = driver;
-          found_entry = entry;
-        }
+  candidates = g_hash_table_lookup (priv->usb_driver_index,
+                                    USB_DRIVER_INDEX_KEY (vid, pid));
+
+  /* Find the best driver to handle this USB device. */
+  for (i = 0; candidates && i < candidates->len; i++)
+    {
+      UsbDriverCandidate *candidate = &g_array_index (candidates, UsbDriverCandidate, i);
+      gint driver_score = 50;
+
+      if (usb_device && candidate->cls->usb_discover)
+        driver_score = candidate->cls->usb_discover (usb_device);
+
+      /* Is this driver better than the one we had? */
+      if (driver_score <= found_score)
+        continue;
+
+      found_score = driver_score;
+      found_driver = candidate->driver;
+      found_entry = candidate->entry;
     }
 
+  if (entry)
+    *entry = found_entry;
+
+  return found_driver;
+}
+
+static void
+usb_device_added_cb (FpContext *self, GUsbDevice *device, GUsbContext *usb_ctx)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (self);
+  GType found_driver;
+  const FpIdEntry *found_entry = NULL;
+  guint16 pid, vid;
+
+  pid = g_usb_device_get_pid (device);
+  vid = g_usb_device_get_vid (device);
+
+  found_driver = fpi_context_find_usb_driver (self, vid, pid, device, &found_entry);
+
   if (found_driver == G_TYPE_NONE)
     {
       g_debug ("No driver found for USB device %04X:%04X", vid, pid);
@@ -256,6 +353,7 @@ usb_device_added_cb (FpContext *self, GUsbDevice *device, GUsbContext *usb_ctx)
                               self,
                               "fpi-usb-device", device,
                               "fpi-driver-data", found_entry->driver_data,
+                              "fpi-driver-thread", priv->device_threads,
                               NULL);
 }
 
@@ -289,6 +387,8 @@ fp_context_finalize (GObject *object)
   g_clear_object (&priv->cancellable);
   g_clear_pointer (&priv->drivers, g_array_unref);
   g_clear_pointer (&priv->devices, g_ptr_array_unref);
+  g_clear_pointer (&priv->usb_driver_index, g_hash_table_unref);
+  g_clear_pointer (&priv->usb_driver_classes, g_ptr_array_unref);
 
   g_slist_free_full (g_steal_pointer (&priv->sources), (GDestroyNotify) g_source_destroy);
 
@@ -299,12 +399,72 @@ fp_context_finalize (GObject *object)
   G_OBJECT_CLASS (fp_context_parent_class)->finalize (object);
 }
 
+static void
+fp_context_get_property (GObject    *object,
+                         guint       prop_id,
+                         GValue     *value,
+                         GParamSpec *pspec)
+{
+  FpContext *self = FP_CONTEXT (object);
+  FpContextPrivate *priv = fp_context_get_instance_private (self);
+
+  switch (prop_id)
+    {
+    case PROP_DEVICE_THREADS:
+      g_value_set_boolean (value, priv->device_threads);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+fp_context_set_property (GObject      *object,
+                         guint         prop_id,
+                         const GValue *value,
+                         GParamSpec   *pspec)
+{
+  FpContext *self = FP_CONTEXT (object);
+  FpContextPrivate *priv = fp_context_get_instance_private (self);
+
+  switch (prop_id)
+    {
+    case PROP_DEVICE_THREADS:
+      priv->device_threads = g_value_get_boolean (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
 static void
 fp_context_class_init (FpContextClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
   object_class->finalize = fp_context_finalize;
+  object_class->get_property = fp_context_get_property;
+  object_class->set_property = fp_context_set_property;
+
+  /**
+   * FpContext:device-threads:
+   *
+   * Whether each discovered #FpDevice runs its driver on a dedicated thread
+   * with its own #GMainContext, so that a busy reader does not delay the
+   * others. The results of asynchronous operations, the enroll progress
+   * and match callbacks, as well as the signals and property notifications
+   * of the device are still dispatched in the caller's main context.
+   */
+  properties[PROP_DEVICE_THREADS] =
+    g_param_spec_boolean ("device-threads",
+                          "Device threads",
+                          "Run the driver of every device on its own thread",
+                          FALSE,
+                          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
 
   /**
    * FpContext::device-added:
@@ -372,6 +532,8 @@ fp_context_init (FpContext *self)
         }
     }
 
+  build_usb_driver_index (self);
+
   priv->devices = g_ptr_array_new_with_free_func (g_object_unref);
 
   priv->cancellable = g_cancellable_new ();
@@ -422,6 +584,7 @@ fp_context_enumerate (FpContext *context)
 {
   FpContextPrivate *priv = fp_context_get_instance_private (context);
   gboolean dispatched;
+  gint64 start_time;
   gint i;
 
   g_return_if_fail (FP_IS_CONTEXT (context));
@@ -430,6 +593,7 @@ fp_context_enumerate (FpContext *context)
     return;
 
   priv->enumerated = TRUE;
+  start_time = g_get_monotonic_time ();
 
   /* USB devices are handled from callbacks */
   if (priv->usb_ctx)
@@ -462,6 +626,7 @@ fp_context_enumerate (FpContext *context)
                                       context,
                                       "fpi-environ", val,
                                       "fpi-driver-data", entry->driver_data,
+                                      "fpi-driver-thread", priv->device_threads,
                                       NULL);
           g_debug ("created");
         }
@@ -539,6 +704,7 @@ fp_context_enumerate (FpContext *context)
                                         "fpi-driver-data", entry->driver_data,
                                         "fpi-udev-data-spidev", (matched_spidev ? g_udev_device_get_device_file (matched_spidev->data) : NULL),
                                         "fpi-udev-data-hidraw", (matched_hidraw ? g_udev_device_get_device_file (matched_hidraw->data) : NULL),
+                                        "fpi-driver-thread", priv->device_threads,
                                         NULL);
             /* remove entries from list to avoid conflicts */
             if (matched_spidev)
@@ -573,6 +739,9 @@ fp_context_enumerate (FpContext *context)
   dispatched = TRUE;
   while (priv->pending_devices || dispatched)
     dispatched = g_main_context_iteration (NULL, !!priv->pending_devices);
+
+  g_debug ("Enumerated %u devices in %.3f ms", priv->devices->len,
+           (g_get_monotonic_time () - start_time) / 1000.0);
 }
 
 /**
@@ -21,6 +21,8 @@
 #pragma once
 
 #include "fpi-device.h"
+#include "fpi-usb-transfer.h"
+#include "fpi-transfer-replay.h"
 
 /* Chosen so that if we turn on after WARM -> COLD, it takes exactly one time
  * constant to go from COLD -> HOT.
@@ -30,6 +32,31 @@
 #define TEMP_WARM_HOT_THRESH (1.0 - TEMP_COLD_THRESH)
 #define TEMP_HOT_WARM_THRESH (0.5)
 
+/* Number of trace events kept per device, see fp_device_get_stats() */
+#define FP_DEVICE_TRACE_EVENTS 128
+
+/* Transfer counter slots: USB endpoints 0x00-0x0f, 0x80-0x8f, then SPI */
+#define FPI_TRANSFER_COUNTER_SLOTS 33
+#define FPI_TRANSFER_COUNTER_SLOT_SPI (FPI_TRANSFER_COUNTER_SLOTS - 1)
+
+/* Updated without locking, but with the full 64 bit width on 32 bit
+ * platforms as well. GLib has no 64 bit atomics, so use the GCC builtins;
+ * g_autoptr() already requires GCC or clang. */
+#define fpi_transfer_counter_add(counter, value) \
+  __atomic_fetch_add ((counter), (value), __ATOMIC_RELAXED)
+#define fpi_transfer_counter_get(counter) \
+  __atomic_load_n ((counter), __ATOMIC_RELAXED)
+
+typedef struct
+{
+  guint64 transfers;
+  guint64 bytes;
+  guint64 errors;
+  guint64 timeouts;
+  guint64 cancelled;
+  guint64 latency[FP_DEVICE_TRANSFER_LATENCY_BUCKETS];
+} FpiTransferCounters;
+
 /* Delay updates by 100ms to avoid hitting the border exactly */
 #define TEMP_DELAY_SECONDS 0.1
 
@@ -51,6 +78,11 @@ typedef struct
     gchar *hidraw_path;
   } udev_data;
 
+  /* Guards the state below that both the caller and the driver thread
+   * update: is_removed, is_open, finger_status, the temperature model and
+   * the list of timeout sources. */
+  GRecMutex       state_mutex;
+
   gboolean        is_removed;
   gboolean        is_open;
   gboolean        is_suspended;
@@ -65,6 +97,33 @@ typedef struct
   gint            nr_enroll_stages;
   GSList         *sources;
 
+  gint64          probe_start_time;
+
+  /* Ring of trace events, may be written from the driver thread */
+  GMutex             trace_mutex;
+  FpDeviceTraceEvent trace[FP_DEVICE_TRACE_EVENTS];
+  guint              trace_next;
+  guint              trace_len;
+  guint              trace_action;
+  guint              trace_ready_action;
+  gint64             trace_action_start;
+
+  /* Transfer statistics, may be updated from the I/O thread */
+  FpiTransferCounters transfer_counters[FPI_TRANSFER_COUNTER_SLOTS];
+
+  FpiUsbTransferPool *usb_transfer_pool;
+
+  /* Recorded transfers to replay instead of using the bus */
+  FpiTransferReplay *transfer_replay;
+  gboolean           transfer_replay_checked;
+
+  /* Dedicated driver thread, only used if requested on construction */
+  gboolean      use_driver_thread;
+  GMainContext *driver_context;
+  GMainLoop    *driver_loop;
+  GThread      *driver_thread;
+  GMainContext *caller_context;
+
   /* We always make sure that only one task is run at a time. */
   FpiDeviceAction     current_action;
   GTask              *current_task;
@@ -127,9 +186,36 @@ typedef struct
 } FpMatchData;
 
 
+typedef void (*FpDeviceDriverFunc) (FpDevice *device);
+
 void fpi_device_suspend (FpDevice *device);
 void fpi_device_resume (FpDevice *device);
 
+GMainContext *fpi_device_get_driver_context (FpDevice *device);
+void fpi_device_invoke_driver (FpDevice          *device,
+                               FpDeviceDriverFunc driver_func);
+void fpi_device_invoke_in_context (FpDevice      *device,
+                                   GMainContext  *context,
+                                   FpTimeoutFunc  func,
+                                   gpointer       user_data,
+                                   GDestroyNotify destroy_notify);
+
+FpiUsbTransferPool *fpi_device_get_usb_transfer_pool (FpDevice *device);
+
+FpiUsbTransferPool *fpi_usb_transfer_pool_new (void);
+void fpi_usb_transfer_pool_unref (FpiUsbTransferPool *pool);
+
+FpiTransferReplay *fpi_device_get_transfer_replay (FpDevice *device);
+void fpi_device_set_transfer_replay (FpDevice          *device,
+                                     FpiTransferReplay *replay);
+
+gboolean fpi_device_debug_transfer (void);
+void fpi_device_count_transfer (FpDevice     *device,
+                                guint         endpoint,
+                                gssize        bytes,
+                                gint64        latency_usec,
+                                const GError *error);
+
 void fpi_device_configure_wakeup (FpDevice *device,
                                   gboolean  enabled);
 void fpi_device_update_temp (FpDevice *device,
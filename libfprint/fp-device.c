@@ -54,6 +54,7 @@ enum {
   PROP_FPI_UDEV_DATA_SPIDEV,
   PROP_FPI_UDEV_DATA_HIDRAW,
   PROP_FPI_DRIVER_DATA,
+  PROP_FPI_DRIVER_THREAD,
   N_PROPS
 };
 
@@ -118,7 +119,7 @@ fp_device_cancelled_cb (GCancellable *cancellable, FpDevice *self)
                          self,
                          NULL);
   g_source_attach (priv->current_idle_cancel_source,
-                   g_task_get_context (priv->current_task));
+                   fpi_device_get_driver_context (self));
   g_source_unref (priv->current_idle_cancel_source);
 }
 
@@ -137,6 +138,9 @@ setup_task_cancellable (FpDevice *device)
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
   FpDeviceClass *cls = FP_DEVICE_GET_CLASS (device);
 
+  /* Every action is set up here, so this is where its trace starts */
+  fpi_device_trace (device, FP_DEVICE_TRACE_ACTION_START);
+
   /* Create an internal cancellable and hook it up. */
   priv->current_cancellable = g_cancellable_new ();
   if (cls->cancel)
@@ -158,6 +162,19 @@ setup_task_cancellable (FpDevice *device)
     }
 }
 
+static gpointer
+fp_device_driver_thread_func (gpointer user_data)
+{
+  g_autoptr(GMainLoop) loop = user_data;
+  GMainContext *context = g_main_loop_get_context (loop);
+
+  g_main_context_push_thread_default (context);
+  g_main_loop_run (loop);
+  g_main_context_pop_thread_default (context);
+
+  return NULL;
+}
+
 static void
 fp_device_constructed (GObject *object)
 {
@@ -205,6 +222,20 @@ fp_device_constructed (GObject *object)
   priv->temp_last_update = g_get_monotonic_time ();
   priv->temp_last_active = FALSE;
 
+  priv->usb_transfer_pool = fpi_usb_transfer_pool_new ();
+
+  if (priv->use_driver_thread)
+    {
+      g_autofree gchar *thread_name = g_strdup_printf ("fp-%s", cls->id);
+
+      priv->caller_context = g_main_context_ref_thread_default ();
+      priv->driver_context = g_main_context_new ();
+      priv->driver_loop = g_main_loop_new (priv->driver_context, FALSE);
+      priv->driver_thread = g_thread_new (thread_name,
+                                          fp_device_driver_thread_func,
+                                          g_main_loop_ref (priv->driver_loop));
+    }
+
   G_OBJECT_CLASS (fp_device_parent_class)->constructed (object);
 }
 
@@ -227,9 +258,28 @@ fp_device_finalize (GObject *object)
   g_clear_pointer (&priv->current_task_idle_return_source, g_source_destroy);
   g_clear_pointer (&priv->critical_section_flush_source, g_source_destroy);
 
+  if (priv->driver_thread)
+    {
+      g_main_loop_quit (priv->driver_loop);
+
+      /* The last reference may be dropped from the driver thread itself */
+      if (g_thread_self () == priv->driver_thread)
+        g_thread_unref (g_steal_pointer (&priv->driver_thread));
+      else
+        g_thread_join (g_steal_pointer (&priv->driver_thread));
+    }
+  g_clear_pointer (&priv->driver_loop, g_main_loop_unref);
+  g_clear_pointer (&priv->driver_context, g_main_context_unref);
+  g_clear_pointer (&priv->caller_context, g_main_context_unref);
+  g_clear_pointer (&priv->usb_transfer_pool, fpi_usb_transfer_pool_unref);
+  g_clear_pointer (&priv->transfer_replay, fpi_transfer_replay_unref);
+
   g_clear_pointer (&priv->device_id, g_free);
   g_clear_pointer (&priv->device_name, g_free);
 
+  g_mutex_clear (&priv->trace_mutex);
+  g_rec_mutex_clear (&priv->state_mutex);
+
   g_clear_object (&priv->usb_device);
   g_clear_pointer (&priv->virtual_env, g_free);
   g_clear_pointer (&priv->udev_data.spidev_path, g_free);
@@ -238,6 +288,19 @@ fp_device_finalize (GObject *object)
   G_OBJECT_CLASS (fp_device_parent_class)->finalize (object);
 }
 
+static gboolean
+device_is_removed (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  gboolean is_removed;
+
+  g_rec_mutex_lock (&priv->state_mutex);
+  is_removed = priv->is_removed;
+  g_rec_mutex_unlock (&priv->state_mutex);
+
+  return is_removed;
+}
+
 static void
 fp_device_get_property (GObject    *object,
                         guint       prop_id,
@@ -259,11 +322,11 @@ fp_device_get_property (GObject    *object,
       break;
 
     case PROP_FINGER_STATUS:
-      g_value_set_flags (value, priv->finger_status);
+      g_value_set_flags (value, fp_device_get_finger_status (self));
       break;
 
     case PROP_TEMPERATURE:
-      g_value_set_enum (value, priv->temp_current);
+      g_value_set_enum (value, fp_device_get_temperature (self));
       break;
 
     case PROP_DRIVER:
@@ -279,11 +342,11 @@ fp_device_get_property (GObject    *object,
       break;
 
     case PROP_OPEN:
-      g_value_set_boolean (value, priv->is_open);
+      g_value_set_boolean (value, fp_device_is_open (self));
       break;
 
     case PROP_REMOVED:
-      g_value_set_boolean (value, priv->is_removed);
+      g_value_set_boolean (value, device_is_removed (self));
       break;
 
     case PROP_FPI_USB_DEVICE:
@@ -354,14 +417,83 @@ fp_device_set_property (GObject      *object,
       priv->driver_data = g_value_get_uint64 (value);
       break;
 
+    case PROP_FPI_DRIVER_THREAD:
+      priv->use_driver_thread = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
 }
 
+typedef struct
+{
+  gchar *device_id;
+  gint   nr_enroll_stages;
+} FpDeviceProbeResult;
+
+static void
+fp_device_probe_result_free (FpDeviceProbeResult *result)
+{
+  g_free (result->device_id);
+  g_free (result);
+}
+
+static void
+device_probe_thread_func (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  FpDevice *self = FP_DEVICE (source_object);
+  FpDeviceProbeResult *result = g_new0 (FpDeviceProbeResult, 1);
+  GError *error = NULL;
+
+  if (!FP_DEVICE_GET_CLASS (self)->probe_in_thread (self,
+                                                    &result->device_id,
+                                                    &result->nr_enroll_stages,
+                                                    &error))
+    {
+      fp_device_probe_result_free (result);
+      g_task_return_error (task, error);
+    }
+  else
+    {
+      g_task_return_pointer (task, result,
+                             (GDestroyNotify) fp_device_probe_result_free);
+    }
+}
+
+static void
+device_probe_thread_done_cb (GObject      *source_object,
+                             GAsyncResult *res,
+                             gpointer      user_data)
+{
+  FpDevice *device = FP_DEVICE (source_object);
+  FpDeviceProbeResult *result;
+  g_autofree gchar *device_id = NULL;
+  GError *error = NULL;
+
+  result = g_task_propagate_pointer (G_TASK (res), &error);
+  if (result)
+    {
+      /* Applied here, so that the notify is emitted from the device context */
+      if (result->nr_enroll_stages > 0)
+        fpi_device_set_nr_enroll_stages (device, result->nr_enroll_stages);
+
+      device_id = g_steal_pointer (&result->device_id);
+      fp_device_probe_result_free (result);
+    }
+
+  fpi_device_probe_complete (device, device_id, NULL, error);
+}
+
 static void
 device_idle_probe_cb (FpDevice *self, gpointer user_data)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (self);
+  FpDeviceClass *cls = FP_DEVICE_GET_CLASS (self);
+
   /* This should not be an idle handler, see comment where it is registered.
    *
    * This effectively disables USB "persist" for us, and possibly turns off
@@ -369,10 +501,26 @@ device_idle_probe_cb (FpDevice *self, gpointer user_data)
    */
   fpi_device_configure_wakeup (self, FALSE);
 
-  if (!FP_DEVICE_GET_CLASS (self)->probe)
-    fpi_device_probe_complete (self, NULL, NULL, NULL);
+  g_assert (!cls->probe || !cls->probe_in_thread);
+  priv->probe_start_time = g_get_monotonic_time ();
+
+  if (cls->probe_in_thread)
+    {
+      g_autoptr(GTask) task = NULL;
+
+      /* The completion is dispatched from the current (device) context */
+      task = g_task_new (self, NULL, device_probe_thread_done_cb, NULL);
+      g_task_set_source_tag (task, device_idle_probe_cb);
+      g_task_run_in_thread (task, device_probe_thread_func);
+    }
+  else if (!cls->probe)
+    {
+      fpi_device_probe_complete (self, NULL, NULL, NULL);
+    }
   else
-    FP_DEVICE_GET_CLASS (self)->probe (self);
+    {
+      cls->probe (self);
+    }
 
   return;
 }
@@ -594,12 +742,30 @@ fp_device_class_init (FpDeviceClass *klass)
                          0,
                          G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
 
+  /**
+   * FpDevice::fpi-driver-thread: (skip)
+   *
+   * This property is only for internal purposes.
+   *
+   * Stability: private
+   */
+  properties[PROP_FPI_DRIVER_THREAD] =
+    g_param_spec_boolean ("fpi-driver-thread",
+                          "Driver Thread",
+                          "Private: Whether to run the driver on a dedicated thread",
+                          FALSE,
+                          G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
 static void
 fp_device_init (FpDevice *self)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (self);
+
+  g_mutex_init (&priv->trace_mutex);
+  g_rec_mutex_init (&priv->state_mutex);
 }
 
 /**
@@ -658,10 +824,15 @@ gboolean
 fp_device_is_open (FpDevice *device)
 {
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  gboolean is_open;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
-  return priv->is_open;
+  g_rec_mutex_lock (&priv->state_mutex);
+  is_open = priv->is_open;
+  g_rec_mutex_unlock (&priv->state_mutex);
+
+  return is_open;
 }
 
 /**
@@ -696,10 +867,15 @@ FpFingerStatusFlags
 fp_device_get_finger_status (FpDevice *device)
 {
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpFingerStatusFlags finger_status;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FP_FINGER_STATUS_NONE);
 
-  return priv->finger_status;
+  g_rec_mutex_lock (&priv->state_mutex);
+  finger_status = priv->finger_status;
+  g_rec_mutex_unlock (&priv->state_mutex);
+
+  return finger_status;
 }
 
 /**
@@ -733,10 +909,102 @@ FpTemperature
 fp_device_get_temperature (FpDevice *device)
 {
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpTemperature temperature;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), -1);
 
-  return priv->temp_current;
+  g_rec_mutex_lock (&priv->state_mutex);
+  temperature = priv->temp_current;
+  g_rec_mutex_unlock (&priv->state_mutex);
+
+  return temperature;
+}
+
+/**
+ * fp_device_get_stats:
+ * @device: A #FpDevice
+ *
+ * Retrieves the most recent trace events of the device. For every action,
+ * the device records when each of its phases was reached (see
+ * #FpDeviceTracePhase). Comparing the timestamps shows where the time of an
+ * operation went, e.g. waiting for the user, talking to the device or
+ * processing the image.
+ *
+ * Only a limited number of events is kept, older events are dropped.
+ *
+ * Returns: (transfer full) (element-type FpDeviceTraceEvent): The trace
+ *   events, oldest first.
+ */
+GArray *
+fp_device_get_stats (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  GArray *events;
+  guint first;
+  guint i;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), NULL);
+
+  g_mutex_lock (&priv->trace_mutex);
+
+  events = g_array_sized_new (FALSE, FALSE, sizeof (FpDeviceTraceEvent), priv->trace_len);
+  first = (priv->trace_next + FP_DEVICE_TRACE_EVENTS - priv->trace_len) % FP_DEVICE_TRACE_EVENTS;
+  for (i = 0; i < priv->trace_len; i++)
+    g_array_append_val (events, priv->trace[(first + i) % FP_DEVICE_TRACE_EVENTS]);
+
+  g_mutex_unlock (&priv->trace_mutex);
+
+  return events;
+}
+
+/**
+ * fp_device_get_transfer_stats:
+ * @device: A #FpDevice
+ *
+ * Retrieves statistics about the USB and SPI transfers of the device since
+ * it was created. The counters are always kept, so they can be used to
+ * monitor the health of a reader without enabling debug logging.
+ *
+ * Returns: (transfer full) (element-type FpDeviceTransferStats): One entry
+ *   for each endpoint that was used.
+ */
+GArray *
+fp_device_get_transfer_stats (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  GArray *stats_array;
+  guint slot;
+  guint i;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), NULL);
+
+  stats_array = g_array_new (FALSE, FALSE, sizeof (FpDeviceTransferStats));
+
+  for (slot = 0; slot < FPI_TRANSFER_COUNTER_SLOTS; slot++)
+    {
+      FpiTransferCounters *counters = &priv->transfer_counters[slot];
+      FpDeviceTransferStats stats = { 0 };
+
+      stats.transfers = fpi_transfer_counter_get (&counters->transfers);
+      if (stats.transfers == 0)
+        continue;
+
+      if (slot == FPI_TRANSFER_COUNTER_SLOT_SPI)
+        stats.endpoint = FP_DEVICE_TRANSFER_ENDPOINT_SPI;
+      else
+        stats.endpoint = (slot & 0x0f) | ((slot & 0x10) << 3);
+
+      stats.bytes = fpi_transfer_counter_get (&counters->bytes);
+      stats.errors = fpi_transfer_counter_get (&counters->errors);
+      stats.timeouts = fpi_transfer_counter_get (&counters->timeouts);
+      stats.cancelled = fpi_transfer_counter_get (&counters->cancelled);
+      for (i = 0; i < FP_DEVICE_TRANSFER_LATENCY_BUCKETS; i++)
+        stats.latency[i] = fpi_transfer_counter_get (&counters->latency[i]);
+
+      g_array_append_val (stats_array, stats);
+    }
+
+  return stats_array;
 }
 
 /**
@@ -824,7 +1092,7 @@ fp_device_open (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (priv->is_open)
+  if (fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_ALREADY_OPEN));
@@ -863,7 +1131,7 @@ fp_device_open (FpDevice           *device,
   setup_task_cancellable (device);
   fpi_device_report_finger_status (device, FP_FINGER_STATUS_NONE);
 
-  FP_DEVICE_GET_CLASS (device)->open (device);
+  fpi_device_invoke_driver (device, FP_DEVICE_GET_CLASS (device)->open);
 }
 
 /**
@@ -909,7 +1177,7 @@ fp_device_close (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -927,7 +1195,7 @@ fp_device_close (FpDevice           *device,
   priv->current_task = g_steal_pointer (&task);
   setup_task_cancellable (device);
 
-  FP_DEVICE_GET_CLASS (device)->close (device);
+  fpi_device_invoke_driver (device, FP_DEVICE_GET_CLASS (device)->close);
 }
 
 /**
@@ -990,7 +1258,7 @@ fp_device_suspend (FpDevice           *device,
       return;
     }
 
-  if (priv->is_removed)
+  if (device_is_removed (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_REMOVED));
@@ -1055,7 +1323,7 @@ fp_device_resume (FpDevice           *device,
       return;
     }
 
-  if (priv->is_removed)
+  if (device_is_removed (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_REMOVED));
@@ -1139,7 +1407,7 @@ fp_device_enroll (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1182,7 +1450,7 @@ fp_device_enroll (FpDevice           *device,
     }
 
   fpi_device_update_temp (device, TRUE);
-  if (priv->temp_current == FP_TEMPERATURE_HOT)
+  if (fp_device_get_temperature (device) == FP_TEMPERATURE_HOT)
     {
       g_task_return_error (task, fpi_device_error_new (FP_DEVICE_ERROR_TOO_HOT));
       fpi_device_update_temp (device, FALSE);
@@ -1202,7 +1470,7 @@ fp_device_enroll (FpDevice           *device,
   // Attach the progress data as task data so that it is destroyed
   g_task_set_task_data (priv->current_task, data, (GDestroyNotify) enroll_data_free);
 
-  FP_DEVICE_GET_CLASS (device)->enroll (device);
+  fpi_device_invoke_driver (device, FP_DEVICE_GET_CLASS (device)->enroll);
 }
 
 /**
@@ -1277,7 +1545,7 @@ fp_device_verify (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1300,7 +1568,7 @@ fp_device_verify (FpDevice           *device,
     }
 
   fpi_device_update_temp (device, TRUE);
-  if (priv->temp_current == FP_TEMPERATURE_HOT)
+  if (fp_device_get_temperature (device) == FP_TEMPERATURE_HOT)
     {
       g_task_return_error (task, fpi_device_error_new (FP_DEVICE_ERROR_TOO_HOT));
       fpi_device_update_temp (device, FALSE);
@@ -1320,7 +1588,7 @@ fp_device_verify (FpDevice           *device,
   // Attach the match data as task data so that it is destroyed
   g_task_set_task_data (priv->current_task, data, (GDestroyNotify) match_data_free);
 
-  cls->verify (device);
+  fpi_device_invoke_driver (device, cls->verify);
 }
 
 /**
@@ -1404,7 +1672,7 @@ fp_device_identify (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1435,7 +1703,7 @@ fp_device_identify (FpDevice           *device,
     }
 
   fpi_device_update_temp (device, TRUE);
-  if (priv->temp_current == FP_TEMPERATURE_HOT)
+  if (fp_device_get_temperature (device) == FP_TEMPERATURE_HOT)
     {
       g_task_return_error (task, fpi_device_error_new (FP_DEVICE_ERROR_TOO_HOT));
       fpi_device_update_temp (device, FALSE);
@@ -1461,7 +1729,7 @@ fp_device_identify (FpDevice           *device,
   // Attach the match data as task data so that it is destroyed
   g_task_set_task_data (priv->current_task, data, (GDestroyNotify) match_data_free);
 
-  cls->identify (device);
+  fpi_device_invoke_driver (device, cls->identify);
 }
 
 /**
@@ -1537,7 +1805,7 @@ fp_device_capture (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1560,7 +1828,7 @@ fp_device_capture (FpDevice           *device,
     }
 
   fpi_device_update_temp (device, TRUE);
-  if (priv->temp_current == FP_TEMPERATURE_HOT)
+  if (fp_device_get_temperature (device) == FP_TEMPERATURE_HOT)
     {
       g_task_return_error (task, fpi_device_error_new (FP_DEVICE_ERROR_TOO_HOT));
       fpi_device_update_temp (device, FALSE);
@@ -1573,7 +1841,7 @@ fp_device_capture (FpDevice           *device,
 
   priv->wait_for_finger = wait_for_finger;
 
-  cls->capture (device);
+  fpi_device_invoke_driver (device, cls->capture);
 }
 
 /**
@@ -1628,7 +1896,7 @@ fp_device_delete_print (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1657,7 +1925,7 @@ fp_device_delete_print (FpDevice           *device,
                         g_object_ref (enrolled_print),
                         g_object_unref);
 
-  cls->delete (device);
+  fpi_device_invoke_driver (device, cls->delete);
 }
 
 /**
@@ -1706,7 +1974,7 @@ fp_device_list_prints (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1732,7 +2000,7 @@ fp_device_list_prints (FpDevice           *device,
   priv->current_task = g_steal_pointer (&task);
   setup_task_cancellable (device);
 
-  cls->list (device);
+  fpi_device_invoke_driver (device, cls->list);
 }
 
 /**
@@ -1783,7 +2051,7 @@ fp_device_clear_storage (FpDevice           *device,
   if (g_task_return_error_if_cancelled (task))
     return;
 
-  if (!priv->is_open)
+  if (!fp_device_is_open (device))
     {
       g_task_return_error (task,
                            fpi_device_error_new (FP_DEVICE_ERROR_NOT_OPEN));
@@ -1817,7 +2085,7 @@ fp_device_clear_storage (FpDevice           *device,
   priv->current_task = g_steal_pointer (&task);
   setup_task_cancellable (device);
 
-  cls->clear_storage (device);
+  fpi_device_invoke_driver (device, cls->clear_storage);
 
   return;
 }
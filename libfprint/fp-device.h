@@ -102,6 +102,93 @@ typedef enum {
   FP_TEMPERATURE_HOT,
 } FpTemperature;
 
+/**
+ * FpDeviceTracePhase:
+ * @FP_DEVICE_TRACE_ACTION_START: An action (open, enroll, verify, …) was started
+ * @FP_DEVICE_TRACE_OPEN: The driver finished opening the device
+ * @FP_DEVICE_TRACE_ACTIVATE: The sensor was activated and is ready to scan
+ * @FP_DEVICE_TRACE_READY: The device first asked for a finger in this action,
+ *   recorded at most once per action
+ * @FP_DEVICE_TRACE_FINGER_ON: A finger was detected on the sensor
+ * @FP_DEVICE_TRACE_CAPTURE: An image was captured
+ * @FP_DEVICE_TRACE_MINUTIAE: Minutiae detection on the image completed
+ * @FP_DEVICE_TRACE_MATCH: Matching the scan against the prints completed
+ * @FP_DEVICE_TRACE_REPORT: An enroll stage or match result was reported
+ * @FP_DEVICE_TRACE_ACTION_COMPLETE: The action completed
+ *
+ * The phases of an action that are recorded by a device, see
+ * fp_device_get_stats(). Which phases are recorded depends on the driver,
+ * e.g. devices that match on chip do not report minutiae detection.
+ */
+typedef enum {
+  FP_DEVICE_TRACE_ACTION_START,
+  FP_DEVICE_TRACE_OPEN,
+  FP_DEVICE_TRACE_ACTIVATE,
+  FP_DEVICE_TRACE_READY,
+  FP_DEVICE_TRACE_FINGER_ON,
+  FP_DEVICE_TRACE_CAPTURE,
+  FP_DEVICE_TRACE_MINUTIAE,
+  FP_DEVICE_TRACE_MATCH,
+  FP_DEVICE_TRACE_REPORT,
+  FP_DEVICE_TRACE_ACTION_COMPLETE,
+} FpDeviceTracePhase;
+
+/**
+ * FpDeviceTraceEvent:
+ * @action: Sequence number of the action the event belongs to
+ * @phase: The #FpDeviceTracePhase that was reached
+ * @timestamp: Monotonic time of the event in microseconds, see
+ *   g_get_monotonic_time()
+ *
+ * A single entry of the trace recorded by a device.
+ */
+typedef struct
+{
+  guint              action;
+  FpDeviceTracePhase phase;
+  gint64             timestamp;
+} FpDeviceTraceEvent;
+
+/**
+ * FP_DEVICE_TRANSFER_ENDPOINT_SPI:
+ *
+ * The endpoint reported in #FpDeviceTransferStats for SPI transfers.
+ */
+#define FP_DEVICE_TRANSFER_ENDPOINT_SPI 0x100
+
+/**
+ * FP_DEVICE_TRANSFER_LATENCY_BUCKETS:
+ *
+ * The number of buckets in the latency histogram of #FpDeviceTransferStats.
+ */
+#define FP_DEVICE_TRANSFER_LATENCY_BUCKETS 24
+
+/**
+ * FpDeviceTransferStats:
+ * @endpoint: The USB endpoint address, or %FP_DEVICE_TRANSFER_ENDPOINT_SPI
+ * @transfers: Number of completed transfers
+ * @bytes: Number of bytes moved by the transfers that succeeded
+ * @errors: Number of transfers that failed, including timeouts
+ * @timeouts: Number of transfers that timed out
+ * @cancelled: Number of transfers that were cancelled
+ * @latency: Histogram of the time between submission and completion. Bucket
+ *   0 counts transfers that took less than a microsecond, bucket n those that
+ *   took at least 2^(n-1) but less than 2^n microseconds. The last bucket
+ *   also counts all slower transfers.
+ *
+ * Transfer statistics of a single endpoint of a device.
+ */
+typedef struct
+{
+  guint   endpoint;
+  guint64 transfers;
+  guint64 bytes;
+  guint64 errors;
+  guint64 timeouts;
+  guint64 cancelled;
+  guint64 latency[FP_DEVICE_TRANSFER_LATENCY_BUCKETS];
+} FpDeviceTransferStats;
+
 /**
  * FpDeviceRetry:
  * @FP_DEVICE_RETRY_GENERAL: The scan did not succeed due to poor scan quality
@@ -228,6 +315,8 @@ FpScanType   fp_device_get_scan_type (FpDevice *device);
 FpFingerStatusFlags fp_device_get_finger_status (FpDevice *device);
 gint         fp_device_get_nr_enroll_stages (FpDevice *device);
 FpTemperature fp_device_get_temperature (FpDevice *device);
+GArray *     fp_device_get_stats (FpDevice *device);
+GArray *     fp_device_get_transfer_stats (FpDevice *device);
 
 FpDeviceFeature     fp_device_get_features (FpDevice *device);
 gboolean            fp_device_has_feature (FpDevice       *device,
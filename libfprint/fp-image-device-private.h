@@ -37,6 +37,7 @@ typedef struct
   FpImage            *capture_image;
 
   gint                bz3_threshold;
+  FpiMinutiaeProfile  minutiae_profile;
 } FpImageDevicePrivate;
 
 
@@ -197,6 +197,7 @@ fp_image_device_constructed (GObject *obj)
   priv->bz3_threshold = BOZORTH3_DEFAULT_THRESHOLD;
   if (cls->bz3_threshold > 0)
     priv->bz3_threshold = cls->bz3_threshold;
+  priv->minutiae_profile = cls->minutiae_profile;
 
   G_OBJECT_CLASS (fp_image_device_parent_class)->constructed (obj);
 }
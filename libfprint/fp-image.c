@@ -270,6 +270,28 @@ invert_colors (guint8 *data, gint width, gint height)
     data[i] = 0xff - data[i];
 }
 
+static void
+lfsparms_apply_profile (LFSPARMS *lfsparms, FpiMinutiaeProfile profile)
+{
+  switch (profile)
+    {
+    case FPI_MINUTIAE_PROFILE_DEFAULT:
+      break;
+
+    case FPI_MINUTIAE_PROFILE_FAST:
+      lfsparms->refine_direction_map = FALSE;
+      lfsparms->detect_high_curvature = FALSE;
+      lfsparms->remove_pores = FALSE;
+      /* Minutiae are still sorted and deduplicated, only the neighbour
+       * ridge counts that bozorth3 does not use are skipped. */
+      lfsparms->count_ridges = FALSE;
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
 static void
 fp_image_detect_minutiae_nbis_thread_func (GTask        *task,
                                            gpointer      source_object,
@@ -317,6 +339,7 @@ fp_image_detect_minutiae_nbis_thread_func (GTask        *task,
 
   lfsparms = g_memdup2 (&g_lfsparms_V2, sizeof (LFSPARMS));
   lfsparms->remove_perimeter_pts = minutiae_flags & FPI_IMAGE_PARTIAL ? TRUE : FALSE;
+  lfsparms_apply_profile (lfsparms, self->minutiae_profile);
 
   timer = g_timer_new ();
   r = get_minutiae (&ret_data->minutiae, &quality_map, &direction_map,
@@ -325,7 +348,8 @@ fp_image_detect_minutiae_nbis_thread_func (GTask        *task,
                     image, self->width, self->height, 8,
                     self->ppmm, lfsparms);
   g_timer_stop (timer);
-  fp_dbg ("Minutiae scan completed in %f secs", g_timer_elapsed (timer, NULL));
+  fp_dbg ("Minutiae scan (profile %d) completed in %f secs",
+          self->minutiae_profile, g_timer_elapsed (timer, NULL));
 
   if (g_task_had_error (thread_task))
     return;
@@ -163,14 +163,7 @@ fpi_byte_reader_get_sub_reader (FpiByteReader * reader,
 gboolean
 fpi_byte_reader_set_pos (FpiByteReader * reader, guint pos)
 {
-  g_return_val_if_fail (reader != NULL, FALSE);
-
-  if (pos > reader->size)
-    return FALSE;
-
-  reader->byte = pos;
-
-  return TRUE;
+  return fpi_byte_reader_set_pos_inline (reader, pos);
 }
 
 /**
@@ -339,7 +339,7 @@ __FPI_BYTE_READER_GET_PEEK_BITS_UNCHECKED(32,gfloat,float32_be,FLOAT_BE,/* */)
 __FPI_BYTE_READER_GET_PEEK_BITS_UNCHECKED(64,gdouble,float64_le,DOUBLE_LE,/* */)
 __FPI_BYTE_READER_GET_PEEK_BITS_UNCHECKED(64,gdouble,float64_be,DOUBLE_BE,/* */)
 
-#undef __GET_PEEK_BITS_UNCHECKED
+#undef __FPI_BYTE_READER_GET_PEEK_BITS_UNCHECKED
 
 static inline const guint8 *
 fpi_byte_reader_peek_data_unchecked (const FpiByteReader * reader)
@@ -473,6 +473,9 @@ __FPI_BYTE_READER_GET_PEEK_BITS_INLINE(64,gdouble,float64_be)
 #define fpi_byte_reader_get_pos(reader) \
     fpi_byte_reader_get_pos_inline(reader)
 
+#define fpi_byte_reader_set_pos(reader,pos) \
+    fpi_byte_reader_set_pos_inline(reader,pos)
+
 /* we use defines here so we can add the G_LIKELY() */
 #define fpi_byte_reader_get_uint8(reader,val) \
     G_LIKELY(fpi_byte_reader_get_uint8_inline(reader,val))
@@ -650,6 +653,18 @@ fpi_byte_reader_get_pos_inline (const FpiByteReader * reader)
   return fpi_byte_reader_get_pos_unchecked (reader);
 }
 
+static inline gboolean
+fpi_byte_reader_set_pos_inline (FpiByteReader * reader, guint pos)
+{
+  g_return_val_if_fail (reader != NULL, FALSE);
+
+  if (G_UNLIKELY (pos > reader->size))
+    return FALSE;
+
+  reader->byte = pos;
+  return TRUE;
+}
+
 static inline gboolean
 fpi_byte_reader_skip_inline (FpiByteReader * reader, guint nbytes)
 {
@@ -672,6 +687,10 @@ fpi_byte_reader_skip_inline (FpiByteReader * reader, guint nbytes)
     G_LIKELY(fpi_byte_reader_peek_data_inline(reader,size,val))
 #define fpi_byte_reader_skip(reader,nbytes) \
     G_LIKELY(fpi_byte_reader_skip_inline(reader,nbytes))
+#define fpi_byte_reader_peek_sub_reader(reader,sub_reader,size) \
+    G_LIKELY(fpi_byte_reader_peek_sub_reader_inline(reader,sub_reader,size))
+#define fpi_byte_reader_get_sub_reader(reader,sub_reader,size) \
+    G_LIKELY(fpi_byte_reader_get_sub_reader_inline(reader,sub_reader,size))
 
 #endif /* FPI_BYTE_READER_DISABLE_INLINES */
 
@@ -270,12 +270,7 @@ fpi_byte_writer_free_and_get_data (FpiByteWriter * writer)
 guint
 fpi_byte_writer_get_remaining (const FpiByteWriter * writer)
 {
-  g_return_val_if_fail (writer != NULL, -1);
-
-  if (!writer->fixed)
-    return -1;
-  else
-    return writer->alloc_size - writer->parent.byte;
+  return fpi_byte_writer_get_remaining_inline (writer);
 }
 
 /**
@@ -294,6 +289,25 @@ fpi_byte_writer_ensure_free_space (FpiByteWriter * writer, guint size)
   return fpi_byte_writer_ensure_free_space_inline (writer, size);
 }
 
+/**
+ * fpi_byte_writer_reserve:
+ * @writer: #FpiByteWriter instance
+ * @size: Number of bytes that will be written
+ *
+ * Makes sure @size bytes can be written from the current write cursor
+ * without further reallocations. Unlike fpi_byte_writer_ensure_free_space(),
+ * which rounds up to the next power of two, exactly the missing space is
+ * allocated. Use it to allocate once if the size of a message is known
+ * before it is built.
+ *
+ * Returns: %TRUE if at least @size bytes are available
+ */
+gboolean
+fpi_byte_writer_reserve (FpiByteWriter * writer, guint size)
+{
+  return fpi_byte_writer_reserve_inline (writer, size);
+}
+
 
 #define CREATE_WRITE_FUNC(bits,type,name,write_func) \
 gboolean \
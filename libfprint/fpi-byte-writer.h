@@ -135,6 +135,9 @@ guint           fpi_byte_writer_get_remaining     (const FpiByteWriter *writer);
 gboolean        fpi_byte_writer_ensure_free_space (FpiByteWriter *writer, guint size);
 
 
+gboolean        fpi_byte_writer_reserve           (FpiByteWriter *writer, guint size);
+
+
 gboolean        fpi_byte_writer_put_uint8         (FpiByteWriter *writer, guint8 val);
 
 
@@ -264,6 +267,43 @@ fpi_byte_writer_ensure_free_space_inline (FpiByteWriter * writer, guint size)
   return TRUE;
 }
 
+static inline gboolean
+fpi_byte_writer_reserve_inline (FpiByteWriter * writer, guint size)
+{
+  gpointer data;
+
+  g_return_val_if_fail (writer != NULL, FALSE);
+
+  if (size <= writer->alloc_size - writer->parent.byte)
+    return TRUE;
+  if (G_UNLIKELY (writer->fixed || !writer->owned))
+    return FALSE;
+  if (G_UNLIKELY (writer->parent.byte > G_MAXUINT - size))
+    return FALSE;
+
+  /* Unlike fpi_byte_writer_ensure_free_space() allocate exactly what is
+   * requested, the caller knows the final size of the data. */
+  data = g_try_realloc ((guint8 *) writer->parent.data, writer->parent.byte + size);
+  if (G_UNLIKELY (data == NULL))
+    return FALSE;
+
+  writer->parent.data = (guint8 *) data;
+  writer->alloc_size = writer->parent.byte + size;
+
+  return TRUE;
+}
+
+static inline guint
+fpi_byte_writer_get_remaining_inline (const FpiByteWriter * writer)
+{
+  g_return_val_if_fail (writer != NULL, -1);
+
+  if (!writer->fixed)
+    return -1;
+
+  return writer->alloc_size - writer->parent.byte;
+}
+
 #define __FPI_BYTE_WRITER_CREATE_WRITE_FUNC(bits,type,name,write_func) \
 static inline void \
 fpi_byte_writer_put_##name##_unchecked (FpiByteWriter *writer, type val) \
@@ -365,6 +405,10 @@ fpi_byte_writer_fill_inline (FpiByteWriter * writer, guint8 value, guint size)
 
 #define fpi_byte_writer_ensure_free_space(writer, size) \
     G_LIKELY (fpi_byte_writer_ensure_free_space_inline (writer, size))
+#define fpi_byte_writer_reserve(writer, size) \
+    G_LIKELY (fpi_byte_writer_reserve_inline (writer, size))
+#define fpi_byte_writer_get_remaining(writer) \
+    fpi_byte_writer_get_remaining_inline (writer)
 #define fpi_byte_writer_put_uint8(writer, val) \
     G_LIKELY (fpi_byte_writer_put_uint8_inline (writer, val))
 #define fpi_byte_writer_put_int8(writer, val) \
@@ -21,6 +21,7 @@
 #include <gusb.h>
 #include "fp-context.h"
 #include "fpi-compat.h"
+#include "fpi-device.h"
 
 /**
  * fpi_get_driver_types:
@@ -33,3 +34,9 @@
  *   all driver types
  */
 GArray *fpi_get_driver_types (void);
+
+GType fpi_context_find_usb_driver (FpContext        *context,
+                                   guint16           vid,
+                                   guint16           pid,
+                                   GUsbDevice       *usb_device,
+                                   const FpIdEntry **entry);
@@ -50,6 +50,65 @@ fp_device_get_instance_private (FpDevice *self)
                             g_type_class_get_instance_private_offset (dev_class));
 }
 
+static GMainContext *
+device_get_caller_context (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  if (priv->current_task)
+    return g_task_get_context (priv->current_task);
+
+  return priv->caller_context;
+}
+
+static void
+device_notify_cb (FpDevice *device, gpointer user_data)
+{
+  g_object_notify (G_OBJECT (device), user_data);
+}
+
+/*
+ * Notifies about a property change. With a driver thread, the notification
+ * is emitted in the context of the caller rather than in the driver thread.
+ */
+static void
+device_notify (FpDevice    *device,
+               const gchar *property_name)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  if (!priv->driver_context)
+    {
+      g_object_notify (G_OBJECT (device), property_name);
+      return;
+    }
+
+  fpi_device_invoke_in_context (device, device_get_caller_context (device),
+                                device_notify_cb, (gpointer) property_name,
+                                NULL);
+}
+
+static void
+device_emit_removed_cb (FpDevice *device, gpointer user_data)
+{
+  g_signal_emit_by_name (device, "removed");
+}
+
+static void
+device_emit_removed (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  if (!priv->driver_context)
+    {
+      g_signal_emit_by_name (device, "removed");
+      return;
+    }
+
+  fpi_device_invoke_in_context (device, device_get_caller_context (device),
+                                device_emit_removed_cb, NULL, NULL);
+}
+
 /**
  * fpi_device_class_auto_initialize_features:
  *
@@ -268,7 +327,7 @@ fpi_device_set_nr_enroll_stages (FpDevice *device,
   g_return_if_fail (enroll_stages > 0);
 
   priv->nr_enroll_stages = enroll_stages;
-  g_object_notify (G_OBJECT (device), "nr-enroll-stages");
+  device_notify (device, "nr-enroll-stages");
 }
 
 /**
@@ -289,7 +348,7 @@ fpi_device_set_scan_type (FpDevice  *device,
   g_return_if_fail (FP_IS_DEVICE (device));
 
   priv->scan_type = scan_type;
-  g_object_notify (G_OBJECT (device), "scan-type");
+  device_notify (device, "scan-type");
 }
 
 /**
@@ -328,7 +387,9 @@ timeout_finalize (GSource *source)
   FpDevicePrivate *priv;
 
   priv = fp_device_get_instance_private (timeout_source->device);
+  g_rec_mutex_lock (&priv->state_mutex);
   priv->sources = g_slist_remove (priv->sources, source);
+  g_rec_mutex_unlock (&priv->state_mutex);
 }
 
 static gboolean
@@ -350,6 +411,131 @@ static GSourceFuncs timeout_funcs = {
   NULL, NULL
 };
 
+/*
+ * Returns the context the driver code runs in. This is the dedicated driver
+ * context if the device has its own thread, otherwise the context of the
+ * current task or the thread default one.
+ */
+GMainContext *
+fpi_device_get_driver_context (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  if (priv->driver_context)
+    return priv->driver_context;
+
+  if (priv->current_task)
+    return g_task_get_context (priv->current_task);
+
+  return g_main_context_get_thread_default ();
+}
+
+/*
+ * Returns the pool that transfers created by fpi_usb_transfer_new() for
+ * the device are recycled into, or %NULL.
+ */
+FpiUsbTransferPool *
+fpi_device_get_usb_transfer_pool (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  return priv->usb_transfer_pool;
+}
+
+typedef struct
+{
+  FpDevice      *device;
+  FpTimeoutFunc  func;
+  gpointer       user_data;
+  GDestroyNotify destroy_notify;
+} FpDeviceInvokeData;
+
+static gboolean
+device_invoke_cb (gpointer user_data)
+{
+  FpDeviceInvokeData *data = user_data;
+
+  data->func (data->device, data->user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+device_invoke_data_free (gpointer user_data)
+{
+  FpDeviceInvokeData *data = user_data;
+
+  if (data->destroy_notify)
+    data->destroy_notify (data->user_data);
+  g_object_unref (data->device);
+  g_free (data);
+}
+
+/*
+ * Calls @func in @context, directly if the calling thread owns it, otherwise
+ * from an idle source. The device is kept alive until @func returned.
+ */
+void
+fpi_device_invoke_in_context (FpDevice      *device,
+                              GMainContext  *context,
+                              FpTimeoutFunc  func,
+                              gpointer       user_data,
+                              GDestroyNotify destroy_notify)
+{
+  FpDeviceInvokeData *data;
+  GSource *source;
+
+  if (g_main_context_is_owner (context))
+    {
+      func (device, user_data);
+      if (destroy_notify)
+        destroy_notify (user_data);
+      return;
+    }
+
+  data = g_new0 (FpDeviceInvokeData, 1);
+  data->device = g_object_ref (device);
+  data->func = func;
+  data->user_data = user_data;
+  data->destroy_notify = destroy_notify;
+
+  /* Not using g_main_context_invoke(), as it would dispatch right away from
+   * the calling thread if the context happens to not be acquired. */
+  source = g_idle_source_new ();
+  g_source_set_priority (source, G_PRIORITY_DEFAULT);
+  g_source_set_callback (source, device_invoke_cb, data, device_invoke_data_free);
+  g_source_set_name (source, "[fpi] device invoke");
+  g_source_attach (source, context);
+  g_source_unref (source);
+}
+
+static void
+device_invoke_driver_cb (FpDevice *device, gpointer user_data)
+{
+  FpDeviceDriverFunc driver_func = (FpDeviceDriverFunc) user_data;
+
+  driver_func (device);
+}
+
+/*
+ * Runs a driver entry point, on the driver thread if the device has one.
+ */
+void
+fpi_device_invoke_driver (FpDevice          *device,
+                          FpDeviceDriverFunc driver_func)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  if (!priv->driver_context)
+    {
+      driver_func (device);
+      return;
+    }
+
+  fpi_device_invoke_in_context (device, priv->driver_context,
+                                device_invoke_driver_cb, driver_func, NULL);
+}
+
 /**
  * fpi_device_add_timeout:
  * @device: The #FpDevice
@@ -378,16 +564,15 @@ fpi_device_add_timeout (FpDevice      *device,
                                                    sizeof (FpDeviceTimeoutSource));
   source->device = device;
 
-  if (priv->current_task)
-    context = g_task_get_context (priv->current_task);
-  else
-    context = g_main_context_get_thread_default ();
+  context = fpi_device_get_driver_context (device);
 
   g_source_attach (&source->source, context);
   g_source_set_callback (&source->source, (GSourceFunc) func, user_data, destroy_notify);
   g_source_set_ready_time (&source->source,
                            g_source_get_time (&source->source) + interval * (guint64) 1000);
+  g_rec_mutex_lock (&priv->state_mutex);
   priv->sources = g_slist_prepend (priv->sources, source);
+  g_rec_mutex_unlock (&priv->state_mutex);
   g_source_unref (&source->source);
 
   return &source->source;
@@ -671,7 +856,7 @@ fpi_device_get_cancellable (FpDevice *device)
 static void
 emit_removed_on_task_completed (FpDevice *device)
 {
-  g_signal_emit_by_name (device, "removed");
+  device_emit_removed (device);
 }
 
 /**
@@ -689,11 +874,17 @@ fpi_device_remove (FpDevice *device)
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
 
   g_return_if_fail (FP_IS_DEVICE (device));
-  g_return_if_fail (!priv->is_removed);
 
+  g_rec_mutex_lock (&priv->state_mutex);
+  if (priv->is_removed)
+    {
+      g_rec_mutex_unlock (&priv->state_mutex);
+      g_return_if_reached ();
+    }
   priv->is_removed = TRUE;
+  g_rec_mutex_unlock (&priv->state_mutex);
 
-  g_object_notify (G_OBJECT (device), "removed");
+  device_notify (device, "removed");
 
   /* If there is a pending action, we wait for it to fail, otherwise we
    * immediately emit the "removed" signal. */
@@ -707,7 +898,7 @@ fpi_device_remove (FpDevice *device)
     }
   else
     {
-      g_signal_emit_by_name (device, "removed");
+      device_emit_removed (device);
     }
 }
 
@@ -905,7 +1096,7 @@ fpi_device_critical_leave (FpDevice *device)
   g_source_set_name (priv->critical_section_flush_source,
                      "Flush libfprint driver critical section");
   g_source_attach (priv->critical_section_flush_source,
-                   g_task_get_context (priv->current_task));
+                   fpi_device_get_driver_context (device));
   g_source_unref (priv->critical_section_flush_source);
 }
 
@@ -914,7 +1105,15 @@ clear_device_cancel_action (FpDevice *device)
 {
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
 
-  g_clear_pointer (&priv->current_idle_cancel_source, g_source_destroy);
+  /* Disconnecting waits for handlers running in other threads, so the external
+   * cancellable goes first and the idle cancel source is only cleared once no
+   * handler can attach a new one anymore. */
+  if (priv->current_task_cancellable_id)
+    {
+      g_cancellable_disconnect (g_task_get_cancellable (priv->current_task),
+                                priv->current_task_cancellable_id);
+      priv->current_task_cancellable_id = 0;
+    }
 
   if (priv->current_cancellable_id)
     {
@@ -923,12 +1122,7 @@ clear_device_cancel_action (FpDevice *device)
       priv->current_cancellable_id = 0;
     }
 
-  if (priv->current_task_cancellable_id)
-    {
-      g_cancellable_disconnect (g_task_get_cancellable (priv->current_task),
-                                priv->current_task_cancellable_id);
-      priv->current_task_cancellable_id = 0;
-    }
+  g_clear_pointer (&priv->current_idle_cancel_source, g_source_destroy);
 }
 
 typedef enum _FpDeviceTaskReturnType {
@@ -944,24 +1138,108 @@ typedef struct _FpDeviceTaskReturnData
   FpDevice              *device;
   FpDeviceTaskReturnType type;
   gpointer               result;
+  GTask                 *task;
 } FpDeviceTaskReturnData;
 
+static void
+fpi_device_task_return_data_clear_result (FpDeviceTaskReturnData *data)
+{
+  switch (data->type)
+    {
+    case FP_DEVICE_TASK_RETURN_INT:
+    case FP_DEVICE_TASK_RETURN_BOOL:
+      data->result = NULL;
+      break;
+
+    case FP_DEVICE_TASK_RETURN_OBJECT:
+      g_clear_object ((GObject **) &data->result);
+      break;
+
+    case FP_DEVICE_TASK_RETURN_PTR_ARRAY:
+      g_clear_pointer ((GPtrArray **) &data->result, g_ptr_array_unref);
+      break;
+
+    case FP_DEVICE_TASK_RETURN_ERROR:
+      g_clear_error ((GError **) &data->result);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+fpi_device_task_return_data_free (FpDeviceTaskReturnData *data)
+{
+  fpi_device_task_return_data_clear_result (data);
+  g_clear_object (&data->task);
+  g_object_unref (data->device);
+  g_free (data);
+}
+
+/* Runs in the context of the task, i.e. the one of the caller. */
+static void
+fp_device_task_return_cb (FpDevice *device,
+                          gpointer  user_data)
+{
+  FpDeviceTaskReturnData *data = user_data;
+
+  switch (data->type)
+    {
+    case FP_DEVICE_TASK_RETURN_INT:
+      g_task_return_int (data->task, GPOINTER_TO_INT (data->result));
+      break;
+
+    case FP_DEVICE_TASK_RETURN_BOOL:
+      g_task_return_boolean (data->task, GPOINTER_TO_UINT (data->result));
+      break;
+
+    case FP_DEVICE_TASK_RETURN_OBJECT:
+      g_task_return_pointer (data->task, g_steal_pointer (&data->result),
+                             g_object_unref);
+      break;
+
+    case FP_DEVICE_TASK_RETURN_PTR_ARRAY:
+      g_task_return_pointer (data->task, g_steal_pointer (&data->result),
+                             (GDestroyNotify) g_ptr_array_unref);
+      break;
+
+    case FP_DEVICE_TASK_RETURN_ERROR:
+      g_task_return_error (data->task, g_steal_pointer (&data->result));
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/* Runs in the driver context. The action state is only torn down here, after
+ * the driver code that completed the action has returned, so that it stays
+ * valid for the rest of that dispatch. The task itself is then returned in
+ * the context of the caller, which can only start the next action after the
+ * bookkeeping is done. */
 static gboolean
 fp_device_task_return_in_idle_cb (gpointer user_data)
 {
   FpDeviceTaskReturnData *data = user_data;
+  FpDeviceTaskReturnData *return_data;
   FpDevicePrivate *priv = fp_device_get_instance_private (data->device);
   g_autofree char *action_str = NULL;
   FpiDeviceAction action;
 
-  g_autoptr(GTask) task = NULL;
   g_autoptr(GError) cancellation_reason = NULL;
 
 
   action_str = g_enum_to_string (FPI_TYPE_DEVICE_ACTION, priv->current_action);
   g_debug ("Completing action %s in idle!", action_str);
+  fpi_device_trace (data->device, FP_DEVICE_TRACE_ACTION_COMPLETE);
+
+  return_data = g_new0 (FpDeviceTaskReturnData, 1);
+  return_data->device = g_object_ref (data->device);
+  return_data->task = g_steal_pointer (&priv->current_task);
+  return_data->type = data->type;
+  return_data->result = g_steal_pointer (&data->result);
 
-  task = g_steal_pointer (&priv->current_task);
   action = priv->current_action;
   priv->current_action = FPI_DEVICE_ACTION_NONE;
   priv->current_task_idle_return_source = NULL;
@@ -973,16 +1251,20 @@ fp_device_task_return_in_idle_cb (gpointer user_data)
   if (action == FPI_DEVICE_ACTION_OPEN &&
       data->type != FP_DEVICE_TASK_RETURN_ERROR)
     {
+      g_rec_mutex_lock (&priv->state_mutex);
       priv->is_open = TRUE;
-      g_object_notify (G_OBJECT (data->device), "open");
+      g_rec_mutex_unlock (&priv->state_mutex);
+      device_notify (data->device, "open");
     }
   else if (action == FPI_DEVICE_ACTION_CLOSE)
     {
       /* Always consider the device closed. Drivers should try hard to close the
        * device. Generally, e.g. cancellations should be ignored.
        */
+      g_rec_mutex_lock (&priv->state_mutex);
       priv->is_open = FALSE;
-      g_object_notify (G_OBJECT (data->device), "open");
+      g_rec_mutex_unlock (&priv->state_mutex);
+      device_notify (data->device, "open");
     }
 
   /* TODO: Port/use the cancellation mechanism for device removal! */
@@ -993,83 +1275,30 @@ fp_device_task_return_in_idle_cb (gpointer user_data)
       ((action != FPI_DEVICE_ACTION_OPEN) ||
        (action == FPI_DEVICE_ACTION_OPEN && data->type == FP_DEVICE_TASK_RETURN_ERROR)))
     {
-      g_task_return_error (task, fpi_device_error_new (FP_DEVICE_ERROR_REMOVED));
+      fpi_device_task_return_data_clear_result (return_data);
+      return_data->type = FP_DEVICE_TASK_RETURN_ERROR;
+      return_data->result = fpi_device_error_new (FP_DEVICE_ERROR_REMOVED);
 
       /* NOTE: The removed signal will be emitted from the GTask
        *       notify::completed if that is necessary. */
-
-      return G_SOURCE_REMOVE;
     }
-
-  switch (data->type)
+  else if (data->type == FP_DEVICE_TASK_RETURN_ERROR && cancellation_reason)
     {
-    case FP_DEVICE_TASK_RETURN_INT:
-      g_task_return_int (task, GPOINTER_TO_INT (data->result));
-      break;
-
-    case FP_DEVICE_TASK_RETURN_BOOL:
-      g_task_return_boolean (task, GPOINTER_TO_UINT (data->result));
-      break;
-
-    case FP_DEVICE_TASK_RETURN_OBJECT:
-      g_task_return_pointer (task, g_steal_pointer (&data->result),
-                             g_object_unref);
-      break;
-
-    case FP_DEVICE_TASK_RETURN_PTR_ARRAY:
-      g_task_return_pointer (task, g_steal_pointer (&data->result),
-                             (GDestroyNotify) g_ptr_array_unref);
-      break;
-
-    case FP_DEVICE_TASK_RETURN_ERROR:
       /* Return internal cancellation reason instead if we have one.
        * Note that an external cancellation always returns G_IO_ERROR_CANCELLED
        */
-      if (cancellation_reason)
-        {
-          g_task_set_task_data (task, NULL, NULL);
-          g_task_return_error (task, g_steal_pointer (&cancellation_reason));
-        }
-      else
-        {
-          g_task_return_error (task, g_steal_pointer (&data->result));
-        }
-      break;
-
-    default:
-      g_assert_not_reached ();
+      g_task_set_task_data (return_data->task, NULL, NULL);
+      fpi_device_task_return_data_clear_result (return_data);
+      return_data->result = g_steal_pointer (&cancellation_reason);
     }
 
-  return G_SOURCE_REMOVE;
-}
-
-static void
-fpi_device_task_return_data_free (FpDeviceTaskReturnData *data)
-{
-  switch (data->type)
-    {
-    case FP_DEVICE_TASK_RETURN_INT:
-    case FP_DEVICE_TASK_RETURN_BOOL:
-      break;
-
-    case FP_DEVICE_TASK_RETURN_OBJECT:
-      g_clear_object ((GObject **) &data->result);
-      break;
-
-    case FP_DEVICE_TASK_RETURN_PTR_ARRAY:
-      g_clear_pointer ((GPtrArray **) &data->result, g_ptr_array_unref);
-      break;
-
-    case FP_DEVICE_TASK_RETURN_ERROR:
-      g_clear_error ((GError **) &data->result);
-      break;
-
-    default:
-      g_assert_not_reached ();
-    }
+  fpi_device_invoke_in_context (data->device,
+                                g_task_get_context (return_data->task),
+                                fp_device_task_return_cb,
+                                return_data,
+                                (GDestroyNotify) fpi_device_task_return_data_free);
 
-  g_object_unref (data->device);
-  g_free (data);
+  return G_SOURCE_REMOVE;
 }
 
 /**
@@ -1103,7 +1332,7 @@ fpi_device_return_task_in_idle (FpDevice              *device,
                          (GDestroyNotify) fpi_device_task_return_data_free);
 
   g_source_attach (priv->current_task_idle_return_source,
-                   g_task_get_context (priv->current_task));
+                   fpi_device_get_driver_context (device));
   g_source_unref (priv->current_task_idle_return_source);
 }
 
@@ -1127,7 +1356,9 @@ fpi_device_probe_complete (FpDevice    *device,
   g_return_if_fail (FP_IS_DEVICE (device));
   g_return_if_fail (priv->current_action == FPI_DEVICE_ACTION_PROBE);
 
-  g_debug ("Device reported probe completion");
+  g_debug ("Device reported probe completion after %.3f ms (driver %s)",
+           (g_get_monotonic_time () - priv->probe_start_time) / 1000.0,
+           FP_DEVICE_GET_CLASS (device)->id);
 
   clear_device_cancel_action (device);
   fpi_device_report_finger_status (device, FP_FINGER_STATUS_NONE);
@@ -1138,13 +1369,13 @@ fpi_device_probe_complete (FpDevice    *device,
         {
           g_clear_pointer (&priv->device_id, g_free);
           priv->device_id = g_strdup (device_id);
-          g_object_notify (G_OBJECT (device), "device-id");
+          device_notify (device, "device-id");
         }
       if (device_name)
         {
           g_clear_pointer (&priv->device_name, g_free);
           priv->device_name = g_strdup (device_name);
-          g_object_notify (G_OBJECT (device), "name");
+          device_notify (device, "name");
         }
       fpi_device_return_task_in_idle (device, FP_DEVICE_TASK_RETURN_BOOL,
                                       GUINT_TO_POINTER (TRUE));
@@ -1171,6 +1402,7 @@ fpi_device_open_complete (FpDevice *device, GError *error)
   g_return_if_fail (priv->current_action == FPI_DEVICE_ACTION_OPEN);
 
   g_debug ("Device reported open completion");
+  fpi_device_trace (device, FP_DEVICE_TRACE_OPEN);
 
   clear_device_cancel_action (device);
   fpi_device_report_finger_status (device, FP_FINGER_STATUS_NONE);
@@ -1627,7 +1859,7 @@ fpi_device_suspend (FpDevice *device)
           if (priv->critical_section)
             priv->suspend_queued = TRUE;
           else
-            FP_DEVICE_GET_CLASS (device)->suspend (device);
+            fpi_device_invoke_driver (device, FP_DEVICE_GET_CLASS (device)->suspend);
         }
       else
         {
@@ -1672,7 +1904,7 @@ fpi_device_resume (FpDevice *device)
           if (priv->critical_section)
             priv->resume_queued = TRUE;
           else
-            FP_DEVICE_GET_CLASS (device)->resume (device);
+            fpi_device_invoke_driver (device, FP_DEVICE_GET_CLASS (device)->resume);
         }
       else
         {
@@ -1890,6 +2122,76 @@ fpi_device_clear_storage_complete (FpDevice *device,
     fpi_device_return_task_in_idle (device, FP_DEVICE_TASK_RETURN_ERROR, error);
 }
 
+/* With a dedicated driver thread, user callbacks are dispatched from the
+ * context of the task, i.e. the one of the caller. Reports keep a reference to
+ * the task (and so to the callback data) and a snapshot of the results. */
+typedef struct
+{
+  GTask   *task;
+  gint     completed_stages;
+  FpPrint *match;
+  FpPrint *print;
+  GError  *error;
+} FpDeviceReport;
+
+static void
+fp_device_report_free (FpDeviceReport *report)
+{
+  g_clear_object (&report->task);
+  g_clear_object (&report->match);
+  g_clear_object (&report->print);
+  g_clear_error (&report->error);
+  g_free (report);
+}
+
+static void
+enroll_progress_report_cb (FpDevice *device, gpointer user_data)
+{
+  FpDeviceReport *report = user_data;
+  FpEnrollData *data = g_task_get_task_data (report->task);
+
+  data->enroll_progress_cb (device,
+                            report->completed_stages,
+                            report->print,
+                            data->enroll_progress_data,
+                            report->error);
+}
+
+static void
+match_report_cb (FpDevice *device, gpointer user_data)
+{
+  FpDeviceReport *report = user_data;
+  FpMatchData *data = g_task_get_task_data (report->task);
+
+  data->match_cb (device, report->match, report->print, data->match_data,
+                  report->error);
+}
+
+static void
+fpi_device_call_match_cb (FpDevice    *device,
+                          FpMatchData *data)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpDeviceReport *report;
+
+  if (!priv->driver_context)
+    {
+      data->match_cb (device, data->match, data->print, data->match_data, data->error);
+      return;
+    }
+
+  report = g_new0 (FpDeviceReport, 1);
+  report->task = g_object_ref (priv->current_task);
+  report->match = data->match ? g_object_ref (data->match) : NULL;
+  report->print = data->print ? g_object_ref (data->print) : NULL;
+  report->error = data->error ? g_error_copy (data->error) : NULL;
+
+  fpi_device_invoke_in_context (device,
+                                g_task_get_context (priv->current_task),
+                                match_report_cb, report,
+                                (GDestroyNotify) fp_device_report_free);
+}
+
 /**
 
  * fpi_device_enroll_progress:
@@ -1915,6 +2217,7 @@ fpi_device_enroll_progress (FpDevice *device,
   g_return_if_fail (error == NULL || error->domain == FP_DEVICE_RETRY);
 
   g_debug ("Device reported enroll progress, reported %i of %i have been completed", completed_stages, priv->nr_enroll_stages);
+  fpi_device_trace (device, FP_DEVICE_TRACE_REPORT);
 
   if (print)
     g_object_ref_sink (print);
@@ -1927,7 +2230,21 @@ fpi_device_enroll_progress (FpDevice *device,
 
   data = g_task_get_task_data (priv->current_task);
 
-  if (data->enroll_progress_cb)
+  if (data->enroll_progress_cb && priv->driver_context)
+    {
+      FpDeviceReport *report = g_new0 (FpDeviceReport, 1);
+
+      report->task = g_object_ref (priv->current_task);
+      report->completed_stages = completed_stages;
+      report->print = g_steal_pointer (&print);
+      report->error = g_steal_pointer (&error);
+
+      fpi_device_invoke_in_context (device,
+                                    g_task_get_context (priv->current_task),
+                                    enroll_progress_report_cb, report,
+                                    (GDestroyNotify) fp_device_report_free);
+    }
+  else if (data->enroll_progress_cb)
     {
       data->enroll_progress_cb (device,
                                 completed_stages,
@@ -1968,6 +2285,7 @@ fpi_device_verify_report (FpDevice      *device,
   data->result_reported = TRUE;
 
   g_debug ("Device reported verify result");
+  fpi_device_trace (device, FP_DEVICE_TRACE_REPORT);
 
   if (print)
     print = g_object_ref_sink (print);
@@ -2009,7 +2327,7 @@ fpi_device_verify_report (FpDevice      *device,
     }
 
   if (call_cb && data->match_cb)
-    data->match_cb (device, data->match, data->print, data->match_data, data->error);
+    fpi_device_call_match_cb (device, data);
 }
 
 /**
@@ -2066,6 +2384,7 @@ fpi_device_identify_report (FpDevice *device,
     }
 
   g_debug ("Device reported identify result");
+  fpi_device_trace (device, FP_DEVICE_TRACE_REPORT);
 
   if (error)
     {
@@ -2099,7 +2418,168 @@ fpi_device_identify_report (FpDevice *device,
     }
 
   if (call_cb && data->match_cb)
-    data->match_cb (device, data->match, data->print, data->match_data, data->error);
+    fpi_device_call_match_cb (device, data);
+}
+
+/**
+ * fpi_device_trace:
+ * @device: The #FpDevice
+ * @phase: The #FpDeviceTracePhase that was reached
+ *
+ * Records that the current action reached @phase, see fp_device_get_stats().
+ * Most phases are recorded by the core, drivers only need to call this for
+ * phases that the core cannot see (e.g. a capture on a non-image device).
+ */
+void
+fpi_device_trace (FpDevice          *device,
+                  FpDeviceTracePhase phase)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  g_autofree char *phase_str = NULL;
+  FpDeviceTraceEvent *event;
+  gint64 now = g_get_monotonic_time ();
+  gint64 action_start;
+  guint action;
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+
+  g_mutex_lock (&priv->trace_mutex);
+
+  if (phase == FP_DEVICE_TRACE_ACTION_START)
+    {
+      priv->trace_action++;
+      priv->trace_action_start = now;
+    }
+  else if (phase == FP_DEVICE_TRACE_READY)
+    {
+      /* Only the first time to ready of an action is of interest */
+      if (priv->trace_ready_action == priv->trace_action)
+        {
+          g_mutex_unlock (&priv->trace_mutex);
+          return;
+        }
+      priv->trace_ready_action = priv->trace_action;
+    }
+
+  event = &priv->trace[priv->trace_next];
+  event->action = priv->trace_action;
+  event->phase = phase;
+  event->timestamp = now;
+
+  priv->trace_next = (priv->trace_next + 1) % FP_DEVICE_TRACE_EVENTS;
+  priv->trace_len = MIN (priv->trace_len + 1, FP_DEVICE_TRACE_EVENTS);
+
+  action = priv->trace_action;
+  action_start = priv->trace_action_start;
+
+  g_mutex_unlock (&priv->trace_mutex);
+
+  phase_str = g_enum_to_string (FP_TYPE_DEVICE_TRACE_PHASE, phase);
+  fp_dbg ("Trace: action %u reached %s after %" G_GINT64_FORMAT " us",
+          action, phase_str, now - action_start);
+}
+
+/* Returns the replay that transfers of @device are taken from, if any. On
+ * first use, the recording that FP_TRANSFER_REPLAY points to is loaded. */
+FpiTransferReplay *
+fpi_device_get_transfer_replay (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  g_autoptr(GError) error = NULL;
+  const char *filename;
+
+  if (G_LIKELY (priv->transfer_replay_checked))
+    return priv->transfer_replay;
+
+  priv->transfer_replay_checked = TRUE;
+
+  filename = g_getenv ("FP_TRANSFER_REPLAY");
+  if (!filename)
+    return NULL;
+
+  priv->transfer_replay = fpi_transfer_replay_new_from_file (filename, &error);
+  if (!priv->transfer_replay)
+    {
+      g_warning ("Failed to load transfers to replay: %s", error->message);
+      return NULL;
+    }
+
+  fpi_transfer_replay_set_recorded_delays (priv->transfer_replay,
+                                           g_strcmp0 (g_getenv ("FP_TRANSFER_REPLAY_DELAYS"), "recorded") == 0);
+
+  return priv->transfer_replay;
+}
+
+/* Replaces the transfers of @device by those of @replay, %NULL goes back
+ * to using the bus. */
+void
+fpi_device_set_transfer_replay (FpDevice          *device,
+                                FpiTransferReplay *replay)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+
+  if (replay)
+    fpi_transfer_replay_ref (replay);
+
+  g_clear_pointer (&priv->transfer_replay, fpi_transfer_replay_unref);
+  priv->transfer_replay = replay;
+  priv->transfer_replay_checked = TRUE;
+}
+
+/* Whether FP_DEBUG_TRANSFER is set, the environment is only checked once */
+gboolean
+fpi_device_debug_transfer (void)
+{
+  static gsize debug_transfer = 0;
+
+  if (g_once_init_enter (&debug_transfer))
+    g_once_init_leave (&debug_transfer, g_getenv ("FP_DEBUG_TRANSFER") ? 2 : 1);
+
+  return debug_transfer == 2;
+}
+
+/* Updates the transfer statistics of @device once a transfer has completed,
+ * see fp_device_get_transfer_stats(). Safe to call from any thread. */
+void
+fpi_device_count_transfer (FpDevice     *device,
+                           guint         endpoint,
+                           gssize        bytes,
+                           gint64        latency_usec,
+                           const GError *error)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpiTransferCounters *counters;
+  guint bucket = 0;
+
+  if (endpoint == FP_DEVICE_TRANSFER_ENDPOINT_SPI)
+    counters = &priv->transfer_counters[FPI_TRANSFER_COUNTER_SLOT_SPI];
+  else
+    counters = &priv->transfer_counters[(endpoint & 0x0f) | ((endpoint & 0x80) >> 3)];
+
+  if (latency_usec > 0)
+    bucket = MIN (g_bit_storage (latency_usec), FP_DEVICE_TRANSFER_LATENCY_BUCKETS - 1);
+
+  fpi_transfer_counter_add (&counters->transfers, 1);
+  fpi_transfer_counter_add (&counters->latency[bucket], 1);
+
+  /* Only successful transfers count, even if a failed one moved some data */
+  if (bytes > 0 && !error)
+    fpi_transfer_counter_add (&counters->bytes, bytes);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      fpi_transfer_counter_add (&counters->cancelled, 1);
+    }
+  else if (error)
+    {
+      fpi_transfer_counter_add (&counters->errors, 1);
+
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+          g_error_matches (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT))
+        fpi_transfer_counter_add (&counters->timeouts, 1);
+    }
 }
 
 /**
@@ -2118,15 +2598,28 @@ fpi_device_report_finger_status (FpDevice           *device,
 {
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autofree char *status_string = NULL;
+  FpFingerStatusFlags old_status;
+
+  g_rec_mutex_lock (&priv->state_mutex);
+  old_status = priv->finger_status;
+  priv->finger_status = finger_status;
+  g_rec_mutex_unlock (&priv->state_mutex);
 
-  if (priv->finger_status == finger_status)
+  if (old_status == finger_status)
     return FALSE;
 
   status_string = g_flags_to_string (FP_TYPE_FINGER_STATUS_FLAGS, finger_status);
   fp_dbg ("Device reported finger status change: %s", status_string);
 
-  priv->finger_status = finger_status;
-  g_object_notify (G_OBJECT (device), "finger-status");
+  if ((finger_status & FP_FINGER_STATUS_NEEDED) &&
+      !(old_status & FP_FINGER_STATUS_NEEDED))
+    fpi_device_trace (device, FP_DEVICE_TRACE_READY);
+
+  if ((finger_status & FP_FINGER_STATUS_PRESENT) &&
+      !(old_status & FP_FINGER_STATUS_PRESENT))
+    fpi_device_trace (device, FP_DEVICE_TRACE_FINGER_ON);
+
+  device_notify (device, "finger-status");
 
   return TRUE;
 }
@@ -2149,8 +2642,7 @@ fpi_device_report_finger_status_changes (FpDevice           *device,
                                          FpFingerStatusFlags added_status,
                                          FpFingerStatusFlags removed_status)
 {
-  FpDevicePrivate *priv = fp_device_get_instance_private (device);
-  FpFingerStatusFlags finger_status = priv->finger_status;
+  FpFingerStatusFlags finger_status = fp_device_get_finger_status (device);
 
   finger_status |= added_status;
   finger_status &= ~removed_status;
@@ -2162,8 +2654,13 @@ static void
 update_temp_timeout (FpDevice *device, gpointer user_data)
 {
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  gboolean is_active;
+
+  g_rec_mutex_lock (&priv->state_mutex);
+  is_active = priv->temp_last_active;
+  g_rec_mutex_unlock (&priv->state_mutex);
 
-  fpi_device_update_temp (device, priv->temp_last_active);
+  fpi_device_update_temp (device, is_active);
 }
 
 /**
@@ -2184,6 +2681,7 @@ fpi_device_update_temp (FpDevice *device, gboolean is_active)
   gdouble next_threshold;
   gdouble old_ratio;
   FpTemperature old_temp;
+  FpTemperature new_temp;
   g_autofree char *old_temp_str = NULL;
   g_autofree char *new_temp_str = NULL;
 
@@ -2193,6 +2691,8 @@ fpi_device_update_temp (FpDevice *device, gboolean is_active)
       return;
     }
 
+  g_rec_mutex_lock (&priv->state_mutex);
+
   passed_seconds = (now - priv->temp_last_update) / 1e6;
   old_ratio = priv->temp_current_ratio;
 
@@ -2246,11 +2746,32 @@ fpi_device_update_temp (FpDevice *device, gboolean is_active)
            old_temp_str,
            new_temp_str);
 
-  if (priv->temp_current != old_temp)
-    g_object_notify (G_OBJECT (device), "temperature");
+  g_clear_pointer (&priv->temp_timeout, g_source_destroy);
+
+  if (next_threshold >= 0)
+    {
+      /* Set passed_seconds to the time until the next update is needed */
+      if (is_active)
+        passed_seconds = -priv->temp_hot_seconds * log ((next_threshold - 1.0) / (priv->temp_current_ratio - 1.0));
+      else
+        passed_seconds = -priv->temp_cold_seconds * log (next_threshold / priv->temp_current_ratio);
+
+      passed_seconds += TEMP_DELAY_SECONDS;
+
+      priv->temp_timeout = fpi_device_add_timeout (device,
+                                                   passed_seconds * 1000,
+                                                   update_temp_timeout,
+                                                   NULL, NULL);
+    }
+
+  new_temp = priv->temp_current;
+  g_rec_mutex_unlock (&priv->state_mutex);
+
+  if (new_temp != old_temp)
+    device_notify (device, "temperature");
 
   /* If the device is HOT, then do an internal cancellation of long running tasks. */
-  if (priv->temp_current == FP_TEMPERATURE_HOT)
+  if (new_temp == FP_TEMPERATURE_HOT)
     {
       if (priv->current_action == FPI_DEVICE_ACTION_ENROLL ||
           priv->current_action == FPI_DEVICE_ACTION_VERIFY ||
@@ -2263,22 +2784,4 @@ fpi_device_update_temp (FpDevice *device, gboolean is_active)
           g_cancellable_cancel (priv->current_cancellable);
         }
     }
-
-  g_clear_pointer (&priv->temp_timeout, g_source_destroy);
-
-  if (next_threshold < 0)
-    return;
-
-  /* Set passed_seconds to the time until the next update is needed */
-  if (is_active)
-    passed_seconds = -priv->temp_hot_seconds * log ((next_threshold - 1.0) / (priv->temp_current_ratio - 1.0));
-  else
-    passed_seconds = -priv->temp_cold_seconds * log (next_threshold / priv->temp_current_ratio);
-
-  passed_seconds += TEMP_DELAY_SECONDS;
-
-  priv->temp_timeout = fpi_device_add_timeout (device,
-                                               passed_seconds * 1000,
-                                               update_temp_timeout,
-                                               NULL, NULL);
 }
@@ -96,6 +96,17 @@ struct _FpIdEntry
  *   #FpPrint's. It is permissible to temporarily open the USB device if this
  *   is required for the operation. If an error is returned, then the device
  *   will be destroyed again immediately and never reported to the API user.
+ * @probe_in_thread: Alternative to @probe for drivers which need blocking
+ *   calls (e.g. synchronous #GUsbDevice requests) to probe the device. It is
+ *   run on a worker thread so that multiple devices are probed concurrently.
+ *   Return the device identifier in @device_id and %TRUE on success, or
+ *   %FALSE with @error set. A driver which only learns the number of enroll
+ *   stages while probing returns it in @nr_enroll_stages, leaving it at 0
+ *   keeps the class default. The result is reported from the main context as
+ *   if fpi_device_set_nr_enroll_stages() and fpi_device_probe_complete() were
+ *   called. The function must not change any device state, add timeouts,
+ *   submit transfers or run SSMs. Only one of @probe and @probe_in_thread may
+ *   be set.
  * @open: Open the device for further operations. Any of the normal actions are
  *   guaranteed to only happen when the device is open (this includes delete).
  * @close: Close the device again
@@ -160,6 +171,10 @@ struct _FpDeviceClass
   /* Callbacks */
   gint (*usb_discover) (GUsbDevice *usb_device);
   void (*probe)    (FpDevice *device);
+  gboolean (*probe_in_thread) (FpDevice *device,
+                               gchar   **device_id,
+                               gint     *nr_enroll_stages,
+                               GError  **error);
   void (*open)     (FpDevice *device);
   void (*close)    (FpDevice *device);
   void (*enroll)   (FpDevice *device);
@@ -319,6 +334,9 @@ void fpi_device_identify_report (FpDevice *device,
                                  FpPrint  *print,
                                  GError   *error);
 
+void fpi_device_trace (FpDevice          *device,
+                       FpDeviceTracePhase phase);
+
 gboolean fpi_device_report_finger_status (FpDevice           *device,
                                           FpFingerStatusFlags finger_status);
 gboolean fpi_device_report_finger_status_changes (FpDevice           *device,
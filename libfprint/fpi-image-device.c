@@ -44,6 +44,13 @@ fp_image_device_get_instance_private (FpImageDevice *self)
 static void fp_image_device_change_state (FpImageDevice      *self,
                                           FpiImageDeviceState state);
 
+/* Images with less than this share of 16x16 blocks showing ridges are
+ * rejected before the minutiae detection. In the driver test captures the
+ * lowest share is about 27%, swipe sensors leaving a lot of blank area. */
+#define QUALITY_BLOCK_SIZE 16
+#define QUALITY_BLOCK_MIN_SQ_DEV (10 * 10)
+#define QUALITY_MIN_FOREGROUND_RATIO 0.1
+
 /* Private shared functions */
 
 void
@@ -264,6 +271,8 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
       error = fpi_device_retry_new_msg (FP_DEVICE_RETRY_GENERAL, "Minutiae detection failed, please retry");
     }
 
+  fpi_device_trace (device, FP_DEVICE_TRACE_MINUTIAE);
+
   action = fpi_device_get_current_action (device);
 
   if (action == FPI_DEVICE_ACTION_CAPTURE)
@@ -326,6 +335,7 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
         result = fpi_print_bz3_match (template, print, priv->bz3_threshold, &error);
       else
         result = FPI_MATCH_ERROR;
+      fpi_device_trace (device, FP_DEVICE_TRACE_MATCH);
 
       if (!error || error->domain == FP_DEVICE_RETRY)
         fpi_device_verify_report (device, result, g_steal_pointer (&print), g_steal_pointer (&error));
@@ -349,6 +359,7 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
               break;
             }
         }
+      fpi_device_trace (device, FP_DEVICE_TRACE_MATCH);
 
       if (!error || error->domain == FP_DEVICE_RETRY)
         fpi_device_identify_report (device, result, g_steal_pointer (&print), g_steal_pointer (&error));
@@ -367,6 +378,33 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
     }
 }
 
+static gboolean
+fp_image_device_check_image_quality (FpImageDevice *self,
+                                     FpImage       *image,
+                                     FpDeviceRetry *retry)
+{
+  FpImageDeviceClass *cls = FP_IMAGE_DEVICE_GET_CLASS (self);
+  gdouble ratio;
+
+  ratio = fpi_image_get_foreground_ratio (image, QUALITY_BLOCK_SIZE,
+                                          QUALITY_BLOCK_MIN_SQ_DEV);
+  if (ratio >= QUALITY_MIN_FOREGROUND_RATIO)
+    return TRUE;
+
+  fp_dbg ("Rejecting image, only %.1f%% of it shows ridges", ratio * 100);
+
+  if (ratio == 0)
+    /* Blank, or smudged by a wet or pressed finger */
+    *retry = FP_DEVICE_RETRY_REMOVE_FINGER;
+  else if (cls->img_height < 0)
+    /* Swipe sensors, the image height depends on the swipe */
+    *retry = FP_DEVICE_RETRY_TOO_SHORT;
+  else
+    *retry = FP_DEVICE_RETRY_CENTER_FINGER;
+
+  return FALSE;
+}
+
 /*********************************************************/
 /* Private API */
 
@@ -392,6 +430,27 @@ fpi_image_device_set_bz3_threshold (FpImageDevice *self,
   priv->bz3_threshold = bz3_threshold;
 }
 
+/**
+ * fpi_image_device_set_minutiae_profile:
+ * @self: a #FpImageDevice imaging fingerprint device
+ * @profile: #FpiMinutiaeProfile to use
+ *
+ * Dynamically select the minutiae extraction profile. Like
+ * fpi_image_device_set_bz3_threshold(), this is only needed for drivers that
+ * support devices with different properties, e.g. both small swipe and
+ * larger press sensors.
+ */
+void
+fpi_image_device_set_minutiae_profile (FpImageDevice     *self,
+                                       FpiMinutiaeProfile profile)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+
+  g_return_if_fail (FP_IS_IMAGE_DEVICE (self));
+
+  priv->minutiae_profile = profile;
+}
+
 /**
  * fpi_image_device_report_finger_status:
  * @self: a #FpImageDevice imaging fingerprint device
@@ -480,6 +539,7 @@ fpi_image_device_image_captured (FpImageDevice *self, FpImage *image)
 {
   FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
   FpiDeviceAction action;
+  FpDeviceRetry retry;
 
   action = fpi_device_get_current_action (FP_DEVICE (self));
 
@@ -491,8 +551,20 @@ fpi_image_device_image_captured (FpImageDevice *self, FpImage *image)
                     action == FPI_DEVICE_ACTION_CAPTURE);
 
   g_debug ("Image device captured an image");
+  fpi_device_trace (FP_DEVICE (self), FP_DEVICE_TRACE_CAPTURE);
+
+  /* Skip the minutiae detection for images that cannot contain enough
+   * minutiae. Captures are passed on as is, they may be used to debug. */
+  if (action != FPI_DEVICE_ACTION_CAPTURE &&
+      !fp_image_device_check_image_quality (self, image, &retry))
+    {
+      g_object_unref (image);
+      fpi_image_device_retry_scan (self, retry);
+      return;
+    }
 
   priv->minutiae_scan_active = TRUE;
+  image->minutiae_profile = priv->minutiae_profile;
 
   /* XXX: We also detect minutiae in capture mode, we solely do this
    *      to normalize the image which will happen as a by-product. */
@@ -651,6 +723,7 @@ fpi_image_device_activate_complete (FpImageDevice *self, GError *error)
     }
 
   g_debug ("Image device activation completed");
+  fpi_device_trace (FP_DEVICE (self), FP_DEVICE_TRACE_ACTIVATE);
 
   priv->active = TRUE;
 
@@ -21,6 +21,7 @@
 
 #include "fpi-device.h"
 #include "fp-image-device.h"
+#include "fpi-image.h"
 
 /**
  * FpiImageDeviceState:
@@ -75,6 +76,8 @@ typedef enum {
  * @bz3_threshold: Threshold to consider bozorth3 score a match, default: 40
  * @img_width: Width of the image, only provide if constant
  * @img_height: Height of the image, only provide if constant
+ * @minutiae_profile: #FpiMinutiaeProfile for the minutiae extraction,
+ *   default: %FPI_MINUTIAE_PROFILE_DEFAULT
  * @img_open: Open the device and do basic initialization
  *   (use this instead of the #FpDeviceClass open vfunc)
  * @img_close: Close the device
@@ -108,6 +111,8 @@ struct _FpImageDeviceClass
   gint          img_width;
   gint          img_height;
 
+  FpiMinutiaeProfile minutiae_profile;
+
   void          (*img_open)     (FpImageDevice *dev);
   void          (*img_close)    (FpImageDevice *dev);
   void          (*activate)     (FpImageDevice *dev);
@@ -118,6 +123,8 @@ struct _FpImageDeviceClass
 
 void fpi_image_device_set_bz3_threshold (FpImageDevice *self,
                                          gint           bz3_threshold);
+void fpi_image_device_set_minutiae_profile (FpImageDevice     *self,
+                                            FpiMinutiaeProfile profile);
 
 void fpi_image_device_session_error (FpImageDevice *self,
                                      GError        *error);
@@ -108,6 +108,56 @@ fpi_mean_sq_diff_norm (const guint8 *buf1,
   return res / size;
 }
 
+/**
+ * fpi_image_get_foreground_ratio:
+ * @image: a #FpImage
+ * @block_size: width and height of the blocks in pixels
+ * @min_sq_dev: minimum squared standard deviation of a foreground block
+ *
+ * Splits the image into square blocks and counts the ones showing enough
+ * contrast, as measured by fpi_std_sq_dev(), to contain ridges. Blocks at
+ * the right and bottom edge which are cut off are ignored.
+ *
+ * This is cheap compared to the minutiae detection and is used to reject
+ * blank, smudged or partial images early on.
+ *
+ * Returns: the ratio of foreground blocks, between 0 and 1
+ */
+gdouble
+fpi_image_get_foreground_ratio (FpImage *image,
+                                guint    block_size,
+                                gint     min_sq_dev)
+{
+  g_autofree guint8 *block = NULL;
+  guint foreground = 0, total = 0;
+  guint bx, by, y;
+
+  g_return_val_if_fail (FP_IS_IMAGE (image), 0);
+  g_return_val_if_fail (block_size > 0, 0);
+
+  if (image->width < block_size || image->height < block_size)
+    return 0;
+
+  block = g_malloc (block_size * block_size);
+
+  for (by = 0; by + block_size <= image->height; by += block_size)
+    {
+      for (bx = 0; bx + block_size <= image->width; bx += block_size)
+        {
+          for (y = 0; y < block_size; y++)
+            memcpy (block + y * block_size,
+                    image->data + (by + y) * image->width + bx,
+                    block_size);
+
+          if (fpi_std_sq_dev (block, block_size * block_size) >= min_sq_dev)
+            foreground++;
+          total++;
+        }
+    }
+
+  return (gdouble) foreground / total;
+}
+
 FpImage *
 fpi_image_resize (FpImage *orig_img,
                   guint    w_factor,
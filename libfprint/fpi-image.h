@@ -40,6 +40,25 @@ typedef enum {
   FPI_IMAGE_PARTIAL         = 1 << 3,
 } FpiImageFlags;
 
+/**
+ * FpiMinutiaeProfile:
+ * @FPI_MINUTIAE_PROFILE_DEFAULT: Run all stages of the NBIS minutiae
+ *   extraction
+ * @FPI_MINUTIAE_PROFILE_FAST: Skip the second refinement of the direction
+ *   map, the high curvature analysis, the removal of pores and the neighbour
+ *   ridge counting. This is intended for swipe sensors whose prints still
+ *   score well above their bozorth3 threshold. Prints enrolled with another
+ *   profile may score differently, check the fp-minutiae benchmark before
+ *   switching a driver.
+ *
+ * Presets for the minutiae extraction, selecting a tradeoff between the
+ * quality of the detected minutiae and the time needed to find them.
+ */
+typedef enum {
+  FPI_MINUTIAE_PROFILE_DEFAULT = 0,
+  FPI_MINUTIAE_PROFILE_FAST,
+} FpiMinutiaeProfile;
+
 /**
  * FpImage:
  * @width: Width of the image
@@ -64,12 +83,14 @@ struct _FpImage
   FpiImageFlags flags;
 
   /*< private >*/
-  guint8    *data;
-  guint8    *binarized;
+  guint8            *data;
+  guint8            *binarized;
+
+  GPtrArray         *minutiae;
 
-  GPtrArray *minutiae;
+  gboolean           detection_in_progress;
 
-  gboolean   detection_in_progress;
+  FpiMinutiaeProfile minutiae_profile;
 };
 
 gint fpi_std_sq_dev (const guint8 *buf,
@@ -78,6 +99,10 @@ gint fpi_mean_sq_diff_norm (const guint8 *buf1,
                             const guint8 *buf2,
                             gint          size);
 
+gdouble fpi_image_get_foreground_ratio (FpImage *image,
+                                        guint    block_size,
+                                        gint     min_sq_dev);
+
 FpImage *fpi_image_resize (FpImage *orig,
                            guint    w_factor,
                            guint    h_factor);
@@ -23,6 +23,22 @@
 
 #include <openssl/evp.h>
 
+/* Library steps of SDCP that can be timed, see fpi_sdcp_device_set_step_func() */
+typedef enum {
+  FPI_SDCP_STEP_X509,
+  FPI_SDCP_STEP_ECDH,
+  FPI_SDCP_STEP_KBKDF,
+  FPI_SDCP_STEP_HMAC,
+  FPI_SDCP_STEP_CLAIM_STORE,
+  FPI_SDCP_STEP_CLAIM_LOAD,
+} FpiSdcpStep;
+
+/* Called from the thread that ran @step, right after it finished */
+typedef void (*FpiSdcpStepFunc) (FpiSdcpDevice *device,
+                                 FpiSdcpStep    step,
+                                 gint64         start_usec,
+                                 gpointer       user_data);
+
 typedef struct
 {
   EVP_PKEY *host_key;
@@ -35,12 +51,19 @@ typedef struct
   guchar application_secret[SDCP_APPLICATION_SECRET_SIZE];
   guchar application_symmetric_key[SDCP_APPLICATION_SYMMETRIC_KEY_SIZE];
 
+  /* HMAC-SHA256 context keyed with application_secret, duplicated per use */
+  EVP_MAC_CTX *application_hmac_ctx;
+
   gboolean is_connected;
   gboolean supports_reconnect;
+  gboolean precompute_host_keys;
 
   gchar *claim_storage_path;
   gint64 claim_connected_time;
   gint32 claim_expiration_seconds;
+
+  FpiSdcpStepFunc step_func;
+  gpointer step_func_data;
 } FpiSdcpDevicePrivate;
 
 gboolean fpi_sdcp_set_host_keys (FpiSdcpDevice *device,
@@ -48,3 +71,7 @@ gboolean fpi_sdcp_set_host_keys (FpiSdcpDevice *device,
                                  const guchar  *host_random);
 
 void fpi_sdcp_device_delete_cached_claim (FpiSdcpDevice *self);
+
+void fpi_sdcp_device_set_step_func (FpiSdcpDevice  *device,
+                                    FpiSdcpStepFunc func,
+                                    gpointer        user_data);
@@ -23,6 +23,7 @@
 #include "fpi-sdcp-device-private.h"
 
 #include <openssl/core_names.h>
+#include <openssl/crypto.h>
 #include <openssl/ecdh.h>
 #include <openssl/evp.h>
 #include <openssl/kdf.h>
@@ -80,6 +81,9 @@
  *   SDCP-related payloads. Depending on the vendor implementation, it might be
  *   necessary for the driver to implement parsing logic to extract and provide
  *   all of the individual fields of the `ConnectResponse` to this function.
+ *   As the verification is somewhat expensive, drivers should prefer
+ *   fpi_sdcp_derive_keys_and_verify_connect_async() which will not block the
+ *   main loop while the keys are derived.
  *
  * - The driver can check if the connection is already established prior to
  *   connecting by using the function fpi_sdcp_device_is_connected().
@@ -142,6 +146,238 @@ G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (FpiSdcpDevice, fpi_sdcp_device, FP_TYPE_DEV
 
 /*********************************************************/
 
+typedef struct
+{
+  EVP_MD  *sha256;
+  EVP_MAC *hmac;
+  EVP_KDF *kbkdf;
+} SdcpAlgorithms;
+
+/*
+ * Explicitly fetching an algorithm requires a provider lookup, which is
+ * comparatively expensive. The fetched objects are immutable and reference
+ * counted by OpenSSL, so they can be shared between all devices and threads
+ * for the lifetime of the process.
+ */
+static const SdcpAlgorithms *
+sdcp_get_algorithms (void)
+{
+  static SdcpAlgorithms algorithms;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      algorithms.sha256 = EVP_MD_fetch (NULL, "SHA256", NULL);
+      algorithms.hmac = EVP_MAC_fetch (NULL, "HMAC", NULL);
+      algorithms.kbkdf = EVP_KDF_fetch (NULL, "KBKDF", NULL);
+
+      g_assert (algorithms.sha256);
+      g_assert (algorithms.hmac);
+      g_assert (algorithms.kbkdf);
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return &algorithms;
+}
+
+/*
+ * Generating a new P-256 keypair (and to a lesser extent fresh randomness) is
+ * the most expensive part of preparing an SDCP Connect. Devices which opt in
+ * through #FpiSdcpDeviceClass.precompute_host_keys share a small pool that is
+ * filled on a background thread, so that a connect only needs to pop entries.
+ * Whenever the pool is drained it falls back to generating them directly.
+ */
+#define SDCP_POOL_HOST_KEYS 2
+#define SDCP_POOL_RANDOMS   8
+
+typedef struct
+{
+  GMutex       mutex;
+  GQueue       host_keys;
+  GQueue       randoms;
+  GThreadPool *worker;
+  gboolean     refill_queued;
+} SdcpPrecomputePool;
+
+static SdcpPrecomputePool *sdcp_pool = NULL;
+
+static void
+sdcp_pool_refill_func (gpointer data, gpointer user_data)
+{
+  SdcpPrecomputePool *pool = user_data;
+
+  while (TRUE)
+    {
+      gboolean need_key, need_random;
+
+      g_mutex_lock (&pool->mutex);
+      need_key = pool->host_keys.length < SDCP_POOL_HOST_KEYS;
+      need_random = pool->randoms.length < SDCP_POOL_RANDOMS;
+      if (!need_key && !need_random)
+        pool->refill_queued = FALSE;
+      g_mutex_unlock (&pool->mutex);
+
+      if (!need_key && !need_random)
+        break;
+
+      /* Generate outside of the lock so that popping never waits on us */
+      if (need_key)
+        {
+          EVP_PKEY *key = EVP_EC_gen (SDCP_OPENSSL_CURVE_NAME);
+
+          if (!key)
+            {
+              fp_warn ("Failed to precompute SDCP host key");
+              g_mutex_lock (&pool->mutex);
+              pool->refill_queued = FALSE;
+              g_mutex_unlock (&pool->mutex);
+              break;
+            }
+
+          g_mutex_lock (&pool->mutex);
+          g_queue_push_tail (&pool->host_keys, key);
+          g_mutex_unlock (&pool->mutex);
+        }
+
+      if (need_random)
+        {
+          guchar *random = g_malloc (SDCP_RANDOM_SIZE);
+
+          RAND_bytes (random, SDCP_RANDOM_SIZE);
+
+          g_mutex_lock (&pool->mutex);
+          g_queue_push_tail (&pool->randoms, random);
+          g_mutex_unlock (&pool->mutex);
+        }
+    }
+}
+
+static void
+sdcp_pool_schedule_refill (SdcpPrecomputePool *pool)
+{
+  gboolean queue = FALSE;
+
+  g_mutex_lock (&pool->mutex);
+  if (!pool->refill_queued &&
+      (pool->host_keys.length < SDCP_POOL_HOST_KEYS ||
+       pool->randoms.length < SDCP_POOL_RANDOMS))
+    {
+      pool->refill_queued = TRUE;
+      queue = TRUE;
+    }
+  g_mutex_unlock (&pool->mutex);
+
+  if (queue)
+    g_thread_pool_push (pool->worker, GINT_TO_POINTER (TRUE), NULL);
+}
+
+static void
+sdcp_pool_start (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      SdcpPrecomputePool *pool = g_new0 (SdcpPrecomputePool, 1);
+
+      g_mutex_init (&pool->mutex);
+      g_queue_init (&pool->host_keys);
+      g_queue_init (&pool->randoms);
+      pool->worker = g_thread_pool_new (sdcp_pool_refill_func, pool,
+                                        1, FALSE, NULL);
+
+      g_atomic_pointer_set (&sdcp_pool, pool);
+      g_once_init_leave (&initialized, 1);
+    }
+
+  sdcp_pool_schedule_refill (g_atomic_pointer_get (&sdcp_pool));
+}
+
+static EVP_PKEY *
+sdcp_pool_pop_host_key (void)
+{
+  SdcpPrecomputePool *pool = g_atomic_pointer_get (&sdcp_pool);
+  EVP_PKEY *key = NULL;
+
+  if (pool)
+    {
+      g_mutex_lock (&pool->mutex);
+      key = g_queue_pop_head (&pool->host_keys);
+      g_mutex_unlock (&pool->mutex);
+
+      sdcp_pool_schedule_refill (pool);
+    }
+
+  if (!key)
+    {
+      fp_dbg ("No precomputed SDCP host key available, generating one");
+      key = EVP_EC_gen (SDCP_OPENSSL_CURVE_NAME);
+    }
+
+  return key;
+}
+
+static gboolean
+sdcp_pool_pop_random (guchar *out)
+{
+  SdcpPrecomputePool *pool = g_atomic_pointer_get (&sdcp_pool);
+  guchar *random = NULL;
+
+  if (!pool)
+    return FALSE;
+
+  g_mutex_lock (&pool->mutex);
+  random = g_queue_pop_head (&pool->randoms);
+  g_mutex_unlock (&pool->mutex);
+
+  sdcp_pool_schedule_refill (pool);
+
+  if (!random)
+    return FALSE;
+
+  memcpy (out, random, SDCP_RANDOM_SIZE);
+  OPENSSL_cleanse (random, SDCP_RANDOM_SIZE);
+  g_free (random);
+
+  return TRUE;
+}
+
+static void
+sdcp_clear_application_hmac_ctx (FpiSdcpDevice *device)
+{
+  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
+
+  g_clear_pointer (&priv->application_hmac_ctx, EVP_MAC_CTX_free);
+}
+
+/*
+ * Returns a new HMAC-SHA256 context which has already been initialized with
+ * the application secret (s), ready to be updated with the message bytes.
+ * The keyed context is set up once per claim and duplicated for each use.
+ */
+static EVP_MAC_CTX *
+sdcp_new_application_hmac_ctx (FpiSdcpDevice *device)
+{
+  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
+
+  OSSL_PARAM hmac_sha256_params[] = {
+    OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (gchar *) "SHA256", 0),
+    OSSL_PARAM_construct_end (),
+  };
+
+  if (!priv->application_hmac_ctx)
+    {
+      priv->application_hmac_ctx = EVP_MAC_CTX_new (sdcp_get_algorithms ()->hmac);
+      EVP_MAC_init (priv->application_hmac_ctx, priv->application_secret,
+                    SDCP_APPLICATION_SECRET_SIZE, hmac_sha256_params);
+    }
+
+  return EVP_MAC_CTX_dup (priv->application_hmac_ctx);
+}
+
+/*********************************************************/
+
 static EVP_PKEY *
 sdcp_get_pkey (const guchar *private_key_bytes, const guchar *public_key_bytes)
 {
@@ -229,6 +465,8 @@ fpi_sdcp_set_host_keys (FpiSdcpDevice *device,
 
   if (private_key_bytes)
     key = sdcp_get_pkey (private_key_bytes, NULL);
+  else if (priv->precompute_host_keys)
+    key = sdcp_pool_pop_host_key ();
   else
     key = EVP_EC_gen (SDCP_OPENSSL_CURVE_NAME);
 
@@ -281,7 +519,8 @@ fpi_sdcp_set_host_keys (FpiSdcpDevice *device,
               random_bytes,
               SDCP_RANDOM_SIZE);
     }
-  else
+  else if (!priv->precompute_host_keys ||
+           !sdcp_pool_pop_random (priv->host_random))
     {
       random = fpi_sdcp_generate_random ();
       memcpy (priv->host_random,
@@ -293,13 +532,44 @@ fpi_sdcp_set_host_keys (FpiSdcpDevice *device,
   return TRUE;
 }
 
+static inline gint64
+sdcp_step_start (FpiSdcpDevice *device)
+{
+  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
+
+  return priv->step_func ? g_get_monotonic_time () : 0;
+}
+
+static inline void
+sdcp_step_done (FpiSdcpDevice *device, FpiSdcpStep step, gint64 start_usec)
+{
+  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
+
+  if (priv->step_func)
+    priv->step_func (device, step, start_usec, priv->step_func_data);
+}
+
+/*
+ * Sets a function to call after each timed step of @device. This lets
+ * benchmarks time the steps that the public functions are made up of.
+ */
+void
+fpi_sdcp_device_set_step_func (FpiSdcpDevice  *device,
+                               FpiSdcpStepFunc func,
+                               gpointer        user_data)
+{
+  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
+
+  priv->step_func = func;
+  priv->step_func_data = user_data;
+}
+
 static int
 sdcp_get_kbkdf_secret (const guchar *key, gsize key_len,
                        const guchar *label, gsize label_len,
                        const guchar *context, gsize context_len,
                        guchar **secret, gsize secret_len)
 {
-  EVP_KDF *kdf;
   EVP_KDF_CTX *kdf_ctx;
   guchar key_buf[SDCP_MAX_SECRET_SIZE];
   g_autofree guchar *out = g_malloc0 (secret_len);
@@ -323,16 +593,15 @@ sdcp_get_kbkdf_secret (const guchar *key, gsize key_len,
 
   params[i++] = OSSL_PARAM_construct_end ();
 
-  kdf = EVP_KDF_fetch (NULL, "KBKDF", NULL);
-  kdf_ctx = EVP_KDF_CTX_new (kdf);
+  kdf_ctx = EVP_KDF_CTX_new (sdcp_get_algorithms ()->kbkdf);
 
   if (EVP_KDF_derive (kdf_ctx, out, secret_len, params) <= 0) {
     fp_err ("Failure deriving KBKDF secret");
+    EVP_KDF_CTX_free (kdf_ctx);
     return -1;
   }
 
   EVP_KDF_CTX_free (kdf_ctx);
-  EVP_KDF_free (kdf);
 
   if (!secret || !(*secret))
     g_free (*secret);
@@ -417,6 +686,7 @@ sdcp_derive_application_keys (FpiSdcpDevice *device)
                    + SDCP_APPLICATION_SYMMETRIC_KEY_SIZE);
 
   memcpy (priv->application_secret, application_keys, SDCP_APPLICATION_SECRET_SIZE);
+  sdcp_clear_application_hmac_ctx (device);
   memcpy (priv->application_symmetric_key, application_keys + SDCP_APPLICATION_SECRET_SIZE,
           SDCP_APPLICATION_SYMMETRIC_KEY_SIZE);
 
@@ -561,6 +831,7 @@ fpi_sdcp_device_cache_connected_claim (FpiSdcpDevice *self)
   g_autofree guchar *data = NULL;
   gsize data_len;
   const gchar *path = NULL;
+  gint64 start_usec = sdcp_step_start (self);
 
   g_assert (priv->is_connected);
 
@@ -630,6 +901,7 @@ fpi_sdcp_device_cache_connected_claim (FpiSdcpDevice *self)
     }
 
   fp_dbg ("Cached SDCP claim to file \"%s\"", path);
+  sdcp_step_done (self, FPI_SDCP_STEP_CLAIM_STORE, start_usec);
 }
 
 static gboolean
@@ -750,9 +1022,12 @@ fpi_sdcp_device_init_claim (FpiSdcpDevice *self)
   g_autofree guchar *app_symmetric_key = NULL;
   g_autofree gchar *cached_boot_id = NULL;
   gint64 cached_connected_time;
+  gint64 start_usec;
   gboolean read = FALSE;
 
+  start_usec = sdcp_step_start (self);
   cached = fpi_sdcp_device_get_cached_claim_variant (self);
+  sdcp_step_done (self, FPI_SDCP_STEP_CLAIM_LOAD, start_usec);
 
   if (!cached)
     goto generate_new;
@@ -817,6 +1092,7 @@ fpi_sdcp_device_init_claim (FpiSdcpDevice *self)
   if (!read)
     goto cache_init_failed;
   memcpy (priv->application_secret, app_secret, SDCP_APPLICATION_SECRET_SIZE);
+  sdcp_clear_application_hmac_ctx (self);
 
   read = sdcp_get_iter_bytes_value (app_symmetric_key_iter, SDCP_APPLICATION_SYMMETRIC_KEY_SIZE,
                                     &app_symmetric_key);
@@ -910,18 +1186,12 @@ fpi_sdcp_derive_keys_and_verify_connect (FpiSdcpDevice          *device,
   FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
 
   EVP_MD_CTX *sh256_ctx;
-  EVP_MD *sha256;
-  EVP_MAC *hmac;
   EVP_MAC_CTX *hmac_ctx;
   guchar claim_hash[SDCP_DIGEST_SIZE];
   guint claim_hash_len = 0;
   guchar host_connect_mac[SDCP_DIGEST_SIZE];
   gsize host_connect_mac_len = 0;
-
-  OSSL_PARAM hmac_sha256_params[] = {
-    OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (gchar *) "SHA256", 0),
-    OSSL_PARAM_construct_end (),
-  };
+  gint64 start_usec;
 
   /* Ensure we can parse the provided certificate and print its details if dbg is enabled */
   /* TODO: Maybe this is not actually needed? but nice to have at the beginning anyway... */
@@ -931,6 +1201,8 @@ fpi_sdcp_derive_keys_and_verify_connect (FpiSdcpDevice          *device,
   BUF_MEM *bio_mem;
 
   const guchar *cert_buf_ptr = connect_response->model_certificate;
+
+  start_usec = sdcp_step_start (device);
   cert = d2i_X509 (NULL, &cert_buf_ptr, connect_response->model_certificate_len);
   g_assert (cert);
 
@@ -940,14 +1212,20 @@ fpi_sdcp_derive_keys_and_verify_connect (FpiSdcpDevice          *device,
     (int) bio_mem->length, bio_mem->data);
   BIO_free (bio);
   X509_free (cert);
+  sdcp_step_done (device, FPI_SDCP_STEP_X509, start_usec);
 
+  start_usec = sdcp_step_start (device);
   g_assert (sdcp_derive_key_agreement (device, connect_response->firmware_public_key));
+  sdcp_step_done (device, FPI_SDCP_STEP_ECDH, start_usec);
+
+  start_usec = sdcp_step_start (device);
   g_assert (sdcp_derive_master_secret (device, connect_response->device_random));
   g_assert (sdcp_derive_application_keys (device));
+  sdcp_step_done (device, FPI_SDCP_STEP_KBKDF, start_usec);
 
+  start_usec = sdcp_step_start (device);
   sh256_ctx = EVP_MD_CTX_create ();
-  sha256 = EVP_MD_fetch (NULL, "SHA256", NULL);
-  EVP_DigestInit_ex (sh256_ctx, sha256, NULL);
+  EVP_DigestInit_ex (sh256_ctx, sdcp_get_algorithms ()->sha256, NULL);
   EVP_DigestUpdate (sh256_ctx, connect_response->model_certificate,
                     connect_response->model_certificate_len);
   EVP_DigestUpdate (sh256_ctx, connect_response->device_public_key, SDCP_PUBLIC_KEY_SIZE);
@@ -957,18 +1235,15 @@ fpi_sdcp_derive_keys_and_verify_connect (FpiSdcpDevice          *device,
   EVP_DigestUpdate (sh256_ctx, connect_response->device_signature, SDCP_SIGNATURE_SIZE);
   EVP_DigestFinal_ex (sh256_ctx, claim_hash, &claim_hash_len);
   EVP_MD_CTX_free (sh256_ctx);
-  EVP_MD_free (sha256);
 
   g_assert (claim_hash_len == SDCP_DIGEST_SIZE);
 
-  hmac = EVP_MAC_fetch (NULL, "hmac", NULL);
-  hmac_ctx = EVP_MAC_CTX_new (hmac);
-  EVP_MAC_init (hmac_ctx, priv->application_secret, SDCP_DIGEST_SIZE, hmac_sha256_params);
+  hmac_ctx = sdcp_new_application_hmac_ctx (device);
   EVP_MAC_update (hmac_ctx, (guchar *) "connect", sizeof ("connect"));
   EVP_MAC_update (hmac_ctx, claim_hash, SDCP_DIGEST_SIZE);
   EVP_MAC_final (hmac_ctx, host_connect_mac, &host_connect_mac_len, SDCP_DIGEST_SIZE);
   EVP_MAC_CTX_free (hmac_ctx);
-  EVP_MAC_free (hmac);
+  sdcp_step_done (device, FPI_SDCP_STEP_HMAC, start_usec);
 
   g_assert (host_connect_mac_len == SDCP_DIGEST_SIZE);
 
@@ -985,6 +1260,93 @@ fpi_sdcp_derive_keys_and_verify_connect (FpiSdcpDevice          *device,
   }
 }
 
+static void
+sdcp_verify_connect_thread (GTask        *task,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+  FpiSdcpDevice *device = FPI_SDCP_DEVICE (source_object);
+  FpiSdcpConnectResponse *connect_response = task_data;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  if (!fpi_sdcp_derive_keys_and_verify_connect (device, connect_response))
+    {
+      g_task_return_error (task,
+                           fpi_device_error_new_msg (FP_DEVICE_ERROR_PROTO,
+                                                     "Secure connection could "
+                                                     "not be established"));
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * fpi_sdcp_derive_keys_and_verify_connect_async:
+ * @device: The #FpiSdcpDevice
+ * @connect_response: (transfer full): #FpiSdcpConnectResponse filled with the
+ *   `ConnectResponse` received from the device
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronous variant of fpi_sdcp_derive_keys_and_verify_connect().
+ *
+ * The key agreement, secret derivations and MAC verification are performed
+ * on a worker thread so that the main loop (and with it any other device in
+ * the same process) is not blocked while the connection is being verified.
+ * @callback is invoked in the thread-default main context of the caller, so
+ * drivers can safely resume their state machine from it.
+ *
+ * The driver must not use any other SDCP function on @device until @callback
+ * has been invoked. Use fpi_sdcp_derive_keys_and_verify_connect_finish() to
+ * retrieve the result.
+ */
+void
+fpi_sdcp_derive_keys_and_verify_connect_async (FpiSdcpDevice          *device,
+                                               FpiSdcpConnectResponse *connect_response,
+                                               GCancellable           *cancellable,
+                                               GAsyncReadyCallback     callback,
+                                               gpointer                user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (FPI_IS_SDCP_DEVICE (device));
+  g_return_if_fail (connect_response != NULL);
+
+  task = g_task_new (device, cancellable, callback, user_data);
+  g_task_set_source_tag (task, fpi_sdcp_derive_keys_and_verify_connect_async);
+  g_task_set_task_data (task, connect_response,
+                        (GDestroyNotify) fpi_sdcp_connect_response_free);
+
+  g_task_run_in_thread (task, sdcp_verify_connect_thread);
+}
+
+/**
+ * fpi_sdcp_derive_keys_and_verify_connect_finish:
+ * @device: The #FpiSdcpDevice
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for a #GError, or %NULL
+ *
+ * Finishes an operation started with
+ * fpi_sdcp_derive_keys_and_verify_connect_async().
+ *
+ * Returns: %TRUE when the connection was verified and a claim has been
+ *   established, otherwise %FALSE with @error set.
+ */
+gboolean
+fpi_sdcp_derive_keys_and_verify_connect_finish (FpiSdcpDevice *device,
+                                                GAsyncResult  *result,
+                                                GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, device), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /**
  * fpi_sdcp_derive_keys_and_verify_connect_buf:
  * @device: The #FpiSdcpDevice
@@ -1191,28 +1553,21 @@ fpi_sdcp_verify_reconnect (FpiSdcpDevice *device,
 {
   FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
 
-  EVP_MAC *hmac;
   EVP_MAC_CTX *hmac_ctx;
   guchar host_reconnect_mac[SDCP_DIGEST_SIZE];
   gsize host_reconnect_mac_len = 0;
-
-  OSSL_PARAM hmac_sha256_params[] = {
-    OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (gchar *) "SHA256", 0),
-    OSSL_PARAM_construct_end (),
-  };
+  gint64 start_usec;
 
   /* reconnect checks private member to allow reconnecting after claim expired */
   g_assert (priv->is_connected);
 
-  hmac = EVP_MAC_fetch (NULL, "hmac", NULL);
-  hmac_ctx = EVP_MAC_CTX_new (hmac);
-  EVP_MAC_init (hmac_ctx, priv->application_secret, SDCP_APPLICATION_SECRET_SIZE,
-                hmac_sha256_params);
+  start_usec = sdcp_step_start (device);
+  hmac_ctx = sdcp_new_application_hmac_ctx (device);
   EVP_MAC_update (hmac_ctx, (guchar *) "reconnect", sizeof ("reconnect"));
   EVP_MAC_update (hmac_ctx, host_reconnect_random, SDCP_DIGEST_SIZE);
   EVP_MAC_final (hmac_ctx, host_reconnect_mac, &host_reconnect_mac_len, SDCP_DIGEST_SIZE);
   EVP_MAC_CTX_free (hmac_ctx);
-  EVP_MAC_free (hmac);
+  sdcp_step_done (device, FPI_SDCP_STEP_HMAC, start_usec);
 
   g_assert (host_reconnect_mac_len == SDCP_DIGEST_SIZE);
 
@@ -1254,30 +1609,18 @@ fpi_sdcp_verify_authorized_identity (FpiSdcpDevice *device,
                                      const guchar  *device_enrollment_id,
                                      const guchar  *device_identify_mac)
 {
-  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
-
-  EVP_MAC *hmac;
   EVP_MAC_CTX *hmac_ctx;
   guchar host_identify_mac[SDCP_DIGEST_SIZE];
   gsize host_identify_mac_len = 0;
 
-  OSSL_PARAM hmac_sha256_params[] = {
-    OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (gchar *) "SHA256", 0),
-    OSSL_PARAM_construct_end (),
-  };
-
   g_assert (fpi_sdcp_device_is_connected (device));
 
-  hmac = EVP_MAC_fetch (NULL, "hmac", NULL);
-  hmac_ctx = EVP_MAC_CTX_new (hmac);
-  EVP_MAC_init (hmac_ctx, priv->application_secret, SDCP_APPLICATION_SECRET_SIZE,
-                hmac_sha256_params);
+  hmac_ctx = sdcp_new_application_hmac_ctx (device);
   EVP_MAC_update (hmac_ctx, (guchar *) "identify", sizeof ("identify"));
   EVP_MAC_update (hmac_ctx, host_identify_nonce, SDCP_NONCE_SIZE);
   EVP_MAC_update (hmac_ctx, device_enrollment_id, SDCP_ENROLLMENT_ID_SIZE);
   EVP_MAC_final (hmac_ctx, host_identify_mac, &host_identify_mac_len, SDCP_DIGEST_SIZE);
   EVP_MAC_CTX_free (hmac_ctx);
-  EVP_MAC_free (hmac);
 
   g_assert (host_identify_mac_len == SDCP_DIGEST_SIZE);
 
@@ -1307,6 +1650,7 @@ fpi_sdcp_generate_random (void)
 
   RAND_bytes (buf, SDCP_RANDOM_SIZE);
   memcpy (out, buf, SDCP_RANDOM_SIZE);
+  OPENSSL_cleanse (buf, SDCP_RANDOM_SIZE);
 
   return g_steal_pointer (&out);
 }
@@ -1333,29 +1677,17 @@ guchar *
 fpi_sdcp_generate_enrollment_id (FpiSdcpDevice *device,
                                  const guchar  *device_nonce)
 {
-  FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (device);
-
-  EVP_MAC *hmac;
   EVP_MAC_CTX *hmac_ctx;
   g_autofree guchar *out = g_malloc0 (SDCP_ENROLLMENT_ID_SIZE);
   gsize out_len;
 
-  OSSL_PARAM hmac_sha256_params[] = {
-    OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (gchar *) "SHA256", 0),
-    OSSL_PARAM_construct_end (),
-  };
-
   g_assert (fpi_sdcp_device_is_connected (device));
 
-  hmac = EVP_MAC_fetch (NULL, "hmac", NULL);
-  hmac_ctx = EVP_MAC_CTX_new (hmac);
-  EVP_MAC_init (hmac_ctx, priv->application_secret, SDCP_APPLICATION_SECRET_SIZE,
-                hmac_sha256_params);
+  hmac_ctx = sdcp_new_application_hmac_ctx (device);
   EVP_MAC_update (hmac_ctx, (guchar *) "enroll", sizeof ("enroll"));
   EVP_MAC_update (hmac_ctx, device_nonce, SDCP_NONCE_SIZE);
   EVP_MAC_final (hmac_ctx, out, &out_len, SDCP_ENROLLMENT_ID_SIZE);
   EVP_MAC_CTX_free (hmac_ctx);
-  EVP_MAC_free (hmac);
 
   g_assert (out_len == SDCP_ENROLLMENT_ID_SIZE);
   
@@ -1430,6 +1762,7 @@ fpi_sdcp_device_finalize (GObject *object)
   FpiSdcpDevicePrivate *priv = fpi_sdcp_device_get_instance_private (self);
 
   g_clear_pointer (&priv->host_key, EVP_PKEY_free);
+  g_clear_pointer (&priv->application_hmac_ctx, EVP_MAC_CTX_free);
   g_clear_pointer (&priv->claim_storage_path, g_free);
 
   G_OBJECT_CLASS (fpi_sdcp_device_parent_class)->finalize (object);
@@ -1447,6 +1780,10 @@ fpi_sdcp_device_constructed (GObject *object)
 
   priv->claim_expiration_seconds = cls->claim_expiration_seconds;
   priv->supports_reconnect = cls->supports_reconnect;
+  priv->precompute_host_keys = cls->precompute_host_keys;
+
+  if (priv->precompute_host_keys)
+    sdcp_pool_start ();
 
   G_OBJECT_CLASS (fpi_sdcp_device_parent_class)->constructed (object);
 }
@@ -52,6 +52,9 @@ G_DECLARE_DERIVABLE_TYPE (FpiSdcpDevice, fpi_sdcp_device, FPI, SDCP_DEVICE, FpDe
  *   SDCP Reconnect process</ulink>
  * @claim_expiration_seconds: Time in seconds before a connected SDCP claim will
  *   be invalidated; defaults to 86400 or can be set to -1 to disable expiration.
+ * @precompute_host_keys: Boolean to indicate that host keypairs and randoms
+ *   should be taken from a process-wide pool which is refilled in the
+ *   background, so that they do not need to be generated while connecting
  *
  * Additional configuration properties to control the behavior of an #FpiSdcpDevice.
  * 
@@ -70,6 +73,7 @@ struct _FpiSdcpDeviceClass
   /*< public >*/
   gboolean supports_reconnect;
   gint32 claim_expiration_seconds;
+  gboolean precompute_host_keys;
 };
 
 /**
@@ -115,6 +119,16 @@ guchar *fpi_sdcp_get_host_random (FpiSdcpDevice *device);
 gboolean fpi_sdcp_derive_keys_and_verify_connect (FpiSdcpDevice          *device,
                                                   FpiSdcpConnectResponse *device_connect_response);
 
+void fpi_sdcp_derive_keys_and_verify_connect_async (FpiSdcpDevice          *device,
+                                                    FpiSdcpConnectResponse *device_connect_response,
+                                                    GCancellable           *cancellable,
+                                                    GAsyncReadyCallback     callback,
+                                                    gpointer                user_data);
+
+gboolean fpi_sdcp_derive_keys_and_verify_connect_finish (FpiSdcpDevice *device,
+                                                         GAsyncResult  *result,
+                                                         GError       **error);
+
 gboolean fpi_sdcp_derive_keys_and_verify_connect_buf (FpiSdcpDevice *device,
                                                       const guchar  *device_connect_response_buf,
                                                       const gsize    device_connect_response_buf_len);
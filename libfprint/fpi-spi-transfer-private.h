@@ -0,0 +1,38 @@
+/*
+ * FPrint spidev transfer handling
+ * Copyright (C) 2019-2020 Benjamin Berg <bberg@redhat.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "fpi-spi-transfer.h"
+
+#include <linux/spi/spidev.h>
+
+/* The ioctl size is limited to 14 bits, i.e. at most 511 transfers */
+#define FPI_SPI_BATCH_MAX_XFERS (((1 << _IOC_SIZEBITS) - 1) / sizeof (struct spi_ioc_transfer))
+
+/* Submits @n_xfers packed transfers as one SPI_IOC_MESSAGE ioctl */
+typedef int (*FpiSpiBatchSubmitFunc) (FpiSpiTransfer          *transfer,
+                                      struct spi_ioc_transfer *xfer,
+                                      guint                    n_xfers,
+                                      gpointer                 user_data);
+
+int fpi_spi_transfer_batch_pack (FpiSpiTransfer       *transfer,
+                                 gsize                 max_length,
+                                 FpiSpiBatchSubmitFunc submit,
+                                 gpointer              user_data);
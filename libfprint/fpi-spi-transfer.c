@@ -17,9 +17,12 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
-#include "fpi-spi-transfer.h"
+#include "fpi-spi-transfer-private.h"
+#include "fp-device-private.h"
 #include <sys/ioctl.h>
-#include <linux/spi/spidev.h>
+#include <sys/eventfd.h>
+#include <glib-unix.h>
+#include <unistd.h>
 #include <errno.h>
 
 /* spidev can only handle the specified block size, which defaults to 4096. */
@@ -27,6 +30,14 @@
 #define SPIDEV_BLOCK_SIZE_FALLBACK 4096
 static gsize block_size = 0;
 
+typedef struct
+{
+  gsize   offset_wr;
+  gsize   length_wr;
+  guint8 *buffer_rd;
+  gsize   length_rd;
+} FpiSpiMessage;
+
 /**
  * SECTION:fpi-spi-transfer
  * @title: SPI transfer helpers
@@ -37,6 +48,9 @@ static gsize block_size = 0;
  * and provide a usable asynchronous API to libfprint drivers.
  *
  * Currently only transfers with a write and subsequent read are supported.
+ * Many short messages, such as register accesses, can be queued into a single
+ * transfer using fpi_spi_transfer_batch_write_read(). They are then sent
+ * with as few ioctl calls as possible and complete with one callback.
  *
  * Drivers should always use this API rather than calling read/write/ioctl on
  * the spidev device.
@@ -69,12 +83,57 @@ dump_buffer (guchar *buf, gssize dump_len)
     g_debug ("%s", line->str);
 }
 
+static gssize
+transfer_length (FpiSpiTransfer *transfer)
+{
+  gssize length;
+
+  if (!transfer->batch)
+    return MAX (transfer->length_wr, 0) + MAX (transfer->length_rd, 0);
+
+  length = transfer->batch_wr->len;
+  for (guint i = 0; i < transfer->batch->len; i++)
+    length += g_array_index (transfer->batch, FpiSpiMessage, i).length_rd;
+
+  return length;
+}
+
 static void
 log_transfer (FpiSpiTransfer *transfer, gboolean submit, GError *error)
 {
-  if (g_getenv ("FP_DEBUG_TRANSFER"))
+  if (submit)
+    transfer->submit_time = g_get_monotonic_time ();
+  else
+    fpi_device_count_transfer (transfer->device,
+                               FP_DEVICE_TRANSFER_ENDPOINT_SPI,
+                               transfer_length (transfer),
+                               g_get_monotonic_time () - transfer->submit_time,
+                               error);
+
+  if (fpi_device_debug_transfer ())
     {
-      if (submit)
+      if (transfer->batch)
+        {
+          if (submit)
+            g_debug ("Batch transfer %p submitted, %u messages",
+                     transfer, transfer->batch->len);
+          else
+            g_debug ("Batch transfer %p completed %s, %u messages",
+                     transfer,
+                     error ? "with error" : "successfully",
+                     transfer->batch->len);
+
+          for (guint i = 0; i < transfer->batch->len; i++)
+            {
+              FpiSpiMessage *msg = &g_array_index (transfer->batch, FpiSpiMessage, i);
+
+              if (submit && msg->length_wr)
+                dump_buffer (transfer->batch_wr->data + msg->offset_wr, msg->length_wr);
+              else if (!submit && !error && msg->length_rd)
+                dump_buffer (msg->buffer_rd, msg->length_rd);
+            }
+        }
+      else if (submit)
         {
           g_debug ("Transfer %p submitted, write length %zd, read length %zd",
                    transfer,
@@ -167,6 +226,11 @@ fpi_spi_transfer_free (FpiSpiTransfer *self)
   self->buffer_wr = NULL;
   self->buffer_rd = NULL;
 
+  g_clear_pointer (&self->batch, g_array_unref);
+  g_clear_pointer (&self->batch_wr, g_byte_array_unref);
+  g_clear_object (&self->cancellable);
+  g_clear_error (&self->error);
+
   g_slice_free (FpiSpiTransfer, self);
 }
 
@@ -241,6 +305,7 @@ fpi_spi_transfer_write_full (FpiSpiTransfer *transfer,
 {
   g_assert (buffer != NULL);
   g_return_if_fail (transfer);
+  g_return_if_fail (transfer->batch == NULL);
 
   /* Write is always before read, so ensure both are NULL. */
   g_return_if_fail (transfer->buffer_wr == NULL);
@@ -286,6 +351,7 @@ fpi_spi_transfer_read_full (FpiSpiTransfer *transfer,
 {
   g_assert (buffer != NULL);
   g_return_if_fail (transfer);
+  g_return_if_fail (transfer->batch == NULL);
   g_return_if_fail (transfer->buffer_rd == NULL);
 
   transfer->buffer_rd = buffer;
@@ -293,6 +359,74 @@ fpi_spi_transfer_read_full (FpiSpiTransfer *transfer,
   transfer->free_buffer_rd = free_func;
 }
 
+/**
+ * fpi_spi_transfer_batch_write:
+ * @transfer: The #FpiSpiTransfer
+ * @data: The data to write, it is copied
+ * @length: The size of @data
+ *
+ * Queue a write only message into a batch transfer, see
+ * fpi_spi_transfer_batch_write_read().
+ */
+void
+fpi_spi_transfer_batch_write (FpiSpiTransfer *transfer,
+                              const guint8   *data,
+                              gsize           length)
+{
+  fpi_spi_transfer_batch_write_read (transfer, data, length, NULL, 0);
+}
+
+/**
+ * fpi_spi_transfer_batch_write_read:
+ * @transfer: The #FpiSpiTransfer
+ * @data: (nullable): The data to write, it is copied
+ * @length_wr: The size of @data
+ * @buffer_rd: (nullable): Buffer to read data into, it must stay valid
+ *   until the transfer completed
+ * @length_rd: The size of @buffer_rd
+ *
+ * Queue a message made of a write followed by a read into a batch transfer.
+ * The chip is deselected between consecutive messages, just as if every
+ * message was submitted as a separate transfer. However, all the messages of
+ * the batch are submitted using as few ioctl calls as the spidev buffer size
+ * permits and @callback of fpi_spi_transfer_submit() is only called once.
+ *
+ * A batch transfer cannot also use fpi_spi_transfer_write() or
+ * fpi_spi_transfer_read(), and a single message needs to fit into the
+ * spidev buffer.
+ */
+void
+fpi_spi_transfer_batch_write_read (FpiSpiTransfer *transfer,
+                                   const guint8   *data,
+                                   gsize           length_wr,
+                                   guint8         *buffer_rd,
+                                   gsize           length_rd)
+{
+  FpiSpiMessage msg = { 0 };
+
+  g_return_if_fail (transfer);
+  g_return_if_fail (transfer->buffer_wr == NULL && transfer->buffer_rd == NULL);
+  g_return_if_fail (length_wr > 0 || length_rd > 0);
+  g_return_if_fail (data != NULL || length_wr == 0);
+  g_return_if_fail (buffer_rd != NULL || length_rd == 0);
+  g_return_if_fail (length_wr + length_rd <= block_size);
+
+  if (!transfer->batch)
+    {
+      transfer->batch = g_array_new (FALSE, FALSE, sizeof (FpiSpiMessage));
+      transfer->batch_wr = g_byte_array_new ();
+    }
+
+  msg.offset_wr = transfer->batch_wr->len;
+  msg.length_wr = length_wr;
+  msg.buffer_rd = buffer_rd;
+  msg.length_rd = length_rd;
+
+  if (length_wr)
+    g_byte_array_append (transfer->batch_wr, data, length_wr);
+  g_array_append_val (transfer->batch, msg);
+}
+
 static void
 transfer_finish_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
@@ -382,24 +516,116 @@ transfer_chunk (FpiSpiTransfer *transfer, gsize full_length, gsize *transferred)
   return status;
 }
 
-static void
-transfer_thread_func (GTask        *task,
-                      gpointer      source_object,
-                      gpointer      task_data,
-                      GCancellable *cancellable)
+/*
+ * Packs the messages of a batch into as few transfer arrays as possible,
+ * each of them at most @max_length bytes and FPI_SPI_BATCH_MAX_XFERS
+ * entries long, and passes them to @submit.
+ */
+int
+fpi_spi_transfer_batch_pack (FpiSpiTransfer       *transfer,
+                             gsize                 max_length,
+                             FpiSpiBatchSubmitFunc submit,
+                             gpointer              user_data)
+{
+  g_autofree struct spi_ioc_transfer *xfer = NULL;
+  guint max_xfers = MIN (transfer->batch->len * 2, FPI_SPI_BATCH_MAX_XFERS);
+  gsize len = 0;
+  int transfers = 0;
+  int status = 0;
+
+  xfer = g_new (struct spi_ioc_transfer, max_xfers);
+
+  for (guint i = 0; i <= transfer->batch->len; i++)
+    {
+      FpiSpiMessage *msg = NULL;
+
+      if (i < transfer->batch->len)
+        msg = &g_array_index (transfer->batch, FpiSpiMessage, i);
+
+      /* Flush the queued messages if this one does not fit anymore. */
+      if (transfers > 0 &&
+          (!msg ||
+           transfers + (msg->length_wr > 0) + (msg->length_rd > 0) > max_xfers ||
+           len + msg->length_wr + msg->length_rd > max_length))
+        {
+          status = submit (transfer, xfer, transfers, user_data);
+          if (status < 0)
+            return status;
+
+          transfers = 0;
+          len = 0;
+        }
+
+      if (!msg)
+        break;
+
+      /* Deselect the chip between two messages of the same ioctl */
+      if (transfers > 0)
+        xfer[transfers - 1].cs_change = TRUE;
+
+      if (msg->length_wr)
+        {
+          xfer[transfers] = (struct spi_ioc_transfer) {
+            .tx_buf = (gsize) transfer->batch_wr->data + msg->offset_wr,
+            .len = msg->length_wr,
+          };
+          transfers += 1;
+        }
+
+      if (msg->length_rd)
+        {
+          xfer[transfers] = (struct spi_ioc_transfer) {
+            .rx_buf = (gsize) msg->buffer_rd,
+            .len = msg->length_rd,
+          };
+          transfers += 1;
+        }
+
+      len += msg->length_wr + msg->length_rd;
+    }
+
+  return status;
+}
+
+static int
+transfer_batch_ioctl (FpiSpiTransfer          *transfer,
+                      struct spi_ioc_transfer *xfer,
+                      guint                    n_xfers,
+                      gpointer                 user_data)
+{
+  /* This ioctl cannot be interrupted. */
+  return ioctl (transfer->spidev_fd, SPI_IOC_MESSAGE (n_xfers), xfer);
+}
+
+static gboolean
+transfer_run (FpiSpiTransfer *transfer, GError **error)
 {
-  FpiSpiTransfer *transfer = (FpiSpiTransfer *) task_data;
   gsize full_length;
   gsize transferred = 0;
   int status = 0;
 
+  if (transfer->batch)
+    {
+      if (fpi_spi_transfer_batch_pack (transfer, block_size,
+                                       transfer_batch_ioctl, NULL) < 0)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       "Error invoking ioctl for SPI batch transfer (%d)",
+                       errno);
+          return FALSE;
+        }
+      return TRUE;
+    }
+
   if (transfer->buffer_wr == NULL && transfer->buffer_rd == NULL)
     {
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               G_IO_ERROR_INVALID_ARGUMENT,
-                               "Transfer with neither write or read!");
-      return;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_ARGUMENT,
+                   "Transfer with neither write or read!");
+      return FALSE;
     }
 
   full_length = 0;
@@ -413,16 +639,282 @@ transfer_thread_func (GTask        *task,
 
   if (status < 0)
     {
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               g_io_error_from_errno (errno),
-                               "Error invoking ioctl for SPI transfer (%d)",
-                               errno);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "Error invoking ioctl for SPI transfer (%d)",
+                   errno);
+      return FALSE;
     }
+
+  return TRUE;
+}
+
+static void
+transfer_thread_func (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  FpiSpiTransfer *transfer = (FpiSpiTransfer *) task_data;
+  GError *error = NULL;
+
+  if (transfer_run (transfer, &error))
+    g_task_return_boolean (task, TRUE);
   else
+    g_task_return_error (task, error);
+}
+
+/*
+ * Every device gets one I/O thread that performs its transfers in order of
+ * submission. Transfers are handed over using lock-free lists linked
+ * through transfer->next, and an eventfd is used in each direction to wake
+ * up the I/O thread and the main context of the device respectively.
+ */
+typedef struct
+{
+  GThread        *thread;
+  int             submit_fd;
+  int             complete_fd;
+  GSource        *complete_source;
+
+  FpiSpiTransfer *submitted;
+  FpiSpiTransfer *completed;
+  gint            quit;
+} FpiSpiWorker;
+
+static void
+spi_queue_push (FpiSpiTransfer **queue, FpiSpiTransfer *transfer)
+{
+  FpiSpiTransfer *head;
+
+  do
+    {
+      head = g_atomic_pointer_get (queue);
+      transfer->next = head;
+    }
+  while (!g_atomic_pointer_compare_and_exchange (queue, head, transfer));
+}
+
+/* Takes all queued transfers, returning them in order of submission */
+static FpiSpiTransfer *
+spi_queue_steal (FpiSpiTransfer **queue)
+{
+  FpiSpiTransfer *head;
+  FpiSpiTransfer *ordered = NULL;
+
+  do
+    {
+      head = g_atomic_pointer_get (queue);
+    }
+  while (head && !g_atomic_pointer_compare_and_exchange (queue, head, NULL));
+
+  while (head)
+    {
+      FpiSpiTransfer *next = head->next;
+
+      head->next = ordered;
+      ordered = head;
+      head = next;
+    }
+
+  return ordered;
+}
+
+static void
+spi_worker_wakeup (int fd)
+{
+  guint64 val = 1;
+
+  while (write (fd, &val, sizeof (val)) < 0 && errno == EINTR)
+    ;
+}
+
+static gpointer
+spi_worker_thread_func (gpointer user_data)
+{
+  FpiSpiWorker *worker = user_data;
+
+  while (TRUE)
+    {
+      FpiSpiTransfer *pending;
+      guint64 val;
+
+      if (read (worker->submit_fd, &val, sizeof (val)) < 0 && errno == EINTR)
+        continue;
+
+      if (g_atomic_int_get (&worker->quit))
+        break;
+
+      pending = spi_queue_steal (&worker->submitted);
+      while (pending)
+        {
+          FpiSpiTransfer *transfer = pending;
+
+          pending = transfer->next;
+          transfer->next = NULL;
+
+          transfer_run (transfer, &transfer->error);
+
+          spi_queue_push (&worker->completed, transfer);
+          spi_worker_wakeup (worker->complete_fd);
+        }
+    }
+
+  return NULL;
+}
+
+static void
+transfer_complete (FpiSpiTransfer *transfer)
+{
+  FpDevice *device = transfer->device;
+  GError *error = g_steal_pointer (&transfer->error);
+  FpiSpiTransferCallback callback;
+
+  /* The transfer cannot be cancelled, but report it as such if requested */
+  if (transfer->cancellable && g_cancellable_is_cancelled (transfer->cancellable))
+    {
+      g_clear_error (&error);
+      g_cancellable_set_error_if_cancelled (transfer->cancellable, &error);
+    }
+  g_clear_object (&transfer->cancellable);
+
+  log_transfer (transfer, FALSE, error);
+
+  callback = transfer->callback;
+  transfer->callback = NULL;
+  callback (transfer, device, transfer->user_data, error);
+
+  fpi_spi_transfer_unref (transfer);
+  g_object_unref (device);
+}
+
+static gboolean
+transfer_replay (FpiSpiTransfer *transfer, FpiTransferReplay *replay, GError **error)
+{
+  if (transfer->batch)
+    {
+      for (guint i = 0; i < transfer->batch->len; i++)
+        {
+          FpiSpiMessage *msg = &g_array_index (transfer->batch, FpiSpiMessage, i);
+
+          if (msg->length_wr &&
+              !fpi_transfer_replay_spi (replay, FALSE,
+                                        transfer->batch_wr->data + msg->offset_wr,
+                                        msg->length_wr, error))
+            return FALSE;
+
+          if (msg->length_rd &&
+              !fpi_transfer_replay_spi (replay, TRUE, msg->buffer_rd,
+                                        msg->length_rd, error))
+            return FALSE;
+        }
+
+      return TRUE;
+    }
+
+  if (transfer->buffer_wr &&
+      !fpi_transfer_replay_spi (replay, FALSE, transfer->buffer_wr,
+                                transfer->length_wr, error))
+    return FALSE;
+
+  if (transfer->buffer_rd &&
+      !fpi_transfer_replay_spi (replay, TRUE, transfer->buffer_rd,
+                                transfer->length_rd, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+replay_complete_cb (FpDevice *device, gpointer user_data)
+{
+  transfer_complete (user_data);
+}
+
+static gboolean
+spi_worker_complete_cb (gint         fd,
+                        GIOCondition condition,
+                        gpointer     user_data)
+{
+  FpiSpiWorker *worker = user_data;
+  FpiSpiTransfer *completed;
+  guint64 val;
+
+  if (read (fd, &val, sizeof (val)) < 0 && errno != EAGAIN && errno != EINTR)
+    g_warning ("Failed to read SPI completion event: %s", g_strerror (errno));
+
+  /* The worker may be gone once the last transfer released the device */
+  completed = spi_queue_steal (&worker->completed);
+  while (completed)
+    {
+      FpiSpiTransfer *transfer = completed;
+
+      completed = transfer->next;
+      transfer->next = NULL;
+
+      transfer_complete (transfer);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+spi_worker_free (FpiSpiWorker *worker)
+{
+  g_assert_null (g_atomic_pointer_get (&worker->submitted));
+  g_assert_null (g_atomic_pointer_get (&worker->completed));
+
+  g_atomic_int_set (&worker->quit, TRUE);
+  spi_worker_wakeup (worker->submit_fd);
+  g_thread_join (worker->thread);
+
+  g_source_destroy (worker->complete_source);
+  g_source_unref (worker->complete_source);
+
+  close (worker->submit_fd);
+  close (worker->complete_fd);
+
+  g_free (worker);
+}
+
+static FpiSpiWorker *
+spi_worker_get (FpDevice *device)
+{
+  FpiSpiWorker *worker = g_object_get_data (G_OBJECT (device), "fpi-spi-worker");
+
+  if (worker)
+    return worker;
+
+  worker = g_new0 (FpiSpiWorker, 1);
+  worker->submit_fd = eventfd (0, EFD_CLOEXEC);
+  worker->complete_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (worker->submit_fd < 0 || worker->complete_fd < 0)
     {
-      g_task_return_boolean (task, TRUE);
+      g_warning ("Failed to create SPI worker eventfd: %s", g_strerror (errno));
+      if (worker->submit_fd >= 0)
+        close (worker->submit_fd);
+      if (worker->complete_fd >= 0)
+        close (worker->complete_fd);
+      g_free (worker);
+      return NULL;
     }
+
+  /* Completions are dispatched where the driver submits the transfers */
+  worker->complete_source = g_unix_fd_source_new (worker->complete_fd, G_IO_IN);
+  g_source_set_callback (worker->complete_source,
+                         (GSourceFunc) spi_worker_complete_cb,
+                         worker, NULL);
+  g_source_set_name (worker->complete_source, "[fpi] spi transfer completion");
+  g_source_attach (worker->complete_source, g_main_context_get_thread_default ());
+
+  worker->thread = g_thread_new ("fp-spi-io", spi_worker_thread_func, worker);
+
+  g_object_set_data_full (G_OBJECT (device), "fpi-spi-worker", worker,
+                          (GDestroyNotify) spi_worker_free);
+
+  return worker;
 }
 
 /**
@@ -437,6 +929,10 @@ transfer_thread_func (GTask        *task,
  * The underlying transfer cannot be cancelled. The current implementation
  * will only call @callback after the transfer has been completed.
  *
+ * Transfers are performed in order of submission on an I/O thread owned by
+ * the device, @callback is invoked from the thread default main context
+ * that was active when the first transfer of the device was submitted.
+ *
  * Note that #FpiSpiTransfer will be stolen when this function is called.
  * So that all associated data will be free'ed automatically, after the
  * callback ran unless fpi_usb_transfer_ref() is explicitly called.
@@ -448,6 +944,8 @@ fpi_spi_transfer_submit (FpiSpiTransfer        *transfer,
                          gpointer               user_data)
 {
   g_autoptr(GTask) task = NULL;
+  FpiTransferReplay *replay;
+  FpiSpiWorker *worker;
 
   g_return_if_fail (transfer);
   g_return_if_fail (callback);
@@ -460,6 +958,31 @@ fpi_spi_transfer_submit (FpiSpiTransfer        *transfer,
 
   log_transfer (transfer, TRUE, NULL);
 
+  /* Take the data from the recording, completing in the main loop */
+  replay = fpi_device_get_transfer_replay (transfer->device);
+  if (replay)
+    {
+      g_object_ref (transfer->device);
+      g_set_object (&transfer->cancellable, cancellable);
+      transfer_replay (transfer, replay, &transfer->error);
+
+      fpi_device_add_timeout (transfer->device, 0, replay_complete_cb,
+                              g_steal_pointer (&transfer), NULL);
+      return;
+    }
+
+  worker = spi_worker_get (transfer->device);
+  if (worker)
+    {
+      g_object_ref (transfer->device);
+      g_set_object (&transfer->cancellable, cancellable);
+
+      spi_queue_push (&worker->submitted, g_steal_pointer (&transfer));
+      spi_worker_wakeup (worker->submit_fd);
+      return;
+    }
+
+  /* Fall back to running the transfer on the GLib thread pool */
   task = g_task_new (transfer->device,
                      cancellable,
                      transfer_finish_cb,
@@ -489,6 +1012,7 @@ fpi_spi_transfer_submit_sync (FpiSpiTransfer *transfer,
                               GError        **error)
 {
   g_autoptr(GTask) task = NULL;
+  FpiTransferReplay *replay;
   GError *err = NULL;
   gboolean res;
 
@@ -499,6 +1023,16 @@ fpi_spi_transfer_submit_sync (FpiSpiTransfer *transfer,
 
   log_transfer (transfer, TRUE, NULL);
 
+  replay = fpi_device_get_transfer_replay (transfer->device);
+  if (replay)
+    {
+      res = transfer_replay (transfer, replay, &err);
+      log_transfer (transfer, FALSE, err);
+      g_propagate_error (error, err);
+
+      return res;
+    }
+
   task = g_task_new (transfer->device,
                      NULL,
                      NULL,
@@ -46,7 +46,8 @@ typedef void (*FpiSpiTransferCallback)(FpiSpiTransfer *transfer,
  *
  * Helper for handling SPI transfers. Currently transfers can either be pure
  * write/read transfers or a write followed by a read (full duplex support
- * can easily be added if desired).
+ * can easily be added if desired). Alternatively, a transfer can be a batch
+ * of short messages, see fpi_spi_transfer_batch_write_read().
  */
 struct _FpiSpiTransfer
 {
@@ -73,6 +74,18 @@ struct _FpiSpiTransfer
   /* Data free function */
   GDestroyNotify free_buffer_wr;
   GDestroyNotify free_buffer_rd;
+
+  /* Batched messages and the data they write */
+  GArray     *batch;
+  GByteArray *batch_wr;
+
+  /* Monotonic time of submission, for the transfer statistics */
+  gint64 submit_time;
+
+  /* State while queued on the I/O thread of the device */
+  FpiSpiTransfer *next;
+  GCancellable   *cancellable;
+  GError         *error;
 };
 
 GType              fpi_spi_transfer_get_type (void) G_GNUC_CONST;
@@ -99,6 +112,18 @@ void               fpi_spi_transfer_read_full (FpiSpiTransfer *transfer,
                                                gsize           length,
                                                GDestroyNotify  free_func);
 
+FP_GNUC_ACCESS (read_only, 2, 3)
+void               fpi_spi_transfer_batch_write (FpiSpiTransfer *transfer,
+                                                 const guint8   *data,
+                                                 gsize           length);
+
+FP_GNUC_ACCESS (read_only, 2, 3)
+void               fpi_spi_transfer_batch_write_read (FpiSpiTransfer *transfer,
+                                                      const guint8   *data,
+                                                      gsize           length_wr,
+                                                      guint8         *buffer_rd,
+                                                      gsize           length_rd);
+
 void               fpi_spi_transfer_submit (FpiSpiTransfer        *transfer,
                                             GCancellable          *cancellable,
                                             FpiSpiTransferCallback callback,
@@ -0,0 +1,821 @@
+/*
+ * FPrint transfer replay
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "transfer_replay"
+
+#include <errno.h>
+#include <string.h>
+
+#include "fpi-byte-reader.h"
+#include "fpi-byte-utils.h"
+#include "fpi-log.h"
+#include "fpi-transfer-replay.h"
+
+/**
+ * SECTION:fpi-transfer-replay
+ * @title: Transfer replay
+ * @short_description: Replay recorded USB and SPI transfers
+ *
+ * #FpiTransferReplay feeds the responses from a recording back to a driver
+ * instead of talking to the hardware. Once a replay has been set using
+ * fpi_device_set_transfer_replay(), fpi_usb_transfer_submit(),
+ * fpi_spi_transfer_submit() and their synchronous variants take the next
+ * matching transfer from the recording rather than going to the bus.
+ * Setting FP_TRANSFER_REPLAY to the path of a recording does the same for
+ * every device.
+ *
+ * USB transfers are read from usbmon pcapng captures and SPI transfers from
+ * umockdev ioctl recordings, i.e. the files that the driver tests use.
+ * Data written by the driver is compared against the recording and the
+ * transfer fails if it differs.
+ *
+ * By default, transfers complete right away. This leaves only the time that
+ * is spent on the host, e.g. to measure the CPU cost of a driver operation.
+ * With fpi_transfer_replay_set_recorded_delays() (or setting
+ * FP_TRANSFER_REPLAY_DELAYS to "recorded") USB transfers instead complete
+ * after the time they took in the recording. SPI recordings contain no
+ * timing information.
+ */
+
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define LINKTYPE_USB_LINUX_MMAPPED 220
+
+/* See Documentation/usb/usbmon.rst in the kernel */
+#define USBMON_ISOCHRONOUS 0
+#define USBMON_INTERRUPT 1
+#define USBMON_CONTROL 2
+#define USBMON_BULK 3
+
+/* One cursor per endpoint address, 0x00-0x0f and 0x80-0x8f */
+#define USB_ENDPOINT_SLOTS 32
+#define USB_ENDPOINT_SLOT(ep) (((ep) & 0x0f) | (((ep) & 0x80) >> 3))
+
+typedef struct
+{
+  guint16  bus;
+  guint8   address;
+  guint8   type;
+  guint8   endpoint;
+  gboolean has_setup;
+  guint8   setup[8];
+
+  gboolean completed;
+  gint32   status;
+  guint32  actual_length;
+  gint64   submit_time;
+  gint64   complete_time;
+
+  /* Written data for OUT transfers, received data for IN transfers */
+  GBytes *data;
+} UsbRecord;
+
+typedef struct
+{
+  gboolean read;
+  GBytes  *data;
+} SpiSegment;
+
+struct _FpiTransferReplay
+{
+  gint     ref_count;
+  gboolean recorded_delays;
+
+  /* Transfers of the busiest USB device in the capture */
+  GArray *usb_records;
+  guint16 usb_bus;
+  guint8  usb_address;
+  guint   usb_cursor[USB_ENDPOINT_SLOTS];
+
+  /* SPI data in the order it went over the bus */
+  GArray *spi_segments;
+  guint   spi_cursor;
+  gsize   spi_offset;
+};
+
+static void
+usb_record_clear (gpointer data)
+{
+  UsbRecord *record = data;
+
+  g_clear_pointer (&record->data, g_bytes_unref);
+}
+
+static void
+spi_segment_clear (gpointer data)
+{
+  SpiSegment *segment = data;
+
+  g_clear_pointer (&segment->data, g_bytes_unref);
+}
+
+static gboolean
+load_usbmon_packet (FpiTransferReplay *replay,
+                    GHashTable        *pending,
+                    const guint8      *packet,
+                    guint              length,
+                    GError           **error)
+{
+  FpiByteReader reader;
+  UsbRecord *record;
+  const guint8 *setup;
+  const guint8 *data;
+  gboolean read_ok = TRUE;
+  guint64 urb_id;
+  guint8 event, type, endpoint, address;
+  guint16 bus;
+  gint8 flag_setup, flag_data;
+  gint64 ts_sec, timestamp;
+  gint32 ts_usec, status;
+  guint32 urb_length, data_length;
+  gpointer index;
+
+  fpi_byte_reader_init (&reader, packet, length);
+
+  read_ok &= fpi_byte_reader_get_uint64_le (&reader, &urb_id);
+  read_ok &= fpi_byte_reader_get_uint8 (&reader, &event);
+  read_ok &= fpi_byte_reader_get_uint8 (&reader, &type);
+  read_ok &= fpi_byte_reader_get_uint8 (&reader, &endpoint);
+  read_ok &= fpi_byte_reader_get_uint8 (&reader, &address);
+  read_ok &= fpi_byte_reader_get_uint16_le (&reader, &bus);
+  read_ok &= fpi_byte_reader_get_int8 (&reader, &flag_setup);
+  read_ok &= fpi_byte_reader_get_int8 (&reader, &flag_data);
+  read_ok &= fpi_byte_reader_get_int64_le (&reader, &ts_sec);
+  read_ok &= fpi_byte_reader_get_int32_le (&reader, &ts_usec);
+  read_ok &= fpi_byte_reader_get_int32_le (&reader, &status);
+  read_ok &= fpi_byte_reader_get_uint32_le (&reader, &urb_length);
+  read_ok &= fpi_byte_reader_get_uint32_le (&reader, &data_length);
+  read_ok &= fpi_byte_reader_get_data (&reader, 8, &setup);
+  /* interval, start_frame, xfer_flags and ndesc */
+  read_ok &= fpi_byte_reader_skip (&reader, 16);
+
+  if (!read_ok)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Truncated usbmon packet");
+      return FALSE;
+    }
+
+  /* No driver uses isochronous transfers */
+  if (type == USBMON_ISOCHRONOUS)
+    return TRUE;
+
+  data_length = MIN (data_length, fpi_byte_reader_get_remaining (&reader));
+  fpi_byte_reader_get_data (&reader, data_length, &data);
+  timestamp = ts_sec * G_USEC_PER_SEC + ts_usec;
+
+  if (event == 'S')
+    {
+      UsbRecord new_record = {
+        .bus = bus,
+        .address = address,
+        .type = type,
+        .endpoint = endpoint,
+        .has_setup = flag_setup == 0,
+        .submit_time = timestamp,
+      };
+
+      memcpy (new_record.setup, setup, sizeof (new_record.setup));
+      if (!(endpoint & FPI_USB_ENDPOINT_IN) && flag_data == 0 && data_length > 0)
+        new_record.data = g_bytes_new (data, data_length);
+
+      g_array_append_val (replay->usb_records, new_record);
+      g_hash_table_insert (pending,
+                           g_memdup2 (&urb_id, sizeof (urb_id)),
+                           GUINT_TO_POINTER (replay->usb_records->len));
+
+      return TRUE;
+    }
+
+  /* Ignore completions of URBs submitted before the capture started */
+  if (!g_hash_table_lookup_extended (pending, &urb_id, NULL, &index))
+    return TRUE;
+
+  record = &g_array_index (replay->usb_records, UsbRecord, GPOINTER_TO_UINT (index) - 1);
+  g_hash_table_remove (pending, &urb_id);
+
+  record->completed = TRUE;
+  record->status = event == 'E' && status == 0 ? -EIO : status;
+  record->actual_length = urb_length;
+  record->complete_time = timestamp;
+  if ((endpoint & FPI_USB_ENDPOINT_IN) && flag_data == 0 && data_length > 0)
+    record->data = g_bytes_new (data, data_length);
+
+  return TRUE;
+}
+
+static gboolean
+load_pcapng (FpiTransferReplay *replay,
+             const guint8      *contents,
+             gsize              length,
+             GError           **error)
+{
+  g_autoptr(GHashTable) pending = NULL;
+  g_autoptr(GArray) link_types = NULL;
+  FpiByteReader reader;
+
+  if (length > G_MAXUINT)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Capture is too large");
+      return FALSE;
+    }
+
+  pending = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+  link_types = g_array_new (FALSE, FALSE, sizeof (guint16));
+
+  fpi_byte_reader_init (&reader, contents, length);
+
+  while (fpi_byte_reader_get_remaining (&reader) > 0)
+    {
+      FpiByteReader block;
+      guint pos = fpi_byte_reader_get_pos (&reader);
+      guint32 block_type, block_length;
+      gboolean read_ok = TRUE;
+
+      if (!fpi_byte_reader_get_uint32_le (&reader, &block_type) ||
+          !fpi_byte_reader_get_uint32_le (&reader, &block_length) ||
+          block_length < 12 ||
+          block_length > fpi_byte_reader_get_remaining (&reader) + 8)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                               "Truncated pcapng block");
+          return FALSE;
+        }
+
+      fpi_byte_reader_init (&block, contents + pos + 8, block_length - 12);
+      fpi_byte_reader_set_pos (&reader, pos + block_length);
+
+      switch (block_type)
+        {
+        case PCAPNG_SECTION_HEADER:
+          {
+            guint32 magic;
+
+            if (!fpi_byte_reader_get_uint32_le (&block, &magic) ||
+                magic != PCAPNG_BYTE_ORDER_MAGIC)
+              {
+                g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                     "Only little endian pcapng files are supported");
+                return FALSE;
+              }
+
+            /* Interface numbers are local to a section */
+            g_array_set_size (link_types, 0);
+            break;
+          }
+
+        case PCAPNG_INTERFACE_DESCRIPTION:
+          {
+            guint16 link_type;
+
+            read_ok &= fpi_byte_reader_get_uint16_le (&block, &link_type);
+            if (read_ok)
+              g_array_append_val (link_types, link_type);
+            break;
+          }
+
+        case PCAPNG_ENHANCED_PACKET:
+          {
+            const guint8 *packet;
+            guint32 interface, captured;
+
+            read_ok &= fpi_byte_reader_get_uint32_le (&block, &interface);
+            /* timestamp, the usbmon header has its own */
+            read_ok &= fpi_byte_reader_skip (&block, 8);
+            read_ok &= fpi_byte_reader_get_uint32_le (&block, &captured);
+            read_ok &= fpi_byte_reader_skip (&block, 4);
+            read_ok &= fpi_byte_reader_get_data (&block, captured, &packet);
+            if (!read_ok)
+              break;
+
+            if (interface >= link_types->len)
+              {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Packet for unknown interface %u", interface);
+                return FALSE;
+              }
+
+            if (g_array_index (link_types, guint16, interface) != LINKTYPE_USB_LINUX_MMAPPED)
+              break;
+
+            if (!load_usbmon_packet (replay, pending, packet, captured, error))
+              return FALSE;
+            break;
+          }
+
+        default:
+          break;
+        }
+
+      if (!read_ok)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Truncated pcapng block of type 0x%08x", block_type);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Captures often contain other devices on the same bus, pick the one that
+ * did the most bulk and interrupt transfers (or control transfers if there
+ * are no others). */
+static void
+usb_select_device (FpiTransferReplay *replay)
+{
+  guint best_count = 0;
+  guint best = 0;
+  guint pass, i;
+
+  for (pass = 0; pass < 2 && best_count == 0; pass++)
+    {
+      g_autoptr(GHashTable) counts = g_hash_table_new (NULL, NULL);
+
+      for (i = 0; i < replay->usb_records->len; i++)
+        {
+          UsbRecord *record = &g_array_index (replay->usb_records, UsbRecord, i);
+          guint device = (record->bus << 8) | record->address;
+          guint count;
+
+          if (pass == 0 && record->type == USBMON_CONTROL)
+            continue;
+
+          count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, GUINT_TO_POINTER (device))) + 1;
+          g_hash_table_insert (counts, GUINT_TO_POINTER (device), GUINT_TO_POINTER (count));
+
+          if (count > best_count)
+            {
+              best_count = count;
+              best = device;
+            }
+        }
+    }
+
+  replay->usb_bus = best >> 8;
+  replay->usb_address = best & 0xff;
+
+  fp_dbg ("Replaying USB transfers of device %03u:%03u",
+          replay->usb_bus, replay->usb_address);
+}
+
+static gboolean
+load_spi_ioctl (FpiTransferReplay *replay,
+                const gchar       *contents,
+                GError           **error)
+{
+  g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+  guint i;
+
+  if (!g_str_has_suffix (lines[0], " (SPI)"))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Only SPI ioctl recordings are supported");
+      return FALSE;
+    }
+
+  for (i = 1; lines[i]; i++)
+    {
+      const gchar *line = lines[i];
+      g_autofree guint8 *data = NULL;
+      SpiSegment segment;
+      gsize hex_length;
+      gsize j;
+
+      if (*line == '\0')
+        continue;
+
+      /* e.g. "TW 0aff", a message starts with T, continues with C */
+      hex_length = strlen (line) >= 3 ? strlen (line) - 3 : 0;
+      if (strlen (line) < 3 ||
+          (line[0] != 'T' && line[0] != 'C') ||
+          (line[1] != 'W' && line[1] != 'R') ||
+          line[2] != ' ' ||
+          hex_length % 2 != 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Unsupported SPI record in line %u", i + 1);
+          return FALSE;
+        }
+
+      data = g_malloc (hex_length / 2);
+      for (j = 0; j < hex_length / 2; j++)
+        {
+          gint high = g_ascii_xdigit_value (line[3 + j * 2]);
+          gint low = g_ascii_xdigit_value (line[3 + j * 2 + 1]);
+
+          if (high < 0 || low < 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Invalid hex data in line %u", i + 1);
+              return FALSE;
+            }
+
+          data[j] = (high << 4) | low;
+        }
+
+      segment.read = line[1] == 'R';
+      segment.data = g_bytes_new_take (g_steal_pointer (&data), hex_length / 2);
+      g_array_append_val (replay->spi_segments, segment);
+    }
+
+  return TRUE;
+}
+
+/**
+ * fpi_transfer_replay_new_from_file:
+ * @filename: A usbmon pcapng capture or an umockdev SPI ioctl recording
+ * @error: Return location for errors
+ *
+ * Loads the transfers of a recording.
+ *
+ * Returns: (transfer full): A new #FpiTransferReplay, or %NULL on error
+ */
+FpiTransferReplay *
+fpi_transfer_replay_new_from_file (const char *filename,
+                                   GError    **error)
+{
+  g_autoptr(FpiTransferReplay) replay = NULL;
+  g_autofree gchar *contents = NULL;
+  gsize length;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  if (!g_file_get_contents (filename, &contents, &length, error))
+    return NULL;
+
+  replay = g_new0 (FpiTransferReplay, 1);
+  replay->ref_count = 1;
+  replay->usb_records = g_array_new (FALSE, FALSE, sizeof (UsbRecord));
+  g_array_set_clear_func (replay->usb_records, usb_record_clear);
+  replay->spi_segments = g_array_new (FALSE, FALSE, sizeof (SpiSegment));
+  g_array_set_clear_func (replay->spi_segments, spi_segment_clear);
+
+  if (length >= 4 && FP_READ_UINT32_LE (contents) == PCAPNG_SECTION_HEADER)
+    {
+      if (!load_pcapng (replay, (const guint8 *) contents, length, error))
+        return NULL;
+
+      usb_select_device (replay);
+    }
+  else if (g_str_has_prefix (contents, "@DEV "))
+    {
+      if (!load_spi_ioctl (replay, contents, error))
+        return NULL;
+    }
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s is neither a pcapng capture nor an ioctl recording",
+                   filename);
+      return NULL;
+    }
+
+  fp_dbg ("Loaded %u USB transfers and %u SPI transfers from %s",
+          replay->usb_records->len, replay->spi_segments->len, filename);
+
+  return g_steal_pointer (&replay);
+}
+
+/**
+ * fpi_transfer_replay_ref:
+ * @replay: A #FpiTransferReplay
+ *
+ * Increments the reference count of @replay.
+ *
+ * Returns: (transfer full): @replay
+ */
+FpiTransferReplay *
+fpi_transfer_replay_ref (FpiTransferReplay *replay)
+{
+  g_return_val_if_fail (replay, NULL);
+  g_return_val_if_fail (replay->ref_count, NULL);
+
+  g_atomic_int_inc (&replay->ref_count);
+
+  return replay;
+}
+
+/**
+ * fpi_transfer_replay_unref:
+ * @replay: A #FpiTransferReplay
+ *
+ * Decrements the reference count of @replay and frees it once it drops
+ * to zero.
+ */
+void
+fpi_transfer_replay_unref (FpiTransferReplay *replay)
+{
+  g_return_if_fail (replay);
+  g_return_if_fail (replay->ref_count);
+
+  if (!g_atomic_int_dec_and_test (&replay->ref_count))
+    return;
+
+  g_array_unref (replay->usb_records);
+  g_array_unref (replay->spi_segments);
+  g_free (replay);
+}
+
+/**
+ * fpi_transfer_replay_set_recorded_delays:
+ * @replay: A #FpiTransferReplay
+ * @recorded_delays: Whether to delay completions like in the recording
+ *
+ * Selects whether USB transfers complete after the same time as in the
+ * recording, or right away (the default).
+ */
+void
+fpi_transfer_replay_set_recorded_delays (FpiTransferReplay *replay,
+                                         gboolean           recorded_delays)
+{
+  g_return_if_fail (replay);
+
+  replay->recorded_delays = recorded_delays;
+}
+
+/**
+ * fpi_transfer_replay_rewind:
+ * @replay: A #FpiTransferReplay
+ *
+ * Starts the replay from the beginning of the recording again, e.g. to
+ * repeat the recorded operation in a benchmark.
+ */
+void
+fpi_transfer_replay_rewind (FpiTransferReplay *replay)
+{
+  g_return_if_fail (replay);
+
+  memset (replay->usb_cursor, 0, sizeof (replay->usb_cursor));
+  replay->spi_cursor = 0;
+  replay->spi_offset = 0;
+}
+
+static UsbRecord *
+usb_next_record (FpiTransferReplay *replay,
+                 guint8             type,
+                 guint8             endpoint,
+                 const guint8      *setup,
+                 GError           **error)
+{
+  guint *cursor = &replay->usb_cursor[USB_ENDPOINT_SLOT (endpoint)];
+
+  for (; *cursor < replay->usb_records->len; (*cursor)++)
+    {
+      UsbRecord *record = &g_array_index (replay->usb_records, UsbRecord, *cursor);
+
+      if (record->bus != replay->usb_bus ||
+          record->address != replay->usb_address ||
+          record->endpoint != endpoint)
+        continue;
+
+      /* Skip standard requests of the USB stack, e.g. to read descriptors */
+      if (setup && record->has_setup &&
+          memcmp (record->setup, setup, sizeof (record->setup)) != 0 &&
+          (record->setup[0] & 0x60) == 0)
+        continue;
+
+      *cursor += 1;
+
+      if (record->type != type ||
+          (setup && (!record->has_setup ||
+                     memcmp (record->setup, setup, sizeof (record->setup)) != 0)))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Transfer on endpoint 0x%02x does not match the recording",
+                       endpoint);
+          return NULL;
+        }
+
+      return record;
+    }
+
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+               "No recorded transfer left on endpoint 0x%02x", endpoint);
+  return NULL;
+}
+
+/**
+ * fpi_transfer_replay_usb:
+ * @replay: A #FpiTransferReplay
+ * @transfer: The submitted #FpiUsbTransfer
+ * @delay_usec: (out): Return location for the delay before completion
+ * @error: Return location for the error of the transfer
+ *
+ * Completes @transfer using the next matching transfer of the recording.
+ * Received data is copied into the buffer of @transfer and its actual
+ * length is updated.
+ *
+ * Returns: %FALSE if the transfer never completed in the recording, i.e.
+ *   it should stay pending until it is cancelled. Otherwise %TRUE, with
+ *   @error set if the recorded transfer failed or did not match.
+ */
+gboolean
+fpi_transfer_replay_usb (FpiTransferReplay *replay,
+                         FpiUsbTransfer    *transfer,
+                         gint64            *delay_usec,
+                         GError           **error)
+{
+  const guint8 *data = NULL;
+  gsize data_length = 0;
+  guint8 setup[8];
+  guint8 endpoint = transfer->endpoint;
+  guint8 type;
+  UsbRecord *record;
+
+  *delay_usec = 0;
+
+  switch (transfer->type)
+    {
+    case FP_TRANSFER_BULK:
+      type = USBMON_BULK;
+      break;
+
+    case FP_TRANSFER_INTERRUPT:
+      type = USBMON_INTERRUPT;
+      break;
+
+    case FP_TRANSFER_CONTROL:
+      type = USBMON_CONTROL;
+      if (transfer->direction == G_USB_DEVICE_DIRECTION_DEVICE_TO_HOST)
+        endpoint = FPI_USB_ENDPOINT_IN;
+      else
+        endpoint = FPI_USB_ENDPOINT_OUT;
+
+      setup[0] = (transfer->direction << 7) |
+                 (transfer->request_type << 5) |
+                 transfer->recipient;
+      setup[1] = transfer->request;
+      FP_WRITE_UINT16_LE (&setup[2], transfer->value);
+      FP_WRITE_UINT16_LE (&setup[4], transfer->idx);
+      FP_WRITE_UINT16_LE (&setup[6], transfer->length);
+      break;
+
+    case FP_TRANSFER_NONE:
+    default:
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Transfer has not been filled");
+      return TRUE;
+    }
+
+  record = usb_next_record (replay, type, endpoint,
+                            type == USBMON_CONTROL ? setup : NULL, error);
+  if (!record)
+    return TRUE;
+
+  /* The transfer was still pending or got cancelled in the recording */
+  if (!record->completed ||
+      record->status == -ENOENT ||
+      record->status == -ECONNRESET)
+    return FALSE;
+
+  if (replay->recorded_delays)
+    *delay_usec = MAX (record->complete_time - record->submit_time, 0);
+
+  if (record->data)
+    data = g_bytes_get_data (record->data, &data_length);
+
+  if (endpoint & FPI_USB_ENDPOINT_IN)
+    {
+      transfer->actual_length = MIN (record->actual_length, transfer->length);
+      if (data_length > 0)
+        memcpy (transfer->buffer, data, MIN (data_length, transfer->actual_length));
+    }
+  else
+    {
+      /* The capture may have truncated the data, compare what is there */
+      if (data_length > transfer->length ||
+          (data_length > 0 && memcmp (transfer->buffer, data, data_length) != 0))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Data written to endpoint 0x%02x does not match the recording",
+                       endpoint);
+          return TRUE;
+        }
+
+      transfer->actual_length = record->actual_length;
+    }
+
+  switch (record->status)
+    {
+    case 0:
+    /* Short transfer with URB_SHORT_NOT_OK, libusb reports success */
+    case -EREMOTEIO:
+      break;
+
+    case -ETIMEDOUT:
+      g_set_error_literal (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT,
+                           "The recorded transfer timed out");
+      break;
+
+    case -EPIPE:
+      g_set_error_literal (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_NOT_SUPPORTED,
+                           "The recorded transfer stalled");
+      break;
+
+    case -ENODEV:
+    case -ESHUTDOWN:
+      g_set_error_literal (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_NO_DEVICE,
+                           "The device was gone in the recording");
+      break;
+
+    default:
+      g_set_error (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_IO,
+                   "The recorded transfer failed with status %d", record->status);
+      break;
+    }
+
+  return TRUE;
+}
+
+/**
+ * fpi_transfer_replay_spi:
+ * @replay: A #FpiTransferReplay
+ * @read: Whether the data is read from the device
+ * @buffer: The data to write, or the buffer to read into
+ * @length: The length of @buffer
+ * @error: Return location for errors
+ *
+ * Consumes the next @length bytes of the SPI recording. Written data is
+ * compared against the recording, read data is copied into @buffer.
+ *
+ * Returns: %TRUE if the data matched the recording
+ */
+gboolean
+fpi_transfer_replay_spi (FpiTransferReplay *replay,
+                         gboolean           read,
+                         guint8            *buffer,
+                         gsize              length,
+                         GError           **error)
+{
+  gsize done = 0;
+
+  while (done < length)
+    {
+      SpiSegment *segment;
+      const guint8 *data;
+      gsize data_length;
+      gsize chunk;
+
+      if (replay->spi_cursor >= replay->spi_segments->len)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                               "No recorded SPI transfer left");
+          return FALSE;
+        }
+
+      segment = &g_array_index (replay->spi_segments, SpiSegment, replay->spi_cursor);
+      if (segment->read != read)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "SPI %s does not match the recording",
+                       read ? "read" : "write");
+          return FALSE;
+        }
+
+      data = g_bytes_get_data (segment->data, &data_length);
+      chunk = MIN (length - done, data_length - replay->spi_offset);
+
+      if (read && chunk > 0)
+        {
+          memcpy (buffer + done, data + replay->spi_offset, chunk);
+        }
+      else if (!read && chunk > 0 &&
+               memcmp (buffer + done, data + replay->spi_offset, chunk) != 0)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                               "Data written over SPI does not match the recording");
+          return FALSE;
+        }
+
+      done += chunk;
+      replay->spi_offset += chunk;
+
+      if (replay->spi_offset == data_length)
+        {
+          replay->spi_cursor += 1;
+          replay->spi_offset = 0;
+        }
+    }
+
+  return TRUE;
+}
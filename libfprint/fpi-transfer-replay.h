@@ -0,0 +1,48 @@
+/*
+ * FPrint transfer replay
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "fpi-usb-transfer.h"
+
+G_BEGIN_DECLS
+
+typedef struct _FpiTransferReplay FpiTransferReplay;
+
+FpiTransferReplay *fpi_transfer_replay_new_from_file (const char *filename,
+                                                      GError    **error);
+FpiTransferReplay *fpi_transfer_replay_ref (FpiTransferReplay *replay);
+void               fpi_transfer_replay_unref (FpiTransferReplay *replay);
+
+void               fpi_transfer_replay_set_recorded_delays (FpiTransferReplay *replay,
+                                                            gboolean           recorded_delays);
+void               fpi_transfer_replay_rewind (FpiTransferReplay *replay);
+
+gboolean           fpi_transfer_replay_usb (FpiTransferReplay *replay,
+                                            FpiUsbTransfer    *transfer,
+                                            gint64            *delay_usec,
+                                            GError           **error);
+gboolean           fpi_transfer_replay_spi (FpiTransferReplay *replay,
+                                            gboolean           read,
+                                            guint8            *buffer,
+                                            gsize              length,
+                                            GError           **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiTransferReplay, fpi_transfer_replay_unref)
+
+G_END_DECLS
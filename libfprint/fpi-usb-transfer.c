@@ -17,7 +17,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "fpi-usb-transfer.h"
+#include "fp-device-private.h"
 
 /**
  * SECTION:fpi-usb-transfer
@@ -30,15 +34,188 @@
  *
  * Drivers should use this API only rather than accessing the GUsbDevice
  * directly in most cases.
+ *
+ * Transfers and the buffers allocated by the fpi_usb_transfer_fill_*()
+ * functions are recycled through a per-device pool once the last reference
+ * is dropped, so drivers that poll the device do not need to worry about
+ * allocating a new transfer for every request.
  */
 
 
 G_DEFINE_BOXED_TYPE (FpiUsbTransfer, fpi_usb_transfer, fpi_usb_transfer_ref, fpi_usb_transfer_unref)
 
+/* Buffers are pooled in power of two sizes from 64 bytes to 64 KiB, the
+ * ones of 4 KiB and more are page aligned. */
+#define POOL_MIN_BUFFER_SHIFT 6
+#define POOL_ALIGNED_BUFFER_SHIFT 12
+#define POOL_MAX_BUFFER_SHIFT 16
+#define POOL_N_BUCKETS (POOL_MAX_BUFFER_SHIFT - POOL_MIN_BUFFER_SHIFT + 1)
+#define POOL_MAX_BUFFERS 8
+#define POOL_MAX_TRANSFERS 16
+
+struct _FpiUsbTransferPool
+{
+  gint       ref_count;
+  GMutex     mutex;
+
+  GPtrArray *transfers;
+  GPtrArray *buffers[POOL_N_BUCKETS];
+};
+
+static void
+usb_transfer_slice_free (gpointer transfer)
+{
+  g_slice_free (FpiUsbTransfer, transfer);
+}
+
+FpiUsbTransferPool *
+fpi_usb_transfer_pool_new (void)
+{
+  FpiUsbTransferPool *pool = g_new0 (FpiUsbTransferPool, 1);
+  gint i;
+
+  pool->ref_count = 1;
+  g_mutex_init (&pool->mutex);
+
+  pool->transfers = g_ptr_array_new_full (POOL_MAX_TRANSFERS,
+                                          usb_transfer_slice_free);
+  for (i = 0; i < POOL_N_BUCKETS; i++)
+    pool->buffers[i] = g_ptr_array_new_full (POOL_MAX_BUFFERS, g_free);
+
+  return pool;
+}
+
+static FpiUsbTransferPool *
+usb_transfer_pool_ref (FpiUsbTransferPool *pool)
+{
+  g_atomic_int_inc (&pool->ref_count);
+
+  return pool;
+}
+
+void
+fpi_usb_transfer_pool_unref (FpiUsbTransferPool *pool)
+{
+  gint i;
+
+  if (!g_atomic_int_dec_and_test (&pool->ref_count))
+    return;
+
+  g_ptr_array_unref (pool->transfers);
+  for (i = 0; i < POOL_N_BUCKETS; i++)
+    g_ptr_array_unref (pool->buffers[i]);
+
+  g_mutex_clear (&pool->mutex);
+  g_free (pool);
+}
+
+static gint
+usb_transfer_pool_bucket (gsize length, gsize *size)
+{
+  gint shift = POOL_MIN_BUFFER_SHIFT;
+
+  if (length > (1 << POOL_MAX_BUFFER_SHIFT))
+    return -1;
+
+  while (((gsize) 1 << shift) < length)
+    shift++;
+
+  *size = (gsize) 1 << shift;
+
+  return shift - POOL_MIN_BUFFER_SHIFT;
+}
+
+/*
+ * Page aligned buffers let the kernel map large bulk transfers directly.
+ * They are still released with g_free(), which uses the system allocator.
+ */
+static guint8 *
+usb_transfer_pool_new_buffer (gsize size)
+{
+  static gsize page_size = 0;
+  gpointer buffer;
+  gint res;
+
+  if (size < (1 << POOL_ALIGNED_BUFFER_SHIFT))
+    return g_malloc0 (size);
+
+  if (g_once_init_enter (&page_size))
+    g_once_init_leave (&page_size, MAX (sysconf (_SC_PAGESIZE), (glong) sizeof (gpointer)));
+
+  res = posix_memalign (&buffer, page_size, size);
+  if (res != 0)
+    g_error ("%s: failed to allocate %" G_GSIZE_FORMAT " bytes aligned to %" G_GSIZE_FORMAT ": %s",
+             G_STRLOC, size, page_size, g_strerror (res));
+
+  memset (buffer, 0, size);
+
+  return buffer;
+}
+
+static guint8 *
+usb_transfer_alloc_buffer (FpiUsbTransfer *transfer, gsize length)
+{
+  FpiUsbTransferPool *pool = transfer->pool;
+  GPtrArray *buffers;
+  guint8 *buffer = NULL;
+  gsize size;
+  gint bucket;
+
+  if (!pool || (bucket = usb_transfer_pool_bucket (length, &size)) < 0)
+    return g_malloc0 (length);
+
+  buffers = pool->buffers[bucket];
+  g_mutex_lock (&pool->mutex);
+  if (buffers->len)
+    buffer = g_ptr_array_steal_index_fast (buffers, buffers->len - 1);
+  g_mutex_unlock (&pool->mutex);
+
+  if (buffer)
+    memset (buffer, 0, length);
+  else
+    buffer = usb_transfer_pool_new_buffer (size);
+
+  transfer->pool_buffer = buffer;
+  transfer->pool_buffer_size = size;
+
+  return buffer;
+}
+
+static gboolean
+usb_transfer_pool_put_buffer (FpiUsbTransferPool *pool,
+                              guint8             *buffer,
+                              gsize               size)
+{
+  GPtrArray *buffers;
+  gsize bucket_size;
+  gboolean added = FALSE;
+
+  buffers = pool->buffers[usb_transfer_pool_bucket (size, &bucket_size)];
+
+  g_mutex_lock (&pool->mutex);
+  if (buffers->len < POOL_MAX_BUFFERS)
+    {
+      g_ptr_array_add (buffers, buffer);
+      added = TRUE;
+    }
+  g_mutex_unlock (&pool->mutex);
+
+  return added;
+}
+
 static void
 log_transfer (FpiUsbTransfer *transfer, gboolean submit, GError *error)
 {
-  if (g_getenv ("FP_DEBUG_TRANSFER"))
+  if (submit)
+    transfer->submit_time = g_get_monotonic_time ();
+  else
+    fpi_device_count_transfer (transfer->device,
+                               transfer->endpoint,
+                               transfer->actual_length,
+                               g_get_monotonic_time () - transfer->submit_time,
+                               error);
+
+  if (fpi_device_debug_transfer ())
     {
       if (!submit)
         {
@@ -99,15 +276,30 @@ log_transfer (FpiUsbTransfer *transfer, gboolean submit, GError *error)
 FpiUsbTransfer *
 fpi_usb_transfer_new (FpDevice * device)
 {
-  FpiUsbTransfer *self;
+  FpiUsbTransferPool *pool;
+  FpiUsbTransfer *self = NULL;
 
   g_assert (device != NULL);
 
-  self = g_slice_new0 (FpiUsbTransfer);
+  pool = fpi_device_get_usb_transfer_pool (device);
+  if (pool)
+    {
+      g_mutex_lock (&pool->mutex);
+      if (pool->transfers->len)
+        self = g_ptr_array_steal_index_fast (pool->transfers,
+                                             pool->transfers->len - 1);
+      g_mutex_unlock (&pool->mutex);
+    }
+
+  if (!self)
+    self = g_slice_new0 (FpiUsbTransfer);
+
   self->ref_count = 1;
   self->type = FP_TRANSFER_NONE;
 
   self->device = device;
+  if (pool)
+    self->pool = usb_transfer_pool_ref (pool);
 
   return self;
 }
@@ -115,14 +307,37 @@ fpi_usb_transfer_new (FpDevice * device)
 static void
 fpi_usb_transfer_free (FpiUsbTransfer *self)
 {
+  FpiUsbTransferPool *pool;
+
   g_assert (self);
   g_assert_cmpint (self->ref_count, ==, 0);
 
+  pool = g_steal_pointer (&self->pool);
+
+  /* Drivers may steal or replace the buffer, only recycle our own. */
+  if (self->buffer && self->buffer == self->pool_buffer &&
+      usb_transfer_pool_put_buffer (pool, self->buffer, self->pool_buffer_size))
+    self->buffer = NULL;
+
   if (self->free_buffer && self->buffer)
     self->free_buffer (self->buffer);
   self->buffer = NULL;
 
-  g_slice_free (FpiUsbTransfer, self);
+  if (pool)
+    {
+      g_mutex_lock (&pool->mutex);
+      if (pool->transfers->len < POOL_MAX_TRANSFERS)
+        {
+          memset (self, 0, sizeof (FpiUsbTransfer));
+          g_ptr_array_add (pool->transfers, g_steal_pointer (&self));
+        }
+      g_mutex_unlock (&pool->mutex);
+
+      fpi_usb_transfer_pool_unref (pool);
+    }
+
+  if (self)
+    g_slice_free (FpiUsbTransfer, self);
 }
 
 /**
@@ -178,7 +393,7 @@ fpi_usb_transfer_fill_bulk (FpiUsbTransfer *transfer,
 {
   fpi_usb_transfer_fill_bulk_full (transfer,
                                    endpoint,
-                                   g_malloc0 (length),
+                                   usb_transfer_alloc_buffer (transfer, length),
                                    length,
                                    g_free);
 }
@@ -246,7 +461,7 @@ fpi_usb_transfer_fill_control (FpiUsbTransfer       *transfer,
   transfer->idx = idx;
 
   transfer->length = length;
-  transfer->buffer = g_malloc0 (length);
+  transfer->buffer = usb_transfer_alloc_buffer (transfer, length);
   transfer->free_buffer = g_free;
 }
 
@@ -266,7 +481,7 @@ fpi_usb_transfer_fill_interrupt (FpiUsbTransfer *transfer,
 {
   fpi_usb_transfer_fill_interrupt_full (transfer,
                                         endpoint,
-                                        g_malloc0 (length),
+                                        usb_transfer_alloc_buffer (transfer, length),
                                         length,
                                         g_free);
 }
@@ -299,12 +514,36 @@ fpi_usb_transfer_fill_interrupt_full (FpiUsbTransfer *transfer,
   transfer->free_buffer = free_func;
 }
 
+static void
+transfer_complete (FpiUsbTransfer *transfer, GError *error)
+{
+  FpiUsbTransferCallback callback;
+
+  log_transfer (transfer, FALSE, error);
+
+  /* Check for short error, and set an error if requested */
+  if (error == NULL &&
+      transfer->short_is_error &&
+      transfer->actual_length > 0 &&
+      transfer->actual_length != transfer->length)
+    {
+      error = g_error_new (G_USB_DEVICE_ERROR,
+                           G_USB_DEVICE_ERROR_IO,
+                           "Unexpected short error of %zd size (expected %zd)", transfer->actual_length, transfer->length);
+    }
+
+  callback = transfer->callback;
+  transfer->callback = NULL;
+  callback (transfer, transfer->device, transfer->user_data, error);
+
+  fpi_usb_transfer_unref (transfer);
+}
+
 static void
 transfer_finish_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GError *error = NULL;
   FpiUsbTransfer *transfer = user_data;
-  FpiUsbTransferCallback callback;
 
   switch (transfer->type)
     {
@@ -334,24 +573,84 @@ transfer_finish_cb (GObject *source_object, GAsyncResult *res, gpointer user_dat
       g_assert_not_reached ();
     }
 
-  log_transfer (transfer, FALSE, error);
+  transfer_complete (transfer, error);
+}
 
-  /* Check for short error, and set an error if requested */
-  if (error == NULL &&
-      transfer->short_is_error &&
-      transfer->actual_length > 0 &&
-      transfer->actual_length != transfer->length)
+typedef struct
+{
+  FpiUsbTransfer *transfer;
+  GCancellable   *cancellable;
+  gulong          cancellable_id;
+  GSource        *source;
+  GError         *error;
+} FpiUsbTransferReplayData;
+
+static void
+replay_complete_cb (FpDevice *device, gpointer user_data)
+{
+  FpiUsbTransferReplayData *data = user_data;
+
+  if (data->cancellable)
+    g_cancellable_disconnect (data->cancellable, data->cancellable_id);
+  g_clear_object (&data->cancellable);
+
+  transfer_complete (data->transfer, g_steal_pointer (&data->error));
+  g_free (data);
+}
+
+static void
+replay_cancelled_cb (GCancellable *cancellable, gpointer user_data)
+{
+  FpiUsbTransferReplayData *data = user_data;
+
+  g_clear_pointer (&data->source, g_source_destroy);
+  g_clear_error (&data->error);
+
+  data->transfer->actual_length = -1;
+  data->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                     "Transfer was cancelled");
+  data->source = fpi_device_add_timeout (data->transfer->device, 0,
+                                         replay_complete_cb, data, NULL);
+}
+
+/* Completes the transfer from the recording rather than the bus. A transfer
+ * that did not complete in the recording times out like it would on the bus,
+ * or stays pending until cancelled if there is no timeout. */
+static void
+replay_submit (FpiUsbTransfer    *transfer,
+               FpiTransferReplay *replay,
+               guint              timeout_ms,
+               GCancellable      *cancellable)
+{
+  FpiUsbTransferReplayData *data = g_new0 (FpiUsbTransferReplayData, 1);
+  gint64 delay_usec;
+
+  data->transfer = transfer;
+
+  if (fpi_transfer_replay_usb (replay, transfer, &delay_usec, &data->error))
     {
-      error = g_error_new (G_USB_DEVICE_ERROR,
-                           G_USB_DEVICE_ERROR_IO,
-                           "Unexpected short error of %zd size (expected %zd)", transfer->actual_length, transfer->length);
+      data->source = fpi_device_add_timeout (transfer->device, 0,
+                                             replay_complete_cb, data, NULL);
+      g_source_set_ready_time (data->source,
+                               g_source_get_time (data->source) + delay_usec);
+    }
+  else if (timeout_ms > 0)
+    {
+      transfer->actual_length = -1;
+      data->error = g_error_new_literal (G_USB_DEVICE_ERROR,
+                                         G_USB_DEVICE_ERROR_TIMED_OUT,
+                                         "The recorded transfer did not complete");
+      data->source = fpi_device_add_timeout (transfer->device, timeout_ms,
+                                             replay_complete_cb, data, NULL);
     }
 
-  callback = transfer->callback;
-  transfer->callback = NULL;
-  callback (transfer, transfer->device, transfer->user_data, error);
-
-  fpi_usb_transfer_unref (transfer);
+  if (cancellable)
+    {
+      data->cancellable = g_object_ref (cancellable);
+      data->cancellable_id = g_cancellable_connect (cancellable,
+                                                    G_CALLBACK (replay_cancelled_cb),
+                                                    data, NULL);
+    }
 }
 
 static void
@@ -393,6 +692,8 @@ fpi_usb_transfer_submit (FpiUsbTransfer        *transfer,
                          FpiUsbTransferCallback callback,
                          gpointer               user_data)
 {
+  FpiTransferReplay *replay;
+
   g_return_if_fail (transfer);
   g_return_if_fail (callback);
 
@@ -417,6 +718,13 @@ fpi_usb_transfer_submit (FpiUsbTransfer        *transfer,
       return;
     }
 
+  replay = fpi_device_get_transfer_replay (transfer->device);
+  if (replay)
+    {
+      replay_submit (transfer, replay, timeout_ms, cancellable);
+      return;
+    }
+
   switch (transfer->type)
     {
     case FP_TRANSFER_BULK:
@@ -484,6 +792,7 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
                               guint           timeout_ms,
                               GError        **error)
 {
+  FpiTransferReplay *replay;
   gboolean res;
   gsize actual_length;
 
@@ -494,6 +803,34 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
 
   log_transfer (transfer, TRUE, NULL);
 
+  replay = fpi_device_get_transfer_replay (transfer->device);
+  if (replay)
+    {
+      g_autoptr(GError) replay_error = NULL;
+      gint64 delay_usec;
+
+      /* Without a cancellable, a transfer that never completed times out */
+      if (!fpi_transfer_replay_usb (replay, transfer, &delay_usec, &replay_error))
+        {
+          delay_usec = 0;
+          replay_error = g_error_new_literal (G_USB_DEVICE_ERROR,
+                                              G_USB_DEVICE_ERROR_TIMED_OUT,
+                                              "The recorded transfer did not complete");
+        }
+
+      if (delay_usec > 0)
+        g_usleep (delay_usec);
+
+      if (replay_error)
+        transfer->actual_length = -1;
+
+      log_transfer (transfer, FALSE, replay_error);
+      res = replay_error == NULL;
+      g_propagate_error (error, g_steal_pointer (&replay_error));
+
+      return res;
+    }
+
   switch (transfer->type)
     {
     case FP_TRANSFER_BULK:
@@ -548,3 +885,337 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
 
   return res;
 }
+
+/**
+ * FpiUsbStream:
+ *
+ * Helper to stream data from a bulk-in endpoint. A number of transfers with
+ * preallocated buffers are kept queued at all times, so that the bus does not
+ * idle while the driver processes the data that has been received so far.
+ * Completed chunks are handed to the driver in submission order, after which
+ * the transfer is resubmitted using the same buffer.
+ *
+ * The structure is opaque and reference counted, use fpi_usb_stream_new() to
+ * create it.
+ */
+typedef struct
+{
+  FpiUsbStream   *stream;
+  FpiUsbTransfer *transfer;
+  gboolean        completed;
+} FpiUsbStreamSlot;
+
+struct _FpiUsbStream
+{
+  guint                ref_count;
+
+  FpDevice            *device;
+  guint                n_slots;
+  FpiUsbStreamSlot    *slots;
+  guint                next_slot;
+  guint                pending;
+
+  gboolean             active;
+  gboolean             stopping;
+  GError              *error;
+
+  guint                timeout_ms;
+  GCancellable        *cancellable;
+  GCancellable        *external_cancellable;
+  gulong               external_cancellable_id;
+
+  FpiUsbStreamCallback callback;
+  gpointer             user_data;
+};
+
+/**
+ * fpi_usb_stream_new:
+ * @device: The #FpDevice the stream is for
+ * @endpoint: The bulk-in endpoint to read from
+ * @chunk_size: The size of each transfer in bytes
+ * @n_transfers: The number of transfers to keep queued
+ *
+ * Creates a new #FpiUsbStream. All transfers and their buffers are allocated
+ * up front and are reused for the lifetime of the stream.
+ *
+ * Returns: (transfer full): A newly created #FpiUsbStream
+ */
+FpiUsbStream *
+fpi_usb_stream_new (FpDevice *device,
+                    guint8    endpoint,
+                    gsize     chunk_size,
+                    guint     n_transfers)
+{
+  FpiUsbStream *stream;
+  guint i;
+
+  g_return_val_if_fail (device != NULL, NULL);
+  g_return_val_if_fail (endpoint & FPI_USB_ENDPOINT_IN, NULL);
+  g_return_val_if_fail (chunk_size > 0, NULL);
+  g_return_val_if_fail (n_transfers > 0, NULL);
+
+  stream = g_new0 (FpiUsbStream, 1);
+  stream->ref_count = 1;
+  stream->device = device;
+  stream->n_slots = n_transfers;
+  stream->slots = g_new0 (FpiUsbStreamSlot, n_transfers);
+
+  for (i = 0; i < n_transfers; i++)
+    {
+      FpiUsbStreamSlot *slot = &stream->slots[i];
+
+      slot->stream = stream;
+      slot->transfer = fpi_usb_transfer_new (device);
+      fpi_usb_transfer_fill_bulk (slot->transfer, endpoint, chunk_size);
+    }
+
+  return stream;
+}
+
+static void
+fpi_usb_stream_free (FpiUsbStream *stream)
+{
+  guint i;
+
+  g_assert_cmpint (stream->ref_count, ==, 0);
+  g_assert (!stream->active);
+
+  for (i = 0; i < stream->n_slots; i++)
+    g_clear_pointer (&stream->slots[i].transfer, fpi_usb_transfer_unref);
+
+  g_clear_pointer (&stream->slots, g_free);
+  g_clear_object (&stream->cancellable);
+  g_clear_error (&stream->error);
+  g_free (stream);
+}
+
+/**
+ * fpi_usb_stream_ref:
+ * @stream: A #FpiUsbStream
+ *
+ * Increments the reference count of @stream by one.
+ *
+ * Returns: (transfer full): @stream
+ */
+FpiUsbStream *
+fpi_usb_stream_ref (FpiUsbStream *stream)
+{
+  g_return_val_if_fail (stream, NULL);
+  g_return_val_if_fail (stream->ref_count, NULL);
+
+  g_atomic_int_inc (&stream->ref_count);
+
+  return stream;
+}
+
+/**
+ * fpi_usb_stream_unref:
+ * @stream: A #FpiUsbStream
+ *
+ * Decrements the reference count of @stream by one, freeing the structure
+ * when the reference count reaches zero. A running stream keeps a reference
+ * to itself until it has ended.
+ */
+void
+fpi_usb_stream_unref (FpiUsbStream *stream)
+{
+  g_return_if_fail (stream);
+  g_return_if_fail (stream->ref_count);
+
+  if (g_atomic_int_dec_and_test (&stream->ref_count))
+    fpi_usb_stream_free (stream);
+}
+
+static void usb_stream_transfer_cb (FpiUsbTransfer *transfer,
+                                    FpDevice       *device,
+                                    gpointer        user_data,
+                                    GError         *error);
+
+static void
+usb_stream_submit_slot (FpiUsbStream     *stream,
+                        FpiUsbStreamSlot *slot)
+{
+  slot->completed = FALSE;
+  stream->pending++;
+
+  /* Every transfer in flight holds a reference on the stream */
+  fpi_usb_stream_ref (stream);
+  fpi_usb_transfer_submit (fpi_usb_transfer_ref (slot->transfer),
+                           stream->timeout_ms,
+                           stream->cancellable,
+                           usb_stream_transfer_cb,
+                           slot);
+}
+
+static void
+usb_stream_finish (FpiUsbStream *stream)
+{
+  FpiUsbStreamCallback callback = stream->callback;
+  GError *error = g_steal_pointer (&stream->error);
+
+  g_assert (stream->pending == 0);
+
+  if (stream->external_cancellable)
+    {
+      g_cancellable_disconnect (stream->external_cancellable,
+                                stream->external_cancellable_id);
+      stream->external_cancellable_id = 0;
+      g_clear_object (&stream->external_cancellable);
+    }
+
+  stream->active = FALSE;
+  stream->stopping = FALSE;
+  stream->callback = NULL;
+
+  if (!error)
+    error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "Stream was stopped");
+
+  callback (stream, stream->device, NULL, 0, stream->user_data, error);
+}
+
+static void
+usb_stream_transfer_cb (FpiUsbTransfer *transfer,
+                        FpDevice       *device,
+                        gpointer        user_data,
+                        GError         *error)
+{
+  FpiUsbStreamSlot *slot = user_data;
+  FpiUsbStream *stream = slot->stream;
+
+  stream->pending--;
+  slot->completed = TRUE;
+
+  if (error)
+    {
+      if (stream->error == NULL)
+        stream->error = error;
+      else
+        g_error_free (error);
+
+      stream->stopping = TRUE;
+      g_cancellable_cancel (stream->cancellable);
+    }
+
+  /* A cancelled stream delivers no more chunks, same as a stopped one */
+  if (g_cancellable_is_cancelled (stream->cancellable))
+    stream->stopping = TRUE;
+
+  /* Chunks are only delivered in order; later transfers that finished
+   * early are held back until all the previous ones are done. */
+  while (!stream->stopping)
+    {
+      FpiUsbStreamSlot *next = &stream->slots[stream->next_slot];
+
+      if (!next->completed)
+        break;
+
+      stream->next_slot = (stream->next_slot + 1) % stream->n_slots;
+      stream->callback (stream, stream->device,
+                        next->transfer->buffer, next->transfer->actual_length,
+                        stream->user_data, NULL);
+
+      /* The callback may have cancelled the external cancellable */
+      if (g_cancellable_is_cancelled (stream->cancellable))
+        stream->stopping = TRUE;
+
+      if (!stream->stopping)
+        usb_stream_submit_slot (stream, next);
+    }
+
+  if (stream->stopping && stream->pending == 0)
+    usb_stream_finish (stream);
+
+  fpi_usb_stream_unref (stream);
+}
+
+static void
+usb_stream_external_cancelled_cb (GCancellable *cancellable,
+                                  FpiUsbStream *stream)
+{
+  /* The transfers will fail and end the stream */
+  g_cancellable_cancel (stream->cancellable);
+}
+
+/**
+ * fpi_usb_stream_start:
+ * @stream: The #FpiUsbStream
+ * @timeout_ms: Timeout for each transfer in ms
+ * @cancellable: (nullable): Cancellable to use, e.g. fpi_device_get_cancellable()
+ * @callback: Callback for each received chunk and for the end of the stream
+ * @user_data: Data to pass to @callback
+ *
+ * Submits all transfers of the stream and keeps resubmitting them as they
+ * complete until the stream is stopped, cancelled or a transfer fails.
+ * Any error (including a timeout) ends the stream.
+ */
+void
+fpi_usb_stream_start (FpiUsbStream        *stream,
+                      guint                timeout_ms,
+                      GCancellable        *cancellable,
+                      FpiUsbStreamCallback callback,
+                      gpointer             user_data)
+{
+  guint i;
+
+  g_return_if_fail (stream);
+  g_return_if_fail (callback);
+  g_return_if_fail (!stream->active);
+
+  stream->active = TRUE;
+  stream->stopping = FALSE;
+  stream->next_slot = 0;
+  stream->timeout_ms = timeout_ms;
+  stream->callback = callback;
+  stream->user_data = user_data;
+
+  /* A cancellable cannot be reset while operations may still use it */
+  g_clear_object (&stream->cancellable);
+  stream->cancellable = g_cancellable_new ();
+
+  if (cancellable)
+    {
+      stream->external_cancellable = g_object_ref (cancellable);
+      stream->external_cancellable_id =
+        g_cancellable_connect (cancellable,
+                               G_CALLBACK (usb_stream_external_cancelled_cb),
+                               stream, NULL);
+    }
+
+  for (i = 0; i < stream->n_slots; i++)
+    usb_stream_submit_slot (stream, &stream->slots[i]);
+}
+
+/**
+ * fpi_usb_stream_stop:
+ * @stream: The #FpiUsbStream
+ *
+ * Stops the stream by cancelling all queued transfers. No more chunks will
+ * be delivered; the callback will be invoked with %G_IO_ERROR_CANCELLED once
+ * all transfers have returned.
+ */
+void
+fpi_usb_stream_stop (FpiUsbStream *stream)
+{
+  g_return_if_fail (stream);
+
+  if (!stream->active || stream->stopping)
+    return;
+
+  stream->stopping = TRUE;
+  g_cancellable_cancel (stream->cancellable);
+}
+
+/**
+ * fpi_usb_stream_is_active:
+ * @stream: The #FpiUsbStream
+ *
+ * Returns: %TRUE if the stream was started and has not ended yet
+ */
+gboolean
+fpi_usb_stream_is_active (FpiUsbStream *stream)
+{
+  g_return_val_if_fail (stream, FALSE);
+
+  return stream->active;
+}
@@ -30,8 +30,9 @@ G_BEGIN_DECLS
 #define FPI_USB_ENDPOINT_IN 0x80
 #define FPI_USB_ENDPOINT_OUT 0x00
 
-typedef struct _FpiUsbTransfer FpiUsbTransfer;
-typedef struct _FpiSsm         FpiSsm;
+typedef struct _FpiUsbTransfer     FpiUsbTransfer;
+typedef struct _FpiUsbTransferPool FpiUsbTransferPool;
+typedef struct _FpiSsm             FpiSsm;
 
 typedef void (*FpiUsbTransferCallback)(FpiUsbTransfer *transfer,
                                        FpDevice       *dev,
@@ -96,12 +97,20 @@ struct _FpiUsbTransfer
   /* Flags */
   gboolean short_is_error;
 
+  /* Monotonic time of submission, for the transfer statistics */
+  gint64 submit_time;
+
   /* Callbacks */
   gpointer               user_data;
   FpiUsbTransferCallback callback;
 
   /* Data free function */
   GDestroyNotify free_buffer;
+
+  /* Per-device pool the transfer and its allocated buffer return to */
+  FpiUsbTransferPool *pool;
+  guint8             *pool_buffer;
+  gsize               pool_buffer_size;
 };
 
 GType              fpi_usb_transfer_get_type (void) G_GNUC_CONST;
@@ -156,4 +165,45 @@ gboolean           fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiUsbTransfer, fpi_usb_transfer_unref)
 
+typedef struct _FpiUsbStream FpiUsbStream;
+
+/**
+ * FpiUsbStreamCallback:
+ * @stream: The #FpiUsbStream
+ * @dev: The #FpDevice the stream belongs to
+ * @data: (nullable): The received chunk, only valid during the callback
+ * @length: The length of @data
+ * @user_data: User data passed to fpi_usb_stream_start()
+ * @error: (transfer full): A #GError or %NULL
+ *
+ * This callback is invoked for every chunk received on the stream, in the
+ * order the underlying transfers were submitted. Once the stream ends, it is
+ * invoked one final time with @data set to %NULL and @error set. The error
+ * will be %G_IO_ERROR_CANCELLED if the stream was stopped using
+ * fpi_usb_stream_stop() or its cancellable.
+ */
+typedef void (*FpiUsbStreamCallback)(FpiUsbStream *stream,
+                                     FpDevice     *dev,
+                                     const guchar *data,
+                                     gsize         length,
+                                     gpointer      user_data,
+                                     GError       *error);
+
+FpiUsbStream      *fpi_usb_stream_new (FpDevice *device,
+                                       guint8    endpoint,
+                                       gsize     chunk_size,
+                                       guint     n_transfers);
+FpiUsbStream      *fpi_usb_stream_ref (FpiUsbStream *stream);
+void               fpi_usb_stream_unref (FpiUsbStream *stream);
+
+void               fpi_usb_stream_start (FpiUsbStream        *stream,
+                                         guint                timeout_ms,
+                                         GCancellable        *cancellable,
+                                         FpiUsbStreamCallback callback,
+                                         gpointer             user_data);
+void               fpi_usb_stream_stop (FpiUsbStream *stream);
+gboolean           fpi_usb_stream_is_active (FpiUsbStream *stream);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiUsbStream, fpi_usb_stream_unref)
+
 G_END_DECLS
@@ -266,6 +266,12 @@ typedef struct g_lfsparms{
    /* Ridge Counting Controls */
    int    max_nbrs;
    int    max_ridge_steps;
+
+   /* Stage Controls */
+   int    refine_direction_map;
+   int    detect_high_curvature;
+   int    remove_pores;
+   int    count_ridges;
 } LFSPARMS;
 
 /*************************************************************************/
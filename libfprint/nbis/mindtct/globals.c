@@ -155,7 +155,13 @@ LFSPARMS g_lfsparms = {
 
    /* Ridge Counting Controls */
    MAX_NBRS,
-   MAX_RIDGE_STEPS
+   MAX_RIDGE_STEPS,
+
+   /* Stage Controls, all stages are run by default */
+   TRUE,
+   TRUE,
+   TRUE,
+   TRUE
 };
 
 
@@ -241,7 +247,13 @@ LFSPARMS g_lfsparms_V2 = {
 
    /* Ridge Counting Controls */
    MAX_NBRS,
-   MAX_RIDGE_STEPS
+   MAX_RIDGE_STEPS,
+
+   /* Stage Controls, all stages are run by default */
+   TRUE,
+   TRUE,
+   TRUE,
+   TRUE
 };
 
 /* Variables for conducting 8-connected neighbor analyses. */
@@ -184,13 +184,14 @@ int gen_image_maps(int **odmap, int **olcmap, int **olfmap, int **ohcmap,
 
    /* May be able to skip steps 6 and/or 7 if computation time */
    /* is a critical factor.                                    */
+   if(lfsparms->refine_direction_map){
+      /* 6. Remove directions that are inconsistent with neighbors */
+      remove_incon_dirs(direction_map, mw, mh, dir2rad, lfsparms);
 
-   /* 6. Remove directions that are inconsistent with neighbors */
-   remove_incon_dirs(direction_map, mw, mh, dir2rad, lfsparms);
-
-   /* 7. Smooth Direction Map values with their neighbors. */
-   smooth_direction_map(direction_map, low_contrast_map, mw, mh,
-                           dir2rad, lfsparms);
+      /* 7. Smooth Direction Map values with their neighbors. */
+      smooth_direction_map(direction_map, low_contrast_map, mw, mh,
+                              dir2rad, lfsparms);
+   }
 
    /* 8. Set the Direction Map values in the image margin to INVALID. */
    set_margin_blocks(direction_map, mw, mh, INVALID_DIR);
@@ -878,6 +879,12 @@ int gen_high_curve_map(int **ohcmap, int *direction_map,
    /* Initialize High Curvature Map to FALSE (0). */
    memset(high_curve_map, 0, mapsize*sizeof(int));
 
+   /* Leave all blocks at FALSE if the analysis is disabled. */
+   if(!lfsparms->detect_high_curvature){
+      *ohcmap = high_curve_map;
+      return(0);
+   }
+
    hptr = high_curve_map;
    dptr = direction_map;
 
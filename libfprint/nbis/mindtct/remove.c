@@ -189,7 +189,8 @@ int remove_false_minutia_V2(MINUTIAE *minutiae,
 
    /* 10. Remove minutiae that form long, narrow, loops in the */
    /*     "unreliable" regions in the binary image.            */
-   if((ret = remove_pores_V2(minutiae,  bdata, iw, ih,
+   if(lfsparms->remove_pores &&
+      (ret = remove_pores_V2(minutiae,  bdata, iw, ih,
                             direction_map, low_flow_map, high_curve_map,
                             mw, mh, lfsparms))){
       return(ret);
@@ -109,6 +109,11 @@ int count_minutiae_ridges(MINUTIAE *minutiae,
       return(ret);
    }
 
+   /* The sorted and deduplicated list is needed in any case, only the */
+   /* neighbor search and ridge counting itself may be skipped.        */
+   if(!lfsparms->count_ridges)
+      return(0);
+
    /* Foreach remaining sorted minutia in list ... */
    for(i = 0; i < minutiae->num-1; i++){
       /* Located neighbors and count number of ridges in between. */
@@ -199,5 +199,8 @@ patch -p0 < fix-scan-build-reports.patch
 # Add pass to remove perimeter points
 patch -p0 < remove-perimeter-pts.patch
 
+# Allow skipping expensive stages for the extraction profiles
+patch -p0 < lfs-stage-controls.patch
+
 # Fix build on musl by dropping unnecessary redeclaration of stderr
 patch -p0 < fix-musl-build.patch
@@ -0,0 +1,298 @@
+/*
+ * Minutiae extraction profile benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "benchmark_minutiae"
+
+#include <cairo.h>
+
+#include <libfprint/fprint.h>
+#include "fp-print-private.h"
+#include "fpi-image.h"
+#include "fpi-log.h"
+
+#include "benchmark-utils.h"
+
+#define BENCHMARK_DEFAULT_ITERATIONS 5
+
+/*
+ * Minutiae are detected in every capture.png of the driver tests with each
+ * of the extraction profiles. Besides the time needed, the number of
+ * minutiae and the bozorth3 score against the minutiae of the default
+ * profile are printed. The score of the default profile against itself is
+ * the best possible, so the ratio shows how much is lost by a faster
+ * profile.
+ */
+
+/*********************************************************/
+/* Images ************************************************/
+/*********************************************************/
+
+/* The captures are opaque RGB24 images with the grey value in every channel,
+ * see capture.py, so the conversion of virtual-image.py to an alpha mask
+ * would leave them blank. Rows are padded to 4 pixels in the same way. */
+static FpImage *
+load_image (const gchar *path)
+{
+  cairo_surface_t *png;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  FpImage *image;
+  const guint8 *data;
+  gint width, height;
+  gint stride;
+  gint x, y;
+
+  png = cairo_image_surface_create_from_png (path);
+  if (cairo_surface_status (png) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (png);
+      return NULL;
+    }
+
+  width = (cairo_image_surface_get_width (png) + 3) / 4 * 4;
+  height = (cairo_image_surface_get_height (png) + 3) / 4 * 4;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+  cr = cairo_create (surface);
+
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_paint (cr);
+
+  cairo_set_source_surface (cr, png, 0, 0);
+  cairo_paint (cr);
+
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+
+  image = fp_image_new (width, height);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      image->data[y * width + x] = ((const guint32 *) (data + y * stride))[x] & 0xff;
+
+  cairo_surface_destroy (surface);
+  cairo_surface_destroy (png);
+
+  return image;
+}
+
+static gint
+compare_names (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+static GPtrArray *
+list_images (void)
+{
+  GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDir) dir = NULL;
+  const gchar *srcdir = g_getenv ("G_TEST_SRCDIR");
+  const gchar *name;
+
+  if (!srcdir)
+    srcdir = ".";
+
+  dir = g_dir_open (srcdir, 0, &error);
+  if (!dir)
+    g_error ("Could not open test directory %s: %s", srcdir, error->message);
+
+  while ((name = g_dir_read_name (dir)))
+    {
+      g_autofree gchar *path = g_build_filename (srcdir, name, "capture.png", NULL);
+
+      if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        g_ptr_array_add (paths, g_steal_pointer (&path));
+    }
+  g_ptr_array_sort (paths, compare_names);
+
+  return paths;
+}
+
+/*********************************************************/
+/* Extraction ********************************************/
+/*********************************************************/
+
+typedef struct
+{
+  gboolean done;
+  GError  *error;
+} DetectResult;
+
+static void
+on_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  DetectResult *result = user_data;
+
+  fp_image_detect_minutiae_finish (FP_IMAGE (source_object), res, &result->error);
+  result->done = TRUE;
+}
+
+/* Returns the xyt data of the print, NULL if no minutiae were found */
+static struct xyt_struct *
+extract (const gchar *path, FpiMinutiaeProfile profile, BenchmarkPhase *phase,
+         guint *n_minutiae)
+{
+  g_autoptr(FpImage) image = load_image (path);
+  g_autoptr(FpPrint) print = NULL;
+  g_autoptr(GError) error = NULL;
+  DetectResult result = { 0 };
+  gint64 start;
+
+  if (!image)
+    g_error ("Could not load %s", path);
+
+  image->minutiae_profile = profile;
+
+  start = g_get_monotonic_time ();
+  fp_image_detect_minutiae (image, NULL, on_minutiae_detected, &result);
+  while (!result.done)
+    g_main_context_iteration (NULL, TRUE);
+  benchmark_phase_add (phase, start);
+
+  /* e.g. "No minutiae found" */
+  error = result.error;
+  if (error)
+    {
+      *n_minutiae = 0;
+      return NULL;
+    }
+
+  *n_minutiae = fp_image_get_minutiae (image)->len;
+
+  print = g_object_new (FP_TYPE_PRINT, NULL);
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+  if (!fpi_print_add_from_image (print, image, &error))
+    g_error ("Could not create print from %s: %s", path, error->message);
+
+  return g_memdup2 (g_ptr_array_index (print->prints, 0), sizeof (struct xyt_struct));
+}
+
+static gint
+bz3_score (struct xyt_struct *probe, struct xyt_struct *gallery)
+{
+  gint probe_len;
+
+  if (!probe || !gallery)
+    return 0;
+
+  probe_len = bozorth_probe_init (probe);
+
+  return bozorth_to_gallery (probe_len, probe, gallery);
+}
+
+/*********************************************************/
+/* Benchmark *********************************************/
+/*********************************************************/
+
+typedef struct
+{
+  FpiMinutiaeProfile profile;
+  BenchmarkPhase     phase;
+  guint64            minutiae;
+  guint64            score;
+  guint              failures;
+} ProfileResult;
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(GPtrArray) paths = list_images ();
+  guint iterations;
+  guint i, p, n;
+
+  ProfileResult results[] = {
+    { FPI_MINUTIAE_PROFILE_DEFAULT, { "default", "all extraction stages" } },
+    { FPI_MINUTIAE_PROFILE_FAST, { "fast", "no direction refinement, high curvature, pores and ridge counts" } },
+  };
+
+  iterations = benchmark_get_iterations (argc > 1 ? argv[1] : NULL,
+                                         BENCHMARK_DEFAULT_ITERATIONS);
+
+  g_print ("Minutiae profile benchmark, %u images, %u iterations per image (times in usec)\n\n",
+           paths->len, iterations);
+  g_print ("%-28s %10s %10s %10s %10s %10s %8s\n",
+           "image", "profile", "mean", "min", "max", "minutiae", "score");
+
+  for (i = 0; i < paths->len; i++)
+    {
+      const gchar *path = g_ptr_array_index (paths, i);
+      g_autofree gchar *dirname = g_path_get_dirname (path);
+      g_autofree gchar *name = g_path_get_basename (dirname);
+      g_autofree struct xyt_struct *reference = NULL;
+      BenchmarkPhase reference_phase = { 0 };
+      guint n_minutiae;
+
+      reference = extract (path, FPI_MINUTIAE_PROFILE_DEFAULT, &reference_phase,
+                           &n_minutiae);
+
+      for (p = 0; p < G_N_ELEMENTS (results); p++)
+        {
+          ProfileResult *result = &results[p];
+          BenchmarkPhase phase = { result->phase.name, result->phase.description };
+          g_autofree struct xyt_struct *xyt = NULL;
+          gint score;
+
+          for (n = 0; n < iterations; n++)
+            {
+              g_clear_pointer (&xyt, g_free);
+              xyt = extract (path, result->profile, &phase, &n_minutiae);
+            }
+
+          score = bz3_score (xyt, reference);
+          if (!xyt)
+            result->failures++;
+
+          g_print ("%-28s %10s %10.1f %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10u %8d\n",
+                   name,
+                   phase.name,
+                   benchmark_phase_mean (&phase),
+                   phase.min_usec,
+                   phase.max_usec,
+                   n_minutiae,
+                   score);
+
+          result->phase.iterations += phase.iterations;
+          result->phase.total_usec += phase.total_usec;
+          if (result->phase.min_usec == 0 || phase.min_usec < result->phase.min_usec)
+            result->phase.min_usec = phase.min_usec;
+          result->phase.max_usec = MAX (result->phase.max_usec, phase.max_usec);
+          result->minutiae += n_minutiae;
+          result->score += score;
+        }
+    }
+
+  g_print ("\n%-12s %10s %12s %12s %10s  %s\n",
+           "profile", "mean", "minutiae", "score", "failures", "description");
+  for (p = 0; p < G_N_ELEMENTS (results); p++)
+    {
+      ProfileResult *result = &results[p];
+
+      g_print ("%-12s %10.1f %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %10u  %s\n",
+               result->phase.name,
+               benchmark_phase_mean (&result->phase),
+               result->minutiae,
+               result->score,
+               result->failures,
+               result->phase.description);
+    }
+
+  return 0;
+}
@@ -0,0 +1,671 @@
+/*
+ * End-to-end image pipeline benchmark using the virtual-image driver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "benchmark_pipeline"
+
+#include <cairo.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+
+#include <libfprint/fprint.h>
+#include "fpi-image.h"
+#include "fpi-log.h"
+#include "fpi-print.h"
+
+#include "benchmark-utils.h"
+
+#define BENCHMARK_DEFAULT_ITERATIONS 5
+#define BENCHMARK_BZ3_THRESHOLD 40
+
+/*
+ * Every capture.png of the driver tests is fed through the virtual-image
+ * driver. Per image, the stages of the image pipeline are measured on their
+ * own, and enroll, verify and identify are measured end to end through the
+ * device. The results are printed and also written as JSON, to
+ * FP_BENCHMARK_JSON or benchmark-fp-pipeline.json in the build directory,
+ * so that they can be compared between releases.
+ */
+
+/*********************************************************/
+/* Benchmark helpers *************************************/
+/*********************************************************/
+
+static void
+benchmark_phase_json (GString *json, const BenchmarkPhase *phase, gboolean last)
+{
+  gdouble mean = benchmark_phase_mean (phase);
+
+  g_string_append_printf (json,
+                          "        \"%s\": { \"count\": %u, \"failures\": %u, "
+                          "\"mean_usec\": %.1f, \"min_usec\": %" G_GINT64_FORMAT ", "
+                          "\"max_usec\": %" G_GINT64_FORMAT ", \"ops_per_sec\": %.2f }%s\n",
+                          phase->name,
+                          phase->iterations,
+                          phase->failures,
+                          mean,
+                          phase->min_usec,
+                          phase->max_usec,
+                          benchmark_phase_rate (phase),
+                          last ? "" : ",");
+}
+
+/*********************************************************/
+/* Images ************************************************/
+/*********************************************************/
+
+enum {
+  STAGE_RECEIVE,
+  STAGE_MINUTIAE,
+  STAGE_ADD_FROM_IMAGE,
+  STAGE_BZ3_MATCH,
+  STAGE_ENROLL,
+  STAGE_VERIFY,
+  N_STAGES,
+};
+
+typedef struct
+{
+  gchar         *name;
+  gint           width;
+  gint           height;
+  guint          minutiae;
+
+  /* Message as understood by virtual-image: width, height and pixels */
+  GByteArray    *message;
+
+  FpPrint       *enrolled;
+
+  BenchmarkPhase stages[N_STAGES];
+} BenchImage;
+
+static void
+bench_image_free (BenchImage *image)
+{
+  g_free (image->name);
+  g_byte_array_unref (image->message);
+  g_clear_object (&image->enrolled);
+  g_free (image);
+}
+
+static const guint8 *
+bench_image_pixels (BenchImage *image)
+{
+  return image->message->data + 2 * sizeof (gint);
+}
+
+/* Same conversion as done by virtual-image.py */
+static BenchImage *
+bench_image_load (const gchar *name, const gchar *path)
+{
+  BenchmarkPhase stages[N_STAGES] = {
+    [STAGE_RECEIVE] = { "receive", "image sent until capture completed" },
+    [STAGE_MINUTIAE] = { "minutiae", "fp_image_detect_minutiae" },
+    [STAGE_ADD_FROM_IMAGE] = { "add-from-image", "fpi_print_add_from_image" },
+    [STAGE_BZ3_MATCH] = { "bz3-match", "fpi_print_bz3_match" },
+    [STAGE_ENROLL] = { "enroll", "enroll through the device" },
+    [STAGE_VERIFY] = { "verify", "verify through the device" },
+  };
+  cairo_surface_t *png;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  BenchImage *image;
+  const guint8 *data;
+  gint header[2];
+  gint stride;
+  gint y;
+
+  png = cairo_image_surface_create_from_png (path);
+  if (cairo_surface_status (png) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (png);
+      return NULL;
+    }
+
+  image = g_new0 (BenchImage, 1);
+  image->name = g_strdup (name);
+  image->width = (cairo_image_surface_get_width (png) + 3) / 4 * 4;
+  image->height = (cairo_image_surface_get_height (png) + 3) / 4 * 4;
+  memcpy (image->stages, stages, sizeof (stages));
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, image->width, image->height);
+  cr = cairo_create (surface);
+
+  cairo_set_source_rgba (cr, 1, 1, 1, 1);
+  cairo_paint (cr);
+
+  cairo_set_source_rgba (cr, 0, 0, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface (cr, png, 0, 0);
+  cairo_paint (cr);
+
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+
+  header[0] = image->width;
+  header[1] = image->height;
+  image->message = g_byte_array_sized_new (sizeof (header) + image->width * image->height);
+  g_byte_array_append (image->message, (guint8 *) header, sizeof (header));
+
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  for (y = 0; y < image->height; y++)
+    g_byte_array_append (image->message, data + y * stride, image->width);
+
+  cairo_surface_destroy (surface);
+  cairo_surface_destroy (png);
+
+  return image;
+}
+
+static gint
+compare_names (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+static GPtrArray *
+bench_images_load (void)
+{
+  GPtrArray *images = g_ptr_array_new_with_free_func ((GDestroyNotify) bench_image_free);
+  g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDir) dir = NULL;
+  const gchar *srcdir = g_getenv ("G_TEST_SRCDIR");
+  const gchar *name;
+  guint i;
+
+  if (!srcdir)
+    srcdir = ".";
+
+  dir = g_dir_open (srcdir, 0, &error);
+  if (!dir)
+    g_error ("Could not open test directory %s: %s", srcdir, error->message);
+
+  while ((name = g_dir_read_name (dir)))
+    g_ptr_array_add (names, g_strdup (name));
+  g_ptr_array_sort (names, compare_names);
+
+  for (i = 0; i < names->len; i++)
+    {
+      const gchar *driver = g_ptr_array_index (names, i);
+      g_autofree gchar *path = g_build_filename (srcdir, driver, "capture.png", NULL);
+      BenchImage *image;
+
+      if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        continue;
+
+      image = bench_image_load (driver, path);
+      if (image)
+        g_ptr_array_add (images, image);
+      else
+        g_message ("Skipping %s, image could not be loaded", path);
+    }
+
+  return images;
+}
+
+static FpImage *
+bench_image_new_fp_image (BenchImage *image)
+{
+  FpImage *fp_image = fp_image_new (image->width, image->height);
+
+  memcpy (fp_image->data, bench_image_pixels (image), image->width * image->height);
+
+  return fp_image;
+}
+
+/*********************************************************/
+/* Device operations *************************************/
+/*********************************************************/
+
+typedef struct
+{
+  FpDevice      *device;
+  GOutputStream *stream;
+
+  guint          pending_writes;
+
+  guint          reports;
+  gboolean       done;
+  GError        *error;
+  FpPrint       *print;
+  FpImage       *image;
+  gboolean       match;
+} Bench;
+
+static void
+bench_iterate_until (Bench *bench, const gboolean *condition)
+{
+  while (!*condition || bench->pending_writes)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+bench_wait_for_finger_needed (Bench *bench)
+{
+  while (!(fp_device_get_finger_status (bench->device) & FP_FINGER_STATUS_NEEDED))
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+on_image_sent (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  Bench *bench = user_data;
+
+  if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (source_object), res, NULL, &error))
+    g_error ("Could not send image: %s", error->message);
+
+  bench->pending_writes--;
+}
+
+static void
+bench_send_image (Bench *bench, BenchImage *image)
+{
+  bench->pending_writes++;
+  g_output_stream_write_all_async (bench->stream,
+                                   image->message->data,
+                                   image->message->len,
+                                   G_PRIORITY_DEFAULT,
+                                   NULL,
+                                   on_image_sent,
+                                   bench);
+}
+
+static void
+bench_reset (Bench *bench)
+{
+  bench->reports = 0;
+  bench->done = FALSE;
+  bench->match = FALSE;
+  g_clear_error (&bench->error);
+  g_clear_object (&bench->print);
+  g_clear_object (&bench->image);
+}
+
+static void
+on_capture_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  bench->image = fp_device_capture_finish (bench->device, res, &bench->error);
+  bench->done = TRUE;
+}
+
+static void
+on_enroll_progress (FpDevice *device,
+                    gint      completed_stages,
+                    FpPrint  *print,
+                    gpointer  user_data,
+                    GError   *error)
+{
+  Bench *bench = user_data;
+
+  bench->reports++;
+}
+
+static void
+on_enroll_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  bench->print = fp_device_enroll_finish (bench->device, res, &bench->error);
+  bench->done = TRUE;
+}
+
+static void
+on_verify_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  fp_device_verify_finish (bench->device, res, &bench->match, NULL, &bench->error);
+  bench->done = TRUE;
+}
+
+static void
+on_identify_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  fp_device_identify_finish (bench->device, res, &bench->print, NULL, &bench->error);
+  bench->match = bench->print != NULL;
+  bench->done = TRUE;
+}
+
+static void
+bench_capture (Bench *bench, BenchImage *image)
+{
+  gint64 start;
+
+  bench_reset (bench);
+  fp_device_capture (bench->device, TRUE, NULL, on_capture_done, bench);
+  bench_wait_for_finger_needed (bench);
+
+  start = g_get_monotonic_time ();
+  bench_send_image (bench, image);
+  bench_iterate_until (bench, &bench->done);
+  benchmark_phase_add (&image->stages[STAGE_RECEIVE], start);
+
+  if (bench->error)
+    image->stages[STAGE_RECEIVE].failures++;
+}
+
+static void
+bench_enroll (Bench *bench, BenchImage *image)
+{
+  g_autoptr(FpPrint) template = fp_print_new (bench->device);
+  gint64 start = g_get_monotonic_time ();
+  guint sent = 0;
+
+  bench_reset (bench);
+  fp_device_enroll (bench->device, g_steal_pointer (&template), NULL,
+                    on_enroll_progress, bench, NULL,
+                    on_enroll_done, bench);
+  bench_wait_for_finger_needed (bench);
+
+  /* Send another image for every stage (or retry) that was reported */
+  while (!bench->done)
+    {
+      if (sent == bench->reports)
+        {
+          bench_send_image (bench, image);
+          sent++;
+        }
+      g_main_context_iteration (NULL, TRUE);
+    }
+  bench_iterate_until (bench, &bench->done);
+  benchmark_phase_add (&image->stages[STAGE_ENROLL], start);
+
+  if (bench->error)
+    {
+      image->stages[STAGE_ENROLL].failures++;
+      return;
+    }
+
+  g_set_object (&image->enrolled, bench->print);
+}
+
+static void
+bench_verify (Bench *bench, BenchImage *image)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  bench_reset (bench);
+  fp_device_verify (bench->device, image->enrolled, NULL,
+                    NULL, NULL, NULL,
+                    on_verify_done, bench);
+  bench_wait_for_finger_needed (bench);
+  bench_send_image (bench, image);
+  bench_iterate_until (bench, &bench->done);
+  benchmark_phase_add (&image->stages[STAGE_VERIFY], start);
+
+  if (bench->error || !bench->match)
+    image->stages[STAGE_VERIFY].failures++;
+}
+
+static void
+bench_identify (Bench *bench, BenchImage *image, GPtrArray *gallery,
+                BenchmarkPhase *phase)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  bench_reset (bench);
+  fp_device_identify (bench->device, gallery, NULL,
+                      NULL, NULL, NULL,
+                      on_identify_done, bench);
+  bench_wait_for_finger_needed (bench);
+  bench_send_image (bench, image);
+  bench_iterate_until (bench, &bench->done);
+  benchmark_phase_add (phase, start);
+
+  if (bench->error || bench->print != image->enrolled)
+    phase->failures++;
+}
+
+/*********************************************************/
+/* Image pipeline stages *********************************/
+/*********************************************************/
+
+static void
+on_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean *done = user_data;
+
+  if (!fp_image_detect_minutiae_finish (FP_IMAGE (source_object), res, &error))
+    g_error ("Minutiae detection failed: %s", error->message);
+
+  *done = TRUE;
+}
+
+static FpPrint *
+bench_print_from_image (Bench *bench, BenchImage *image)
+{
+  g_autoptr(FpImage) fp_image = bench_image_new_fp_image (image);
+  g_autoptr(FpPrint) print = fp_print_new (bench->device);
+  g_autoptr(GError) error = NULL;
+  gboolean done = FALSE;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  fp_image_detect_minutiae (fp_image, NULL, on_minutiae_detected, &done);
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+  benchmark_phase_add (&image->stages[STAGE_MINUTIAE], start);
+
+  image->minutiae = fp_image_get_minutiae (fp_image)->len;
+
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+  start = g_get_monotonic_time ();
+  if (!fpi_print_add_from_image (print, fp_image, &error))
+    {
+      image->stages[STAGE_ADD_FROM_IMAGE].failures++;
+      return NULL;
+    }
+  benchmark_phase_add (&image->stages[STAGE_ADD_FROM_IMAGE], start);
+
+  return g_steal_pointer (&print);
+}
+
+static void
+bench_pipeline (Bench *bench, BenchImage *image)
+{
+  g_autoptr(FpPrint) template = bench_print_from_image (bench, image);
+  g_autoptr(FpPrint) probe = bench_print_from_image (bench, image);
+  g_autoptr(GError) error = NULL;
+  FpiMatchResult result;
+  gint64 start;
+
+  if (!template || !probe)
+    return;
+
+  start = g_get_monotonic_time ();
+  result = fpi_print_bz3_match (template, probe, BENCHMARK_BZ3_THRESHOLD, &error);
+  benchmark_phase_add (&image->stages[STAGE_BZ3_MATCH], start);
+
+  if (result != FPI_MATCH_SUCCESS)
+    image->stages[STAGE_BZ3_MATCH].failures++;
+}
+
+/*********************************************************/
+/* Benchmark *********************************************/
+/*********************************************************/
+
+static void
+write_json (const gchar *path, guint iterations, GPtrArray *images,
+            const BenchmarkPhase *identify)
+{
+  g_autoptr(GString) json = g_string_new ("{\n");
+  g_autoptr(GError) error = NULL;
+  guint i, s;
+
+  g_string_append_printf (json, "  \"benchmark\": \"pipeline\",\n");
+  g_string_append_printf (json, "  \"iterations\": %u,\n", iterations);
+  g_string_append_printf (json, "  \"images\": {\n");
+
+  for (i = 0; i < images->len; i++)
+    {
+      BenchImage *image = g_ptr_array_index (images, i);
+
+      g_string_append_printf (json, "    \"%s\": {\n", image->name);
+      g_string_append_printf (json, "      \"width\": %d,\n", image->width);
+      g_string_append_printf (json, "      \"height\": %d,\n", image->height);
+      g_string_append_printf (json, "      \"minutiae\": %u,\n", image->minutiae);
+      g_string_append_printf (json, "      \"stages\": {\n");
+      for (s = 0; s < N_STAGES; s++)
+        benchmark_phase_json (json, &image->stages[s], s == N_STAGES - 1);
+      g_string_append_printf (json, "      }\n");
+      g_string_append_printf (json, "    }%s\n", i == images->len - 1 ? "" : ",");
+    }
+
+  g_string_append_printf (json, "  },\n");
+  g_string_append_printf (json, "  \"operations\": {\n");
+  benchmark_phase_json (json, identify, TRUE);
+  g_string_append_printf (json, "  }\n}\n");
+
+  if (!g_file_set_contents (path, json->str, json->len, &error))
+    g_error ("Could not write %s: %s", path, error->message);
+
+  g_print ("\nJSON results written to %s\n", path);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(FpContext) context = NULL;
+  g_autoptr(GPtrArray) images = NULL;
+  g_autoptr(GPtrArray) gallery = NULL;
+  g_autoptr(GSocketClient) client = NULL;
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *sockaddr = NULL;
+  g_autofree gchar *json_path = NULL;
+  BenchmarkPhase identify = { "identify", "identify against all enrolled prints" };
+  Bench bench = { 0 };
+  GPtrArray *devices;
+  guint iterations;
+  guint i, j, s;
+
+  iterations = benchmark_get_iterations (argc > 1 ? argv[1] : NULL,
+                                         BENCHMARK_DEFAULT_ITERATIONS);
+
+  images = bench_images_load ();
+  if (images->len == 0)
+    {
+      g_print ("No capture.png images found, skipping\n");
+      return 77;
+    }
+
+  tmpdir = g_dir_make_tmp ("libfprint-pipeline-benchmark-XXXXXX", &error);
+  g_assert_no_error (error);
+  sockaddr = g_build_filename (tmpdir, "virtual-image.socket", NULL);
+  g_setenv ("FP_VIRTUAL_IMAGE", sockaddr, TRUE);
+
+  context = fp_context_new ();
+  devices = fp_context_get_devices (context);
+  for (i = 0; i < devices->len; i++)
+    {
+      FpDevice *device = g_ptr_array_index (devices, i);
+
+      if (g_strcmp0 (fp_device_get_driver (device), "virtual_image") == 0)
+        bench.device = device;
+    }
+
+  if (!bench.device)
+    {
+      g_print ("virtual_image driver is not available, skipping\n");
+      return 77;
+    }
+
+  if (!fp_device_open_sync (bench.device, NULL, &error))
+    g_error ("Could not open device: %s", error->message);
+
+  client = g_socket_client_new ();
+  address = g_unix_socket_address_new (sockaddr);
+  connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, &error);
+  if (!connection)
+    g_error ("Could not connect to virtual-image: %s", error->message);
+  bench.stream = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; j < images->len; j++)
+        {
+          BenchImage *image = g_ptr_array_index (images, j);
+
+          bench_capture (&bench, image);
+          bench_pipeline (&bench, image);
+          bench_enroll (&bench, image);
+          if (image->enrolled)
+            bench_verify (&bench, image);
+        }
+    }
+
+  gallery = g_ptr_array_new ();
+  for (j = 0; j < images->len; j++)
+    {
+      BenchImage *image = g_ptr_array_index (images, j);
+
+      if (image->enrolled)
+        g_ptr_array_add (gallery, image->enrolled);
+    }
+
+  for (i = 0; i < iterations && gallery->len > 0; i++)
+    {
+      for (j = 0; j < images->len; j++)
+        {
+          BenchImage *image = g_ptr_array_index (images, j);
+
+          if (image->enrolled)
+            bench_identify (&bench, image, gallery, &identify);
+        }
+    }
+
+  g_print ("Image pipeline benchmark, %u images, %u iterations (times in usec)\n\n",
+           images->len, iterations);
+  benchmark_print_header ("stage", "ops/sec");
+
+  for (j = 0; j < images->len; j++)
+    {
+      BenchImage *image = g_ptr_array_index (images, j);
+      g_autofree gchar *prefix = g_strdup_printf ("%s/", image->name);
+
+      for (s = 0; s < N_STAGES; s++)
+        benchmark_phase_print (prefix, &image->stages[s]);
+    }
+  benchmark_phase_print (NULL, &identify);
+
+  if (g_getenv ("FP_BENCHMARK_JSON"))
+    json_path = g_strdup (g_getenv ("FP_BENCHMARK_JSON"));
+  else
+    json_path = g_build_filename (g_getenv ("G_TEST_BUILDDIR") ?: ".",
+                                  "benchmark-fp-pipeline.json", NULL);
+  write_json (json_path, iterations, images, &identify);
+
+  bench_reset (&bench);
+  g_clear_object (&connection);
+  if (!fp_device_close_sync (bench.device, NULL, &error))
+    g_error ("Could not close device: %s", error->message);
+
+  g_unlink (sockaddr);
+  g_rmdir (tmpdir);
+
+  return 0;
+}
@@ -0,0 +1,443 @@
+/*
+ * Driver benchmark replaying the recordings of the driver tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "benchmark_replay"
+
+#include <string.h>
+
+#include <libfprint/fprint.h>
+#include "fp-device-private.h"
+#include "fpi-log.h"
+#include "fpi-transfer-replay.h"
+
+#include "benchmark-utils.h"
+
+#define BENCHMARK_DEFAULT_ITERATIONS 20
+#define BENCHMARK_RECORDED_ITERATIONS 2
+
+/*
+ * Every driver test with a capture recording (capture.pcapng for USB,
+ * capture.ioctl for SPI) is run through its driver: open the device, capture
+ * an image and close it again. The transfers are replayed from memory, first
+ * completing right away so that only the time spent on the host remains,
+ * then with the delays of the recording for comparison.
+ *
+ * MoC devices have a custom.pcapng recording of their custom.py instead. The
+ * benchmark only knows the storage flow of the egismoc tests (list, clear,
+ * enroll, verify, identify, delete), the replay needs exactly the operations
+ * of the recording in the same order. Enroll and identify are also timed on
+ * their own.
+ *
+ * The devices still need to exist, so for every recording the benchmark runs
+ * itself through umockdev-run, set up the same way as by umockdev-test.py.
+ * It is skipped if umockdev-run is not installed.
+ */
+
+/*********************************************************/
+/* Recordings ********************************************/
+/*********************************************************/
+
+static gchar *
+get_recording (const gchar *dir)
+{
+  g_autofree gchar *pcap = g_build_filename (dir, "capture.pcapng", NULL);
+  g_autofree gchar *ioctl = g_build_filename (dir, "capture.ioctl", NULL);
+  g_autofree gchar *custom = g_build_filename (dir, "custom.pcapng", NULL);
+
+  if (g_file_test (pcap, G_FILE_TEST_EXISTS))
+    return g_steal_pointer (&pcap);
+  if (g_file_test (ioctl, G_FILE_TEST_EXISTS))
+    return g_steal_pointer (&ioctl);
+  if (g_file_test (custom, G_FILE_TEST_EXISTS))
+    return g_steal_pointer (&custom);
+
+  return NULL;
+}
+
+static gchar *
+read_first_line (const gchar *path)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *contents = NULL;
+
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    g_error ("Cannot read %s: %s", path, error->message);
+
+  return g_strndup (contents, strcspn (contents, "\n"));
+}
+
+static gint
+compare_strings (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Same arguments as used by umockdev-test.py */
+static GPtrArray *
+get_umockdev_args (const gchar *dir, const gchar *recording)
+{
+  g_autoptr(GPtrArray) args = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) devices = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDir) gdir = NULL;
+  g_autofree gchar *first_line = NULL;
+  const gchar *name;
+  guint i;
+
+  gdir = g_dir_open (dir, 0, &error);
+  if (!gdir)
+    g_error ("Cannot open %s: %s", dir, error->message);
+
+  while ((name = g_dir_read_name (gdir)))
+    if (g_str_equal (name, "device") ||
+        (g_str_has_prefix (name, "device-") && !g_str_has_suffix (name, "~")))
+      g_ptr_array_add (devices, g_build_filename (dir, name, NULL));
+  g_ptr_array_sort (devices, compare_strings);
+
+  g_ptr_array_add (args, g_strdup ("umockdev-run"));
+  for (i = 0; i < devices->len; i++)
+    {
+      g_ptr_array_add (args, g_strdup ("-d"));
+      g_ptr_array_add (args, g_strdup (g_ptr_array_index (devices, i)));
+    }
+
+  if (g_str_has_suffix (recording, ".pcapng"))
+    {
+      g_autofree gchar *device = g_build_filename (dir, "device", NULL);
+
+      first_line = read_first_line (device);
+      if (!g_str_has_prefix (first_line, "P: "))
+        g_error ("Unexpected device description in %s", device);
+
+      g_ptr_array_add (args, g_strdup ("-p"));
+      g_ptr_array_add (args, g_strdup_printf ("/sys%s=%s", first_line + 3, recording));
+    }
+  else
+    {
+      gchar *dev;
+
+      /* e.g. "@DEV /dev/spidev0.0 (SPI)" */
+      first_line = read_first_line (recording);
+      if (!g_str_has_prefix (first_line, "@DEV "))
+        g_error ("Unexpected ioctl recording %s", recording);
+
+      dev = first_line + 5;
+      if (g_str_has_suffix (dev, " (SPI)"))
+        *strrchr (dev, ' ') = '\0';
+
+      g_ptr_array_add (args, g_strdup ("-i"));
+      g_ptr_array_add (args, g_strdup_printf ("%s=%s", dev, recording));
+    }
+
+  g_ptr_array_add (args, g_strdup ("--"));
+
+  return g_steal_pointer (&args);
+}
+
+/*********************************************************/
+/* Benchmark *********************************************/
+/*********************************************************/
+
+enum {
+  PHASE_ZERO_DELAY,
+  PHASE_RECORDED_DELAY,
+  PHASE_ENROLL,
+  PHASE_IDENTIFY,
+  N_PHASES,
+};
+
+static gboolean
+is_storage_recording (const gchar *recording)
+{
+  g_autofree gchar *name = g_path_get_basename (recording);
+
+  return g_str_equal (name, "custom.pcapng");
+}
+
+static void
+run_capture (FpDevice *device, FpiTransferReplay *replay, BenchmarkPhase *phase)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpImage) image = NULL;
+  gint64 start = g_get_monotonic_time ();
+  gint64 start_cpu = benchmark_get_cpu_time ();
+
+  fpi_transfer_replay_rewind (replay);
+
+  if (!fp_device_open_sync (device, NULL, &error))
+    g_error ("Failed to open device: %s", error->message);
+
+  image = fp_device_capture_sync (device, TRUE, NULL, &error);
+  if (!image)
+    g_error ("Failed to capture: %s", error->message);
+
+  if (!fp_device_close_sync (device, NULL, &error))
+    g_error ("Failed to close device: %s", error->message);
+
+  benchmark_phase_add (phase, start);
+  benchmark_phase_add_cpu (phase, start_cpu);
+}
+
+static void
+check_stored_prints (FpDevice *device, guint n_prints)
+{
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autoptr(GError) error = NULL;
+
+  prints = fp_device_list_prints_sync (device, NULL, &error);
+  if (!prints)
+    g_error ("Failed to list prints: %s", error->message);
+  if (n_prints != G_MAXUINT && prints->len != n_prints)
+    g_error ("Expected %u stored prints, got %u", n_prints, prints->len);
+}
+
+static FpPrint *
+enroll_finger (FpDevice *device, FpFinger finger, BenchmarkPhase *phase, GError **error)
+{
+  FpPrint *template = fp_print_new (device);
+  FpPrint *print;
+  gint64 start = g_get_monotonic_time ();
+  gint64 start_cpu = benchmark_get_cpu_time ();
+
+  fp_print_set_finger (template, finger);
+  print = fp_device_enroll_sync (device, template, NULL, NULL, NULL, error);
+
+  if (print && phase)
+    {
+      benchmark_phase_add (phase, start);
+      benchmark_phase_add_cpu (phase, start_cpu);
+    }
+
+  return print;
+}
+
+/* Same operations as tests/egismoc-0586/custom.py */
+static void
+run_storage (FpDevice          *device,
+             FpiTransferReplay *replay,
+             BenchmarkPhase    *phase,
+             BenchmarkPhase    *enroll_phase,
+             BenchmarkPhase    *identify_phase)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autoptr(FpPrint) p1 = NULL;
+  g_autoptr(FpPrint) p2 = NULL;
+  g_autoptr(FpPrint) duplicate = NULL;
+  g_autoptr(FpPrint) match = NULL;
+  gboolean verified = FALSE;
+  gint64 start = g_get_monotonic_time ();
+  gint64 start_cpu = benchmark_get_cpu_time ();
+  gint64 identify_start, identify_start_cpu;
+
+  fpi_transfer_replay_rewind (replay);
+
+  if (!fp_device_open_sync (device, NULL, &error))
+    g_error ("Failed to open device: %s", error->message);
+
+  /* The recording starts out with prints stored */
+  check_stored_prints (device, G_MAXUINT);
+  if (!fp_device_clear_storage_sync (device, NULL, &error))
+    g_error ("Failed to clear storage: %s", error->message);
+  check_stored_prints (device, 0);
+
+  p1 = enroll_finger (device, FP_FINGER_LEFT_INDEX, enroll_phase, &error);
+  if (!p1)
+    g_error ("Failed to enroll: %s", error->message);
+  check_stored_prints (device, 1);
+
+  if (!fp_device_verify_sync (device, p1, NULL, NULL, NULL, &verified, NULL, &error))
+    g_error ("Failed to verify: %s", error->message);
+  if (!verified)
+    g_error ("Enrolled print did not verify");
+
+  prints = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (prints, g_object_ref (p1));
+
+  identify_start = g_get_monotonic_time ();
+  identify_start_cpu = benchmark_get_cpu_time ();
+  if (!fp_device_identify_sync (device, prints, NULL, NULL, NULL, &match, NULL, &error))
+    g_error ("Failed to identify: %s", error->message);
+  if (!match || !fp_print_equal (match, p1))
+    g_error ("Enrolled print was not identified");
+  if (identify_phase)
+    {
+      benchmark_phase_add (identify_phase, identify_start);
+      benchmark_phase_add_cpu (identify_phase, identify_start_cpu);
+    }
+
+  duplicate = enroll_finger (device, FP_FINGER_RIGHT_INDEX, NULL, &error);
+  if (!g_error_matches (error, FP_DEVICE_ERROR, FP_DEVICE_ERROR_DATA_DUPLICATE))
+    g_error ("Duplicate was not rejected: %s", error ? error->message : "enrolled");
+  g_clear_error (&error);
+  check_stored_prints (device, 1);
+
+  p2 = enroll_finger (device, FP_FINGER_RIGHT_INDEX, enroll_phase, &error);
+  if (!p2)
+    g_error ("Failed to enroll: %s", error->message);
+  check_stored_prints (device, 2);
+
+  if (!fp_device_delete_print_sync (device, p1, NULL, &error))
+    g_error ("Failed to delete print: %s", error->message);
+  check_stored_prints (device, 1);
+
+  if (!fp_device_clear_storage_sync (device, NULL, &error))
+    g_error ("Failed to clear storage: %s", error->message);
+  check_stored_prints (device, 0);
+
+  if (!fp_device_close_sync (device, NULL, &error))
+    g_error ("Failed to close device: %s", error->message);
+
+  benchmark_phase_add (phase, start);
+  benchmark_phase_add_cpu (phase, start_cpu);
+}
+
+static void
+run_flow (FpDevice          *device,
+          FpiTransferReplay *replay,
+          gboolean           storage,
+          BenchmarkPhase    *phase,
+          BenchmarkPhase    *enroll_phase,
+          BenchmarkPhase    *identify_phase)
+{
+  if (storage)
+    run_storage (device, replay, phase, enroll_phase, identify_phase);
+  else
+    run_capture (device, replay, phase);
+}
+
+/* Runs inside of umockdev */
+static int
+run_replay (const gchar *dir, guint iterations)
+{
+  g_autoptr(FpContext) ctx = fp_context_new ();
+  g_autoptr(FpiTransferReplay) replay = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *name = g_path_get_basename (dir);
+  g_autofree gchar *prefix = g_strconcat (name, " ", NULL);
+  g_autofree gchar *recording = get_recording (dir);
+  gboolean storage = is_storage_recording (recording);
+  const gchar *flow = storage ? "storage" : "capture";
+  g_autofree gchar *zero_description = g_strdup_printf ("%s, transfers complete immediately", flow);
+  g_autofree gchar *recorded_description = g_strdup_printf ("%s, transfers take the recorded time", flow);
+  GPtrArray *devices;
+  FpDevice *device;
+  guint i;
+
+  BenchmarkPhase phases[N_PHASES] = {
+    [PHASE_ZERO_DELAY] = { "zero", zero_description },
+    [PHASE_RECORDED_DELAY] = { "recorded", recorded_description },
+    [PHASE_ENROLL] = { "enroll", "enroll, transfers complete immediately" },
+    [PHASE_IDENTIFY] = { "identify", "identify, transfers complete immediately" },
+  };
+
+  devices = fp_context_get_devices (ctx);
+  if (devices->len == 0)
+    g_error ("No device found for %s", name);
+  device = g_ptr_array_index (devices, 0);
+
+  replay = fpi_transfer_replay_new_from_file (recording, &error);
+  if (!replay)
+    g_error ("Failed to load %s: %s", recording, error->message);
+  fpi_device_set_transfer_replay (device, replay);
+
+  /* Warm up, e.g. loading of the driver data */
+  run_flow (device, replay, storage, &phases[PHASE_ZERO_DELAY], NULL, NULL);
+  phases[PHASE_ZERO_DELAY] = (BenchmarkPhase) { "zero", phases[PHASE_ZERO_DELAY].description };
+
+  for (i = 0; i < iterations; i++)
+    run_flow (device, replay, storage, &phases[PHASE_ZERO_DELAY],
+              &phases[PHASE_ENROLL], &phases[PHASE_IDENTIFY]);
+
+  /* SPI recordings have no timing information */
+  if (g_str_has_suffix (recording, ".pcapng"))
+    {
+      fpi_transfer_replay_set_recorded_delays (replay, TRUE);
+      for (i = 0; i < MIN (iterations, BENCHMARK_RECORDED_ITERATIONS); i++)
+        run_flow (device, replay, storage, &phases[PHASE_RECORDED_DELAY], NULL, NULL);
+    }
+
+  for (i = 0; i < N_PHASES; i++)
+    if (phases[i].iterations > 0)
+      benchmark_phase_print_cpu (prefix, &phases[i]);
+
+  fpi_device_set_transfer_replay (device, NULL);
+
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const gchar *srcdir = g_getenv ("G_TEST_SRCDIR");
+  g_autofree gchar *umockdev_run = NULL;
+  guint iterations;
+  int res = 0;
+  int i;
+
+  iterations = benchmark_get_iterations (NULL, BENCHMARK_DEFAULT_ITERATIONS);
+
+  if (argc == 3 && g_str_equal (argv[1], "--replay"))
+    return run_replay (argv[2], iterations);
+
+  umockdev_run = g_find_program_in_path ("umockdev-run");
+  if (!umockdev_run)
+    {
+      g_print ("umockdev-run not found, skipping benchmark\n");
+      return 77;
+    }
+
+  g_print ("Driver replay benchmark, %u iterations per recording (times in usec)\n\n", iterations);
+  benchmark_print_header ("phase", "cpu");
+
+  for (i = 1; i < argc; i++)
+    {
+      g_autoptr(GPtrArray) args = NULL;
+      g_autoptr(GError) error = NULL;
+      g_autofree gchar *dir = NULL;
+      g_autofree gchar *recording = NULL;
+      g_autofree gchar *driver = NULL;
+      g_auto(GStrv) envp = NULL;
+      gint status;
+
+      dir = g_build_filename (srcdir ? srcdir : ".", argv[i], NULL);
+      recording = get_recording (dir);
+      if (!recording)
+        g_error ("No capture recording in %s", dir);
+
+      args = get_umockdev_args (dir, recording);
+      g_ptr_array_add (args, g_strdup (argv[0]));
+      g_ptr_array_add (args, g_strdup ("--replay"));
+      g_ptr_array_add (args, g_strdup (dir));
+      g_ptr_array_add (args, NULL);
+
+      /* Only load the driver of the recording, e.g. egismoc for egismoc-0586 */
+      driver = g_strndup (argv[i], strcspn (argv[i], "-"));
+      envp = g_environ_setenv (g_get_environ (), "FP_DRIVERS_ALLOWLIST", driver, TRUE);
+
+      if (!g_spawn_sync (NULL, (gchar **) args->pdata, envp, G_SPAWN_SEARCH_PATH,
+                         NULL, NULL, NULL, NULL, &status, &error) ||
+          !g_spawn_check_exit_status (status, &error))
+        {
+          g_printerr ("Replaying %s failed: %s\n", argv[i], error->message);
+          res = 1;
+        }
+    }
+
+  return res;
+}
@@ -0,0 +1,300 @@
+/*
+ * Byte reader and writer benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+
+#include "fpi-byte-reader.h"
+#include "fpi-byte-writer.h"
+
+#include "benchmark-utils.h"
+
+#define BENCHMARK_DEFAULT_ITERATIONS 200
+#define BENCHMARK_PACKETS 1000
+#define BENCHMARK_RECORDS 32
+#define BENCHMARK_RECORD_DATA 8
+
+/*
+ * The packets are laid out like the ones of the match-on-chip drivers: a
+ * header with command and length, a list of records with mixed integer
+ * sizes and a blob each, and a trailing checksum. Every phase builds or
+ * parses BENCHMARK_PACKETS of them.
+ *
+ * Calling the functions through parentheses, e.g.
+ * (fpi_byte_reader_get_uint8) (...), bypasses the macros and uses the
+ * exported out-of-line functions, which is what the "call" phases measure.
+ */
+
+#define PACKET_SIZE (4 + BENCHMARK_RECORDS * (7 + BENCHMARK_RECORD_DATA) + 2)
+
+/* Results are stored here so that the work is not optimized away */
+static volatile guint32 sink;
+
+/*********************************************************/
+/* Packets ***********************************************/
+/*********************************************************/
+
+static const guint8 record_data[BENCHMARK_RECORD_DATA] = {
+  0xde, 0xad, 0xbe, 0xef, 0x01, 0x23, 0x45, 0x67
+};
+
+static guint8 *
+build_packet_call (void)
+{
+  g_auto(FpiByteWriter) writer = {0};
+  gboolean written = TRUE;
+  guint i;
+
+  fpi_byte_writer_init (&writer);
+
+  written &= (fpi_byte_writer_put_uint8) (&writer, 0xa5);
+  written &= (fpi_byte_writer_put_uint8) (&writer, 0x01);
+  written &= (fpi_byte_writer_put_uint16_le) (&writer, PACKET_SIZE - 4);
+
+  for (i = 0; i < BENCHMARK_RECORDS; i++)
+    {
+      written &= (fpi_byte_writer_put_uint8) (&writer, i & 0x7);
+      written &= (fpi_byte_writer_put_uint16_be) (&writer, i);
+      written &= (fpi_byte_writer_put_uint32_le) (&writer, i * 0x01010101);
+      written &= (fpi_byte_writer_put_data) (&writer, record_data, sizeof (record_data));
+    }
+
+  written &= (fpi_byte_writer_put_uint16_be) (&writer, 0xffff);
+  g_assert_true (written);
+
+  return fpi_byte_writer_reset_and_get_data (&writer);
+}
+
+static void
+build_packet_body (FpiByteWriter *writer)
+{
+  gboolean written = TRUE;
+  guint i;
+
+  written &= fpi_byte_writer_put_uint8 (writer, 0xa5);
+  written &= fpi_byte_writer_put_uint8 (writer, 0x01);
+  written &= fpi_byte_writer_put_uint16_le (writer, PACKET_SIZE - 4);
+
+  for (i = 0; i < BENCHMARK_RECORDS; i++)
+    {
+      written &= fpi_byte_writer_put_uint8 (writer, i & 0x7);
+      written &= fpi_byte_writer_put_uint16_be (writer, i);
+      written &= fpi_byte_writer_put_uint32_le (writer, i * 0x01010101);
+      written &= fpi_byte_writer_put_data (writer, record_data, sizeof (record_data));
+    }
+
+  written &= fpi_byte_writer_put_uint16_be (writer, 0xffff);
+  g_assert_true (written);
+}
+
+static guint8 *
+build_packet_grow (void)
+{
+  g_auto(FpiByteWriter) writer = {0};
+
+  fpi_byte_writer_init (&writer);
+  build_packet_body (&writer);
+
+  return fpi_byte_writer_reset_and_get_data (&writer);
+}
+
+static guint8 *
+build_packet_reserve (void)
+{
+  g_auto(FpiByteWriter) writer = {0};
+
+  fpi_byte_writer_init (&writer);
+  if (!fpi_byte_writer_reserve (&writer, PACKET_SIZE))
+    g_error ("Failed to reserve %u bytes", PACKET_SIZE);
+  build_packet_body (&writer);
+
+  g_assert_cmpuint (writer.alloc_size, ==, PACKET_SIZE);
+
+  return fpi_byte_writer_reset_and_get_data (&writer);
+}
+
+static guint8 *
+build_packet_fixed (void)
+{
+  g_auto(FpiByteWriter) writer = {0};
+
+  fpi_byte_writer_init_with_size (&writer, PACKET_SIZE, TRUE);
+  build_packet_body (&writer);
+
+  return fpi_byte_writer_reset_and_get_data (&writer);
+}
+
+static guint32
+parse_packet_call (const guint8 *packet)
+{
+  FpiByteReader reader;
+  gboolean read = TRUE;
+  guint32 sum = 0;
+  guint8 cmd, flags;
+  guint16 length, checksum;
+  guint i;
+
+  (fpi_byte_reader_init) (&reader, packet, PACKET_SIZE);
+
+  read &= (fpi_byte_reader_get_uint8) (&reader, &cmd);
+  read &= (fpi_byte_reader_get_uint8) (&reader, &flags);
+  read &= (fpi_byte_reader_get_uint16_le) (&reader, &length);
+  sum += cmd + flags + length;
+
+  for (i = 0; i < BENCHMARK_RECORDS; i++)
+    {
+      const guint8 *data;
+      guint8 type;
+      guint16 id;
+      guint32 value;
+
+      read &= (fpi_byte_reader_get_uint8) (&reader, &type);
+      read &= (fpi_byte_reader_get_uint16_be) (&reader, &id);
+      read &= (fpi_byte_reader_get_uint32_le) (&reader, &value);
+      read &= (fpi_byte_reader_get_data) (&reader, BENCHMARK_RECORD_DATA, &data);
+      sum += type + id + value + data[0];
+    }
+
+  read &= (fpi_byte_reader_get_uint16_be) (&reader, &checksum);
+  g_assert_true (read);
+
+  return sum + checksum;
+}
+
+static guint32
+parse_packet_inline (const guint8 *packet)
+{
+  FpiByteReader reader;
+  gboolean read = TRUE;
+  guint32 sum = 0;
+  guint8 cmd, flags;
+  guint16 length, checksum;
+  guint i;
+
+  fpi_byte_reader_init (&reader, packet, PACKET_SIZE);
+
+  read &= fpi_byte_reader_get_uint8 (&reader, &cmd);
+  read &= fpi_byte_reader_get_uint8 (&reader, &flags);
+  read &= fpi_byte_reader_get_uint16_le (&reader, &length);
+  sum += cmd + flags + length;
+
+  for (i = 0; i < BENCHMARK_RECORDS; i++)
+    {
+      const guint8 *data;
+      guint8 type;
+      guint16 id;
+      guint32 value;
+
+      read &= fpi_byte_reader_get_uint8 (&reader, &type);
+      read &= fpi_byte_reader_get_uint16_be (&reader, &id);
+      read &= fpi_byte_reader_get_uint32_le (&reader, &value);
+      read &= fpi_byte_reader_get_data (&reader, BENCHMARK_RECORD_DATA, &data);
+      sum += type + id + value + data[0];
+    }
+
+  read &= fpi_byte_reader_get_uint16_be (&reader, &checksum);
+  g_assert_true (read);
+
+  return sum + checksum;
+}
+
+/*********************************************************/
+/* Benchmark *********************************************/
+/*********************************************************/
+
+enum {
+  PHASE_READ_CALL,
+  PHASE_READ_INLINE,
+  PHASE_WRITE_CALL,
+  PHASE_WRITE_GROW,
+  PHASE_WRITE_RESERVE,
+  PHASE_WRITE_FIXED,
+  N_PHASES,
+};
+
+typedef guint8 *(*BuildFunc) (void);
+
+static void
+run_build (BenchmarkPhase *phase, BuildFunc build)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < BENCHMARK_PACKETS; i++)
+    {
+      g_autofree guint8 *packet = build ();
+
+      sink += packet[PACKET_SIZE - 1];
+    }
+
+  benchmark_phase_add (phase, start);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autofree guint8 *packet = NULL;
+  g_autofree guint8 *reserved = NULL;
+  guint iterations;
+  guint i, j;
+
+  BenchmarkPhase phases[N_PHASES] = {
+    [PHASE_READ_CALL] = { "read-call", "parse, out-of-line getters", BENCHMARK_PACKETS },
+    [PHASE_READ_INLINE] = { "read-inline", "parse, inline getters", BENCHMARK_PACKETS },
+    [PHASE_WRITE_CALL] = { "write-call", "build, out-of-line putters, growing buffer", BENCHMARK_PACKETS },
+    [PHASE_WRITE_GROW] = { "write-grow", "build, inline putters, growing buffer", BENCHMARK_PACKETS },
+    [PHASE_WRITE_RESERVE] = { "write-reserve", "build, inline putters, reserved exact size", BENCHMARK_PACKETS },
+    [PHASE_WRITE_FIXED] = { "write-fixed", "build, inline putters, fixed zeroed buffer", BENCHMARK_PACKETS },
+  };
+
+  iterations = benchmark_get_iterations (argc > 1 ? argv[1] : NULL,
+                                         BENCHMARK_DEFAULT_ITERATIONS);
+
+  /* All ways of building have to produce the same packet */
+  packet = build_packet_call ();
+  reserved = build_packet_reserve ();
+  g_assert_cmpmem (packet, PACKET_SIZE, reserved, PACKET_SIZE);
+  g_assert_cmpuint (parse_packet_call (packet), ==, parse_packet_inline (packet));
+
+  g_print ("Byte reader/writer benchmark, %u iterations of %u packets of %u bytes (times in usec)\n\n",
+           iterations, BENCHMARK_PACKETS, PACKET_SIZE);
+  benchmark_print_header ("phase", "packets/s");
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      for (j = 0; j < BENCHMARK_PACKETS; j++)
+        sink += parse_packet_call (packet);
+      benchmark_phase_add (&phases[PHASE_READ_CALL], start);
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < BENCHMARK_PACKETS; j++)
+        sink += parse_packet_inline (packet);
+      benchmark_phase_add (&phases[PHASE_READ_INLINE], start);
+
+      run_build (&phases[PHASE_WRITE_CALL], build_packet_call);
+      run_build (&phases[PHASE_WRITE_GROW], build_packet_grow);
+      run_build (&phases[PHASE_WRITE_RESERVE], build_packet_reserve);
+      run_build (&phases[PHASE_WRITE_FIXED], build_packet_fixed);
+    }
+
+  for (i = 0; i < N_PHASES; i++)
+    benchmark_phase_print (NULL, &phases[i]);
+
+  return 0;
+}
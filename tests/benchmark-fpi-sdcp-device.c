@@ -0,0 +1,585 @@
+/*
+ * Secure Device Connection Protocol support benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "benchmark_sdcp_device"
+
+#include <glib/gstdio.h>
+#include <openssl/core_names.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include "fpi-device.h"
+#include "fpi-log.h"
+#include "fpi-sdcp-device-private.h"
+
+#include "benchmark-utils.h"
+
+#define BENCHMARK_DEFAULT_ITERATIONS 100
+
+/*********************************************************/
+/* FpiBenchmarkSdcpDevice device setup *******************/
+/*********************************************************/
+
+#define FPI_TYPE_BENCHMARK_SDCP_DEVICE (fpi_benchmark_sdcp_device_get_type ())
+G_DECLARE_FINAL_TYPE (FpiBenchmarkSdcpDevice, fpi_benchmark_sdcp_device, FPI,
+                      BENCHMARK_SDCP_DEVICE, FpiSdcpDevice)
+
+struct _FpiBenchmarkSdcpDevice
+{
+  FpiSdcpDevice parent;
+};
+
+G_DEFINE_TYPE (FpiBenchmarkSdcpDevice, fpi_benchmark_sdcp_device, FPI_TYPE_SDCP_DEVICE)
+
+static const FpIdEntry id_table[] = {
+  { .virtual_envvar = "FP_VIRTUAL_FAKE_DEVICE" },
+  { .virtual_envvar = NULL }
+};
+
+static void
+fpi_benchmark_sdcp_device_probe (FpDevice *device)
+{
+  FpDeviceClass *dev_class = FP_DEVICE_GET_CLASS (device);
+
+  fpi_device_probe_complete (device, dev_class->id, dev_class->full_name, NULL);
+}
+
+static void
+fpi_benchmark_sdcp_device_open (FpDevice *device)
+{
+  fpi_device_open_complete (device, NULL);
+}
+
+static void
+fpi_benchmark_sdcp_device_close (FpDevice *device)
+{
+  fpi_device_close_complete (device, NULL);
+}
+
+static void
+fpi_benchmark_sdcp_device_init (FpiBenchmarkSdcpDevice *self)
+{
+}
+
+static void
+fpi_benchmark_sdcp_device_class_init (FpiBenchmarkSdcpDeviceClass *klass)
+{
+  FpDeviceClass *dev_class = FP_DEVICE_CLASS (klass);
+  FpiSdcpDeviceClass *sdcp_dev_class = FPI_SDCP_DEVICE_CLASS (klass);
+
+  dev_class->id = FP_COMPONENT;
+  dev_class->full_name = "Virtual SDCP benchmark device";
+
+  dev_class->type = FP_DEVICE_TYPE_VIRTUAL;
+  dev_class->scan_type = FP_SCAN_TYPE_PRESS;
+  dev_class->id_table = id_table;
+  dev_class->nr_enroll_stages = 5;
+
+  dev_class->probe = fpi_benchmark_sdcp_device_probe;
+  dev_class->open = fpi_benchmark_sdcp_device_open;
+  dev_class->close = fpi_benchmark_sdcp_device_close;
+
+  sdcp_dev_class->supports_reconnect = TRUE;
+  /* measure the cost of generating host keys on the connect path */
+  sdcp_dev_class->precompute_host_keys = FALSE;
+}
+
+/*********************************************************/
+/* Software SDCP firmware ********************************/
+/*********************************************************/
+
+/*
+ * Minimal in-process implementation of the device (firmware) side of SDCP,
+ * so that valid ConnectResponse, ReconnectResponse and AuthorizedIdentity
+ * payloads can be produced without any hardware.
+ */
+typedef struct
+{
+  EVP_PKEY *model_key;
+  EVP_PKEY *device_key;
+  EVP_PKEY *firmware_key;
+
+  guchar   *model_certificate;
+  gsize     model_certificate_len;
+
+  guchar    device_public_key[SDCP_PUBLIC_KEY_SIZE];
+  guchar    firmware_public_key[SDCP_PUBLIC_KEY_SIZE];
+  guchar    firmware_hash[SDCP_DIGEST_SIZE];
+  guchar    model_signature[SDCP_SIGNATURE_SIZE];
+  guchar    device_signature[SDCP_SIGNATURE_SIZE];
+
+  guchar    application_secret[SDCP_APPLICATION_SECRET_SIZE];
+} SoftSdcpFirmware;
+
+static void
+soft_get_public_key (EVP_PKEY *key, guchar *out)
+{
+  gsize len = 0;
+
+  g_assert (EVP_PKEY_get_octet_string_param (key, OSSL_PKEY_PARAM_PUB_KEY,
+                                             out, SDCP_PUBLIC_KEY_SIZE, &len));
+  g_assert_cmpuint (len, ==, SDCP_PUBLIC_KEY_SIZE);
+}
+
+static EVP_PKEY *
+soft_get_peer_key (const guchar *public_key)
+{
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name (NULL, "EC", NULL);
+  EVP_PKEY *key = NULL;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_utf8_string (OSSL_PKEY_PARAM_GROUP_NAME,
+                                      (gchar *) SDCP_OPENSSL_CURVE_GROUP_NAME, 0),
+    OSSL_PARAM_construct_octet_string (OSSL_PKEY_PARAM_PUB_KEY,
+                                       (guchar *) public_key, SDCP_PUBLIC_KEY_SIZE),
+    OSSL_PARAM_construct_end (),
+  };
+
+  EVP_PKEY_fromdata_init (ctx);
+  g_assert (EVP_PKEY_fromdata (ctx, &key, EVP_PKEY_PUBLIC_KEY, params) > 0);
+  EVP_PKEY_CTX_free (ctx);
+
+  return key;
+}
+
+static void
+soft_sign (EVP_PKEY *key, const guchar *data, gsize data_len, guchar *out)
+{
+  EVP_MD_CTX *md_ctx = EVP_MD_CTX_new ();
+  g_autofree guchar *der = NULL;
+  const guchar *der_ptr;
+  gsize der_len = 0;
+  ECDSA_SIG *sig;
+  const BIGNUM *r, *s;
+
+  g_assert (EVP_DigestSignInit_ex (md_ctx, NULL, "SHA256", NULL, NULL, key, NULL));
+  g_assert (EVP_DigestSign (md_ctx, NULL, &der_len, data, data_len));
+  der = g_malloc0 (der_len);
+  g_assert (EVP_DigestSign (md_ctx, der, &der_len, data, data_len));
+  EVP_MD_CTX_free (md_ctx);
+
+  /* SDCP uses raw r || s signatures rather than DER */
+  der_ptr = der;
+  sig = d2i_ECDSA_SIG (NULL, &der_ptr, der_len);
+  g_assert (sig);
+  ECDSA_SIG_get0 (sig, &r, &s);
+  BN_bn2binpad (r, out, SDCP_SIGNATURE_SIZE / 2);
+  BN_bn2binpad (s, out + SDCP_SIGNATURE_SIZE / 2, SDCP_SIGNATURE_SIZE / 2);
+  ECDSA_SIG_free (sig);
+}
+
+static void
+soft_make_model_certificate (SoftSdcpFirmware *fw)
+{
+  X509 *cert = X509_new ();
+  X509_NAME *name;
+  guchar *der = NULL;
+  int der_len;
+
+  X509_set_version (cert, X509_VERSION_3);
+  ASN1_INTEGER_set (X509_get_serialNumber (cert), 1);
+  X509_gmtime_adj (X509_getm_notBefore (cert), 0);
+  X509_gmtime_adj (X509_getm_notAfter (cert), 60 * 60 * 24);
+  X509_set_pubkey (cert, fw->model_key);
+
+  name = X509_get_subject_name (cert);
+  X509_NAME_add_entry_by_txt (name, "CN", MBSTRING_ASC,
+                              (guchar *) "libfprint SDCP benchmark model", -1, -1, 0);
+  X509_set_issuer_name (cert, name);
+
+  g_assert (X509_sign (cert, fw->model_key, EVP_sha256 ()) > 0);
+
+  der_len = i2d_X509 (cert, &der);
+  g_assert (der_len > 0);
+
+  fw->model_certificate = g_memdup2 (der, der_len);
+  fw->model_certificate_len = der_len;
+
+  OPENSSL_free (der);
+  X509_free (cert);
+}
+
+static void
+soft_kbkdf (const guchar *key, gsize key_len,
+            const gchar *label,
+            const guchar *context, gsize context_len,
+            guchar *out, gsize out_len)
+{
+  EVP_KDF *kdf = EVP_KDF_fetch (NULL, "KBKDF", NULL);
+  EVP_KDF_CTX *kdf_ctx = EVP_KDF_CTX_new (kdf);
+  guchar key_buf[SDCP_MAX_SECRET_SIZE];
+  OSSL_PARAM params[7];
+  int i = 0;
+
+  memcpy (key_buf, key, key_len);
+
+  params[i++] = OSSL_PARAM_construct_utf8_string (OSSL_KDF_PARAM_MODE, (gchar *) "counter", 0);
+  params[i++] = OSSL_PARAM_construct_utf8_string (OSSL_KDF_PARAM_MAC, (gchar *) "HMAC", 0);
+  params[i++] = OSSL_PARAM_construct_utf8_string (OSSL_KDF_PARAM_DIGEST, (gchar *) "SHA2-256", 0);
+  params[i++] = OSSL_PARAM_construct_octet_string (OSSL_KDF_PARAM_KEY, key_buf, key_len);
+  params[i++] = OSSL_PARAM_construct_octet_string (OSSL_KDF_PARAM_SALT,
+                                                   (gchar *) label, strlen (label));
+  if (context)
+    params[i++] = OSSL_PARAM_construct_octet_string (OSSL_KDF_PARAM_INFO,
+                                                     (guchar *) context, context_len);
+  params[i++] = OSSL_PARAM_construct_end ();
+
+  g_assert (EVP_KDF_derive (kdf_ctx, out, out_len, params) > 0);
+
+  EVP_KDF_CTX_free (kdf_ctx);
+  EVP_KDF_free (kdf);
+}
+
+static void
+soft_ecdh (EVP_PKEY *key, const guchar *peer_public_key, guchar *out)
+{
+  EVP_PKEY *peer = soft_get_peer_key (peer_public_key);
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_pkey (NULL, key, NULL);
+  gsize len = SDCP_KEY_AGREEMENT_SIZE;
+
+  EVP_PKEY_derive_init (ctx);
+  EVP_PKEY_derive_set_peer (ctx, peer);
+  g_assert (EVP_PKEY_derive (ctx, out, &len) > 0);
+  g_assert_cmpuint (len, ==, SDCP_KEY_AGREEMENT_SIZE);
+
+  EVP_PKEY_CTX_free (ctx);
+  EVP_PKEY_free (peer);
+}
+
+/* HMAC-SHA256 over the NUL-terminated @label followed by @a and @b */
+static void
+soft_hmac (const guchar *secret, const gchar *label,
+           const guchar *a, gsize a_len,
+           const guchar *b, gsize b_len,
+           guchar *out)
+{
+  EVP_MAC *mac = EVP_MAC_fetch (NULL, "HMAC", NULL);
+  EVP_MAC_CTX *ctx = EVP_MAC_CTX_new (mac);
+  gsize out_len = 0;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (gchar *) "SHA256", 0),
+    OSSL_PARAM_construct_end (),
+  };
+
+  EVP_MAC_init (ctx, secret, SDCP_APPLICATION_SECRET_SIZE, params);
+  EVP_MAC_update (ctx, (const guchar *) label, strlen (label) + 1);
+  if (a)
+    EVP_MAC_update (ctx, a, a_len);
+  if (b)
+    EVP_MAC_update (ctx, b, b_len);
+  EVP_MAC_final (ctx, out, &out_len, SDCP_DIGEST_SIZE);
+  EVP_MAC_CTX_free (ctx);
+  EVP_MAC_free (mac);
+
+  g_assert_cmpuint (out_len, ==, SDCP_DIGEST_SIZE);
+}
+
+static SoftSdcpFirmware *
+soft_firmware_new (void)
+{
+  SoftSdcpFirmware *fw = g_new0 (SoftSdcpFirmware, 1);
+  const gchar firmware_image[] = "libfprint SDCP benchmark firmware";
+  guchar signed_data[SDCP_DIGEST_SIZE + SDCP_PUBLIC_KEY_SIZE];
+  EVP_MD_CTX *md_ctx;
+
+  fw->model_key = EVP_EC_gen (SDCP_OPENSSL_CURVE_NAME);
+  fw->device_key = EVP_EC_gen (SDCP_OPENSSL_CURVE_NAME);
+  fw->firmware_key = EVP_EC_gen (SDCP_OPENSSL_CURVE_NAME);
+  g_assert (fw->model_key && fw->device_key && fw->firmware_key);
+
+  soft_make_model_certificate (fw);
+  soft_get_public_key (fw->device_key, fw->device_public_key);
+  soft_get_public_key (fw->firmware_key, fw->firmware_public_key);
+
+  /* h_f = H(firmware || pk_f) */
+  md_ctx = EVP_MD_CTX_new ();
+  EVP_DigestInit_ex (md_ctx, EVP_sha256 (), NULL);
+  EVP_DigestUpdate (md_ctx, firmware_image, sizeof (firmware_image));
+  EVP_DigestUpdate (md_ctx, fw->firmware_public_key, SDCP_PUBLIC_KEY_SIZE);
+  EVP_DigestFinal_ex (md_ctx, fw->firmware_hash, NULL);
+  EVP_MD_CTX_free (md_ctx);
+
+  /* s_m = sign(sk_m, pk_d), s_d = sign(sk_d, h_f || pk_f) */
+  soft_sign (fw->model_key, fw->device_public_key, SDCP_PUBLIC_KEY_SIZE,
+             fw->model_signature);
+
+  memcpy (signed_data, fw->firmware_hash, SDCP_DIGEST_SIZE);
+  memcpy (signed_data + SDCP_DIGEST_SIZE, fw->firmware_public_key, SDCP_PUBLIC_KEY_SIZE);
+  soft_sign (fw->device_key, signed_data, sizeof (signed_data), fw->device_signature);
+
+  return fw;
+}
+
+static void
+soft_firmware_free (SoftSdcpFirmware *fw)
+{
+  EVP_PKEY_free (fw->model_key);
+  EVP_PKEY_free (fw->device_key);
+  EVP_PKEY_free (fw->firmware_key);
+  g_free (fw->model_certificate);
+  g_free (fw);
+}
+
+static FpiSdcpConnectResponse *
+soft_firmware_connect (SoftSdcpFirmware *fw,
+                       const guchar     *host_public_key,
+                       const guchar     *host_random)
+{
+  FpiSdcpConnectResponse *response = g_new0 (FpiSdcpConnectResponse, 1);
+  guchar key_agreement[SDCP_KEY_AGREEMENT_SIZE];
+  guchar master_secret[SDCP_MASTER_SECRET_SIZE];
+  guchar application_keys[SDCP_APPLICATION_SECRET_SIZE +
+                          SDCP_APPLICATION_SYMMETRIC_KEY_SIZE];
+  guchar context[SDCP_RANDOM_SIZE * 2];
+  guchar claim_hash[SDCP_DIGEST_SIZE];
+  EVP_MD_CTX *md_ctx;
+
+  RAND_bytes (response->device_random, SDCP_RANDOM_SIZE);
+  response->model_certificate = g_memdup2 (fw->model_certificate,
+                                           fw->model_certificate_len);
+  response->model_certificate_len = fw->model_certificate_len;
+  memcpy (response->device_public_key, fw->device_public_key, SDCP_PUBLIC_KEY_SIZE);
+  memcpy (response->firmware_public_key, fw->firmware_public_key, SDCP_PUBLIC_KEY_SIZE);
+  memcpy (response->firmware_hash, fw->firmware_hash, SDCP_DIGEST_SIZE);
+  memcpy (response->model_signature, fw->model_signature, SDCP_SIGNATURE_SIZE);
+  memcpy (response->device_signature, fw->device_signature, SDCP_SIGNATURE_SIZE);
+
+  /* a = ECDH(sk_f, pk_h) */
+  soft_ecdh (fw->firmware_key, host_public_key, key_agreement);
+
+  /* ms = KDF(a, "master secret", r_h || r_d) */
+  memcpy (context, host_random, SDCP_RANDOM_SIZE);
+  memcpy (context + SDCP_RANDOM_SIZE, response->device_random, SDCP_RANDOM_SIZE);
+  soft_kbkdf (key_agreement, sizeof (key_agreement), "master secret",
+              context, sizeof (context), master_secret, sizeof (master_secret));
+
+  /* (s, k) = KDF(ms, "application keys") */
+  soft_kbkdf (master_secret, sizeof (master_secret), "application keys",
+              NULL, 0, application_keys, sizeof (application_keys));
+  memcpy (fw->application_secret, application_keys, SDCP_APPLICATION_SECRET_SIZE);
+
+  /* H = SHA256(cert_m || pk_d || pk_f || h_f || s_m || s_d) */
+  md_ctx = EVP_MD_CTX_new ();
+  EVP_DigestInit_ex (md_ctx, EVP_sha256 (), NULL);
+  EVP_DigestUpdate (md_ctx, response->model_certificate, response->model_certificate_len);
+  EVP_DigestUpdate (md_ctx, response->device_public_key, SDCP_PUBLIC_KEY_SIZE);
+  EVP_DigestUpdate (md_ctx, response->firmware_public_key, SDCP_PUBLIC_KEY_SIZE);
+  EVP_DigestUpdate (md_ctx, response->firmware_hash, SDCP_DIGEST_SIZE);
+  EVP_DigestUpdate (md_ctx, response->model_signature, SDCP_SIGNATURE_SIZE);
+  EVP_DigestUpdate (md_ctx, response->device_signature, SDCP_SIGNATURE_SIZE);
+  EVP_DigestFinal_ex (md_ctx, claim_hash, NULL);
+  EVP_MD_CTX_free (md_ctx);
+
+  /* m = MAC(s, "connect\0" || H) */
+  soft_hmac (fw->application_secret, "connect", claim_hash, SDCP_DIGEST_SIZE,
+             NULL, 0, response->mac);
+
+  return response;
+}
+
+static void
+soft_firmware_reconnect (SoftSdcpFirmware *fw,
+                         const guchar     *host_reconnect_random,
+                         guchar           *mac)
+{
+  soft_hmac (fw->application_secret, "reconnect",
+             host_reconnect_random, SDCP_RANDOM_SIZE, NULL, 0, mac);
+}
+
+static void
+soft_firmware_identify (SoftSdcpFirmware *fw,
+                        const guchar     *host_identify_nonce,
+                        const guchar     *enrollment_id,
+                        guchar           *mac)
+{
+  soft_hmac (fw->application_secret, "identify",
+             host_identify_nonce, SDCP_NONCE_SIZE,
+             enrollment_id, SDCP_ENROLLMENT_ID_SIZE, mac);
+}
+
+/*********************************************************/
+/* Benchmark *********************************************/
+/*********************************************************/
+
+enum {
+  PHASE_KEYGEN,
+  PHASE_X509,
+  PHASE_ECDH,
+  PHASE_KBKDF,
+  PHASE_HMAC,
+  PHASE_CONNECT,
+  PHASE_RECONNECT,
+  PHASE_IDENTIFY,
+  PHASE_ENROLL_ID,
+  PHASE_CLAIM_STORE,
+  PHASE_CLAIM_READ,
+  PHASE_CLAIM_LOAD,
+  N_PHASES,
+};
+
+static const guint step_phases[] = {
+  [FPI_SDCP_STEP_X509] = PHASE_X509,
+  [FPI_SDCP_STEP_ECDH] = PHASE_ECDH,
+  [FPI_SDCP_STEP_KBKDF] = PHASE_KBKDF,
+  [FPI_SDCP_STEP_HMAC] = PHASE_HMAC,
+  [FPI_SDCP_STEP_CLAIM_STORE] = PHASE_CLAIM_STORE,
+  [FPI_SDCP_STEP_CLAIM_LOAD] = PHASE_CLAIM_READ,
+};
+
+/* Times the library steps inside the public SDCP functions */
+static void
+benchmark_step_cb (FpiSdcpDevice *device,
+                   FpiSdcpStep    step,
+                   gint64         start_usec,
+                   gpointer       user_data)
+{
+  BenchmarkPhase *phases = user_data;
+
+  benchmark_phase_add (&phases[step_phases[step]], start_usec);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(FpDevice) device = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *state_dir = NULL;
+  g_autofree gchar *claim_dir = NULL;
+  SoftSdcpFirmware *fw;
+  FpiSdcpDevice *sdcp_dev;
+  guchar enrollment_id[SDCP_ENROLLMENT_ID_SIZE];
+  guint iterations;
+  guint i;
+
+  BenchmarkPhase phases[N_PHASES] = {
+    [PHASE_KEYGEN] = { "keygen", "P-256 host keypair and random (set_host_keys)" },
+    [PHASE_X509] = { "x509", "model certificate parse (in connect)" },
+    [PHASE_ECDH] = { "ecdh", "P-256 key agreement (in connect)" },
+    [PHASE_KBKDF] = { "kbkdf", "master secret and application keys (in connect)" },
+    [PHASE_HMAC] = { "hmac", "claim hash and MAC (in connect and reconnect)" },
+    [PHASE_CONNECT] = { "connect", "full ConnectResponse verification" },
+    [PHASE_RECONNECT] = { "reconnect", "HMAC verification and claim cache store" },
+    [PHASE_IDENTIFY] = { "identify", "AuthorizedIdentity HMAC verification" },
+    [PHASE_ENROLL_ID] = { "enrollment-id", "enrollment ID HMAC generation" },
+    [PHASE_CLAIM_STORE] = { "claim-store", "claim cache write (in connect and reconnect)" },
+    [PHASE_CLAIM_READ] = { "claim-read", "claim cache read (in claim-load)" },
+    [PHASE_CLAIM_LOAD] = { "claim-load", "new device and claim cache load" },
+  };
+
+  iterations = benchmark_get_iterations (argc > 1 ? argv[1] : NULL,
+                                         BENCHMARK_DEFAULT_ITERATIONS);
+
+  /* keep the cached claims of the benchmark away from any real ones */
+  state_dir = g_dir_make_tmp ("libfprint-sdcp-benchmark-XXXXXX", &error);
+  g_assert_no_error (error);
+  g_setenv ("STATE_DIRECTORY", state_dir, TRUE);
+
+  fw = soft_firmware_new ();
+
+  device = g_object_new (FPI_TYPE_BENCHMARK_SDCP_DEVICE, NULL);
+  sdcp_dev = FPI_SDCP_DEVICE (device);
+  if (!fp_device_open_sync (device, NULL, &error))
+    g_error ("Could not open device: %s", error->message);
+
+  fpi_sdcp_device_delete_cached_claim (sdcp_dev);
+  fpi_sdcp_device_set_step_func (sdcp_dev, benchmark_step_cb, phases);
+
+  g_print ("SDCP benchmark, %u iterations per phase (times in usec)\n\n", iterations);
+  benchmark_print_header ("phase", "ops/sec");
+
+  /* Full FpiSdcpDevice operations against the software firmware */
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(FpiSdcpConnectResponse) response = NULL;
+      g_autofree guchar *public_key = NULL;
+      g_autofree guchar *random = NULL;
+      gint64 start = g_get_monotonic_time ();
+
+      g_assert (fpi_sdcp_set_host_keys (sdcp_dev, NULL, NULL));
+      benchmark_phase_add (&phases[PHASE_KEYGEN], start);
+
+      public_key = fpi_sdcp_get_host_public_key (sdcp_dev);
+      random = fpi_sdcp_get_host_random (sdcp_dev);
+      response = soft_firmware_connect (fw, public_key, random);
+
+      start = g_get_monotonic_time ();
+      g_assert (fpi_sdcp_derive_keys_and_verify_connect (sdcp_dev, response));
+      benchmark_phase_add (&phases[PHASE_CONNECT], start);
+    }
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autofree guchar *reconnect_random = fpi_sdcp_generate_random ();
+      g_autofree guchar *nonce = fpi_sdcp_generate_random ();
+      guchar mac[SDCP_DIGEST_SIZE];
+      gint64 start;
+
+      soft_firmware_reconnect (fw, reconnect_random, mac);
+      start = g_get_monotonic_time ();
+      g_assert (fpi_sdcp_verify_reconnect (sdcp_dev, reconnect_random, mac));
+      benchmark_phase_add (&phases[PHASE_RECONNECT], start);
+
+      start = g_get_monotonic_time ();
+      {
+        g_autofree guchar *id = fpi_sdcp_generate_enrollment_id (sdcp_dev, nonce);
+        memcpy (enrollment_id, id, SDCP_ENROLLMENT_ID_SIZE);
+      }
+      benchmark_phase_add (&phases[PHASE_ENROLL_ID], start);
+
+      soft_firmware_identify (fw, nonce, enrollment_id, mac);
+      start = g_get_monotonic_time ();
+      g_assert (fpi_sdcp_verify_authorized_identity (sdcp_dev, nonce, enrollment_id, mac));
+      benchmark_phase_add (&phases[PHASE_IDENTIFY], start);
+    }
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(FpDevice) cached_device = NULL;
+      gint64 start = g_get_monotonic_time ();
+
+      cached_device = g_object_new (FPI_TYPE_BENCHMARK_SDCP_DEVICE, NULL);
+      fpi_sdcp_device_set_step_func (FPI_SDCP_DEVICE (cached_device),
+                                     benchmark_step_cb, phases);
+      if (!fp_device_open_sync (cached_device, NULL, &error))
+        g_error ("Could not open device: %s", error->message);
+      g_assert (fpi_sdcp_device_is_connected (FPI_SDCP_DEVICE (cached_device)));
+      benchmark_phase_add (&phases[PHASE_CLAIM_LOAD], start);
+
+      fp_device_close_sync (cached_device, NULL, NULL);
+    }
+
+  for (i = 0; i < N_PHASES; i++)
+    benchmark_phase_print (NULL, &phases[i]);
+
+  fpi_sdcp_device_delete_cached_claim (sdcp_dev);
+  fp_device_close_sync (device, NULL, NULL);
+  soft_firmware_free (fw);
+
+  /* remove the (now empty) claim directories below the state directory */
+  claim_dir = g_build_filename (state_dir, FP_COMPONENT, NULL);
+  {
+    g_autofree gchar *device_dir = g_build_filename (claim_dir, FP_COMPONENT, NULL);
+    g_rmdir (device_dir);
+  }
+  g_rmdir (claim_dir);
+  g_rmdir (state_dir);
+
+  return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * SPI transfer round-trip latency benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "benchmark_spi_transfer"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <unistd.h>
+
+#include "fpi-device.h"
+#include "fpi-log.h"
+#include "fpi-spi-transfer.h"
+#include "test-device-fake.h"
+
+#include "benchmark-utils.h"
+
+#define BENCHMARK_DEFAULT_ITERATIONS 1000
+#define BENCHMARK_REGISTERS 64
+
+/*
+ * There is no spidev device to talk to, so all transfers go to /dev/null.
+ * The ioctl fails right away, which leaves just the cost of handing the
+ * transfer to another thread and getting the result back into the main
+ * context, i.e. the overhead every single register access pays.
+ */
+
+/*********************************************************/
+/* Transfers *********************************************/
+/*********************************************************/
+
+static void
+transfer_done_cb (FpiSpiTransfer *transfer,
+                  FpDevice       *dev,
+                  gpointer        user_data,
+                  GError         *error)
+{
+  guint *pending = user_data;
+
+  g_clear_error (&error);
+  *pending -= 1;
+}
+
+static void
+wait_for_transfers (guint *pending)
+{
+  while (*pending > 0)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+submit_register_write (FpDevice *device, int fd, guint8 reg, guint *pending)
+{
+  FpiSpiTransfer *xfer = fpi_spi_transfer_new (device, fd);
+
+  fpi_spi_transfer_write (xfer, 2);
+  xfer->buffer_wr[0] = reg | 0x80;
+  xfer->buffer_wr[1] = 0x5a;
+
+  *pending += 1;
+  fpi_spi_transfer_submit (xfer, NULL, transfer_done_cb, pending);
+}
+
+/* What every transfer used to do: one GTask on the GLib thread pool */
+static void
+gtask_thread_func (GTask        *task,
+                   gpointer      source_object,
+                   gpointer      task_data,
+                   GCancellable *cancellable)
+{
+  struct spi_ioc_transfer xfer = { 0 };
+  guint8 buffer[2] = { 0x80, 0x5a };
+  int fd = GPOINTER_TO_INT (task_data);
+
+  xfer.tx_buf = (gsize) buffer;
+  xfer.len = sizeof (buffer);
+
+  if (ioctl (fd, SPI_IOC_MESSAGE (1), &xfer) < 0)
+    g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errno),
+                             "Error invoking ioctl for SPI transfer (%d)", errno);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+gtask_done_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  guint *pending = user_data;
+
+  g_task_propagate_boolean (G_TASK (res), NULL);
+  *pending -= 1;
+}
+
+static void
+submit_gtask (FpDevice *device, int fd, guint *pending)
+{
+  g_autoptr(GTask) task = g_task_new (device, NULL, gtask_done_cb, pending);
+
+  g_task_set_task_data (task, GINT_TO_POINTER (fd), NULL);
+  *pending += 1;
+  g_task_run_in_thread (task, gtask_thread_func);
+}
+
+/*********************************************************/
+/* Benchmark *********************************************/
+/*********************************************************/
+
+enum {
+  PHASE_GTASK,
+  PHASE_WORKER,
+  PHASE_GTASK_SEQUENCE,
+  PHASE_WORKER_SEQUENCE,
+  PHASE_WORKER_PIPELINED,
+  PHASE_BATCH,
+  N_PHASES,
+};
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(FpDevice) device = NULL;
+  guint pending = 0;
+  guint iterations;
+  guint i, reg;
+  int fd;
+
+  BenchmarkPhase phases[N_PHASES] = {
+    [PHASE_GTASK] = { "gtask", "round-trip, GTask on the GLib thread pool" },
+    [PHASE_WORKER] = { "worker", "round-trip, device I/O thread" },
+    [PHASE_GTASK_SEQUENCE] = { "gtask-seq", "64 register writes one after another, GTask" },
+    [PHASE_WORKER_SEQUENCE] = { "worker-seq", "64 register writes one after another, I/O thread" },
+    [PHASE_WORKER_PIPELINED] = { "worker-queued", "64 register writes queued at once, I/O thread" },
+    [PHASE_BATCH] = { "batch", "64 register writes as one batch transfer" },
+  };
+
+  iterations = benchmark_get_iterations (argc > 1 ? argv[1] : NULL,
+                                         BENCHMARK_DEFAULT_ITERATIONS);
+
+  fd = open ("/dev/null", O_RDWR | O_CLOEXEC);
+  g_assert_cmpint (fd, >=, 0);
+
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+
+  g_print ("SPI transfer benchmark, %u iterations per phase (times in usec)\n\n", iterations);
+  benchmark_print_header ("phase", "ops/sec");
+
+  /* Warm up the thread pool and the I/O thread of the device */
+  submit_gtask (device, fd, &pending);
+  submit_register_write (device, fd, 0, &pending);
+  wait_for_transfers (&pending);
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      submit_gtask (device, fd, &pending);
+      wait_for_transfers (&pending);
+      benchmark_phase_add (&phases[PHASE_GTASK], start);
+
+      start = g_get_monotonic_time ();
+      submit_register_write (device, fd, 0, &pending);
+      wait_for_transfers (&pending);
+      benchmark_phase_add (&phases[PHASE_WORKER], start);
+    }
+
+  for (i = 0; i < MAX (iterations / BENCHMARK_REGISTERS, 1); i++)
+    {
+      FpiSpiTransfer *xfer;
+      gint64 start = g_get_monotonic_time ();
+
+      for (reg = 0; reg < BENCHMARK_REGISTERS; reg++)
+        {
+          submit_gtask (device, fd, &pending);
+          wait_for_transfers (&pending);
+        }
+      benchmark_phase_add (&phases[PHASE_GTASK_SEQUENCE], start);
+
+      start = g_get_monotonic_time ();
+      for (reg = 0; reg < BENCHMARK_REGISTERS; reg++)
+        {
+          submit_register_write (device, fd, reg, &pending);
+          wait_for_transfers (&pending);
+        }
+      benchmark_phase_add (&phases[PHASE_WORKER_SEQUENCE], start);
+
+      start = g_get_monotonic_time ();
+      for (reg = 0; reg < BENCHMARK_REGISTERS; reg++)
+        submit_register_write (device, fd, reg, &pending);
+      wait_for_transfers (&pending);
+      benchmark_phase_add (&phases[PHASE_WORKER_PIPELINED], start);
+
+      start = g_get_monotonic_time ();
+      xfer = fpi_spi_transfer_new (device, fd);
+      for (reg = 0; reg < BENCHMARK_REGISTERS; reg++)
+        {
+          guint8 cmd[2] = { reg | 0x80, 0x5a };
+
+          fpi_spi_transfer_batch_write (xfer, cmd, sizeof (cmd));
+        }
+      pending += 1;
+      fpi_spi_transfer_submit (xfer, NULL, transfer_done_cb, &pending);
+      wait_for_transfers (&pending);
+      benchmark_phase_add (&phases[PHASE_BATCH], start);
+    }
+
+  for (i = 0; i < N_PHASES; i++)
+    benchmark_phase_print (NULL, &phases[i]);
+
+  g_clear_object (&device);
+  close (fd);
+
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Shared helpers for the libfprint benchmarks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <time.h>
+
+#include "benchmark-utils.h"
+
+gint64
+benchmark_get_cpu_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+  return ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+void
+benchmark_phase_add (BenchmarkPhase *phase, gint64 start_usec)
+{
+  gint64 elapsed = g_get_monotonic_time () - start_usec;
+
+  if (phase->iterations == 0 || elapsed < phase->min_usec)
+    phase->min_usec = elapsed;
+  if (elapsed > phase->max_usec)
+    phase->max_usec = elapsed;
+
+  phase->total_usec += elapsed;
+  phase->iterations++;
+}
+
+/* To be called together with benchmark_phase_add() */
+void
+benchmark_phase_add_cpu (BenchmarkPhase *phase, gint64 start_cpu_usec)
+{
+  phase->cpu_usec += benchmark_get_cpu_time () - start_cpu_usec;
+}
+
+gdouble
+benchmark_phase_mean (const BenchmarkPhase *phase)
+{
+  return phase->iterations ? (gdouble) phase->total_usec / phase->iterations : 0;
+}
+
+/* Operations per second */
+gdouble
+benchmark_phase_rate (const BenchmarkPhase *phase)
+{
+  gdouble mean = benchmark_phase_mean (phase);
+
+  return mean > 0 ? MAX (phase->batch, 1) * G_USEC_PER_SEC / mean : 0;
+}
+
+void
+benchmark_print_header (const gchar *first_column, const gchar *last_column)
+{
+  g_print ("%-28s %8s %10s %10s %10s %10s\n",
+           first_column, "count", "mean", "min", "max", last_column);
+}
+
+static void
+benchmark_phase_print_row (const gchar          *prefix,
+                           const BenchmarkPhase *phase,
+                           gdouble               last_value)
+{
+  g_autofree gchar *name = g_strconcat (prefix ?: "", phase->name, NULL);
+
+  g_print ("%-28s %8u %10.1f %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10.1f  %s\n",
+           name,
+           phase->iterations,
+           benchmark_phase_mean (phase),
+           phase->min_usec,
+           phase->max_usec,
+           last_value,
+           phase->description);
+}
+
+/* Prints a row matching benchmark_print_header() with the rate last */
+void
+benchmark_phase_print (const gchar *prefix, const BenchmarkPhase *phase)
+{
+  benchmark_phase_print_row (prefix, phase, benchmark_phase_rate (phase));
+}
+
+/* Prints a row matching benchmark_print_header() with the mean CPU time last */
+void
+benchmark_phase_print_cpu (const gchar *prefix, const BenchmarkPhase *phase)
+{
+  gdouble cpu = phase->iterations ? (gdouble) phase->cpu_usec / phase->iterations : 0;
+
+  benchmark_phase_print_row (prefix, phase, cpu);
+}
+
+/*
+ * The number of iterations is taken from @arg if given, otherwise from
+ * FP_BENCHMARK_ITERATIONS.
+ */
+guint
+benchmark_get_iterations (const gchar *arg, guint default_iterations)
+{
+  const gchar *env = arg ?: g_getenv ("FP_BENCHMARK_ITERATIONS");
+  guint64 iterations = default_iterations;
+
+  if (env && !g_ascii_string_to_unsigned (env, 10, 1, G_MAXUINT, &iterations, NULL))
+    g_error ("Invalid number of iterations: %s", env);
+
+  return iterations;
+}
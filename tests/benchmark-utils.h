@@ -0,0 +1,55 @@
+/*
+ * Shared helpers for the libfprint benchmarks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* Statistics of one measured phase, times are in usec. */
+typedef struct
+{
+  const gchar *name;
+  const gchar *description;
+  guint        batch;      /* Operations per iteration, 0 counts as 1 */
+  guint        iterations;
+  guint        failures;
+  gint64       total_usec;
+  gint64       min_usec;
+  gint64       max_usec;
+  gint64       cpu_usec;
+} BenchmarkPhase;
+
+gint64 benchmark_get_cpu_time (void);
+
+void benchmark_phase_add (BenchmarkPhase *phase,
+                          gint64          start_usec);
+void benchmark_phase_add_cpu (BenchmarkPhase *phase,
+                              gint64          start_cpu_usec);
+
+gdouble benchmark_phase_mean (const BenchmarkPhase *phase);
+gdouble benchmark_phase_rate (const BenchmarkPhase *phase);
+
+void benchmark_print_header (const gchar *first_column,
+                             const gchar *last_column);
+void benchmark_phase_print (const gchar          *prefix,
+                            const BenchmarkPhase *phase);
+void benchmark_phase_print_cpu (const gchar          *prefix,
+                                const BenchmarkPhase *phase);
+
+guint benchmark_get_iterations (const gchar *arg,
+                                guint        default_iterations);
@@ -0,0 +1,15 @@
+#!/usr/bin/python3
+
+# Runs the egismoc test flow with the enrolled ID cache used as on real
+# hardware. The recording is the one of the egismoc test without the list
+# commands of the verify and the identify that follow a listing, so the
+# test only passes if both skip the command and use the cached list.
+
+import os
+import runpy
+
+os.environ['FP_EGISMOC_TRUST_CACHED_IDS'] = '1'
+
+runpy.run_path(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            '..', 'egismoc', 'custom.py'),
+               run_name='__main__')
@@ -0,0 +1,57 @@
+#!/usr/bin/python3
+
+# Probes the device twice. The first probe reads the serial number and stores
+# it in the probe cache of a private state directory. The test then changes
+# the stored serial, so the second probe can only report it if it was taken
+# from the cache instead of the device.
+
+import os
+import shutil
+import sys
+import tempfile
+import traceback
+
+if not os.path.exists('/proc/sys/kernel/random/boot_id'):
+    print('No kernel boot ID, the probe cache is disabled')
+    sys.exit(77)
+
+state_dir = tempfile.mkdtemp(prefix='libfprint-egismoc-probe-cache-')
+os.environ['STATE_DIRECTORY'] = state_dir
+
+import gi
+gi.require_version('FPrint', '2.0')
+from gi.repository import FPrint, GLib
+
+# Exit with error on any exception, included those happening in async callbacks
+sys.excepthook = lambda *args: (traceback.print_exception(*args), sys.exit(1))
+
+def probe_device_id():
+    c = FPrint.Context()
+    c.enumerate()
+    devices = c.get_devices()
+    assert len(devices) == 1
+    assert devices[0].get_driver() == 'egismoc'
+    return devices[0].get_device_id()
+
+cache_path = os.path.join(state_dir, 'egismoc', 'probe-cache')
+
+print('probing without a cache entry')
+assert probe_device_id() == 'emulated-device'
+
+cache = GLib.KeyFile()
+cache.load_from_file(cache_path, GLib.KeyFileFlags.NONE)
+groups, _ = cache.get_groups()
+assert len(groups) == 1
+assert cache.get_string(groups[0], 'serial') == 'emulated-device'
+cache.set_string(groups[0], 'serial', 'cached-device')
+cache.save_to_file(cache_path)
+
+print('probing with a cache entry')
+assert probe_device_id() == 'cached-device'
+
+print('probing with a cache entry of another boot')
+cache.set_string(groups[0], 'boot-id', 'another-boot')
+cache.save_to_file(cache_path)
+assert probe_device_id() == 'emulated-device'
+
+shutil.rmtree(state_dir)
@@ -20,6 +20,7 @@
 #include <libfprint/fprint.h>
 
 #include "test-utils.h"
+#include "fpi-context.h"
 #include "fpi-device.h"
 
 static void
@@ -383,6 +384,90 @@ test_context_remove_device_active (void)
   fpt_teardown_virtual_device_environment ();
 }
 
+/* Without usb_discover hooks all drivers have the same score, so the first
+ * matching entry wins. */
+static GType
+find_usb_driver_linear (GArray           *drivers,
+                        guint16           vid,
+                        guint16           pid,
+                        const FpIdEntry **found_entry)
+{
+  guint i;
+
+  for (i = 0; i < drivers->len; i++)
+    {
+      GType driver = g_array_index (drivers, GType, i);
+      g_autoptr(FpDeviceClass) cls = g_type_class_ref (driver);
+      const FpIdEntry *entry;
+
+      if (cls->type != FP_DEVICE_TYPE_USB)
+        continue;
+
+      for (entry = cls->id_table; entry->pid; entry++)
+        {
+          if (entry->pid != pid || entry->vid != vid)
+            continue;
+
+          *found_entry = entry;
+          return driver;
+        }
+    }
+
+  *found_entry = NULL;
+  return G_TYPE_NONE;
+}
+
+static void
+test_context_usb_driver_index (void)
+{
+  g_autoptr(FpContext) context = NULL;
+  g_autoptr(GArray) drivers = NULL;
+  g_autofree gchar *allowlist = g_strdup (g_getenv ("FP_DRIVERS_ALLOWLIST"));
+  guint checked = 0;
+  guint i;
+
+  /* Index all the drivers, not only the allowed ones */
+  g_unsetenv ("FP_DRIVERS_ALLOWLIST");
+  context = fp_context_new ();
+  if (allowlist)
+    g_setenv ("FP_DRIVERS_ALLOWLIST", allowlist, TRUE);
+
+  drivers = fpi_get_driver_types ();
+
+  for (i = 0; i < drivers->len; i++)
+    {
+      GType driver = g_array_index (drivers, GType, i);
+      g_autoptr(FpDeviceClass) cls = g_type_class_ref (driver);
+      const FpIdEntry *entry;
+
+      if (cls->type != FP_DEVICE_TYPE_USB)
+        continue;
+
+      for (entry = cls->id_table; entry->pid; entry++)
+        {
+          const FpIdEntry *linear_entry = NULL;
+          const FpIdEntry *indexed_entry = NULL;
+          GType linear_driver;
+          GType indexed_driver;
+
+          linear_driver = find_usb_driver_linear (drivers, entry->vid,
+                                                  entry->pid, &linear_entry);
+          indexed_driver = fpi_context_find_usb_driver (context, entry->vid,
+                                                        entry->pid, NULL,
+                                                        &indexed_entry);
+
+          g_assert_cmpstr (g_type_name (indexed_driver), ==,
+                           g_type_name (linear_driver));
+          g_assert_true (indexed_entry == linear_entry);
+          checked++;
+        }
+    }
+
+  g_debug ("Checked %u USB ID table entries", checked);
+
+  g_assert_true (fpi_context_find_usb_driver (context, 0, 0, NULL, NULL) == G_TYPE_NONE);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -397,6 +482,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/context/remove-device-open", test_context_remove_device_open);
   g_test_add_func ("/context/remove-device-opening", test_context_remove_device_opening);
   g_test_add_func ("/context/remove-device-active", test_context_remove_device_active);
+  g_test_add_func ("/context/usb-driver-index", test_context_usb_driver_index);
 
   return g_test_run ();
 }
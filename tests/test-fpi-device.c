@@ -17,6 +17,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <config.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
 #include "fp-device.h"
 #include "fp-enums.h"
 #include <libfprint/fprint.h>
@@ -26,6 +31,13 @@
 #include "fpi-device.h"
 #include "fpi-compat.h"
 #include "fpi-log.h"
+#include "fpi-byte-utils.h"
+#include "fpi-usb-transfer.h"
+#include "fpi-transfer-replay.h"
+#include "fp-device-private.h"
+#ifdef HAVE_SPI
+#include "fpi-spi-transfer-private.h"
+#endif
 #include "test-device-fake.h"
 #include "fp-print-private.h"
 
@@ -896,6 +908,82 @@ test_driver_probe_action_error (void)
     g_main_context_iteration (NULL, TRUE);
 }
 
+static GThread *probe_thread = NULL;
+
+static gboolean
+fake_device_probe_in_thread (FpDevice *device,
+                             gchar   **device_id,
+                             gint     *nr_enroll_stages,
+                             GError  **error)
+{
+  g_assert_cmpuint (fpi_device_get_current_action (device), ==, FPI_DEVICE_ACTION_PROBE);
+
+  probe_thread = g_thread_self ();
+  *device_id = g_strdup ("Threaded device ID");
+  *nr_enroll_stages = 7;
+
+  return TRUE;
+}
+
+static gboolean
+fake_device_probe_in_thread_error (FpDevice *device,
+                                   gchar   **device_id,
+                                   gint     *nr_enroll_stages,
+                                   GError  **error)
+{
+  g_set_error_literal (error, FP_DEVICE_ERROR, FP_DEVICE_ERROR_NOT_SUPPORTED,
+                       "Threaded probe failure");
+
+  return FALSE;
+}
+
+static void
+on_driver_probe_in_thread_async (GObject *initable, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  FpDevice **out_device = user_data;
+
+  *out_device = FP_DEVICE (g_async_initable_new_finish (G_ASYNC_INITABLE (initable), res, &error));
+  g_assert_no_error (error);
+}
+
+static void
+test_driver_probe_in_thread (void)
+{
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpDevice) device = NULL;
+
+  probe_thread = NULL;
+  dev_class->probe = NULL;
+  dev_class->probe_in_thread = fake_device_probe_in_thread;
+  g_async_initable_new_async (FPI_TYPE_DEVICE_FAKE, G_PRIORITY_DEFAULT, NULL,
+                              on_driver_probe_in_thread_async, &device, NULL);
+
+  while (!FP_IS_DEVICE (device))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_nonnull (probe_thread);
+  g_assert_true (probe_thread != g_thread_self ());
+  g_assert_false (fp_device_is_open (device));
+  g_assert_cmpstr (fp_device_get_device_id (device), ==, "Threaded device ID");
+  g_assert_cmpint (fp_device_get_nr_enroll_stages (device), ==, 7);
+}
+
+static void
+test_driver_probe_in_thread_error (void)
+{
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  gboolean done = FALSE;
+
+  dev_class->probe = NULL;
+  dev_class->probe_in_thread = fake_device_probe_in_thread_error;
+  g_async_initable_new_async (FPI_TYPE_DEVICE_FAKE, G_PRIORITY_DEFAULT, NULL,
+                              on_driver_probe_error_async, &done, NULL);
+
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+}
+
 static void
 test_driver_open (void)
 {
@@ -1390,6 +1478,118 @@ test_driver_verify (void)
   g_assert_true (match);
 }
 
+static void
+test_driver_verify_stats (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpAutoCloseDevice) device = auto_close_fake_device_new ();
+  g_autoptr(FpPrint) enrolled_print = make_fake_print_reffed (device, NULL);
+  g_autoptr(GArray) events = NULL;
+  FpiDeviceFake *fake_dev = FPI_DEVICE_FAKE (device);
+  FpDeviceTracePhase expected[] = {
+    FP_DEVICE_TRACE_ACTION_START,
+    FP_DEVICE_TRACE_REPORT,
+    FP_DEVICE_TRACE_ACTION_COMPLETE,
+  };
+  FpDeviceTraceEvent *event;
+  guint open_action;
+  guint i, n;
+
+  events = fp_device_get_stats (device);
+  g_assert_cmpuint (events->len, ==, 3);
+  event = &g_array_index (events, FpDeviceTraceEvent, 1);
+  g_assert_cmpint (event->phase, ==, FP_DEVICE_TRACE_OPEN);
+  open_action = event->action;
+  g_clear_pointer (&events, g_array_unref);
+
+  fake_dev->ret_result = FPI_MATCH_SUCCESS;
+  g_assert_true (fp_device_verify_sync (device, enrolled_print, NULL,
+                                        NULL, NULL, NULL, NULL, &error));
+  g_assert_no_error (error);
+
+  events = fp_device_get_stats (device);
+  for (i = 0, n = 0; i < events->len; i++)
+    {
+      event = &g_array_index (events, FpDeviceTraceEvent, i);
+
+      if (i > 0)
+        g_assert_cmpint (event->timestamp, >=,
+                         g_array_index (events, FpDeviceTraceEvent, i - 1).timestamp);
+
+      if (event->action == open_action)
+        continue;
+
+      g_assert_cmpuint (event->action, ==, open_action + 1);
+      if (event->phase == FP_DEVICE_TRACE_FINGER_ON)
+        continue;
+
+      g_assert_cmpuint (n, <, G_N_ELEMENTS (expected));
+      g_assert_cmpint (event->phase, ==, expected[n++]);
+    }
+  g_assert_cmpuint (n, ==, G_N_ELEMENTS (expected));
+}
+
+static void
+fake_device_verify_two_stages (FpDevice *device)
+{
+  FpPrint *print;
+
+  fpi_device_get_verify_data (device, &print);
+
+  fpi_device_report_finger_status (device, FP_FINGER_STATUS_NEEDED);
+  fpi_device_report_finger_status (device, FP_FINGER_STATUS_PRESENT);
+  fpi_device_report_finger_status (device, FP_FINGER_STATUS_NEEDED);
+  fpi_device_report_finger_status (device, FP_FINGER_STATUS_NONE);
+
+  fpi_device_verify_report (device, FPI_MATCH_SUCCESS, print, NULL);
+  fpi_device_verify_complete (device, NULL);
+}
+
+static void
+test_driver_verify_stats_ready (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpAutoCloseDevice) device = NULL;
+  g_autoptr(FpPrint) enrolled_print = NULL;
+  g_autoptr(GArray) events = NULL;
+  guint ready[2] = { 0 };
+  guint open_action;
+  guint i;
+
+  dev_class->verify = fake_device_verify_two_stages;
+  device = auto_close_fake_device_new ();
+  enrolled_print = make_fake_print_reffed (device, NULL);
+
+  events = fp_device_get_stats (device);
+  open_action = g_array_index (events, FpDeviceTraceEvent, events->len - 1).action;
+  g_clear_pointer (&events, g_array_unref);
+
+  for (i = 0; i < G_N_ELEMENTS (ready); i++)
+    {
+      g_assert_true (fp_device_verify_sync (device, enrolled_print, NULL,
+                                            NULL, NULL, NULL, NULL, &error));
+      g_assert_no_error (error);
+    }
+
+  /* The finger is needed twice per action, but only the first one is ready */
+  events = fp_device_get_stats (device);
+  for (i = 0; i < events->len; i++)
+    {
+      FpDeviceTraceEvent *event = &g_array_index (events, FpDeviceTraceEvent, i);
+
+      if (event->phase != FP_DEVICE_TRACE_READY)
+        continue;
+
+      g_assert_cmpuint (event->action, >, open_action);
+      g_assert_cmpuint (event->action - open_action - 1, <, G_N_ELEMENTS (ready));
+      ready[event->action - open_action - 1]++;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (ready); i++)
+    g_assert_cmpuint (ready[i], ==, 1);
+}
+
 static void
 test_driver_verify_not_supported (void)
 {
@@ -1423,6 +1623,317 @@ test_driver_verify_not_supported (void)
   g_assert_false (match);
 }
 
+static GThread *driver_thread_action_thread = NULL;
+
+static void
+fake_device_thread_open (FpDevice *device)
+{
+  driver_thread_action_thread = g_thread_self ();
+  fpi_device_open_complete (device, NULL);
+}
+
+static void
+fake_device_thread_verify (FpDevice *device)
+{
+  FpPrint *print;
+
+  driver_thread_action_thread = g_thread_self ();
+
+  fpi_device_get_verify_data (device, &print);
+  fpi_device_verify_report (device, FPI_MATCH_SUCCESS, print, NULL);
+  fpi_device_verify_complete (device, NULL);
+}
+
+static void
+test_driver_thread_match_cb (FpDevice *device,
+                             FpPrint  *match,
+                             FpPrint  *print,
+                             gpointer  user_data,
+                             GError   *error)
+{
+  g_assert_true (g_thread_self () == user_data);
+  test_driver_match_cb (device, match, print,
+                        g_object_get_data (G_OBJECT (device), "match-data"),
+                        error);
+}
+
+static void
+test_driver_thread_verify (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpDevice) device = NULL;
+  g_autoptr(FpPrint) enrolled_print = NULL;
+  g_autoptr(FpPrint) out_print = NULL;
+  g_autoptr(MatchCbData) match_data = g_new0 (MatchCbData, 1);
+  gboolean match;
+
+  dev_class->open = fake_device_thread_open;
+  dev_class->verify = fake_device_thread_verify;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, "fpi-driver-thread", TRUE, NULL);
+  enrolled_print = make_fake_print_reffed (device, NULL);
+
+  g_assert_true (fp_device_open_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_nonnull (driver_thread_action_thread);
+  g_assert_false (driver_thread_action_thread == g_thread_self ());
+
+  driver_thread_action_thread = NULL;
+  g_object_set_data (G_OBJECT (device), "match-data", match_data);
+  g_assert_true (fp_device_verify_sync (device, enrolled_print, NULL,
+                                        test_driver_thread_match_cb, g_thread_self (),
+                                        &match, &out_print, &error));
+  g_assert_no_error (error);
+  g_assert_nonnull (driver_thread_action_thread);
+  g_assert_false (driver_thread_action_thread == g_thread_self ());
+
+  g_assert_true (match_data->called);
+  g_assert_true (match_data->match == enrolled_print);
+  g_assert_true (out_print == enrolled_print);
+  g_assert_true (match);
+
+  g_assert_true (fp_device_close_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  driver_thread_action_thread = NULL;
+}
+
+static void
+fake_device_thread_verify_wait (FpDevice *device)
+{
+  FpDeviceFake *fake_dev = FPI_DEVICE_FAKE (device);
+
+  fake_dev->last_called_function = fake_device_thread_verify_wait;
+  g_atomic_pointer_set (&driver_thread_action_thread, g_thread_self ());
+}
+
+static void
+fake_device_thread_cancel (FpDevice *device)
+{
+  FpDeviceFake *fake_dev = FPI_DEVICE_FAKE (device);
+
+  g_assert_true (g_thread_self () == driver_thread_action_thread);
+  g_assert_true (fpi_device_action_is_cancelled (device));
+  fake_dev->last_called_function = fake_device_thread_cancel;
+
+  fpi_device_verify_complete (device,
+                              g_error_new (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                           "Cancelled"));
+
+  /* The action state stays valid until the driver code returned */
+  g_assert_cmpuint (fpi_device_get_current_action (device), ==,
+                    FPI_DEVICE_ACTION_VERIFY);
+  g_assert_true (G_IS_CANCELLABLE (fpi_device_get_cancellable (device)));
+}
+
+static void
+test_driver_thread_verify_cancel_cb (GObject      *obj,
+                                     GAsyncResult *res,
+                                     gpointer      user_data)
+{
+  GError **error = user_data;
+  gboolean match;
+
+  g_assert_true (g_thread_self () != driver_thread_action_thread);
+  g_assert_false (fp_device_verify_finish (FP_DEVICE (obj), res, &match, NULL, error));
+  g_assert_nonnull (*error);
+}
+
+static void
+test_driver_thread_cancel (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpDevice) device = NULL;
+  g_autoptr(FpPrint) enrolled_print = NULL;
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  FpDeviceFake *fake_dev;
+
+  dev_class->open = fake_device_thread_open;
+  dev_class->verify = fake_device_thread_verify_wait;
+  dev_class->cancel = fake_device_thread_cancel;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, "fpi-driver-thread", TRUE, NULL);
+  fake_dev = FPI_DEVICE_FAKE (device);
+  enrolled_print = make_fake_print_reffed (device, NULL);
+
+  g_assert_true (fp_device_open_sync (device, NULL, &error));
+  g_assert_no_error (error);
+
+  g_atomic_pointer_set (&driver_thread_action_thread, NULL);
+  fp_device_verify (device, enrolled_print, cancellable, NULL, NULL, NULL,
+                    test_driver_thread_verify_cancel_cb, &error);
+
+  /* Cancel from the caller thread once the driver is waiting */
+  while (g_atomic_pointer_get (&driver_thread_action_thread) == NULL)
+    g_main_context_iteration (NULL, FALSE);
+  g_cancellable_cancel (cancellable);
+
+  while (error == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert (fake_dev->last_called_function == fake_device_thread_cancel);
+  g_assert_cmpuint (fpi_device_get_current_action (device), ==,
+                    FPI_DEVICE_ACTION_NONE);
+  g_clear_error (&error);
+
+  /* Cancelling once the action is done has no effect */
+  g_cancellable_cancel (cancellable);
+
+  g_assert_true (fp_device_close_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  driver_thread_action_thread = NULL;
+}
+
+static void
+fake_device_thread_verify_slow (FpDevice *device)
+{
+  FpPrint *print;
+
+  fake_device_thread_verify (device);
+
+  /* Keep running driver code after completion, the next action must not be
+   * started by the caller in the meantime. */
+  g_usleep (G_USEC_PER_SEC / 100);
+
+  fpi_device_get_verify_data (device, &print);
+  g_assert_true (FP_IS_PRINT (print));
+  g_assert_cmpuint (fpi_device_get_current_action (device), ==,
+                    FPI_DEVICE_ACTION_VERIFY);
+  g_assert_false (fpi_device_action_is_cancelled (device));
+}
+
+static void
+test_driver_thread_back_to_back (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpDevice) device = NULL;
+  g_autoptr(FpPrint) enrolled_print = NULL;
+  guint i;
+
+  dev_class->open = fake_device_thread_open;
+  dev_class->verify = fake_device_thread_verify_slow;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, "fpi-driver-thread", TRUE, NULL);
+  enrolled_print = make_fake_print_reffed (device, NULL);
+
+  g_assert_true (fp_device_open_sync (device, NULL, &error));
+  g_assert_no_error (error);
+
+  for (i = 0; i < 10; i++)
+    {
+      g_autoptr(FpPrint) out_print = NULL;
+      gboolean match;
+
+      g_assert_true (fp_device_verify_sync (device, enrolled_print, NULL,
+                                            NULL, NULL,
+                                            &match, &out_print, &error));
+      g_assert_no_error (error);
+      g_assert_true (match);
+      g_assert_true (out_print == enrolled_print);
+      g_assert_cmpuint (fpi_device_get_current_action (device), ==,
+                        FPI_DEVICE_ACTION_NONE);
+    }
+
+  g_assert_true (fp_device_close_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  driver_thread_action_thread = NULL;
+}
+
+static void
+fake_device_thread_verify_finger (FpDevice *device)
+{
+  fpi_device_report_finger_status (device, FP_FINGER_STATUS_NEEDED);
+  fpi_device_report_finger_status_changes (device, FP_FINGER_STATUS_PRESENT,
+                                           FP_FINGER_STATUS_NONE);
+
+  fake_device_thread_verify (device);
+}
+
+static void
+fake_device_thread_remove (FpDevice *device)
+{
+  driver_thread_action_thread = g_thread_self ();
+  fpi_device_remove (device);
+}
+
+static void
+on_driver_thread_notify (FpDevice   *device,
+                         GParamSpec *pspec,
+                         GPtrArray  *notified)
+{
+  g_assert_true (g_thread_self () == g_object_get_data (G_OBJECT (device),
+                                                        "caller-thread"));
+  g_ptr_array_add (notified, (gpointer) g_param_spec_get_name (pspec));
+}
+
+static void
+on_driver_thread_removed (FpDevice *device,
+                          gboolean *removed)
+{
+  g_assert_true (g_thread_self () == g_object_get_data (G_OBJECT (device),
+                                                        "caller-thread"));
+  *removed = TRUE;
+}
+
+static gboolean
+notified_property (GPtrArray *notified, const gchar *property_name)
+{
+  return g_ptr_array_find_with_equal_func (notified, property_name,
+                                           g_str_equal, NULL);
+}
+
+static void
+test_driver_thread_notify (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpDevice) device = NULL;
+  g_autoptr(FpPrint) enrolled_print = NULL;
+  g_autoptr(FpPrint) out_print = NULL;
+  g_autoptr(GPtrArray) notified = g_ptr_array_new ();
+  gboolean removed = FALSE;
+  gboolean match;
+
+  dev_class->open = fake_device_thread_open;
+  dev_class->verify = fake_device_thread_verify_finger;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, "fpi-driver-thread", TRUE, NULL);
+  enrolled_print = make_fake_print_reffed (device, NULL);
+
+  g_object_set_data (G_OBJECT (device), "caller-thread", g_thread_self ());
+  g_signal_connect (device, "notify", G_CALLBACK (on_driver_thread_notify), notified);
+  g_signal_connect (device, "removed", G_CALLBACK (on_driver_thread_removed), &removed);
+
+  g_assert_true (fp_device_open_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_true (notified_property (notified, "open"));
+  g_assert_true (fp_device_is_open (device));
+
+  g_assert_true (fp_device_verify_sync (device, enrolled_print, NULL,
+                                        NULL, NULL,
+                                        &match, &out_print, &error));
+  g_assert_no_error (error);
+  g_assert_true (match);
+  g_assert_true (notified_property (notified, "finger-status"));
+
+  g_assert_true (fp_device_close_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_false (fp_device_is_open (device));
+
+  /* Removal reported by the driver thread */
+  driver_thread_action_thread = NULL;
+  fpi_device_invoke_driver (device, fake_device_thread_remove);
+  while (!removed)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_nonnull (driver_thread_action_thread);
+  g_assert_false (driver_thread_action_thread == g_thread_self ());
+  g_assert_true (notified_property (notified, "removed"));
+
+  g_signal_handlers_disconnect_by_data (device, notified);
+  g_signal_handlers_disconnect_by_data (device, &removed);
+  driver_thread_action_thread = NULL;
+}
+
 static void
 test_driver_verify_fail (void)
 {
@@ -2843,7 +3354,7 @@ test_driver_current_action (void)
 {
   g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
 
-  g_assert_cmpint (fpi_device_get_current_action (device), ==, FPI_DEVICE_ACTION_NONE);
+  g_assert_cmpuint (fpi_device_get_current_action (device), ==, FPI_DEVICE_ACTION_NONE);
 }
 
 static void
@@ -2869,7 +3380,7 @@ test_driver_current_action_open (void)
   fake_dev = FPI_DEVICE_FAKE (device);
   g_assert (fake_dev->last_called_function == test_driver_current_action_open_vfunc);
 
-  g_assert_cmpint (fpi_device_get_current_action (device), ==, FPI_DEVICE_ACTION_NONE);
+  g_assert_cmpuint (fpi_device_get_current_action (device), ==, FPI_DEVICE_ACTION_NONE);
 }
 
 static void
@@ -3387,6 +3898,489 @@ test_driver_retry_error_types (void)
   g_test_assert_expected_messages ();
 }
 
+static void
+test_driver_usb_transfer_pool (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autofree guint8 *stolen = NULL;
+  FpiUsbTransfer *transfer;
+  FpiUsbTransfer *recycled;
+  guint8 *buffer;
+  gint i;
+
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk (transfer, 0x81, 100);
+  memset (transfer->buffer, 0xff, transfer->length);
+  buffer = transfer->buffer;
+  fpi_usb_transfer_unref (transfer);
+
+  /* Both the transfer and its buffer are recycled, buffer is cleared */
+  recycled = fpi_usb_transfer_new (device);
+  g_assert_true (recycled == transfer);
+  g_assert_cmpint (recycled->type, ==, -1);
+  g_assert_null (recycled->buffer);
+
+  fpi_usb_transfer_fill_bulk (recycled, 0x81, 80);
+  g_assert_true (recycled->buffer == buffer);
+  g_assert_cmpint (recycled->length, ==, 80);
+  for (i = 0; i < recycled->length; i++)
+    g_assert_cmpuint (recycled->buffer[i], ==, 0);
+
+  /* A buffer stolen by the driver is not returned to the pool */
+  stolen = g_steal_pointer (&recycled->buffer);
+  fpi_usb_transfer_unref (recycled);
+
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_control (transfer, G_USB_DEVICE_DIRECTION_DEVICE_TO_HOST,
+                                 G_USB_DEVICE_REQUEST_TYPE_VENDOR,
+                                 G_USB_DEVICE_RECIPIENT_DEVICE,
+                                 0, 0, 0, 100);
+  g_assert_false (transfer->buffer == stolen);
+  fpi_usb_transfer_unref (transfer);
+
+  /* Large buffers are page aligned */
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk (transfer, 0x81, 5000);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (transfer->buffer) % sysconf (_SC_PAGESIZE), ==, 0);
+  for (i = 0; i < transfer->length; i++)
+    g_assert_cmpuint (transfer->buffer[i], ==, 0);
+  fpi_usb_transfer_unref (transfer);
+
+  /* Transfers may outlive their device */
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_interrupt (transfer, 0x83, 1 << 20);
+  g_clear_object (&device);
+  fpi_usb_transfer_unref (transfer);
+}
+
+#ifdef HAVE_SPI
+static void
+spi_transfer_done_cb (FpiSpiTransfer *transfer,
+                      FpDevice       *dev,
+                      gpointer        user_data,
+                      GError         *error)
+{
+  gboolean *done = user_data;
+
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_error_free (error);
+  *done = TRUE;
+}
+
+static void
+test_driver_transfer_stats (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(GArray) stats_array = NULL;
+  g_autoptr(GError) error = NULL;
+  FpDeviceTransferStats *stats;
+  FpiSpiTransfer *transfer;
+  gboolean done = FALSE;
+  guint64 latency_total = 0;
+  guint i;
+  int fd;
+
+  stats_array = fp_device_get_transfer_stats (device);
+  g_assert_cmpuint (stats_array->len, ==, 0);
+  g_clear_pointer (&stats_array, g_array_unref);
+
+  /* spidev ioctls on /dev/null fail right away */
+  fd = open ("/dev/null", O_RDWR | O_CLOEXEC);
+  g_assert_cmpint (fd, >=, 0);
+
+  transfer = fpi_spi_transfer_new (device, fd);
+  fpi_spi_transfer_write (transfer, 2);
+  g_assert_false (fpi_spi_transfer_submit_sync (transfer, &error));
+  g_assert_nonnull (error);
+  fpi_spi_transfer_unref (transfer);
+
+  transfer = fpi_spi_transfer_new (device, fd);
+  fpi_spi_transfer_read (transfer, 4);
+  g_cancellable_cancel (cancellable);
+  fpi_spi_transfer_submit (transfer, cancellable, spi_transfer_done_cb, &done);
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+
+  stats_array = fp_device_get_transfer_stats (device);
+  g_assert_cmpuint (stats_array->len, ==, 1);
+
+  stats = &g_array_index (stats_array, FpDeviceTransferStats, 0);
+  g_assert_cmpuint (stats->endpoint, ==, FP_DEVICE_TRANSFER_ENDPOINT_SPI);
+  g_assert_cmpuint (stats->transfers, ==, 2);
+  g_assert_cmpuint (stats->bytes, ==, 0);
+  g_assert_cmpuint (stats->errors, ==, 1);
+  g_assert_cmpuint (stats->timeouts, ==, 0);
+  g_assert_cmpuint (stats->cancelled, ==, 1);
+
+  for (i = 0; i < FP_DEVICE_TRANSFER_LATENCY_BUCKETS; i++)
+    latency_total += stats->latency[i];
+  g_assert_cmpuint (latency_total, ==, stats->transfers);
+
+  close (fd);
+}
+
+typedef struct
+{
+  guint    n_xfers;
+  gsize    length;
+  gboolean cs_change_last;
+} SpiBatchCall;
+
+static int
+spi_batch_record_submit (FpiSpiTransfer          *transfer,
+                         struct spi_ioc_transfer *xfer,
+                         guint                    n_xfers,
+                         gpointer                 user_data)
+{
+  GArray *calls = user_data;
+  SpiBatchCall call = { .n_xfers = n_xfers };
+  guint i;
+
+  for (i = 0; i < n_xfers; i++)
+    {
+      call.length += xfer[i].len;
+
+      /* The chip is deselected between messages, but not within one */
+      if (i + 1 < n_xfers)
+        g_assert_cmpuint (xfer[i].cs_change, ==, xfer[i].rx_buf != 0 || xfer[i + 1].tx_buf != 0);
+    }
+  call.cs_change_last = xfer[n_xfers - 1].cs_change;
+
+  g_array_append_val (calls, call);
+
+  return 0;
+}
+
+static void
+test_driver_spi_batch_pack (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(GArray) calls = g_array_new (FALSE, FALSE, sizeof (SpiBatchCall));
+  guint8 cmd[2] = { 0x80, 0x00 };
+  guint8 reply[3];
+  FpiSpiTransfer *transfer;
+  SpiBatchCall *call;
+  guint i;
+
+  /* Write followed by read messages, all packed into one ioctl */
+  transfer = fpi_spi_transfer_new (device, -1);
+  for (i = 0; i < 3; i++)
+    fpi_spi_transfer_batch_write_read (transfer, cmd, sizeof (cmd), reply, sizeof (reply));
+  fpi_spi_transfer_batch_write (transfer, cmd, sizeof (cmd));
+
+  g_assert_cmpint (fpi_spi_transfer_batch_pack (transfer, 4096,
+                                                spi_batch_record_submit,
+                                                calls), ==, 0);
+  g_assert_cmpuint (calls->len, ==, 1);
+  call = &g_array_index (calls, SpiBatchCall, 0);
+  g_assert_cmpuint (call->n_xfers, ==, 7);
+  g_assert_cmpuint (call->length, ==, 3 * 5 + 2);
+  g_assert_false (call->cs_change_last);
+  fpi_spi_transfer_unref (transfer);
+  g_array_set_size (calls, 0);
+
+  /* Split at the spidev buffer size, without splitting a message */
+  transfer = fpi_spi_transfer_new (device, -1);
+  for (i = 0; i < 10; i++)
+    fpi_spi_transfer_batch_write (transfer, cmd, sizeof (cmd));
+
+  g_assert_cmpint (fpi_spi_transfer_batch_pack (transfer, 7,
+                                                spi_batch_record_submit,
+                                                calls), ==, 0);
+  g_assert_cmpuint (calls->len, ==, 4);
+  for (i = 0; i < calls->len; i++)
+    {
+      call = &g_array_index (calls, SpiBatchCall, i);
+      g_assert_cmpuint (call->n_xfers, ==, i < 3 ? 3 : 1);
+      g_assert_cmpuint (call->length, <=, 7);
+      g_assert_false (call->cs_change_last);
+    }
+  fpi_spi_transfer_unref (transfer);
+  g_array_set_size (calls, 0);
+
+  /* Split at the maximum number of transfers of one ioctl */
+  g_assert_cmpuint (FPI_SPI_BATCH_MAX_XFERS, ==, 511);
+  transfer = fpi_spi_transfer_new (device, -1);
+  for (i = 0; i < 600; i++)
+    fpi_spi_transfer_batch_write (transfer, cmd, 1);
+
+  g_assert_cmpint (fpi_spi_transfer_batch_pack (transfer, G_MAXSIZE,
+                                                spi_batch_record_submit,
+                                                calls), ==, 0);
+  g_assert_cmpuint (calls->len, ==, 2);
+  g_assert_cmpuint (g_array_index (calls, SpiBatchCall, 0).n_xfers, ==, 511);
+  g_assert_cmpuint (g_array_index (calls, SpiBatchCall, 1).n_xfers, ==, 89);
+  fpi_spi_transfer_unref (transfer);
+}
+
+#endif
+
+static char *
+write_recording (const guint8 *data, gsize length)
+{
+  g_autoptr(GError) error = NULL;
+  char *filename = NULL;
+  int fd;
+
+  fd = g_file_open_tmp ("libfprint-replay-XXXXXX", &filename, &error);
+  g_assert_no_error (error);
+  close (fd);
+
+  g_file_set_contents (filename, (const char *) data, length, &error);
+  g_assert_no_error (error);
+
+  return filename;
+}
+
+static void
+pcapng_append_block (GByteArray *pcap, guint32 type, const guint8 *body, guint32 length)
+{
+  guint32 block_length = GUINT32_TO_LE (12 + ((length + 3) & ~3));
+  guint8 padding[3] = { 0 };
+
+  type = GUINT32_TO_LE (type);
+  g_byte_array_append (pcap, (guint8 *) &type, 4);
+  g_byte_array_append (pcap, (guint8 *) &block_length, 4);
+  g_byte_array_append (pcap, body, length);
+  g_byte_array_append (pcap, padding, ((length + 3) & ~3) - length);
+  g_byte_array_append (pcap, (guint8 *) &block_length, 4);
+}
+
+static void
+pcapng_append_urb (GByteArray   *pcap,
+                   guint64       id,
+                   gchar         event,
+                   guint8        type,
+                   guint8        endpoint,
+                   guint32       usec,
+                   const guint8 *data,
+                   guint32       length)
+{
+  g_autoptr(GByteArray) packet = g_byte_array_new ();
+  guint8 header[64] = { 0 };
+  guint32 captured;
+
+  FP_WRITE_UINT64_LE (&header[0], id);
+  header[8] = event;
+  header[9] = type;
+  header[10] = endpoint;
+  header[11] = 5;                              /* device address */
+  FP_WRITE_UINT16_LE (&header[12], 1);         /* bus */
+  header[14] = '-';                            /* no setup packet */
+  header[15] = data ? 0 : '<';
+  FP_WRITE_UINT32_LE (&header[24], usec);
+  FP_WRITE_UINT32_LE (&header[32], length);
+  FP_WRITE_UINT32_LE (&header[36], data ? length : 0);
+
+  /* interface, timestamp, captured and original length */
+  g_byte_array_set_size (packet, 20);
+  memset (packet->data, 0, 20);
+  captured = GUINT32_TO_LE (sizeof (header) + (data ? length : 0));
+  memcpy (&packet->data[12], &captured, 4);
+  memcpy (&packet->data[16], &captured, 4);
+  g_byte_array_append (packet, header, sizeof (header));
+  if (data)
+    g_byte_array_append (packet, data, length);
+
+  pcapng_append_block (pcap, 0x00000006, packet->data, packet->len);
+}
+
+typedef struct
+{
+  gboolean done;
+  GError  *error;
+} UsbReplayResult;
+
+static void
+usb_transfer_done_cb (FpiUsbTransfer *transfer,
+                      FpDevice       *dev,
+                      gpointer        user_data,
+                      GError         *error)
+{
+  UsbReplayResult *result = user_data;
+
+  result->done = TRUE;
+  result->error = error;
+}
+
+static GError *
+usb_transfer_replay (FpiUsbTransfer *transfer, guint timeout_ms, GCancellable *cancellable)
+{
+  UsbReplayResult result = { 0 };
+
+  fpi_usb_transfer_submit (transfer, timeout_ms, cancellable, usb_transfer_done_cb, &result);
+  if (cancellable)
+    {
+      g_main_context_iteration (NULL, FALSE);
+      g_assert_false (result.done);
+      g_cancellable_cancel (cancellable);
+    }
+
+  while (!result.done)
+    g_main_context_iteration (NULL, TRUE);
+
+  return result.error;
+}
+
+static void
+test_driver_transfer_replay_usb (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(FpiTransferReplay) replay = NULL;
+  g_autoptr(GByteArray) pcap = g_byte_array_new ();
+  g_autoptr(GArray) stats_array = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *filename = NULL;
+  FpDeviceTransferStats *stats;
+  const guint8 section[16] = { 0x4d, 0x3c, 0x2b, 0x1a, 1, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  const guint8 interface[8] = { 220, 0, 0, 0, 0, 0, 0, 0 };
+  const guint8 command[2] = { 0x01, 0x02 };
+  const guint8 reply[3] = { 0xaa, 0xbb, 0xcc };
+  FpiUsbTransfer *transfer;
+
+  pcapng_append_block (pcap, 0x0A0D0D0A, section, sizeof (section));
+  pcapng_append_block (pcap, 0x00000001, interface, sizeof (interface));
+  pcapng_append_urb (pcap, 1, 'S', 3, 0x01, 0, command, sizeof (command));
+  pcapng_append_urb (pcap, 1, 'C', 3, 0x01, 100, NULL, sizeof (command));
+  pcapng_append_urb (pcap, 2, 'S', 3, 0x81, 200, NULL, 64);
+  pcapng_append_urb (pcap, 2, 'C', 3, 0x81, 300, reply, sizeof (reply));
+  /* Never completed, i.e. the driver cancelled it or it timed out */
+  pcapng_append_urb (pcap, 3, 'S', 1, 0x83, 400, NULL, 8);
+  pcapng_append_urb (pcap, 4, 'S', 1, 0x83, 500, NULL, 8);
+
+  filename = write_recording (pcap->data, pcap->len);
+  replay = fpi_transfer_replay_new_from_file (filename, &error);
+  g_unlink (filename);
+  g_assert_no_error (error);
+
+  fpi_device_set_transfer_replay (device, replay);
+
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk_full (transfer, 0x01, (guint8 *) command, sizeof (command), NULL);
+  error = usb_transfer_replay (transfer, 1000, NULL);
+  g_assert_no_error (error);
+
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk (transfer, 0x81, 64);
+  fpi_usb_transfer_ref (transfer);
+  error = usb_transfer_replay (transfer, 1000, NULL);
+  g_assert_no_error (error);
+  g_assert_cmpint (transfer->actual_length, ==, sizeof (reply));
+  g_assert_cmpmem (transfer->buffer, transfer->actual_length, reply, sizeof (reply));
+  fpi_usb_transfer_unref (transfer);
+
+  /* Stays pending until cancelled without a timeout */
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_interrupt (transfer, 0x83, 8);
+  error = usb_transfer_replay (transfer, 0, cancellable);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&error);
+
+  /* Times out otherwise */
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_interrupt (transfer, 0x83, 8);
+  error = usb_transfer_replay (transfer, 10, NULL);
+  g_assert_error (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT);
+  g_clear_error (&error);
+
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk (transfer, 0x81, 64);
+  error = usb_transfer_replay (transfer, 1000, NULL);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&error);
+
+  /* Written data is checked against the recording */
+  fpi_transfer_replay_rewind (replay);
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk (transfer, 0x01, sizeof (command));
+  g_assert_false (fpi_usb_transfer_submit_sync (transfer, 1000, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  fpi_usb_transfer_unref (transfer);
+  g_clear_error (&error);
+
+  /* Replayed transfers are counted like real ones */
+  stats_array = fp_device_get_transfer_stats (device);
+  g_assert_cmpuint (stats_array->len, ==, 3);
+
+  stats = &g_array_index (stats_array, FpDeviceTransferStats, 0);
+  g_assert_cmpuint (stats->endpoint, ==, 0x01);
+  g_assert_cmpuint (stats->transfers, ==, 2);
+  g_assert_cmpuint (stats->bytes, ==, sizeof (command));
+  g_assert_cmpuint (stats->errors, ==, 1);
+  g_assert_cmpuint (stats->cancelled, ==, 0);
+
+  stats = &g_array_index (stats_array, FpDeviceTransferStats, 1);
+  g_assert_cmpuint (stats->endpoint, ==, 0x81);
+  g_assert_cmpuint (stats->transfers, ==, 2);
+  g_assert_cmpuint (stats->bytes, ==, sizeof (reply));
+  g_assert_cmpuint (stats->errors, ==, 1);
+  g_assert_cmpuint (stats->timeouts, ==, 0);
+
+  stats = &g_array_index (stats_array, FpDeviceTransferStats, 2);
+  g_assert_cmpuint (stats->endpoint, ==, 0x83);
+  g_assert_cmpuint (stats->transfers, ==, 2);
+  g_assert_cmpuint (stats->bytes, ==, 0);
+  g_assert_cmpuint (stats->errors, ==, 1);
+  g_assert_cmpuint (stats->timeouts, ==, 1);
+  g_assert_cmpuint (stats->cancelled, ==, 1);
+}
+
+#ifdef HAVE_SPI
+static void
+test_driver_transfer_replay_spi (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(FpiTransferReplay) replay = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *filename = NULL;
+  const char recording[] =
+    "@DEV /dev/spidev0.0 (SPI)\n"
+    "TW 0aff\n"
+    "CR 09\n"
+    "TW 31\n"
+    "TW 57\n"
+    "CR af\n";
+  FpiSpiTransfer *transfer;
+  guint8 cmd[1] = { 0x31 };
+  guint8 reg = 0;
+
+  filename = write_recording ((const guint8 *) recording, strlen (recording));
+  replay = fpi_transfer_replay_new_from_file (filename, &error);
+  g_unlink (filename);
+  g_assert_no_error (error);
+
+  fpi_device_set_transfer_replay (device, replay);
+
+  transfer = fpi_spi_transfer_new (device, -1);
+  fpi_spi_transfer_write (transfer, 2);
+  transfer->buffer_wr[0] = 0x0a;
+  transfer->buffer_wr[1] = 0xff;
+  fpi_spi_transfer_read (transfer, 1);
+  g_assert_true (fpi_spi_transfer_submit_sync (transfer, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (transfer->buffer_rd[0], ==, 0x09);
+  fpi_spi_transfer_unref (transfer);
+
+  /* Batches are matched message by message */
+  transfer = fpi_spi_transfer_new (device, -1);
+  fpi_spi_transfer_batch_write (transfer, cmd, sizeof (cmd));
+  cmd[0] = 0x57;
+  fpi_spi_transfer_batch_write_read (transfer, cmd, sizeof (cmd), &reg, 1);
+  g_assert_true (fpi_spi_transfer_submit_sync (transfer, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (reg, ==, 0xaf);
+  fpi_spi_transfer_unref (transfer);
+
+  transfer = fpi_spi_transfer_new (device, -1);
+  fpi_spi_transfer_read (transfer, 1);
+  g_assert_false (fpi_spi_transfer_submit_sync (transfer, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  fpi_spi_transfer_unref (transfer);
+}
+#endif
+
 int
 main (int argc, char *argv[])
 {
@@ -3430,6 +4424,8 @@ main (int argc, char *argv[])
   g_test_add_func ("/driver/probe", test_driver_probe);
   g_test_add_func ("/driver/probe/error", test_driver_probe_error);
   g_test_add_func ("/driver/probe/action_error", test_driver_probe_action_error);
+  g_test_add_func ("/driver/probe/in_thread", test_driver_probe_in_thread);
+  g_test_add_func ("/driver/probe/in_thread/error", test_driver_probe_in_thread_error);
   g_test_add_func ("/driver/open", test_driver_open);
   g_test_add_func ("/driver/open/error", test_driver_open_error);
   g_test_add_func ("/driver/close", test_driver_close);
@@ -3446,6 +4442,12 @@ main (int argc, char *argv[])
   g_test_add_func ("/driver/enroll/update_nbis_missing_feature",
                    test_driver_enroll_update_nbis_missing_feature);
   g_test_add_func ("/driver/verify", test_driver_verify);
+  g_test_add_func ("/driver/verify/stats", test_driver_verify_stats);
+  g_test_add_func ("/driver/verify/stats/ready", test_driver_verify_stats_ready);
+  g_test_add_func ("/driver/thread/verify", test_driver_thread_verify);
+  g_test_add_func ("/driver/thread/cancel", test_driver_thread_cancel);
+  g_test_add_func ("/driver/thread/back-to-back", test_driver_thread_back_to_back);
+  g_test_add_func ("/driver/thread/notify", test_driver_thread_notify);
   g_test_add_func ("/driver/verify/fail", test_driver_verify_fail);
   g_test_add_func ("/driver/verify/retry", test_driver_verify_retry);
   g_test_add_func ("/driver/verify/error", test_driver_verify_error);
@@ -3498,6 +4500,13 @@ main (int argc, char *argv[])
 
   g_test_add_func ("/driver/timeout", test_driver_add_timeout);
   g_test_add_func ("/driver/timeout/cancelled", test_driver_add_timeout_cancelled);
+  g_test_add_func ("/driver/usb_transfer/pool", test_driver_usb_transfer_pool);
+#ifdef HAVE_SPI
+  g_test_add_func ("/driver/transfer_stats", test_driver_transfer_stats);
+  g_test_add_func ("/driver/transfer_replay/spi", test_driver_transfer_replay_spi);
+  g_test_add_func ("/driver/spi_transfer/batch_pack", test_driver_spi_batch_pack);
+#endif
+  g_test_add_func ("/driver/transfer_replay/usb", test_driver_transfer_replay_usb);
 
   g_test_add_func ("/driver/error_types", test_driver_error_types);
   g_test_add_func ("/driver/retry_error_types", test_driver_retry_error_types);
@@ -0,0 +1,124 @@
+/*
+ * FpImage Unit tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include "fpi-image.h"
+
+#define TEST_BLOCK_SIZE 16
+#define TEST_MIN_SQ_DEV (10 * 10)
+
+/* Utility functions */
+
+static FpImage *
+make_blank_image (guint width, guint height)
+{
+  FpImage *image = fp_image_new (width, height);
+
+  memset (image->data, 0xff, width * height);
+
+  return image;
+}
+
+/* Draws horizontal ridges, 4 pixels wide, into the given rectangle */
+static void
+draw_ridges (FpImage *image, guint x, guint y, guint width, guint height)
+{
+  guint i, j;
+
+  for (j = y; j < y + height; j++)
+    for (i = x; i < x + width; i++)
+      image->data[j * image->width + i] = (j / 4) % 2 ? 0x00 : 0xff;
+}
+
+/* Tests */
+
+static void
+test_foreground_ratio_blank (void)
+{
+  g_autoptr(FpImage) image = make_blank_image (64, 64);
+
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 0);
+
+  /* Low noise does not count as ridges either */
+  for (guint i = 0; i < 64 * 64; i++)
+    image->data[i] = 0x80 + (i % 3);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 0);
+}
+
+static void
+test_foreground_ratio_partial (void)
+{
+  g_autoptr(FpImage) image = make_blank_image (64, 64);
+
+  /* One of the four block rows */
+  draw_ridges (image, 0, 0, 64, 16);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 0.25);
+
+  /* And the left half */
+  draw_ridges (image, 0, 0, 32, 64);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 10.0 / 16);
+}
+
+static void
+test_foreground_ratio_full (void)
+{
+  g_autoptr(FpImage) image = make_blank_image (64, 64);
+
+  draw_ridges (image, 0, 0, 64, 64);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 1);
+}
+
+static void
+test_foreground_ratio_edges (void)
+{
+  g_autoptr(FpImage) image = make_blank_image (70, 70);
+  g_autoptr(FpImage) small = make_blank_image (15, 64);
+
+  /* Blocks cut off at the right and bottom edge are ignored */
+  draw_ridges (image, 0, 0, 64, 64);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 1);
+
+  draw_ridges (image, 0, 0, 70, 70);
+  memset (image->data, 0xff, 70 * 64);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (image, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 0);
+
+  /* No complete block at all */
+  draw_ridges (small, 0, 0, 15, 64);
+  g_assert_cmpfloat (fpi_image_get_foreground_ratio (small, TEST_BLOCK_SIZE,
+                                                     TEST_MIN_SQ_DEV), ==, 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/image/foreground-ratio/blank", test_foreground_ratio_blank);
+  g_test_add_func ("/image/foreground-ratio/partial", test_foreground_ratio_partial);
+  g_test_add_func ("/image/foreground-ratio/full", test_foreground_ratio_full);
+  g_test_add_func ("/image/foreground-ratio/edges", test_foreground_ratio_edges);
+
+  return g_test_run ();
+}
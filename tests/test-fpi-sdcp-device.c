@@ -264,6 +264,41 @@ sdcp_test_generate_enrollment_id (void)
   fp_device_close_sync (device, NULL, NULL);
 }
 
+static void
+sdcp_test_reuse_application_secret (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_TEST_SDCP_DEVICE, NULL);
+  FpiSdcpDevice *sdcp_dev = FPI_SDCP_DEVICE (device);
+  g_autoptr(FpiSdcpConnectResponse) response = sdcp_test_get_test_response();
+  g_autofree guchar *enrollment_id = NULL;
+
+  fp_device_open_sync (device, NULL, NULL);
+
+  /* claim should have been cached from prior test */
+  g_assert (fpi_sdcp_device_is_connected (sdcp_dev));
+
+  /* the keyed HMAC context is reused between operations on the same claim */
+  g_assert (fpi_sdcp_verify_authorized_identity (sdcp_dev, TEST_IDENTIFY_NONCE,
+    TEST_IDENTIFY_ENROLLMENT_ID, TEST_IDENTIFY_MAC));
+  g_assert (fpi_sdcp_verify_authorized_identity (sdcp_dev, TEST_IDENTIFY_NONCE,
+    TEST_IDENTIFY_ENROLLMENT_ID, TEST_IDENTIFY_MAC));
+  g_assert (!fpi_sdcp_verify_authorized_identity (sdcp_dev, TEST_IDENTIFY_NONCE,
+    TEST_IDENTIFY_ENROLLMENT_ID, TEST_RECONNECT_MAC));
+  g_assert (fpi_sdcp_verify_reconnect (sdcp_dev, TEST_RECONNECT_RANDOM, TEST_RECONNECT_MAC));
+
+  enrollment_id = fpi_sdcp_generate_enrollment_id (sdcp_dev, TEST_ENROLLMENT_NONCE);
+  g_assert_cmpmem (enrollment_id, SDCP_ENROLLMENT_ID_SIZE,
+    TEST_ENROLLMENT_ENROLLMENT_ID, SDCP_ENROLLMENT_ID_SIZE);
+
+  /* deriving the application keys again must still produce the same MACs */
+  g_assert (fpi_sdcp_set_host_keys (sdcp_dev, TEST_HOST_PRIVATE_KEY, TEST_HOST_RANDOM));
+  g_assert (fpi_sdcp_derive_keys_and_verify_connect (sdcp_dev, response));
+  g_assert (fpi_sdcp_verify_authorized_identity (sdcp_dev, TEST_IDENTIFY_NONCE,
+    TEST_IDENTIFY_ENROLLMENT_ID, TEST_IDENTIFY_MAC));
+
+  fp_device_close_sync (device, NULL, NULL);
+}
+
 static void
 sdcp_test_generate_random (void)
 {
@@ -312,6 +347,49 @@ sdcp_test_verify_reconnect (void)
   fp_device_close_sync (device, NULL, NULL);
 }
 
+static void
+sdcp_test_verify_connect_async_cb (GObject      *source_object,
+                                   GAsyncResult *res,
+                                   gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean *completed = user_data;
+
+  g_assert (fpi_sdcp_derive_keys_and_verify_connect_finish (FPI_SDCP_DEVICE (source_object),
+                                                            res, &error));
+  g_assert_no_error (error);
+
+  *completed = TRUE;
+}
+
+static void
+sdcp_test_verify_connect_async (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_TEST_SDCP_DEVICE, NULL);
+  FpiSdcpDevice *sdcp_dev = FPI_SDCP_DEVICE (device);
+  gboolean completed = FALSE;
+
+  fp_device_open_sync (device, NULL, NULL);
+
+  fpi_sdcp_device_delete_cached_claim (sdcp_dev);
+
+  g_assert (fpi_sdcp_set_host_keys (sdcp_dev, TEST_HOST_PRIVATE_KEY, TEST_HOST_RANDOM));
+  g_assert (!fpi_sdcp_device_is_connected (sdcp_dev));
+
+  fpi_sdcp_derive_keys_and_verify_connect_async (sdcp_dev,
+                                                 sdcp_test_get_test_response (),
+                                                 NULL,
+                                                 sdcp_test_verify_connect_async_cb,
+                                                 &completed);
+
+  while (!completed)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert (fpi_sdcp_device_is_connected (sdcp_dev));
+
+  fp_device_close_sync (device, NULL, NULL);
+}
+
 static void
 sdcp_test_verify_connect_buf (void)
 {
@@ -423,6 +501,54 @@ sdcp_test_expired_claim (void)
   fp_device_close_sync (device, NULL, NULL);
 }
 
+static void
+sdcp_test_precomputed_host_keys (void)
+{
+  g_autoptr(GTypeClass) type_class = g_type_class_ref (FPI_TYPE_TEST_SDCP_DEVICE);
+  FpiSdcpDeviceClass *sdcp_dev_class = FPI_SDCP_DEVICE_CLASS (type_class);
+  g_autoptr(FpDevice) device = NULL;
+  FpiSdcpDevice *sdcp_dev;
+  g_autofree guchar *public_key = NULL;
+  g_autofree guchar *random = NULL;
+  g_autofree guchar *next_public_key = NULL;
+  g_autofree guchar *next_random = NULL;
+  gint i;
+
+  /* only this device uses the pool, the flag is read on construction */
+  sdcp_dev_class->precompute_host_keys = TRUE;
+  device = g_object_new (FPI_TYPE_TEST_SDCP_DEVICE, NULL);
+  sdcp_dev_class->precompute_host_keys = FALSE;
+  sdcp_dev = FPI_SDCP_DEVICE (device);
+
+  fp_device_open_sync (device, NULL, NULL);
+
+  /* drain more keys than the pool holds to also hit the fallback path */
+  for (i = 0; i < 4; i++)
+    {
+      g_assert (fpi_sdcp_set_host_keys (sdcp_dev, NULL, NULL));
+      g_assert (!fpi_sdcp_device_is_connected (sdcp_dev));
+
+      g_clear_pointer (&public_key, g_free);
+      g_clear_pointer (&random, g_free);
+      public_key = g_steal_pointer (&next_public_key);
+      random = g_steal_pointer (&next_random);
+
+      next_public_key = fpi_sdcp_get_host_public_key (sdcp_dev);
+      next_random = fpi_sdcp_get_host_random (sdcp_dev);
+
+      /* uncompressed P-256 point */
+      g_assert_cmpint (next_public_key[0], ==, 0x04);
+
+      if (public_key)
+        {
+          g_assert (memcmp (public_key, next_public_key, SDCP_PUBLIC_KEY_SIZE) != 0);
+          g_assert (memcmp (random, next_random, SDCP_RANDOM_SIZE) != 0);
+        }
+    }
+
+  fp_device_close_sync (device, NULL, NULL);
+}
+
 static void
 sdcp_test_verify_connect_cached (void)
 {
@@ -553,13 +679,16 @@ main (int argc, char *argv[])
   g_test_add_func ("/sdcp/set_host_keys", sdcp_test_set_host_keys);
   g_test_add_func ("/sdcp/get_host_public_key", sdcp_test_get_host_public_key);
   g_test_add_func ("/sdcp/get_host_random", sdcp_test_get_host_random);
+  g_test_add_func ("/sdcp/precomputed_host_keys", sdcp_test_precomputed_host_keys);
   g_test_add_func ("/sdcp/verify_connect", sdcp_test_verify_connect);
   g_test_add_func ("/sdcp/verify_connect_cached", sdcp_test_verify_connect_cached);
   g_test_add_func ("/sdcp/expired_claim", sdcp_test_expired_claim);
   g_test_add_func ("/sdcp/verify_connect_ex", sdcp_test_verify_connect_ex);
   g_test_add_func ("/sdcp/verify_connect_buf", sdcp_test_verify_connect_buf);
+  g_test_add_func ("/sdcp/verify_connect_async", sdcp_test_verify_connect_async);
   g_test_add_func ("/sdcp/verify_reconnect", sdcp_test_verify_reconnect);
   g_test_add_func ("/sdcp/verify_authorized_identity", sdcp_test_verify_authorized_identity);
+  g_test_add_func ("/sdcp/reuse_application_secret", sdcp_test_reuse_application_secret);
   g_test_add_func ("/sdcp/generate_random", sdcp_test_generate_random);
   g_test_add_func ("/sdcp/generate_enrollment_id", sdcp_test_generate_enrollment_id);
   g_test_add_func ("/sdcp/get_cert_length_from_buf", sdcp_test_get_cert_length_from_buf);
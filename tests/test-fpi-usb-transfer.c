@@ -0,0 +1,324 @@
+/*
+ * FpiUsbTransfer Unit tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "usb_transfer"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#include "drivers_api.h"
+#include "fp-device-private.h"
+#include "fpi-byte-writer.h"
+#include "fpi-transfer-replay.h"
+#include "test-device-fake.h"
+
+#define TEST_ENDPOINT 0x81
+#define TEST_CHUNK_SIZE 64
+#define TEST_N_TRANSFERS 3
+
+#define ROUND_UP_4(n) (((n) + 3) & ~3)
+
+/* Utility functions and shared data */
+
+static FpDevice *fake_device = NULL;
+
+static void
+write_usbmon_packet (FpiByteWriter *writer,
+                     guint64        urb_id,
+                     guint8         event,
+                     gint32         status,
+                     guint32        length,
+                     const guint8  *data)
+{
+  guint32 data_length = data ? length : 0;
+  guint32 block_length = 32 + 64 + ROUND_UP_4 (data_length);
+
+  /* Enhanced packet block */
+  fpi_byte_writer_put_uint32_le (writer, 0x00000006);
+  fpi_byte_writer_put_uint32_le (writer, block_length);
+  fpi_byte_writer_put_uint32_le (writer, 0);
+  fpi_byte_writer_put_uint64_le (writer, 0);
+  fpi_byte_writer_put_uint32_le (writer, 64 + data_length);
+  fpi_byte_writer_put_uint32_le (writer, 64 + data_length);
+
+  /* usbmon header */
+  fpi_byte_writer_put_uint64_le (writer, urb_id);
+  fpi_byte_writer_put_uint8 (writer, event);
+  fpi_byte_writer_put_uint8 (writer, 3); /* bulk */
+  fpi_byte_writer_put_uint8 (writer, TEST_ENDPOINT);
+  fpi_byte_writer_put_uint8 (writer, 2); /* address */
+  fpi_byte_writer_put_uint16_le (writer, 1); /* bus */
+  fpi_byte_writer_put_int8 (writer, '-'); /* no setup */
+  fpi_byte_writer_put_int8 (writer, data ? 0 : '<');
+  fpi_byte_writer_put_int64_le (writer, 0);
+  fpi_byte_writer_put_int32_le (writer, 0);
+  fpi_byte_writer_put_int32_le (writer, status);
+  fpi_byte_writer_put_uint32_le (writer, length);
+  fpi_byte_writer_put_uint32_le (writer, data_length);
+  fpi_byte_writer_fill (writer, 0, 8 + 16);
+
+  if (data)
+    {
+      fpi_byte_writer_put_data (writer, data, data_length);
+      fpi_byte_writer_fill (writer, 0, ROUND_UP_4 (data_length) - data_length);
+    }
+
+  fpi_byte_writer_put_uint32_le (writer, block_length);
+}
+
+/*
+ * Writes a usbmon pcapng capture with @n_chunks successful bulk-in transfers
+ * on TEST_ENDPOINT, chunk i being filled with the value i. If @last_status
+ * is not 0, one more transfer failing with it is appended.
+ */
+static gchar *
+write_capture (guint n_chunks, gint32 last_status)
+{
+  g_autoptr(GError) error = NULL;
+  FpiByteWriter writer;
+  gchar *path;
+  guint8 chunk[TEST_CHUNK_SIZE];
+  gsize length;
+  g_autofree guint8 *contents = NULL;
+  gint fd;
+  guint i;
+
+  fd = g_file_open_tmp ("libfprint-usb-stream-XXXXXX.pcapng", &path, &error);
+  g_assert_no_error (error);
+  g_close (fd, NULL);
+
+  fpi_byte_writer_init (&writer);
+
+  /* Section header block */
+  fpi_byte_writer_put_uint32_le (&writer, 0x0A0D0D0A);
+  fpi_byte_writer_put_uint32_le (&writer, 28);
+  fpi_byte_writer_put_uint32_le (&writer, 0x1A2B3C4D);
+  fpi_byte_writer_put_uint16_le (&writer, 1);
+  fpi_byte_writer_put_uint16_le (&writer, 0);
+  fpi_byte_writer_put_int64_le (&writer, -1);
+  fpi_byte_writer_put_uint32_le (&writer, 28);
+
+  /* Interface description block, LINKTYPE_USB_LINUX_MMAPPED */
+  fpi_byte_writer_put_uint32_le (&writer, 0x00000001);
+  fpi_byte_writer_put_uint32_le (&writer, 20);
+  fpi_byte_writer_put_uint16_le (&writer, 220);
+  fpi_byte_writer_put_uint16_le (&writer, 0);
+  fpi_byte_writer_put_uint32_le (&writer, 0);
+  fpi_byte_writer_put_uint32_le (&writer, 20);
+
+  for (i = 0; i < n_chunks; i++)
+    {
+      memset (chunk, i, sizeof (chunk));
+      write_usbmon_packet (&writer, i + 1, 'S', -EINPROGRESS, sizeof (chunk), NULL);
+      write_usbmon_packet (&writer, i + 1, 'C', 0, sizeof (chunk), chunk);
+    }
+
+  if (last_status != 0)
+    {
+      write_usbmon_packet (&writer, i + 1, 'S', -EINPROGRESS, sizeof (chunk), NULL);
+      write_usbmon_packet (&writer, i + 1, 'C', last_status, 0, NULL);
+    }
+
+  length = fpi_byte_writer_get_pos (&writer);
+  contents = fpi_byte_writer_reset_and_get_data (&writer);
+
+  g_file_set_contents (path, (const gchar *) contents, length, &error);
+  g_assert_no_error (error);
+
+  return path;
+}
+
+static void
+setup_replay (guint n_chunks, gint32 last_status)
+{
+  g_autoptr(FpiTransferReplay) replay = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = write_capture (n_chunks, last_status);
+
+  replay = fpi_transfer_replay_new_from_file (path, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (replay);
+  g_unlink (path);
+
+  fpi_device_set_transfer_replay (fake_device, replay);
+}
+
+typedef struct
+{
+  guint         chunks;
+  guint         stop_after;
+  GCancellable *cancel_after;
+  gboolean      finished;
+  GError       *error;
+} FpiUsbStreamTestData;
+
+static void
+test_stream_cb (FpiUsbStream *stream,
+                FpDevice     *dev,
+                const guchar *data,
+                gsize         length,
+                gpointer      user_data,
+                GError       *error)
+{
+  FpiUsbStreamTestData *test_data = user_data;
+  gsize i;
+
+  g_assert (dev == fake_device);
+  g_assert_false (test_data->finished);
+
+  if (error)
+    {
+      g_assert_null (data);
+      g_assert_false (fpi_usb_stream_is_active (stream));
+      test_data->error = error;
+      test_data->finished = TRUE;
+      return;
+    }
+
+  g_assert_true (fpi_usb_stream_is_active (stream));
+  g_assert_cmpuint (length, ==, TEST_CHUNK_SIZE);
+  for (i = 0; i < length; i++)
+    g_assert_cmpuint (data[i], ==, test_data->chunks);
+
+  test_data->chunks++;
+
+  if (test_data->chunks == test_data->stop_after)
+    fpi_usb_stream_stop (stream);
+  if (test_data->cancel_after && test_data->chunks == 2)
+    g_cancellable_cancel (test_data->cancel_after);
+}
+
+static void
+run_stream (FpiUsbStream *stream, FpiUsbStreamTestData *test_data)
+{
+  fpi_usb_stream_start (stream, 1000, test_data->cancel_after,
+                        test_stream_cb, test_data);
+  g_assert_true (fpi_usb_stream_is_active (stream));
+
+  while (!test_data->finished)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+/* Tests */
+
+static void
+test_usb_stream_read (void)
+{
+  g_autoptr(FpiUsbStream) stream = NULL;
+  FpiUsbStreamTestData test_data = { 0 };
+
+  setup_replay (8, -EPIPE);
+
+  stream = fpi_usb_stream_new (fake_device, TEST_ENDPOINT,
+                               TEST_CHUNK_SIZE, TEST_N_TRANSFERS);
+  run_stream (stream, &test_data);
+
+  /* All chunks arrive in order, the stall ends the stream */
+  g_assert_cmpuint (test_data.chunks, ==, 8);
+  g_assert_error (test_data.error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_NOT_SUPPORTED);
+  g_clear_error (&test_data.error);
+
+  fpi_device_set_transfer_replay (fake_device, NULL);
+}
+
+static void
+test_usb_stream_stop (void)
+{
+  g_autoptr(FpiUsbStream) stream = NULL;
+  FpiUsbStreamTestData test_data = { .stop_after = 3 };
+
+  setup_replay (8, 0);
+
+  stream = fpi_usb_stream_new (fake_device, TEST_ENDPOINT,
+                               TEST_CHUNK_SIZE, TEST_N_TRANSFERS);
+  run_stream (stream, &test_data);
+
+  /* Transfers that were still queued are not delivered */
+  g_assert_cmpuint (test_data.chunks, ==, 3);
+  g_assert_error (test_data.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&test_data.error);
+
+  fpi_device_set_transfer_replay (fake_device, NULL);
+}
+
+static void
+test_usb_stream_cancel (void)
+{
+  g_autoptr(FpiUsbStream) stream = NULL;
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  FpiUsbStreamTestData test_data = { .cancel_after = cancellable };
+
+  setup_replay (8, 0);
+
+  stream = fpi_usb_stream_new (fake_device, TEST_ENDPOINT,
+                               TEST_CHUNK_SIZE, TEST_N_TRANSFERS);
+  run_stream (stream, &test_data);
+
+  g_assert_cmpuint (test_data.chunks, ==, 2);
+  g_assert_error (test_data.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&test_data.error);
+
+  fpi_device_set_transfer_replay (fake_device, NULL);
+}
+
+static void
+test_usb_stream_restart (void)
+{
+  g_autoptr(FpiUsbStream) stream = NULL;
+  FpiUsbStreamTestData test_data = { .stop_after = 2 };
+
+  setup_replay (4, 0);
+
+  stream = fpi_usb_stream_new (fake_device, TEST_ENDPOINT,
+                               TEST_CHUNK_SIZE, TEST_N_TRANSFERS);
+  run_stream (stream, &test_data);
+
+  g_assert_cmpuint (test_data.chunks, ==, 2);
+  g_assert_error (test_data.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&test_data.error);
+
+  /* A stopped stream can be started again, with the same transfers */
+  setup_replay (4, 0);
+  test_data = (FpiUsbStreamTestData) { 0 };
+  run_stream (stream, &test_data);
+
+  g_assert_cmpuint (test_data.chunks, ==, 4);
+  g_assert_error (test_data.error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&test_data.error);
+
+  fpi_device_set_transfer_replay (fake_device, NULL);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(FpDevice) device = NULL;
+
+  g_test_init (&argc, &argv, NULL);
+
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  fake_device = device;
+  g_object_add_weak_pointer (G_OBJECT (device), (gpointer) & fake_device);
+
+  g_test_add_func ("/usb-stream/read", test_usb_stream_read);
+  g_test_add_func ("/usb-stream/stop", test_usb_stream_stop);
+  g_test_add_func ("/usb-stream/cancel", test_usb_stream_cancel);
+  g_test_add_func ("/usb-stream/restart", test_usb_stream_restart);
+
+  return g_test_run ();
+}
@@ -146,6 +146,27 @@ class VirtualDeviceBase(unittest.TestCase):
         while ctx.pending():
             ctx.iteration(False)
 
+    def send_batch(self, commands):
+        data = '\n'.join(commands).encode('utf-8')
+
+        with Connection(self.sockaddr) as con:
+            con.sendall('BATCH {}\n'.format(len(data)).encode('utf-8') + data)
+
+        while ctx.pending():
+            ctx.iteration(False)
+
+    def send_scenario(self, commands):
+        path = os.path.join(self.tmpdir, 'scenario')
+        with open(path, 'w') as f:
+            f.write('# Generated scenario\n\n')
+            f.write('\n'.join(commands))
+
+        with Connection(self.sockaddr) as con:
+            con.sendall('SCENARIO {}'.format(path).encode('utf-8'))
+
+        while ctx.pending():
+            ctx.iteration(False)
+
     def send_finger_report(self, has_finger, iterate=True):
         self.send_command('FINGER', 1 if has_finger else 0)
 
@@ -1188,6 +1209,57 @@ class VirtualDeviceStorage(VirtualDevice):
         self.check_verify(lt, 'right-thumb', identify=True, match=False)
         self.check_verify(rt, 'left-thumb', identify=True, match=False)
 
+    def enroll_identify_delete_cycles(self, send, cycles):
+        commands = []
+        for i in range(cycles):
+            commands += ['SCAN print-{}'.format(i)] * self.dev.get_nr_enroll_stages()
+            commands += ['SCAN print-{}'.format(i), 'CONT ']
+        send(commands + ['CONT '])
+
+        for i in range(cycles):
+            enrolled = self.dev.enroll_sync(FPrint.Print.new(self.dev))
+            self.assertEqual(enrolled.props.fpi_data.unpack(), 'print-{}'.format(i))
+            match, fp = self.dev.identify_sync([enrolled])
+            self.assertTrue(match.equal(enrolled))
+            self.dev.delete_print_sync(enrolled)
+
+        self.assertEqual(len(self.dev.list_prints_sync()), 0)
+
+    def test_batch_cycles(self):
+        # Large enough to need more than one read
+        self.enroll_identify_delete_cycles(self.send_batch, 100)
+
+    def test_scenario_cycles(self):
+        self.enroll_identify_delete_cycles(self.send_scenario, 10)
+
+    def test_batch_settings_in_order(self):
+        rt = self.enroll_print('right-thumb', FPrint.Finger.RIGHT_THUMB)
+        self.send_batch(['SET_SCAN_TYPE press', 'SCAN right-thumb',
+                         'SET_SCAN_TYPE swipe'])
+
+        # Nothing is pending in front of the first setting, the second one
+        # only applies once the scan before it was consumed
+        self.assertEqual(self.dev.get_scan_type(), FPrint.ScanType.PRESS)
+        match, fp = self.dev.verify_sync(rt)
+        self.assertTrue(match)
+        self.assertEqual(self.dev.get_scan_type(), FPrint.ScanType.PRESS)
+
+        self.dev.list_prints_sync()
+        self.assertEqual(self.dev.get_scan_type(), FPrint.ScanType.SWIPE)
+
+    def test_identify_large_gallery(self):
+        rt = self.enroll_print('right-thumb', FPrint.Finger.RIGHT_THUMB)
+        lt = self.enroll_print('left-thumb', FPrint.Finger.LEFT_THUMB)
+        gallery = [FPrint.Print.new(self.dev) for i in range(1000)] + [lt, rt]
+
+        self.check_verify(gallery, 'right-thumb', identify=True, match=True)
+        self.assertTrue(self._verify_report_match.equal(rt))
+        self.check_verify(gallery, 'left-thumb', identify=True, match=True)
+        self.assertTrue(self._verify_report_match.equal(lt))
+
+        self.dev.delete_print_sync(rt)
+        self.check_verify(gallery, 'right-thumb', identify=True, match=False)
+
     def test_identify_retry(self):
         with self.assertRaises(GLib.GError) as error:
             self.check_verify(FPrint.Print.new(self.dev),
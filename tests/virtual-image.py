@@ -14,6 +14,8 @@ try:
     import shutil
     import glob
     import cairo
+    import mmap
+    import fcntl
     import tempfile
 except Exception as e:
     print("Missing dependencies: %s" % str(e))
@@ -98,6 +100,9 @@ class VirtualImage(unittest.TestCase):
         self.con.connect(self.sockaddr)
 
     def tearDown(self):
+        if getattr(self, 'ring', None) is not None:
+            self.ring.close()
+            self.ring = None
         self.con.close()
         del self.con
         self.dev.close_sync()
@@ -133,13 +138,57 @@ class VirtualImage(unittest.TestCase):
         mem = mem.tobytes()
         assert len(mem) == img.get_width() * img.get_height()
 
-        encoded_img = struct.pack('ii', img.get_width(), img.get_height())
+        self.send_raw_image(img.get_width(), img.get_height(), mem, iterate)
+
+    def send_raw_image(self, width, height, mem, iterate=True):
+        encoded_img = struct.pack('ii', width, height)
         encoded_img += mem
 
         self.con.sendall(encoded_img)
         while iterate and ctx.pending():
             ctx.iteration(False)
 
+    def attach_ring(self, n_slots=16):
+        if (not hasattr(os, 'memfd_create') or not hasattr(socket, 'send_fds') or
+                not hasattr(fcntl, 'F_ADD_SEALS')):
+            self.skipTest('memfd_create, sealing and send_fds are required for the ring')
+
+        # Header (8 x uint32) and slots (int, int, uint64 and pixel data),
+        # see FpiDeviceVirtualRingHeader
+        slot_size = max(img.get_width() * img.get_height() for img in self.prints.values())
+        self.ring_slot_size = (slot_size + 7) // 8 * 8
+        self.ring_slots = n_slots
+        self.ring_head = 0
+
+        fd = os.memfd_create('libfprint-virtual-image-ring', os.MFD_CLOEXEC | os.MFD_ALLOW_SEALING)
+        size = 32 + n_slots * (16 + self.ring_slot_size)
+        os.ftruncate(fd, size)
+        # The driver refuses rings that could be truncated under its mapping
+        fcntl.fcntl(fd, fcntl.F_ADD_SEALS, fcntl.F_SEAL_SHRINK | fcntl.F_SEAL_SEAL)
+        self.ring = mmap.mmap(fd, size)
+        struct.pack_into('8I', self.ring, 0, 0x47525046, 1, n_slots, self.ring_slot_size, 0, 0, 0, 0)
+
+        self.con.sendall(struct.pack('ii', -6, 0))
+        socket.send_fds(self.con, [b'\0'], [fd])
+        os.close(fd)
+
+    def queue_image(self, image, timestamp=0):
+        img = self.prints[image]
+        mem = img.get_data().tobytes()
+
+        tail = struct.unpack_from('I', self.ring, 20)[0]
+        assert self.ring_head - tail < self.ring_slots
+
+        offset = 32 + (self.ring_head % self.ring_slots) * (16 + self.ring_slot_size)
+        struct.pack_into('iiQ', self.ring, offset, img.get_width(), img.get_height(), timestamp)
+        self.ring[offset + 16:offset + 16 + len(mem)] = mem
+
+        self.ring_head += 1
+        struct.pack_into('I', self.ring, 16, self.ring_head)
+
+    def kick_ring(self):
+        self.con.sendall(struct.pack('ii', -7, 0))
+
     def wait_for_finger_status(self, finger_status, timeout=5000):
         done = False
         def on_timeout_reached():
@@ -436,6 +485,90 @@ class VirtualImage(unittest.TestCase):
             ctx.iteration(True)
         assert(not self._verify_match)
 
+    def test_verify_image_quality(self):
+        def verify_cb(dev, res):
+            try:
+                self._verify_match, self._verify_fp = dev.verify_finish(res)
+            except gi.repository.GLib.Error as e:
+                self._verify_error = e
+
+        def verify_image(width, height, mem):
+            self._verify_match = None
+            self._verify_error = None
+            self.dev.verify(fp_whorl, callback=verify_cb)
+            self.wait_for_finger_status(FPrint.FingerStatusFlags.NEEDED)
+            self.send_raw_image(width, height, bytes(mem))
+            while self._verify_match is None and self._verify_error is None:
+                ctx.iteration(True)
+
+        fp_whorl = self.enroll_print('whorl')
+        width, height = 256, 256
+
+        # A blank frame is rejected before the minutiae detection, which
+        # would have failed with RETRY_GENERAL instead.
+        blank = bytearray(b'\xff' * width * height)
+        verify_image(width, height, blank)
+        self.assertIsNotNone(self._verify_error)
+        self.assertTrue(self._verify_error.matches(FPrint.device_retry_quark(),
+                                                   FPrint.DeviceRetry.REMOVE_FINGER))
+
+        # Ridges in a single corner only, i.e. 4 of 256 blocks
+        partial = bytearray(blank)
+        for y in range(32):
+            if y // 4 % 2:
+                partial[y * width:y * width + 32] = b'\0' * 32
+        verify_image(width, height, partial)
+        self.assertIsNotNone(self._verify_error)
+        self.assertTrue(self._verify_error.matches(FPrint.device_retry_quark(),
+                                                   FPrint.DeviceRetry.CENTER_FINGER))
+
+        # A full print still goes through
+        verify_image(self.prints['whorl'].get_width(),
+                     self.prints['whorl'].get_height(),
+                     self.prints['whorl'].get_data().tobytes())
+        self.assertIsNone(self._verify_error)
+        self.assertTrue(self._verify_match)
+
+    def test_ring_enroll_verify(self):
+        enrolled = None
+        match = None
+
+        def done_cb(dev, res):
+            nonlocal enrolled
+            enrolled = dev.enroll_finish(res)
+
+        def verify_cb(dev, res):
+            nonlocal match
+            match, fp = dev.verify_finish(res)
+
+        # Queue the whole enrollment and a verification in one go
+        self.attach_ring()
+        for i in range(6):
+            self.queue_image('whorl')
+        self.kick_ring()
+
+        template = FPrint.Print.new(self.dev)
+        self.dev.enroll(template, None, lambda *args: None, tuple(), done_cb)
+        while enrolled is None:
+            ctx.iteration(True)
+
+        self.dev.verify(enrolled, callback=verify_cb)
+        while match is None:
+            ctx.iteration(True)
+        self.assertTrue(match)
+        self.assertEqual(struct.unpack_from('I', self.ring, 20)[0], 6)
+
+    def test_ring_replay(self):
+        self.attach_ring()
+        self.queue_image('whorl', timestamp=1)
+        self.queue_image('whorl', timestamp=300001)
+
+        start = GLib.get_monotonic_time()
+        self.kick_ring()
+        self.assertIsNotNone(self.dev.capture_sync(True, None))
+        self.assertIsNotNone(self.dev.capture_sync(True, None))
+        self.assertGreaterEqual(GLib.get_monotonic_time() - start, 300000)
+
 if __name__ == '__main__':
     try:
         gi.require_version('FPrint', '2.0')